@@ -149,7 +149,12 @@ enum HPD_OPTION
 
 	HPD_OPTION_LOG = 3,
 
-	HPD_OPTION_CFG_PATH = 4
+	HPD_OPTION_CFG_PATH = 4,
+
+	/** Number of threads running the functions of services, followed
+	 *  by an int. 0 runs them on the event loop
+	*/
+	HPD_OPTION_WORKERS = 5
 
 };
 
@@ -160,9 +165,16 @@ int HPD_register_service( Service *service_to_register );
 int HPD_unregister_service( Service *service_to_unregister );
 int HPD_register_device_services( Device *device_to_register );
 int HPD_unregister_device_services( Device *device_to_unregister );
+int HPD_register_begin();
+int HPD_register_commit();
 int HPD_send_event_of_value_change ( Service *service_changed, char *updated_value );
+int HPD_set_cache_policy( Service *service, enum HPD_CachePolicy policy, double max_age );
+char *HPD_get_last_value( Service *service, double *time, enum HPD_ValueSource *source );
+int HPD_poll_service( Service *service, double interval, double max_interval, double deadband );
 
 Service* HPD_get_service( char *device_type, char *device_ID, char *service_type, char *service_ID );
 Device* HPD_get_device( char *device_type, char *device_ID );
+int HPD_foreach_service_of_type( char *type, HPD_ServiceCallback cb, void *data );
+int HPD_foreach_device_at_location( char *location, HPD_DeviceCallback cb, void *data );
 
 #endif
@@ -61,6 +61,8 @@ struct HPD_Daemon
 	char *root_ca_path;
 #endif
 
+	int workers; /**<Threads running the functions of services, 0 to run them on the event loop*/
+
 };
 
 
@@ -57,11 +57,69 @@ typedef struct Parameter Parameter;
 typedef struct serviceElement serviceElement;
 
 typedef struct ServiceElement ServiceElement;
+/**
+ * The links of a Service or a Device in an index of the registry
+ */
+typedef struct RegistryLink RegistryLink;
+
+struct hpd_poll;
+
+/**
+ * When a GET of a Service is answered from its last known value
+ */
+enum HPD_CachePolicy
+{
+  HPD_CACHE_LIVE = 0,/**<Always ask the device*/
+  HPD_CACHE_MAX_AGE = 1,/**<Use the last value unless older than the max age*/
+  HPD_CACHE_ALWAYS = 2/**<Use the last value if any, for devices sending all their changes*/
+};
+
+/**
+ * Where the last known value of a Service comes from
+ */
+enum HPD_ValueSource
+{
+  HPD_VALUE_NONE = 0,/**<No value is known*/
+  HPD_VALUE_EVENT = 1,/**<Sent by the device with HPD_send_event_of_value_change()*/
+  HPD_VALUE_PUT = 2,/**<Returned by the PUT function*/
+  HPD_VALUE_GET = 3/**<Returned by the GET function*/
+};
 
 typedef size_t (*HPD_GetFunction) (Service* service, char *buffer, size_t max_buffer_size);
 
 typedef size_t (*HPD_PutFunction) (Service* service, char *buffer, size_t max_buffer_size, char *put_value);
 
+/**
+ * A GET or PUT request waiting for the value of a Service, see HPD_reply()
+ */
+typedef struct HPD_Reply HPD_Reply;
+
+/**
+ * Asynchronous variant of HPD_GetFunction. It returns without waiting for
+ * the device, which keeps serving other requests meanwhile, and gives the
+ * value later to HPD_reply(), from any thread. Unregistering the Service
+ * waits until every reply has been given, so it must not be called from
+ * the thread that gives them
+ */
+typedef void (*HPD_GetAsyncFunction) (Service* service, HPD_Reply *reply);
+
+/**
+ * Asynchronous variant of HPD_PutFunction, giving the new value to
+ * HPD_reply() like HPD_GetAsyncFunction. put_value is only valid during
+ * the call
+ */
+typedef void (*HPD_PutAsyncFunction) (Service* service, HPD_Reply *reply, char *put_value);
+
+struct RegistryLink
+{
+  void *next;/**<The next entry of the chain*/
+  void *prev;/**<The previous entry of the chain*/
+};
+
+/**
+ * The strings of Devices and Services are interned with intern_string():
+ * identical strings are shared, and must not be modified or freed
+ */
 struct Device
 {
   char *description;/**<The Device description*/
@@ -75,6 +133,9 @@ struct Device
   char *type;/**<The Device type*/
   int secure_device;/**<A variable that states if the Device is Secure or not (HPD_SECURE_DEVICE or HPD_NON_SECURE_DEVICE)*/
   ServiceElement *service_head;/**<The first Service of the Service List*/
+  int registered_services;/**<The number of Services of the Device in the registry*/
+  RegistryLink registry_link;/**<Links in the registry of Devices by type and ID*/
+  RegistryLink location_link;/**<Links in the registry of Devices by location*/
 };
 
 struct Service
@@ -88,13 +149,26 @@ struct Service
   char *DNS_SD_type;/**<*/
   char* zeroConfName;/**<The name used to advertise the service using ZeroConf*/
   char* get_function_buffer;
-  char *put_value;
   Device *device;/**<The Device that contains the Service*/
   HPD_GetFunction get_function;/**<A pointer to the GET function of the Service*/
   HPD_PutFunction put_function;/**<A pointer to the PUT function of the Service*/
+  HPD_GetAsyncFunction get_async_function;/**<A pointer to the asynchronous GET function of the Service*/
+  HPD_PutAsyncFunction put_async_function;/**<A pointer to the asynchronous PUT function of the Service*/
   void* user_data_pointer;/**<Pointer used for the used to store its data*/
   Parameter *parameter;/**<The first Parameter of the Parameter List*/
-  pthread_mutex_t *mutex; /**<A mutex used to access a Service in the list*/
+  pthread_mutex_t *mutex; /**<A mutex used to access a Service in the list, and its last value*/
+  enum HPD_CachePolicy cache_policy;/**<When GETs are answered from the last known value*/
+  double cache_max_age;/**<The age in seconds up to which the last value is used, with HPD_CACHE_MAX_AGE*/
+  char *last_value;/**<The last known value, or NULL*/
+  double last_value_time;/**<When the last value was known, in seconds since the Epoch*/
+  enum HPD_ValueSource last_value_source;/**<Where the last value comes from*/
+  double poll_interval;/**<The shortest interval in seconds between samples of the value by the daemon, or 0 not to poll it*/
+  double poll_max_interval;/**<The longest interval between samples, reached while the value does not change*/
+  double poll_deadband;/**<The smallest change of a numeric value sampled sent as an event*/
+  struct hpd_poll *poll;/**<The polling of the Service while registered, or NULL*/
+  int pending_replies;/**<Functions called that did not give their value to HPD_reply() yet*/
+  RegistryLink registry_link;/**<Links in the registry of Services by identifiers*/
+  RegistryLink type_link;/**<Links in the registry of Services by type*/
 };
 
 struct ServiceElement
@@ -143,8 +217,22 @@ Service* create_service_struct(
     Parameter *parameter,
     void* user_data_pointer);
 
+Service* create_async_service_struct(
+    char *description,
+    char *ID,
+    int isActuator,
+    char *type,
+    char *unit,
+    Device *device,
+    HPD_GetAsyncFunction get_async_function,
+    HPD_PutAsyncFunction put_async_function,
+    Parameter *parameter,
+    void* user_data_pointer);
+
 int destroy_service_struct( Service *service ); 
 
+void HPD_reply( HPD_Reply *reply, const char *value, size_t len );
+
 ServiceElement* create_service_element_struct( Service *service );
 
 int destroy_service_element_struct( ServiceElement *service_element_to_destroy );
@@ -163,6 +251,28 @@ Device* create_device_struct(
 
 int destroy_device_struct( Device *device ); 
 
+typedef void (*HPD_ServiceCallback) (Service *service, void *data);
+typedef void (*HPD_DeviceCallback) (Device *device, void *data);
+
+int registry_add_service( Service *service );
+int registry_remove_service( Service *service );
+Service* registry_get_service( const char *device_type, const char *device_ID,
+                               const char *service_type, const char *service_ID );
+Device* registry_get_device( const char *device_type, const char *device_ID );
+int registry_foreach_service_of_type( const char *type, HPD_ServiceCallback cb, void *data );
+int registry_foreach_device_at_location( const char *location, HPD_DeviceCallback cb, void *data );
+void set_device_location( Device *device, const char *location );
+
+int set_service_cache_policy( Service *service, enum HPD_CachePolicy policy, double max_age );
+int store_service_value( Service *service, const char *value, size_t len, enum HPD_ValueSource source );
+char *get_cached_service_value( Service *service, double *age );
+char *get_last_service_value( Service *service, double *time, enum HPD_ValueSource *source );
+int set_service_polling( Service *service, double interval, double max_interval, double deadband );
+
+char *intern_string( const char *str );
+void release_string( char *str );
+void replace_string( char **field, const char *str );
+
 int add_service_to_device( Service *service, Device *device );
 
 int remove_service_from_device( Service *service, Device *device );
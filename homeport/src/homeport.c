@@ -88,6 +88,15 @@ parse_option_va( va_list ap )
 			}
 				break;
 
+			case HPD_OPTION_WORKERS :
+				hpd_daemon->workers = va_arg( ap, int );
+				if( hpd_daemon->workers < 0 )
+			{
+				printf("Bad value for number of workers\n");
+				return HPD_E_BAD_PARAMETER;
+			}
+				break;
+
 			default :
 				printf("Unrecognized option\n");	
 				return HPD_E_BAD_PARAMETER;
@@ -219,6 +228,9 @@ HPD_register_service( Service *service_to_register )
 /**
  * Unregisters a given Service in the HomePort Daemon
  *
+ * Waits until the functions of the Service called have given their
+ * value to HPD_reply(), after which the Service may be destroyed
+ *
  * @param service_to_unregister The service to unregister
  *
  * @return A HPD error code
@@ -271,6 +283,31 @@ HPD_unregister_device_services( Device *device_to_unregister )
 	return unregister_device_services( device_to_unregister );
 }
 
+/**
+ * Begins a batch of registrations. The Services registered or
+ *  unregistered until HPD_register_commit are served right away,
+ *  but the services.xml file is written only once, at the commit.
+ *  Batches can be nested
+ *
+ * @return A HPD error code
+ */
+int 
+HPD_register_begin()
+{
+	return register_begin();
+}
+
+/**
+ * Commits a batch of registrations begun with HPD_register_begin
+ *
+ * @return A HPD error code
+ */
+int 
+HPD_register_commit()
+{
+	return register_commit();
+}
+
 
 /**
  * Gets a service given its uniqueness identifiers
@@ -292,7 +329,7 @@ HPD_get_service( char *device_type, char *device_ID, char *service_type, char *s
 	if( device_type == NULL || device_ID == NULL || service_type == NULL || service_ID == NULL )
 		return NULL;
 
-	return get_service( device_type, device_ID, service_type, service_ID );
+	return registry_get_service( device_type, device_ID, service_type, service_ID );
 }
 
 /**
@@ -310,7 +347,51 @@ HPD_get_device( char *device_type, char *device_ID )
 	if( device_type == NULL || device_ID == NULL )
 		return NULL;
 
-	return get_device( device_type, device_ID );
+	return registry_get_device( device_type, device_ID );
+}
+
+/**
+ * Calls a function on each registered service of a type
+ *
+ * The function must not register or unregister services.
+ *
+ * @param type The type of the services
+ *
+ * @param cb The function
+ *
+ * @param data The data given to the function
+ *
+ * @return The number of services, or a HPD error code
+ */
+int
+HPD_foreach_service_of_type( char *type, HPD_ServiceCallback cb, void *data )
+{
+	if( type == NULL || cb == NULL )
+		return HPD_E_NULL_POINTER;
+
+	return registry_foreach_service_of_type( type, cb, data );
+}
+
+/**
+ * Calls a function on each device with registered services at a location
+ *
+ * The function must not register or unregister services.
+ *
+ * @param location The location of the devices
+ *
+ * @param cb The function
+ *
+ * @param data The data given to the function
+ *
+ * @return The number of devices, or a HPD error code
+ */
+int
+HPD_foreach_device_at_location( char *location, HPD_DeviceCallback cb, void *data )
+{
+	if( location == NULL || cb == NULL )
+		return HPD_E_NULL_POINTER;
+
+	return registry_foreach_device_at_location( location, cb, data );
 }
 
 /**
@@ -325,9 +406,87 @@ HPD_get_device( char *device_type, char *device_ID )
 int 
 HPD_send_event_of_value_change ( Service *service_changed, char *updated_value )
 {
+	if( service_changed && updated_value )
+		store_service_value( service_changed, updated_value, strlen(updated_value), HPD_VALUE_EVENT );
+
 	return send_event_of_value_change (service_changed, updated_value, NULL);
 }
 
+/**
+ * Sets when GETs of a Service are answered from its last known value
+ *
+ * The last known value comes from HPD_send_event_of_value_change(), and
+ * from the results of the GET and PUT functions. Services of devices
+ * that send all their changes can use HPD_CACHE_ALWAYS, so that GETs do
+ * not reach the device once a value is known.
+ *
+ * @param service The Service
+ *
+ * @param policy HPD_CACHE_LIVE (the default), HPD_CACHE_MAX_AGE or HPD_CACHE_ALWAYS
+ *
+ * @param max_age The age in seconds up to which the last value is used,
+ * 		with HPD_CACHE_MAX_AGE
+ *
+ * @return HPD_E_SUCCESS if successful
+ */
+int
+HPD_set_cache_policy( Service *service, enum HPD_CachePolicy policy, double max_age )
+{
+	return set_service_cache_policy( service, policy, max_age );
+}
+
+/**
+ * Sets how the daemon polls the value of a Service
+ *
+ * Values of devices that cannot send their changes are sampled with the
+ * GET function of the Service while it is registered, so that clients
+ * can subscribe to value change events instead of polling. The interval
+ * between samples halves when the value changed, down to interval, and
+ * grows while it does not, up to max_interval. Changes of numeric values
+ * are only sent as events when larger than deadband.
+ *
+ * @param service The Service
+ *
+ * @param interval The shortest interval in seconds between samples, or 0
+ * 		to stop polling
+ *
+ * @param max_interval The longest interval in seconds between samples
+ *
+ * @param deadband The smallest change of a numeric value sent as an event
+ *
+ * @return HPD_E_SUCCESS if successful
+ */
+int
+HPD_poll_service( Service *service, double interval, double max_interval, double deadband )
+{
+	int rc = set_service_polling( service, interval, max_interval, deadband );
+
+	if( rc < HPD_E_SUCCESS )
+		return rc;
+
+	return update_service_polling( service );
+}
+
+/**
+ * Gets the last known value of a Service
+ *
+ * @param service The Service
+ *
+ * @param time Set to when the value was known, in seconds since the Epoch, or NULL
+ *
+ * @param source Set to where the value comes from, or NULL
+ *
+ * @return A copy of the value, which must be freed, or NULL if none is known
+ */
+char *
+HPD_get_last_value( Service *service, double *time, enum HPD_ValueSource *source )
+{
+	if( service == NULL )
+		return NULL;
+
+	return get_last_service_value( service, time, source );
+}
+
 static void
 sig_cb ( struct ev_loop *loop, struct ev_signal *w, int revents )
 {
@@ -85,12 +85,14 @@ entry_group_callback(	AvahiServer *s,
 			case AVAHI_ENTRY_GROUP_COLLISION: {
 				char *n;
 
-				/* A service name collision happened. Let's pick a new name */
-				n = avahi_alternative_service_name(called_service->ID);
-				avahi_free(called_service->ID);
-				called_service->ID = n;
+				/* A service name collision happened. Let's pick a new name.
+				 * Only the published name changes, the ID is interned and
+				 * indexes the service in the registry */
+				n = avahi_alternative_service_name(called_service->zeroConfName);
+				replace_string(&called_service->zeroConfName, n);
+				avahi_free(n);
 
-				fprintf(stderr, "Service name collision, renaming service to '%s'\n", name);
+				fprintf(stderr, "Service name collision, renaming service to '%s'\n", called_service->zeroConfName);
 
 				/* And recreate the services */
 
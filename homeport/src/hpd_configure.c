@@ -32,6 +32,7 @@ authors and should not be interpreted as representing official policies, either
 
 #include "hpd_configure.h"
 #include "hpd_error.h"
+#include "hpd_workers.h"
 
 config_t *cfg = NULL;
 
@@ -61,6 +62,8 @@ HPD_init_daemon()
 	hpd_daemon->server_key_path = NULL;
 	hpd_daemon->root_ca_path = NULL;
 #endif
+
+	hpd_daemon->workers = HPD_WORKERS_DEFAULT;
 	return HPD_E_SUCCESS;
 
 }
@@ -160,6 +163,9 @@ HPD_config_file_init( const char *cfg_file_path )
 	}
 #endif
 
+	/* Optional, keeps its default if not found */
+	config_lookup_int(cfg, "hpdaemon.workers", &hpd_daemon->workers);
+
 	if(!config_lookup_int(cfg, "hpdlog.max_log_size", &max_log_size))
 	{
 		printf("Max Log size not found in hpd.cfg\n");
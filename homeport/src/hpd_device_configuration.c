@@ -666,13 +666,11 @@ int modify_services(configurationXML *configure)
 		{
 			if(strcmp(att_iterator->name, "desc") == 0)
 			{
-				((Service *)iterator->entity)->description = realloc(((Service *)iterator->entity)->description,sizeof(char)*(strlen(att_iterator->value) + 1));
-				strcpy(((Device *)iterator->entity)->description, att_iterator->value);
+				replace_string(&((Service *)iterator->entity)->description, att_iterator->value);
 			}
 			if(strcmp(att_iterator->name, "unit") == 0)
 			{
-				((Service *)iterator->entity)->unit = realloc(((Service *)iterator->entity)->unit,sizeof(char)*(strlen(att_iterator->value) + 1));
-				strcpy(((Service *)iterator->entity)->unit, att_iterator->value);
+				replace_string(&((Service *)iterator->entity)->unit, att_iterator->value);
 			}
 		}
 		update_service_xml((Service *)iterator->entity);
@@ -692,38 +690,31 @@ int modify_devices(configurationXML *configure)
 		{
 			if(strcmp(att_iterator->name, "desc") == 0)
 			{
-				((Device *)iterator->entity)->description = realloc(((Device *)iterator->entity)->description,sizeof(char)*(strlen(att_iterator->value) + 1));
-				strcpy(((Device *)iterator->entity)->description, att_iterator->value);
+				replace_string(&((Device *)iterator->entity)->description, att_iterator->value);
 			}
 			if(strcmp(att_iterator->name, "vendorid") == 0)
 			{
-				((Device *)iterator->entity)->vendorID = realloc(((Device *)iterator->entity)->vendorID,sizeof(char)*(strlen(att_iterator->value) + 1));
-				strcpy(((Device *)iterator->entity)->vendorID, att_iterator->value);
+				replace_string(&((Device *)iterator->entity)->vendorID, att_iterator->value);
 			}
 			if(strcmp(att_iterator->name, "productid") == 0)
 			{
-				((Device *)iterator->entity)->productID = realloc(((Device *)iterator->entity)->productID,sizeof(char)*(strlen(att_iterator->value) + 1));
-				strcpy(((Device *)iterator->entity)->productID, att_iterator->value);
+				replace_string(&((Device *)iterator->entity)->productID, att_iterator->value);
 			}
 			if(strcmp(att_iterator->name, "version") == 0)
 			{
-				((Device *)iterator->entity)->version = realloc(((Device *)iterator->entity)->version,sizeof(char)*(strlen(att_iterator->value) + 1));
-				strcpy(((Device *)iterator->entity)->version, att_iterator->value);
+				replace_string(&((Device *)iterator->entity)->version, att_iterator->value);
 			}
 			if(strcmp(att_iterator->name, "ip") == 0)
 			{
-				((Device *)iterator->entity)->IP = realloc(((Device *)iterator->entity)->IP,sizeof(char)*(strlen(att_iterator->value) + 1));
-				strcpy(((Device *)iterator->entity)->IP, att_iterator->value);
+				replace_string(&((Device *)iterator->entity)->IP, att_iterator->value);
 			}
 			if(strcmp(att_iterator->name, "port") == 0)
 			{
-				((Device *)iterator->entity)->port = realloc(((Device *)iterator->entity)->port,sizeof(char)*(strlen(att_iterator->value) + 1));
-				strcpy(((Device *)iterator->entity)->port, att_iterator->value);
+				replace_string(&((Device *)iterator->entity)->port, att_iterator->value);
 			}
 			if(strcmp(att_iterator->name, "location") == 0)
 			{
-				((Device *)iterator->entity)->location = realloc(((Device *)iterator->entity)->location,sizeof(char)*(strlen(att_iterator->value) + 1));
-				strcpy(((Device *)iterator->entity)->location, att_iterator->value);
+				set_device_location((Device *)iterator->entity, att_iterator->value);
 			}
 		}
 		update_device_xml((Device *)iterator->entity);
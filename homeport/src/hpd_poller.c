@@ -0,0 +1,383 @@
+/*Copyright 2011 Aalborg University. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed*/
+
+/**
+ * @file hpd_poller.c
+ * @brief  Background polling of the values of services
+ *
+ * Services that cannot send their changes are sampled by the daemon, so
+ * that clients subscribe to value change events instead of polling the
+ * device each. Polls are kept on a timer wheel ticking on the event loop,
+ * and start at different ticks, spreading the samples over time. Each
+ * poll adapts its interval between the bounds of its service: it halves
+ * when the value changed, and grows by half when it did not. Only changes
+ * of numeric values larger than the deadband of the service are sent as
+ * events, and any change of other values.
+ */
+
+#include "hpd_poller.h"
+#include "hpd_server_sent_events.h"
+#include "utlist.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Slots of the wheel, polls further away wait for later turns
+#define POLL_SLOTS 512
+
+/// Factors of the interval of a poll when the value did not change, or did
+#define POLL_SLOWER 1.5
+#define POLL_FASTER 0.5
+
+/// The polling of a service
+struct hpd_poll
+{
+   struct hpd_poller *poller;
+   Service *service;
+   double interval;          ///< Seconds until the next sample
+   char *last;               ///< Last value sent as an event, or first sampled
+   unsigned long due;        ///< Tick of the next sample
+   int busy;                 ///< A sample is being taken
+   int removed;              ///< Removed while busy, freed once sampled
+   char *value;              ///< Value sampled, NULL on failure
+   struct hpd_poll *next;    ///< Next poll of the slot, or sampled
+   struct hpd_poll *prev;
+};
+
+struct hpd_poller
+{
+   struct ev_loop *loop;
+   ev_timer tick;
+   ev_async wake;            ///< Sent when samples are taken or polls added
+   hpd_sample_cb sample;
+   pthread_mutex_t lock;
+   unsigned long now;        ///< Ticks since the poller was created
+   struct hpd_poll *slots[POLL_SLOTS];
+   struct hpd_poll *sampled; ///< Samples taken, handled on the loop
+   int count;                ///< Polls in the wheel or busy
+};
+
+/**
+ * Put a poll in the slot of the tick in interval seconds
+ */
+static void
+schedule( struct hpd_poller *poller, struct hpd_poll *poll, double interval )
+{
+   unsigned long ticks = (unsigned long)ceil(interval / HPD_POLL_TICK);
+
+   poll->due = poller->now + (ticks ? ticks : 1);
+   DL_APPEND(poller->slots[poll->due % POLL_SLOTS], poll);
+}
+
+/**
+ * Whether a value changed more than the deadband since the last one
+ */
+static int
+changed( const char *last, const char *value, double deadband )
+{
+   char *last_end, *value_end;
+   double a = strtod(last, &last_end);
+   double b = strtod(value, &value_end);
+
+   if (last_end != last && *last_end == '\0'
+       && value_end != value && *value_end == '\0')
+      return fabs(b - a) > deadband;
+   return strcmp(last, value) != 0;
+}
+
+/**
+ * Handle a sample: send it as an event if it changed, adapt the interval
+ * and schedule the next one
+ */
+static void
+handle_sample( struct hpd_poller *poller, struct hpd_poll *poll )
+{
+   Service *service = poll->service;
+
+   if (poll->value && !poll->last) {
+      poll->last = poll->value;
+      poll->value = NULL;
+   } else if (poll->value
+              && changed(poll->last, poll->value, service->poll_deadband)) {
+      send_event_of_value_change(service, poll->value, NULL);
+      free(poll->last);
+      poll->last = poll->value;
+      poll->value = NULL;
+      poll->interval *= POLL_FASTER;
+   } else if (poll->value) {
+      poll->interval *= POLL_SLOWER;
+   }
+   free(poll->value);
+   poll->value = NULL;
+
+   if (poll->interval < service->poll_interval)
+      poll->interval = service->poll_interval;
+   if (poll->interval > service->poll_max_interval)
+      poll->interval = service->poll_max_interval;
+
+   pthread_mutex_lock(&poller->lock);
+   poll->busy = 0;
+   schedule(poller, poll, poll->interval);
+   pthread_mutex_unlock(&poller->lock);
+}
+
+static void
+free_poll( struct hpd_poll *poll )
+{
+   free(poll->last);
+   free(poll->value);
+   free(poll);
+}
+
+/**
+ * Take the samples due at the next tick
+ */
+static void
+tick_cb( struct ev_loop *loop, ev_timer *w, int revents )
+{
+   struct hpd_poller *poller = w->data;
+   struct hpd_poll *poll, *tmp, *due = NULL;
+
+   pthread_mutex_lock(&poller->lock);
+   poller->now++;
+   DL_FOREACH_SAFE(poller->slots[poller->now % POLL_SLOTS], poll, tmp) {
+      if (poll->due <= poller->now) {
+         DL_DELETE(poller->slots[poller->now % POLL_SLOTS], poll);
+         poll->busy = 1;
+         DL_APPEND(due, poll);
+      }
+   }
+   if (poller->count == 0)
+      ev_timer_stop(loop, w);
+   pthread_mutex_unlock(&poller->lock);
+
+   // Samples may be taken right away, calling hpd_poller_sampled()
+   DL_FOREACH_SAFE(due, poll, tmp) {
+      DL_DELETE(due, poll);
+      if (poll->removed || poller->sample(poll->service, poll))
+         hpd_poller_sampled(poll, NULL, 0);
+   }
+}
+
+/**
+ * Handle the samples taken, and start ticking if polls were added
+ */
+static void
+wake_cb( struct ev_loop *loop, ev_async *w, int revents )
+{
+   struct hpd_poller *poller = w->data;
+   struct hpd_poll *poll, *sampled;
+
+   pthread_mutex_lock(&poller->lock);
+   sampled = poller->sampled;
+   poller->sampled = NULL;
+   if (poller->count > 0 && !ev_is_active(&poller->tick))
+      ev_timer_again(loop, &poller->tick);
+   pthread_mutex_unlock(&poller->lock);
+
+   while (sampled) {
+      poll = sampled;
+      sampled = poll->next;
+      if (poll->removed)
+         free_poll(poll);
+      else
+         handle_sample(poller, poll);
+   }
+}
+
+/**
+ * Create a poller ticking on an event loop
+ *
+ * @param loop The loop of the web server
+ *
+ * @param sample The function starting to take samples
+ *
+ * @return The poller, or NULL on failure
+ */
+struct hpd_poller *
+hpd_poller_create( struct ev_loop *loop, hpd_sample_cb sample )
+{
+   struct hpd_poller *poller = calloc(1, sizeof(struct hpd_poller));
+
+   if (!poller) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return NULL;
+   }
+   poller->loop = loop;
+   poller->sample = sample;
+   pthread_mutex_init(&poller->lock, NULL);
+
+   ev_init(&poller->tick, tick_cb);
+   poller->tick.repeat = HPD_POLL_TICK;
+   poller->tick.data = poller;
+   ev_async_init(&poller->wake, wake_cb);
+   poller->wake.data = poller;
+   ev_async_start(loop, &poller->wake);
+
+   return poller;
+}
+
+/**
+ * Stop polling and free a poller
+ *
+ * Samples being taken must have been given to hpd_poller_sampled()
+ *
+ * @param poller The poller to destroy
+ */
+void
+hpd_poller_destroy( struct hpd_poller *poller )
+{
+   struct hpd_poll *poll, *tmp;
+   int i;
+
+   if (!poller)
+      return;
+
+   ev_timer_stop(poller->loop, &poller->tick);
+   ev_async_stop(poller->loop, &poller->wake);
+
+   for (i = 0; i < POLL_SLOTS; i++) {
+      DL_FOREACH_SAFE(poller->slots[i], poll, tmp) {
+         poll->service->poll = NULL;
+         free_poll(poll);
+      }
+   }
+   while (poller->sampled) {
+      poll = poller->sampled;
+      poller->sampled = poll->next;
+      if (!poll->removed)
+         poll->service->poll = NULL;
+      free_poll(poll);
+   }
+
+   pthread_mutex_destroy(&poller->lock);
+   free(poller);
+}
+
+/**
+ * Start polling a service, at the intervals and with the deadband of the
+ * service
+ *
+ * The first sample is taken at a tick picked from the service within its
+ * interval, so that services polled at the same interval are not sampled
+ * together.
+ *
+ * @param poller The poller
+ *
+ * @param service The service, which must not be polled already
+ *
+ * @return 0 on success, 1 on memory errors
+ */
+int
+hpd_poller_add( struct hpd_poller *poller, Service *service )
+{
+   struct hpd_poll *poll = calloc(1, sizeof(struct hpd_poll));
+   double phase;
+
+   if (!poll) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return 1;
+   }
+   poll->poller = poller;
+   poll->service = service;
+   poll->interval = service->poll_interval;
+   phase = (double)((uintptr_t)service->value_url / 16 % 1024) / 1024;
+
+   pthread_mutex_lock(&poller->lock);
+   schedule(poller, poll, phase * poll->interval);
+   poller->count++;
+   pthread_mutex_unlock(&poller->lock);
+
+   service->poll = poll;
+   ev_async_send(poller->loop, &poller->wake);
+   return 0;
+}
+
+/**
+ * Stop polling a service
+ *
+ * A sample being taken is dropped, and must still be given to
+ * hpd_poller_sampled().
+ *
+ * @param poller The poller
+ *
+ * @param service The service, polled or not
+ */
+void
+hpd_poller_remove( struct hpd_poller *poller, Service *service )
+{
+   struct hpd_poll *poll = service->poll;
+   int busy;
+
+   if (!poll)
+      return;
+   service->poll = NULL;
+
+   pthread_mutex_lock(&poller->lock);
+   poller->count--;
+   busy = poll->busy;
+   if (busy)
+      poll->removed = 1;
+   else
+      DL_DELETE(poller->slots[poll->due % POLL_SLOTS], poll);
+   pthread_mutex_unlock(&poller->lock);
+
+   if (!busy)
+      free_poll(poll);
+}
+
+/**
+ * Give a sample of a value, from any thread
+ *
+ * @param poll The poll given with the service to sample
+ *
+ * @param value The value, not necessarily \0 terminated
+ *
+ * @param len The length of value, or 0 if it could not be sampled
+ */
+void
+hpd_poller_sampled( struct hpd_poll *poll, const char *value, size_t len )
+{
+   struct hpd_poller *poller = poll->poller;
+
+   if (len) {
+      poll->value = malloc((len+1) * sizeof(char));
+      if (poll->value) {
+         memcpy(poll->value, value, len);
+         poll->value[len] = '\0';
+      }
+   }
+
+   pthread_mutex_lock(&poller->lock);
+   poll->next = poller->sampled;
+   poller->sampled = poll;
+   pthread_mutex_unlock(&poller->lock);
+
+   ev_async_send(poller->loop, &poller->wake);
+}
@@ -0,0 +1,56 @@
+/*Copyright 2011 Aalborg University. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed*/
+
+/**
+ * @file hpd_poller.h
+ * @brief  Background polling of the values of services
+ */
+
+#ifndef HPD_POLLER_H
+#define HPD_POLLER_H
+
+#include "hpd_services.h"
+
+#include <ev.h>
+
+/// Seconds between the ticks of the wheel of polls
+#define HPD_POLL_TICK 0.1
+
+struct hpd_poll;
+struct hpd_poller;
+
+/// Starts taking a sample of the value of a service, given to
+/// hpd_poller_sampled(). Returns 0 on success
+typedef int (*hpd_sample_cb)(Service *service, struct hpd_poll *poll);
+
+struct hpd_poller *hpd_poller_create( struct ev_loop *loop, hpd_sample_cb sample );
+void hpd_poller_destroy( struct hpd_poller *poller );
+
+int hpd_poller_add( struct hpd_poller *poller, Service *service );
+void hpd_poller_remove( struct hpd_poller *poller, Service *service );
+
+void hpd_poller_sampled( struct hpd_poll *poll, const char *value, size_t len );
+
+#endif
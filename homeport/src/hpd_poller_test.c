@@ -0,0 +1,218 @@
+// hpd_poller_test.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+ *   
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *  
+ *  The views and conclusions contained in the software and
+ *  documentation are those of the authors and should not be interpreted
+ *  as representing official policies, either expressed.
+ */
+
+#include "hpd_poller.c"
+#include "unit_test.h"
+
+// The poller is driven by calling its watchers directly, so that ticks
+// do not depend on time
+
+static int events = 0;
+static char event_value[32];
+
+int send_event_of_value_change(Service *service, const char *updated_value,
+                               const char *IP)
+{
+   events++;
+   snprintf(event_value, sizeof(event_value), "%s", updated_value);
+   return 0;
+}
+
+static int samples = 0;
+static const char *sample_value = NULL; ///< Given right away, or kept busy
+static struct hpd_poll *busy = NULL;
+
+static int sample(Service *service, struct hpd_poll *poll)
+{
+   samples++;
+   if (sample_value)
+      hpd_poller_sampled(poll, sample_value, strlen(sample_value));
+   else
+      busy = poll;
+   return 0;
+}
+
+static void init_service(Service *service, double interval,
+                         double max_interval, double deadband)
+{
+   memset(service, 0, sizeof(Service));
+   service->value_url = "/Lamp/1/Switch/0";
+   service->poll_interval = interval;
+   service->poll_max_interval = max_interval;
+   service->poll_deadband = deadband;
+}
+
+/// Tick until a sample is taken, and handle it
+static int next_sample(struct hpd_poller *poller, int max_ticks)
+{
+   int ticks = 0, before = samples;
+
+   wake_cb(poller->loop, &poller->wake, 0);
+   while (samples == before && ticks < max_ticks) {
+      tick_cb(poller->loop, &poller->tick, 0);
+      ticks++;
+   }
+   wake_cb(poller->loop, &poller->wake, 0);
+   return ticks;
+}
+
+TEST_START("hpd_poller.c")
+
+TEST(deadband)
+   ASSERT(changed("20.0", "20.4", 0.5));
+   ASSERT(!changed("20.0", "20.6", 0.5));
+   ASSERT(!changed("20.0", "19.4", 0.5));
+   ASSERT(changed("1", "1.0", 0));
+   ASSERT(!changed("1", "2", 0));
+   ASSERT(!changed("ON", "OFF", 100));
+   ASSERT(changed("ON", "ON", 0));
+   ASSERT(!changed("1", "1x", 100));
+TSET()
+
+TEST(adaptive_interval)
+   struct ev_loop *loop = ev_loop_new(0);
+   struct hpd_poller *poller = hpd_poller_create(loop, sample);
+   Service service;
+   struct hpd_poll *poll;
+
+   init_service(&service, 0.2, 0.6, 0.5);
+   ASSERT(hpd_poller_add(poller, &service));
+   poll = service.poll;
+   ASSERT_NOT_NULL(poll);
+   events = samples = 0;
+
+   // The first sample only sets the value changes are compared to
+   sample_value = "20.0";
+   next_sample(poller, 10);
+   ASSERT(samples != 1);
+   ASSERT(events != 0);
+   ASSERT(poll->interval != 0.2);
+
+   // Unchanged, slower up to the max interval
+   next_sample(poller, 10);
+   ASSERT(poll->interval != 0.2 * POLL_SLOWER);
+   next_sample(poller, 10);
+   ASSERT(poll->interval != 0.2 * POLL_SLOWER * POLL_SLOWER);
+   next_sample(poller, 10);
+   ASSERT(poll->interval != 0.6);
+   ASSERT(next_sample(poller, 10) != 6);
+   ASSERT(poll->interval != 0.6);
+
+   // Changes within the deadband are not sent
+   sample_value = "20.3";
+   next_sample(poller, 10);
+   ASSERT(events != 0);
+   ASSERT(poll->interval != 0.6);
+
+   // Changed, faster down to the interval
+   sample_value = "21.0";
+   next_sample(poller, 10);
+   ASSERT(events != 1);
+   ASSERT(strcmp(event_value, "21.0"));
+   ASSERT(poll->interval != 0.6 * POLL_FASTER);
+   sample_value = "22.0";
+   ASSERT(next_sample(poller, 10) != 3);
+   ASSERT(events != 2);
+   ASSERT(poll->interval != 0.2);
+   ASSERT(next_sample(poller, 10) != 2);
+   ASSERT(poll->interval != 0.2 * POLL_SLOWER);
+
+   // Failed samples keep the interval
+   sample_value = "";
+   next_sample(poller, 10);
+   ASSERT(events != 2);
+   ASSERT(poll->interval != 0.2 * POLL_SLOWER);
+
+   hpd_poller_remove(poller, &service);
+   ASSERT_NULL(service.poll);
+   ASSERT(poller->count != 0);
+   hpd_poller_destroy(poller);
+   ev_loop_destroy(loop);
+TSET()
+
+TEST(wrap_around)
+   struct ev_loop *loop = ev_loop_new(0);
+   struct hpd_poller *poller = hpd_poller_create(loop, sample);
+   Service service;
+   int ticks = (int)ceil(100 / HPD_POLL_TICK);
+
+   // Due further away than the slots of the wheel
+   init_service(&service, 100, 100, 0);
+   ASSERT(ticks <= POLL_SLOTS);
+   ASSERT(hpd_poller_add(poller, &service));
+   samples = 0;
+
+   sample_value = "1";
+   ASSERT(next_sample(poller, ticks + 1) > ticks);
+   ASSERT(next_sample(poller, ticks + 1) != ticks);
+   ASSERT(next_sample(poller, ticks + 1) != ticks);
+   ASSERT(samples != 3);
+
+   hpd_poller_remove(poller, &service);
+   hpd_poller_destroy(poller);
+   ev_loop_destroy(loop);
+TSET()
+
+TEST(remove_while_busy)
+   struct ev_loop *loop = ev_loop_new(0);
+   struct hpd_poller *poller = hpd_poller_create(loop, sample);
+   Service service;
+
+   init_service(&service, 0.1, 0.1, 0);
+   ASSERT(hpd_poller_add(poller, &service));
+   events = samples = 0;
+
+   // The first sample is not given until the service is removed
+   sample_value = NULL;
+   busy = NULL;
+   next_sample(poller, 10);
+   ASSERT_NOT_NULL(busy);
+   ASSERT(!busy->busy);
+
+   hpd_poller_remove(poller, &service);
+   ASSERT_NULL(service.poll);
+   ASSERT(poller->count != 0);
+   ASSERT(!busy->removed);
+
+   // Dropped when given, and not sampled again
+   hpd_poller_sampled(busy, "1", 1);
+   wake_cb(loop, &poller->wake, 0);
+   ASSERT(events != 0);
+   ASSERT(next_sample(poller, 10) != 10);
+   ASSERT(samples != 1);
+
+   hpd_poller_destroy(poller);
+   ev_loop_destroy(loop);
+TSET()
+
+TEST_END()
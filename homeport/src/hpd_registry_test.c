@@ -0,0 +1,277 @@
+// hpd_registry_test.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+ *   
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *  
+ *  The views and conclusions contained in the software and
+ *  documentation are those of the authors and should not be interpreted
+ *  as representing official policies, either expressed.
+ */
+
+#include "hpd_services.c"
+#include "unit_test.h"
+
+#define N_DEVICES 4
+#define N_SERVICES 12 ///< Per device, enough for the indexes to grow
+
+// The registry is tested on its own, no service is registered in the
+// web server
+int is_service_registered( Service *service )
+{
+   return 0;
+}
+
+static Device *devices[N_DEVICES];
+static Service *services[N_DEVICES][N_SERVICES];
+
+static void create_all(void)
+{
+   char id[16];
+   int d, s;
+   Parameter *parameter;
+
+   for (d = 0; d < N_DEVICES; d++) {
+      sprintf(id, "%d", d);
+      devices[d] = create_device_struct("Lamp", id, "0x01", "0x01", "V1",
+                                        NULL, NULL, d % 2 ? "Kitchen" : NULL,
+                                        "Lamp", HPD_NON_SECURE_DEVICE);
+      for (s = 0; s < N_SERVICES; s++) {
+         sprintf(id, "%d", s);
+         parameter = create_parameter_struct("0", NULL, NULL, NULL,
+                                             NULL, NULL, NULL, NULL);
+         services[d][s] = create_service_struct("Switch", id, 0,
+                                                s % 2 ? "Switch" : "Dimmer",
+                                                "ON/OFF", devices[d],
+                                                NULL, NULL, parameter, NULL);
+      }
+   }
+}
+
+static void destroy_all(void)
+{
+   int d;
+
+   for (d = 0; d < N_DEVICES; d++)
+      destroy_device_struct(devices[d]);
+}
+
+static int is_found(Service *service)
+{
+   return registry_get_service(service->device->type, service->device->ID,
+                               service->type, service->ID) == service;
+}
+
+/// The longest chain of an index
+static size_t longest_chain(RegistryIndex *index)
+{
+   size_t i, n, longest = 0;
+   void *entry;
+
+   for (i = 0; index->buckets && i <= index->mask; i++) {
+      n = 0;
+      for (entry = index->buckets[i]; entry; entry = LINK(index, entry)->next)
+         n++;
+      if (n > longest)
+         longest = n;
+   }
+   return longest;
+}
+
+static void count_service(Service *service, void *data)
+{
+   (*(int *)data)++;
+}
+
+static void count_device(Device *device, void *data)
+{
+   (*(int *)data)++;
+}
+
+TEST_START("hpd_services.c registry")
+
+TEST(resize_with_chains)
+   int d, s, missing = 0, chained = 0;
+   size_t mask;
+
+   create_all();
+   for (d = 0; d < N_DEVICES; d++) {
+      for (s = 0; s < N_SERVICES; s++) {
+         mask = services_index.mask;
+         if (services_index.count > mask && longest_chain(&services_index) > 1)
+            chained = 1;
+         ASSERT(registry_add_service(services[d][s]));
+      }
+   }
+   ASSERT(services_index.count != N_DEVICES * N_SERVICES);
+   ASSERT(services_index.mask + 1 < services_index.count);
+   ASSERT(!chained);
+
+   for (d = 0; d < N_DEVICES; d++)
+      for (s = 0; s < N_SERVICES; s++)
+         if (!is_found(services[d][s]))
+            missing++;
+   ASSERT(missing);
+   ASSERT_NULL(registry_get_service("Lamp", "0", "Switch", "100"));
+   ASSERT_NULL(registry_get_service("Lamp", "0", "Heater", "1"));
+
+   for (d = 0; d < N_DEVICES; d++)
+      for (s = 0; s < N_SERVICES; s++)
+         registry_remove_service(services[d][s]);
+   ASSERT(services_index.count != 0);
+   ASSERT_NULL(services_index.buckets);
+   destroy_all();
+TSET()
+
+TEST(remove_chain_head)
+   int d, s, missing = 0;
+   size_t b;
+   Service *head = NULL;
+
+   create_all();
+   for (d = 0; d < N_DEVICES; d++)
+      for (s = 0; s < N_SERVICES; s++)
+         registry_add_service(services[d][s]);
+
+   for (b = 0; b <= services_index.mask && !head; b++) {
+      head = services_index.buckets[b];
+      if (head && !head->registry_link.next)
+         head = NULL;
+   }
+   ASSERT_NOT_NULL(head);
+   if (!head)
+      return 1;
+
+   registry_remove_service(head);
+   ASSERT(is_found(head));
+   for (d = 0; d < N_DEVICES; d++)
+      for (s = 0; s < N_SERVICES; s++)
+         if (services[d][s] != head && !is_found(services[d][s]))
+            missing++;
+   ASSERT(missing);
+
+   // And added back
+   ASSERT(registry_add_service(head));
+   ASSERT(!is_found(head));
+
+   for (d = 0; d < N_DEVICES; d++)
+      for (s = 0; s < N_SERVICES; s++)
+         registry_remove_service(services[d][s]);
+   destroy_all();
+TSET()
+
+TEST(device_with_last_service)
+   int n;
+
+   create_all();
+   registry_add_service(services[1][0]);
+   registry_add_service(services[1][1]);
+   ASSERT(registry_get_device("Lamp", "1") != devices[1]);
+   ASSERT_NULL(registry_get_device("Lamp", "0"));
+   n = 0;
+   ASSERT(registry_foreach_device_at_location("Kitchen", count_device, &n) != 1);
+   ASSERT(n != 1);
+
+   registry_remove_service(services[1][0]);
+   ASSERT(registry_get_device("Lamp", "1") != devices[1]);
+   ASSERT(devices[1]->registered_services != 1);
+
+   registry_remove_service(services[1][1]);
+   ASSERT_NULL(registry_get_device("Lamp", "1"));
+   ASSERT(registry_foreach_device_at_location("Kitchen", count_device, &n) != 0);
+   ASSERT(devices_index.count != 0);
+   ASSERT(locations_index.count != 0);
+
+   // Again, for add/remove cycles
+   registry_add_service(services[1][1]);
+   ASSERT(registry_get_device("Lamp", "1") != devices[1]);
+   registry_remove_service(services[1][1]);
+   ASSERT_NULL(registry_get_device("Lamp", "1"));
+   destroy_all();
+TSET()
+
+TEST(location_moves)
+   int d;
+
+   create_all();
+   for (d = 0; d < N_DEVICES; d++)
+      registry_add_service(services[d][0]);
+   ASSERT(registry_foreach_device_at_location("Kitchen", count_device, &d) != 2);
+
+   // Registered devices are moved
+   set_device_location(devices[1], "Hall");
+   ASSERT(registry_foreach_device_at_location("Kitchen", count_device, &d) != 1);
+   ASSERT(registry_foreach_device_at_location("Hall", count_device, &d) != 1);
+   set_device_location(devices[0], "Hall");
+   ASSERT(registry_foreach_device_at_location("Hall", count_device, &d) != 2);
+   set_device_location(devices[1], NULL);
+   ASSERT(registry_foreach_device_at_location("Hall", count_device, &d) != 1);
+   ASSERT(locations_index.count != 2);
+
+   // Unregistered ones only when they are registered
+   registry_remove_service(services[3][0]);
+   set_device_location(devices[3], "Hall");
+   ASSERT(registry_foreach_device_at_location("Hall", count_device, &d) != 1);
+   registry_add_service(services[3][0]);
+   ASSERT(registry_foreach_device_at_location("Hall", count_device, &d) != 2);
+   ASSERT(registry_foreach_device_at_location("Kitchen", count_device, &d) != 0);
+
+   for (d = 0; d < N_DEVICES; d++)
+      registry_remove_service(services[d][0]);
+   ASSERT(locations_index.count != 0);
+   destroy_all();
+TSET()
+
+TEST(services_of_type)
+   int d, s, n;
+
+   create_all();
+   for (d = 0; d < N_DEVICES; d++)
+      for (s = 0; s < N_SERVICES; s++)
+         registry_add_service(services[d][s]);
+   n = 0;
+   ASSERT(registry_foreach_service_of_type("Switch", count_service, &n)
+          != N_DEVICES * N_SERVICES / 2);
+   ASSERT(n != N_DEVICES * N_SERVICES / 2);
+   ASSERT(registry_foreach_service_of_type("Heater", count_service, &n) != 0);
+
+   // Half of the switches removed
+   for (d = 0; d < N_DEVICES; d += 2)
+      for (s = 1; s < N_SERVICES; s += 2)
+         registry_remove_service(services[d][s]);
+   ASSERT(registry_foreach_service_of_type("Switch", count_service, &n)
+          != N_DEVICES * N_SERVICES / 4);
+   ASSERT(registry_foreach_service_of_type("Dimmer", count_service, &n)
+          != N_DEVICES * N_SERVICES / 2);
+
+   for (d = 0; d < N_DEVICES; d++)
+      for (s = 0; s < N_SERVICES; s++)
+         if (d % 2 || s % 2 == 0)
+            registry_remove_service(services[d][s]);
+   ASSERT(types_index.count != 0);
+   destroy_all();
+TSET()
+
+TEST_END()
@@ -61,6 +61,7 @@ struct event_socket *subscribe_to_events(const char *body, struct
    struct event_socket *socket = malloc(sizeof(struct event_socket));
    socket->url = NULL;
    socket->req = NULL;
+   socket->ws = NULL;
    socket->next = NULL;
    socket->prev = NULL;
 
@@ -92,9 +93,40 @@ void open_event_socket(struct event_socket *socket,
    sockets = socket;
 }
 
+/**
+ * Open an event socket for a websocket subscriber
+ *
+ * The socket is opened immediately, as the subscription is made by the
+ * websocket handshake itself. The caller should set the ws field.
+ *
+ * @param loop The event loop
+ *
+ * @return The new socket, or NULL if out of memory
+ */
+struct event_socket *open_event_websocket(struct ev_loop *loop)
+{
+   struct event_socket *socket = malloc(sizeof(struct event_socket));
+   if (!socket) return NULL;
+
+   socket->url = NULL;
+   socket->req = NULL;
+   socket->ws = NULL;
+   socket->prev = NULL;
+   socket->loop = loop;
+   ev_init(&socket->timeout_watcher, timeout_cb);
+   socket->timeout_watcher.data = socket;
+
+   if (sockets) sockets->prev = socket;
+   socket->next = sockets;
+   sockets = socket;
+
+   return socket;
+}
+
 void close_event_socket(struct event_socket *socket)
 {
    socket->req = NULL;
+   socket->ws = NULL;
 
    if (sockets == socket) sockets = socket->next;
    if (socket->next) socket->next->prev = socket->prev;
@@ -163,6 +195,59 @@ send_event_of_value_change( Service *service, const char *value , const char *IP
 	return HPD_E_SUCCESS;
 }
 
+/**
+ * Sends the events of several Service values that changed together
+ *
+ * Event streams get all the events in one chunk, event websockets one
+ * message per event as usual.
+ *
+ * @param services The Services of which the values changed
+ *
+ * @param values The updated value of each Service
+ *
+ * @param n The number of Services
+ *
+ * @return HPD_E_MALLOC_ERROR if an error occured, HPD_E_SUCCESS if successful
+ */
+int 
+send_events_of_value_changes( Service **services, char **values, int n,
+                              const char *IP )
+{
+   static const char *fmt = "event: %s\ndata: %s\ndata: %s\nid: %s\n\n";
+   struct event_socket *s;
+   char *events = NULL, *tmp;
+   size_t len = 0;
+   int i, event_len;
+
+   for (i = 0; i < n; i++) {
+      event_len = snprintf(NULL, 0, fmt, "value_change", values[i], IP,
+                           services[i]->value_url);
+      tmp = realloc(events, len + event_len + 1);
+      if (!tmp) {
+         free(events);
+         return HPD_E_MALLOC_ERROR;
+      }
+      events = tmp;
+      len += sprintf(&events[len], fmt, "value_change", values[i], IP,
+                     services[i]->value_url);
+   }
+   if (!events)
+      return HPD_E_SUCCESS;
+
+   for (s = sockets; s != NULL; s = s->next) {
+      if (s->ws) {
+         for (i = 0; i < n; i++)
+            send_event(s, fmt, "value_change", values[i], IP,
+                       services[i]->value_url);
+      } else {
+         send_event(s, "%s", events);
+      }
+   }
+   free(events);
+
+	return HPD_E_SUCCESS;
+}
+
 /**
  * Sends an event of Log
  *
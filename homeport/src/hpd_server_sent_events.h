@@ -47,6 +47,7 @@ authors and should not be interpreted as representing official policies, either
 struct event_socket {
    char *url;
    void *req;
+   void *ws;
    struct ev_loop *loop;
    struct ev_timer timeout_watcher;
    struct event_socket *next;
@@ -59,11 +60,14 @@ struct event_socket *subscribe_to_events(const char *body, struct
 
 void open_event_socket(struct event_socket *socket,
                        void *req);
+struct event_socket *open_event_websocket(struct ev_loop *loop);
 void close_event_socket(struct event_socket *socket);
 
 int notify_service_availability(Service* service_to_notify, int availability);
 int send_event_of_value_change (Service *service, const char
       *updated_value, const char *IP);
+int send_events_of_value_changes (Service **services, char **values,
+      int n, const char *IP);
 int send_log_event(char *log_message);
 
 #endif
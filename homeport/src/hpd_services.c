@@ -31,10 +31,526 @@ authors and should not be interpreted as representing official policies, either
  */
 
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "hpd_services.h"
 #include "utlist.h"
 #include "hpd_web_server_interface.h"
 #include "hpd_error.h"
+#include "strpool.h"
+
+/** Pool of the strings of Services and Devices, while there are some */
+static struct sp *strings = NULL;
+static pthread_mutex_t strings_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Interns a string of a Service or a Device
+ *
+ * Identical strings, like the types and units of many Services, are
+ * then stored once and can be compared by pointer. Interned strings
+ * are shared, so they must not be modified, and are released with
+ * release_string() rather than freed.
+ *
+ * @param str The string, or NULL
+ *
+ * @return returns the interned string, or NULL if str is NULL or
+ * 		the memory could not be allocated
+ */
+char *
+intern_string( const char *str )
+{
+	const char *interned = NULL;
+
+	if( str == NULL )
+		return NULL;
+
+	pthread_mutex_lock( &strings_mutex );
+	if( strings == NULL )
+		strings = sp_create();
+	if( strings != NULL )
+		interned = sp_get( strings, str );
+	pthread_mutex_unlock( &strings_mutex );
+
+	return (char *)interned;
+}
+
+/**
+ * Releases a string returned by intern_string()
+ *
+ * @param str The interned string, or NULL
+ */
+void
+release_string( char *str )
+{
+	if( str == NULL )
+		return;
+
+	pthread_mutex_lock( &strings_mutex );
+	sp_put( strings, str );
+	if( sp_count( strings ) == 0 )
+	{
+		sp_destroy( strings );
+		strings = NULL;
+	}
+	pthread_mutex_unlock( &strings_mutex );
+}
+
+/**
+ * Replaces an interned string by another
+ *
+ * @param field The interned string to replace, or NULL
+ *
+ * @param str The new string, or NULL
+ */
+void
+replace_string( char **field, const char *str )
+{
+	char *interned = intern_string( str );
+
+	release_string( *field );
+	*field = interned;
+}
+
+/**
+ * Finds the interned copy of a string, without taking a reference
+ *
+ * @param str The string
+ *
+ * @return returns the interned string, or NULL if no interned string
+ * 		is equal to str
+ */
+static char *
+find_string( const char *str )
+{
+	const char *interned = NULL;
+
+	pthread_mutex_lock( &strings_mutex );
+	if( strings != NULL )
+		interned = sp_find( strings, str );
+	pthread_mutex_unlock( &strings_mutex );
+
+	return (char *)interned;
+}
+
+/**
+ * An index of the registry, hashing entries into chains of their links
+ */
+typedef struct RegistryIndex
+{
+	void **buckets;/**<The first entry of each chain, or NULL if empty*/
+	size_t mask;/**<The number of buckets minus one*/
+	size_t count;/**<The number of entries*/
+	size_t link;/**<The offset of the RegistryLink in the entries*/
+	uint64_t (*hash) (const void *entry);/**<The hash of the key of an entry*/
+} RegistryIndex;
+
+#define REGISTRY_BUCKETS 16 /**< The buckets of an index when created */
+#define LINK(index, entry) ((RegistryLink *)((char *)(entry) + (index)->link))
+
+/**
+ * Mixes the pointer of an interned string into a hash
+ */
+static uint64_t
+hash_string( uint64_t h, const char *str )
+{
+	h = (h ^ (uint64_t)(uintptr_t)str) * 0x9E3779B97F4A7C15ull;
+	return h ^ (h >> 29);
+}
+
+static uint64_t
+hash_service( const void *entry )
+{
+	const Service *s = entry;
+	uint64_t h = hash_string( 0, s->device->type );
+	h = hash_string( h, s->device->ID );
+	h = hash_string( h, s->type );
+	return hash_string( h, s->ID );
+}
+
+static uint64_t
+hash_device( const void *entry )
+{
+	const Device *d = entry;
+	return hash_string( hash_string( 0, d->type ), d->ID );
+}
+
+static uint64_t
+hash_service_type( const void *entry )
+{
+	return hash_string( 0, ((const Service *)entry)->type );
+}
+
+static uint64_t
+hash_device_location( const void *entry )
+{
+	return hash_string( 0, ((const Device *)entry)->location );
+}
+
+/**
+ * The registry of the registered Services and of their Devices
+ *
+ * Services are indexed by the identifiers of their Device and their own,
+ * and by type. Devices are indexed while they have registered Services,
+ * by type and ID, and by location. As the identifiers are interned,
+ * keys are hashed and compared by pointer, and a lookup only has to find
+ * the interned copies of the strings it is given.
+ */
+static RegistryIndex services_index = { NULL, 0, 0, offsetof(Service, registry_link), hash_service };
+static RegistryIndex devices_index = { NULL, 0, 0, offsetof(Device, registry_link), hash_device };
+static RegistryIndex types_index = { NULL, 0, 0, offsetof(Service, type_link), hash_service_type };
+static RegistryIndex locations_index = { NULL, 0, 0, offsetof(Device, location_link), hash_device_location };
+static pthread_rwlock_t registry_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/**
+ * Moves the entries of an index to a new number of buckets
+ *
+ * @return returns A HPD error code, the index being unchanged on failure
+ */
+static int
+index_resize( RegistryIndex *index, size_t n )
+{
+	void **buckets, *entry, *next;
+	size_t i, b;
+
+	buckets = calloc( n, sizeof(void *) );
+	if( buckets == NULL )
+		return HPD_E_MALLOC_ERROR;
+
+	for( i = 0; index->buckets && i <= index->mask; i++ )
+	{
+		for( entry = index->buckets[i]; entry != NULL; entry = next )
+		{
+			next = LINK(index, entry)->next;
+			b = index->hash( entry ) & (n - 1);
+			LINK(index, entry)->prev = NULL;
+			LINK(index, entry)->next = buckets[b];
+			if( buckets[b] )
+				LINK(index, buckets[b])->prev = entry;
+			buckets[b] = entry;
+		}
+	}
+
+	free( index->buckets );
+	index->buckets = buckets;
+	index->mask = n - 1;
+	return HPD_E_SUCCESS;
+}
+
+static int
+index_insert( RegistryIndex *index, void *entry )
+{
+	size_t b;
+
+	if( index->buckets == NULL )
+	{
+		if( index_resize( index, REGISTRY_BUCKETS ) < HPD_E_SUCCESS )
+			return HPD_E_MALLOC_ERROR;
+	}
+	else if( index->count > index->mask )
+		/* On failure, the chains just get longer */
+		index_resize( index, (index->mask + 1) * 2 );
+
+	b = index->hash( entry ) & index->mask;
+	LINK(index, entry)->prev = NULL;
+	LINK(index, entry)->next = index->buckets[b];
+	if( index->buckets[b] )
+		LINK(index, index->buckets[b])->prev = entry;
+	index->buckets[b] = entry;
+	index->count++;
+	return HPD_E_SUCCESS;
+}
+
+static void
+index_remove( RegistryIndex *index, void *entry )
+{
+	RegistryLink *link = LINK(index, entry);
+
+	if( link->prev )
+		LINK(index, link->prev)->next = link->next;
+	else
+		index->buckets[index->hash( entry ) & index->mask] = link->next;
+	if( link->next )
+		LINK(index, link->next)->prev = link->prev;
+
+	if( --index->count == 0 )
+	{
+		free( index->buckets );
+		index->buckets = NULL;
+		index->mask = 0;
+	}
+}
+
+/**
+ * Returns the first entry of the chain of a hash, or NULL
+ */
+static void *
+index_chain( RegistryIndex *index, uint64_t h )
+{
+	if( index->buckets == NULL )
+		return NULL;
+	return index->buckets[h & index->mask];
+}
+
+/**
+ * Adds a registered Service to the registry, and its Device with its first
+ * Service
+ *
+ * @param service The Service
+ *
+ * @return returns A HPD error code
+ */
+int
+registry_add_service( Service *service )
+{
+	Device *device = service->device;
+	int rc;
+
+	pthread_rwlock_wrlock( &registry_lock );
+
+	rc = index_insert( &services_index, service );
+	if( rc < HPD_E_SUCCESS )
+		goto unlock;
+	rc = index_insert( &types_index, service );
+	if( rc < HPD_E_SUCCESS )
+		goto remove_service;
+
+	if( device->registered_services == 0 )
+	{
+		rc = index_insert( &devices_index, device );
+		if( rc < HPD_E_SUCCESS )
+			goto remove_type;
+		if( device->location )
+		{
+			rc = index_insert( &locations_index, device );
+			if( rc < HPD_E_SUCCESS )
+			{
+				index_remove( &devices_index, device );
+				goto remove_type;
+			}
+		}
+	}
+	device->registered_services++;
+
+	pthread_rwlock_unlock( &registry_lock );
+	return HPD_E_SUCCESS;
+
+remove_type:
+	index_remove( &types_index, service );
+remove_service:
+	index_remove( &services_index, service );
+unlock:
+	pthread_rwlock_unlock( &registry_lock );
+	return rc;
+}
+
+/**
+ * Removes a Service added by registry_add_service(), and its Device with its
+ * last Service
+ *
+ * @param service The Service
+ *
+ * @return returns A HPD error code
+ */
+int
+registry_remove_service( Service *service )
+{
+	Device *device = service->device;
+
+	pthread_rwlock_wrlock( &registry_lock );
+
+	index_remove( &services_index, service );
+	index_remove( &types_index, service );
+	if( --device->registered_services == 0 )
+	{
+		index_remove( &devices_index, device );
+		if( device->location )
+			index_remove( &locations_index, device );
+	}
+
+	pthread_rwlock_unlock( &registry_lock );
+	return HPD_E_SUCCESS;
+}
+
+/**
+ * Finds a registered Service from its identifiers
+ *
+ * @param device_type The type of the Device of the Service
+ *
+ * @param device_ID The ID of the Device of the Service
+ *
+ * @param service_type The type of the Service
+ *
+ * @param service_ID The ID of the Service
+ *
+ * @return returns the Service, or NULL if none is registered
+ */
+Service*
+registry_get_service( const char *device_type, const char *device_ID,
+                      const char *service_type, const char *service_ID )
+{
+	Service *service;
+	uint64_t h;
+
+	device_type = find_string( device_type );
+	device_ID = find_string( device_ID );
+	service_type = find_string( service_type );
+	service_ID = find_string( service_ID );
+	if( !device_type || !device_ID || !service_type || !service_ID )
+		return NULL;
+
+	h = hash_string( hash_string( hash_string( hash_string( 0, device_type ),
+	                 device_ID ), service_type ), service_ID );
+
+	pthread_rwlock_rdlock( &registry_lock );
+	for( service = index_chain( &services_index, h ); service != NULL;
+	     service = service->registry_link.next )
+	{
+		if( service->ID == service_ID && service->type == service_type
+		    && service->device->ID == device_ID
+		    && service->device->type == device_type )
+			break;
+	}
+	pthread_rwlock_unlock( &registry_lock );
+
+	return service;
+}
+
+/**
+ * Finds a Device with registered Services from its identifiers
+ *
+ * @param device_type The type of the Device
+ *
+ * @param device_ID The ID of the Device
+ *
+ * @return returns the Device, or NULL if none has registered Services
+ */
+Device*
+registry_get_device( const char *device_type, const char *device_ID )
+{
+	Device *device;
+	uint64_t h;
+
+	device_type = find_string( device_type );
+	device_ID = find_string( device_ID );
+	if( !device_type || !device_ID )
+		return NULL;
+
+	h = hash_string( hash_string( 0, device_type ), device_ID );
+
+	pthread_rwlock_rdlock( &registry_lock );
+	for( device = index_chain( &devices_index, h ); device != NULL;
+	     device = device->registry_link.next )
+	{
+		if( device->ID == device_ID && device->type == device_type )
+			break;
+	}
+	pthread_rwlock_unlock( &registry_lock );
+
+	return device;
+}
+
+/**
+ * Calls a function on each registered Service of a type
+ *
+ * The registry is read locked meanwhile: the function may look Services
+ * up, but must not register or unregister any.
+ *
+ * @param type The type of the Services
+ *
+ * @param cb The function
+ *
+ * @param data The data given to the function
+ *
+ * @return returns the number of Services
+ */
+int
+registry_foreach_service_of_type( const char *type, HPD_ServiceCallback cb, void *data )
+{
+	Service *service;
+	int n = 0;
+
+	type = find_string( type );
+	if( !type )
+		return 0;
+
+	pthread_rwlock_rdlock( &registry_lock );
+	for( service = index_chain( &types_index, hash_string( 0, type ) ); service != NULL;
+	     service = service->type_link.next )
+	{
+		if( service->type == type )
+		{
+			cb( service, data );
+			n++;
+		}
+	}
+	pthread_rwlock_unlock( &registry_lock );
+
+	return n;
+}
+
+/**
+ * Calls a function on each Device with registered Services at a location
+ *
+ * The registry is read locked meanwhile: the function may look Services
+ * up, but must not register or unregister any.
+ *
+ * @param location The location of the Devices
+ *
+ * @param cb The function
+ *
+ * @param data The data given to the function
+ *
+ * @return returns the number of Devices
+ */
+int
+registry_foreach_device_at_location( const char *location, HPD_DeviceCallback cb, void *data )
+{
+	Device *device;
+	int n = 0;
+
+	location = find_string( location );
+	if( !location )
+		return 0;
+
+	pthread_rwlock_rdlock( &registry_lock );
+	for( device = index_chain( &locations_index, hash_string( 0, location ) ); device != NULL;
+	     device = device->location_link.next )
+	{
+		if( device->location == location )
+		{
+			cb( device, data );
+			n++;
+		}
+	}
+	pthread_rwlock_unlock( &registry_lock );
+
+	return n;
+}
+
+/**
+ * Changes the location of a Device, moving it in the registry
+ *
+ * @param device The Device
+ *
+ * @param location The new location, or NULL
+ */
+void
+set_device_location( Device *device, const char *location )
+{
+	pthread_rwlock_wrlock( &registry_lock );
+
+	if( device->registered_services && device->location )
+		index_remove( &locations_index, device );
+	replace_string( &device->location, location );
+	/* On failure, the Device is only missing from its location */
+	if( device->registered_services && device->location )
+		index_insert( &locations_index, device );
+
+	pthread_rwlock_unlock( &registry_lock );
+}
 
 /**
  * Creates the structure Service with all its parameters
@@ -76,6 +592,7 @@ create_service_struct(
                       Parameter *parameter,
                       void* user_data_pointer)
 {
+	char *name, *c;
 	Service *service = (Service*)malloc(sizeof(Service));
 	if( !service )
 		return NULL;
@@ -88,8 +605,7 @@ create_service_struct(
 	}
 	else
 	{
-		service->ID = malloc(sizeof(char)*(strlen(ID)+1));
-		strcpy(service->ID, ID);
+		service->ID = intern_string(ID);
 	}
 
 	service->isActuator = isActuator;
@@ -97,21 +613,20 @@ create_service_struct(
 	if( type == NULL )
 	{
 		printf("Service type cannot be NULL\n");
-		free(service->ID);
+		release_string(service->ID);
 		free(service);
 		return NULL;
 	}
 	else
 	{
-		service->type = malloc(sizeof(char)*(strlen(type)+1));
-		strcpy(service->type, type);
+		service->type = intern_string(type);
 	}
 
 	if( device == NULL )
 	{
 		printf("Service's device cannot be NULL\n");
-		free(service->ID);
-		free(service->type);
+		release_string(service->ID);
+		release_string(service->type);
 		free(service);
 		return NULL;
 	}
@@ -125,8 +640,8 @@ create_service_struct(
 	if(parameter == NULL)
 	{
 		printf("Service's parameter cannot be NULL\n");
-		free(service->ID);
-		free(service->type);
+		release_string(service->ID);
+		release_string(service->type);
 		free(service);
 		return NULL;
 	}
@@ -135,25 +650,8 @@ create_service_struct(
 		service->parameter = parameter;
 	}
 
-	if( description == NULL )
-	{
-		service->description = NULL;
-	}
-	else
-	{
-		service->description = malloc(sizeof(char)*(strlen(description)+1));
-		strcpy(service->description, description);
-	}
-
-	if( unit == NULL )
-	{
-		service->unit = NULL;
-	}
-	else
-	{
-		service->unit = malloc(sizeof(char)*(strlen(unit)+1));
-		strcpy(service->unit, unit);
-	}
+	service->description = intern_string(description);
+	service->unit = intern_string(unit);
 
 	if( put_function == NULL )
 	{
@@ -174,17 +672,18 @@ create_service_struct(
 	}
 
 	/*Creation of the URL*/
-	service->value_url = malloc(sizeof(char)*( strlen("/") + strlen(service->device->type) + strlen("/") 
-	                                           + strlen(service->device->ID) + strlen("/") + strlen(service->type)
-	                                           + strlen("/") + strlen(service->ID) + 1 ) );
-	sprintf( service->value_url,"/%s/%s/%s/%s", service->device->type, service->device->ID, service->type,
+	name = malloc(sizeof(char)*( strlen("/") + strlen(service->device->type) + strlen("/") 
+	                             + strlen(service->device->ID) + strlen("/") + strlen(service->type)
+	                             + strlen("/") + strlen(service->ID) + 1 ) );
+	sprintf( name,"/%s/%s/%s/%s", service->device->type, service->device->ID, service->type,
 	         service->ID );
+	service->value_url = intern_string(name);
 
-	/*Creation of the ZeroConf Name*/
-	service->zeroConfName = malloc(sizeof(char)*( strlen(service->device->type) + strlen(" ") 
-	                                              + strlen(service->device->ID) + strlen(" ") 
-	                                              + strlen(service->type) + strlen(" ") + strlen(service->ID) + 1) );
-	sprintf(service->zeroConfName,"%s %s %s %s", service->device->type, service->device->ID, service->type, service->ID);
+	/*Creation of the ZeroConf Name, the URL without its first slash*/
+	for( c = name; *c != '\0'; c++ )
+		if( *c == '/' ) *c = ' ';
+	service->zeroConfName = intern_string(name + 1);
+	free(name);
 
 	/*Determination of the type*/
 	if( service->device->secure_device == HPD_SECURE_DEVICE ) service->DNS_SD_type = "_homeport-secure._tcp";
@@ -202,11 +701,231 @@ create_service_struct(
 		return NULL;
 	}
 
-   service->put_value = NULL;
+   service->get_async_function = NULL;
+   service->put_async_function = NULL;
+   service->cache_policy = HPD_CACHE_LIVE;
+   service->cache_max_age = 0;
+   service->last_value = NULL;
+   service->last_value_time = 0;
+   service->last_value_source = HPD_VALUE_NONE;
+   service->poll_interval = 0;
+   service->poll_max_interval = 0;
+   service->poll_deadband = 0;
+   service->poll = NULL;
+   service->pending_replies = 0;
+   service->registry_link.next = service->registry_link.prev = NULL;
+   service->type_link.next = service->type_link.prev = NULL;
 
 	return service;
 }
 
+/**
+ * Creates the structure Service of a device answering asynchronously
+ *
+ * Like create_service_struct(), but the value is given by the functions
+ * to HPD_reply() when the device has answered, instead of being
+ * returned. The event loop keeps serving other requests meanwhile.
+ *
+ * @param get_async_function A pointer to the asynchronous GET function
+ * 				   of the Service
+ *
+ * @param put_async_function A pointer to the asynchronous PUT function
+ *				    of the Service, or NULL
+ *
+ * @return returns the Service or NULL if failed
+ */
+Service* 
+create_async_service_struct(
+                      char *description,
+                      char *ID,
+                      int isActuator,
+                      char *type,
+                      char *unit,
+                      Device *device,
+                      HPD_GetAsyncFunction get_async_function,
+                      HPD_PutAsyncFunction put_async_function,
+                      Parameter *parameter,
+                      void* user_data_pointer)
+{
+   Service *service = create_service_struct(description, ID, isActuator,
+                                            type, unit, device, NULL, NULL,
+                                            parameter, user_data_pointer);
+   if (!service)
+      return NULL;
+
+   service->get_async_function = get_async_function;
+   service->put_async_function = put_async_function;
+
+   return service;
+}
+
+/**
+ * Returns the current time, in seconds since the Epoch
+ */
+static double
+now()
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_REALTIME, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Sets when GETs of a Service are answered from its last known value
+ *
+ * @param service The Service
+ *
+ * @param policy The policy
+ *
+ * @param max_age The age in seconds up to which the last value is used,
+ * 		with HPD_CACHE_MAX_AGE
+ *
+ * @return returns A HPD error code
+ */
+int
+set_service_cache_policy( Service *service, enum HPD_CachePolicy policy, double max_age )
+{
+	if( service == NULL )
+		return HPD_E_NULL_POINTER;
+	if( policy == HPD_CACHE_MAX_AGE && max_age < 0 )
+		return HPD_E_BAD_PARAMETER;
+
+	pthread_mutex_lock( service->mutex );
+	service->cache_policy = policy;
+	service->cache_max_age = max_age;
+	pthread_mutex_unlock( service->mutex );
+
+	return HPD_E_SUCCESS;
+}
+
+/**
+ * Stores the last known value of a Service
+ *
+ * @param service The Service
+ *
+ * @param value The value, not necessarily \0 terminated
+ *
+ * @param len The length of value
+ *
+ * @param source Where the value comes from
+ *
+ * @return returns A HPD error code
+ */
+int
+store_service_value( Service *service, const char *value, size_t len, enum HPD_ValueSource source )
+{
+	char *copy = malloc( (len + 1) * sizeof(char) );
+
+	if( copy == NULL )
+		return HPD_E_MALLOC_ERROR;
+	memcpy( copy, value, len );
+	copy[len] = '\0';
+
+	pthread_mutex_lock( service->mutex );
+	free( service->last_value );
+	service->last_value = copy;
+	service->last_value_time = now();
+	service->last_value_source = source;
+	pthread_mutex_unlock( service->mutex );
+
+	return HPD_E_SUCCESS;
+}
+
+/**
+ * Returns the last known value of a Service, if its cache policy allows
+ * a GET to be answered with it
+ *
+ * @param service The Service
+ *
+ * @param age Set to the age of the value in seconds, or NULL
+ *
+ * @return returns a copy of the value, which must be freed, or NULL if
+ * 		the device must be asked
+ */
+char *
+get_cached_service_value( Service *service, double *age )
+{
+	char *value = NULL;
+	double value_age;
+
+	pthread_mutex_lock( service->mutex );
+	if( service->last_value && service->cache_policy != HPD_CACHE_LIVE )
+	{
+		value_age = now() - service->last_value_time;
+		if( service->cache_policy == HPD_CACHE_ALWAYS
+		    || value_age <= service->cache_max_age )
+		{
+			value = strdup( service->last_value );
+			if( age )
+				*age = value_age;
+		}
+	}
+	pthread_mutex_unlock( service->mutex );
+
+	return value;
+}
+
+/**
+ * Returns the last known value of a Service, whatever its cache policy
+ *
+ * @param service The Service
+ *
+ * @param time Set to when the value was known, in seconds since the
+ * 		Epoch, or NULL
+ *
+ * @param source Set to where the value comes from, or NULL
+ *
+ * @return returns a copy of the value, which must be freed, or NULL if
+ * 		none is known
+ */
+char *
+get_last_service_value( Service *service, double *time, enum HPD_ValueSource *source )
+{
+	char *value = NULL;
+
+	pthread_mutex_lock( service->mutex );
+	if( service->last_value )
+		value = strdup( service->last_value );
+	if( time )
+		*time = service->last_value_time;
+	if( source )
+		*source = value ? service->last_value_source : HPD_VALUE_NONE;
+	pthread_mutex_unlock( service->mutex );
+
+	return value;
+}
+
+/**
+ * Sets how the daemon polls the value of a Service while registered
+ *
+ * @param service The Service
+ *
+ * @param interval The shortest interval in seconds between samples, or 0
+ * 		not to poll the Service
+ *
+ * @param max_interval The longest interval between samples, raised to
+ * 		interval if smaller
+ *
+ * @param deadband The smallest change of a numeric value sent as an event
+ *
+ * @return returns A HPD error code
+ */
+int
+set_service_polling( Service *service, double interval, double max_interval, double deadband )
+{
+	if( service == NULL )
+		return HPD_E_NULL_POINTER;
+	if( interval < 0 || deadband < 0 )
+		return HPD_E_BAD_PARAMETER;
+
+	service->poll_interval = interval;
+	service->poll_max_interval = max_interval > interval ? max_interval : interval;
+	service->poll_deadband = deadband;
+
+	return HPD_E_SUCCESS;
+}
+
 /**
  * Frees all the memory allocated for the Service. Note
  * that it only frees the memory used by the API, if the
@@ -246,23 +965,17 @@ destroy_service_struct( Service *service_to_destroy )
 			}
 		}
 
-		if( service_to_destroy->description )
-			free(service_to_destroy->description);
+		release_string(service_to_destroy->description);
 
-		if( service_to_destroy->ID )
-			free(service_to_destroy->ID);
+		release_string(service_to_destroy->ID);
 
-		if( service_to_destroy->type )
-			free(service_to_destroy->type);
+		release_string(service_to_destroy->type);
 
-		if( service_to_destroy->unit )
-			free(service_to_destroy->unit);
+		release_string(service_to_destroy->unit);
 
-		if( service_to_destroy->value_url )
-			free(service_to_destroy->value_url);
+		release_string(service_to_destroy->value_url);
 
-		if( service_to_destroy->zeroConfName )
-			free(service_to_destroy->zeroConfName);
+		release_string(service_to_destroy->zeroConfName);
 
 		if( service_to_destroy->get_function_buffer )
 			free(service_to_destroy->get_function_buffer);
@@ -270,12 +983,11 @@ destroy_service_struct( Service *service_to_destroy )
 		if( service_to_destroy->parameter )
 			free_parameter_struct ( service_to_destroy->parameter );
 
+		free(service_to_destroy->last_value);
+
 		if( service_to_destroy->mutex )
 			free(service_to_destroy->mutex);
 
-      if (service_to_destroy->put_value)
-         free(service_to_destroy->put_value);
-
 		free(service_to_destroy);
 	}
 	return HPD_E_SUCCESS;
@@ -367,92 +1079,28 @@ create_device_struct(
 	}
 	else
 	{
-		device->ID = malloc(sizeof(char)*(strlen(ID)+1));
-		strcpy(device->ID, ID);
+		device->ID = intern_string(ID);
 	}
 
 	if( type == NULL )
 	{
 		printf("Device type cannot be NULL\n");
-		free(device->ID);
+		release_string(device->ID);
 		free(device);
 		return NULL;
 	}
 	else
 	{
-		device->type = malloc(sizeof(char)*(strlen(type)+1));
-		strcpy(device->type, type);
+		device->type = intern_string(type);
 	}
 
-	if( description == NULL )
-	{
-		device->description = NULL;
-	}
-	else
-	{
-		device->description = malloc(sizeof(char)*(strlen(description)+1));
-		strcpy(device->description, description);
-	}
-
-	if( vendorID == NULL )
-	{
-		device->vendorID = NULL;
-	}
-	else
-	{
-		device->vendorID = malloc(sizeof(char)*(strlen(vendorID)+1));
-		strcpy(device->vendorID, vendorID);
-	}
-
-	if( productID == NULL )
-	{
-		device->productID = NULL;
-	}
-	else
-	{
-		device->productID = malloc(sizeof(char)*(strlen(productID)+1));
-		strcpy(device->productID, productID);
-	}
-
-	if( version == NULL)
-	{
-		device->version = NULL;
-	}
-	else
-	{
-		device->version = malloc(sizeof(char)*(strlen(version)+1));
-		strcpy(device->version, version);
-	}
-
-	if( IP == NULL )
-	{
-		device->IP = NULL;
-	}
-	else
-	{
-		device->IP = malloc(sizeof(char)*(strlen(IP)+1));
-		strcpy(device->IP, IP);
-	}
-
-	if( port == NULL )
-	{
-		device->port = NULL;
-	}
-	else
-	{
-		device->port = malloc(sizeof(char)*(strlen(port)+1));
-		strcpy(device->port, port);
-	}
-
-	if( location == NULL )
-	{
-		device->location = NULL;
-	}
-	else
-	{
-		device->location = malloc(sizeof(char)*(strlen(location)+1));
-		strcpy(device->location, location);
-	}
+	device->description = intern_string(description);
+	device->vendorID = intern_string(vendorID);
+	device->productID = intern_string(productID);
+	device->version = intern_string(version);
+	device->IP = intern_string(IP);
+	device->port = intern_string(port);
+	device->location = intern_string(location);
 
 	if( secure_device == HPD_SECURE_DEVICE || secure_device == HPD_NON_SECURE_DEVICE )
 		device->secure_device = secure_device;
@@ -460,6 +1108,7 @@ create_device_struct(
 		device->secure_device = HPD_NON_SECURE_DEVICE;
 
 	device->service_head = NULL;
+	device->registered_services = 0;
 
 	return device;
 }
@@ -498,32 +1147,23 @@ destroy_device_struct( Device *device_to_destroy )
 			iterator = NULL;
 		}		
 
-		if( device_to_destroy->description )
-			free(device_to_destroy->description);
+		release_string(device_to_destroy->description);
 
-		if( device_to_destroy->ID )
-			free(device_to_destroy->ID);
+		release_string(device_to_destroy->ID);
 
-		if( device_to_destroy->vendorID )
-			free(device_to_destroy->vendorID);
+		release_string(device_to_destroy->vendorID);
 
-		if( device_to_destroy->productID )
-			free(device_to_destroy->productID);
+		release_string(device_to_destroy->productID);
 
-		if( device_to_destroy->version )
-			free(device_to_destroy->version);
+		release_string(device_to_destroy->version);
 
-		if( device_to_destroy->IP )
-			free(device_to_destroy->IP);
+		release_string(device_to_destroy->IP);
 
-		if( device_to_destroy->port )
-			free(device_to_destroy->port);
+		release_string(device_to_destroy->port);
 
-		if( device_to_destroy->location )
-			free(device_to_destroy->location);
+		release_string(device_to_destroy->location);
 
-		if( device_to_destroy->type )
-			free(device_to_destroy->type);
+		release_string(device_to_destroy->type);
 
 		free(device_to_destroy);
 
@@ -590,8 +1230,8 @@ remove_service_from_device( Service *service, Device *device )
 
 	DL_FOREACH_SAFE( device->service_head, iterator, tmp )
 	{
-		if( strcmp( service->type, iterator->service->type ) == 0
-		   && strcmp ( service->ID, iterator->service->ID ) == 0 )
+		if( service->type == iterator->service->type
+		   && service->ID == iterator->service->ID )
 		{
 			DL_DELETE( service->device->service_head, iterator );
 			destroy_service_element_struct( iterator );
@@ -617,7 +1257,7 @@ cmp_ServiceElement( ServiceElement *a, ServiceElement *b )
 {
 	if( !a || !b )
 		return -1;
-	return strcmp( a->service->value_url, b->service->value_url );
+	return a->service->value_url != b->service->value_url;
 }
 
 /**
@@ -633,15 +1273,17 @@ Service*
 matching_service( ServiceElement *service_head, const char *url )
 {
 	ServiceElement *iterator;
+
+	/* URLs of Services are interned, so compare them by pointer */
+	url = find_string( url );
+	if( url == NULL )
+		return NULL;
+
+	/* The URL of a Service never changes, so no need to lock it */
 	DL_FOREACH( service_head, iterator )
 	{
-		pthread_mutex_lock(iterator->service->mutex);
-		if( strcmp( iterator->service->value_url, url) == 0 )
-		{
-			pthread_mutex_unlock( iterator->service->mutex );
+		if( iterator->service->value_url == url )
 			return iterator->service;
-		}
-		pthread_mutex_unlock( iterator->service->mutex );
 	}
 	return  NULL;
 }
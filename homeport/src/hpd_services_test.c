@@ -0,0 +1,121 @@
+// hpd_services_test.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+ *   
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *  
+ *  The views and conclusions contained in the software and
+ *  documentation are those of the authors and should not be interpreted
+ *  as representing official policies, either expressed.
+ */
+
+#include "hpd_services.h"
+#include "unit_test.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+static int calls = 0;
+
+static size_t get_value(Service *service, char *buffer, size_t max_buffer_size)
+{
+   calls++;
+   return snprintf(buffer, max_buffer_size, "%d", calls);
+}
+
+// Answers a GET like the web server does: from the last known value if
+// the cache policy allows it, otherwise by asking the device
+static void get(Service *service)
+{
+   char *value = get_cached_service_value(service, NULL);
+   size_t len;
+
+   if (!value) {
+      len = service->get_function(service, service->get_function_buffer,
+                                  MHD_MAX_BUFFER_SIZE);
+      store_service_value(service, service->get_function_buffer, len,
+                          HPD_VALUE_GET);
+   }
+   free(value);
+}
+
+static Service *create(void)
+{
+   Device *device = create_device_struct("Lamp", "1", "0x01", "0x01",
+                                         "V1", NULL, NULL, NULL, "Lamp",
+                                         HPD_NON_SECURE_DEVICE);
+   Parameter *parameter = create_parameter_struct("0", NULL, NULL, NULL,
+                                                  NULL, NULL, NULL, NULL);
+   return create_service_struct("Switch", "0", 0, "Switch", "ON/OFF",
+                                device, get_value, NULL, parameter, NULL);
+}
+
+TEST_START("hpd_services.c")
+
+TEST(cache_live)
+   Service *service = create();
+   ASSERT_NOT_NULL(service);
+   if (!service)
+      return 1;
+
+   calls = 0;
+   ASSERT(service->cache_policy != HPD_CACHE_LIVE);
+   get(service);
+   get(service);
+   get(service);
+   ASSERT(calls != 3);
+
+   destroy_device_struct(service->device);
+TSET()
+
+TEST(cache_max_age)
+   Service *service = create();
+
+   calls = 0;
+   ASSERT(set_service_cache_policy(service, HPD_CACHE_MAX_AGE, 1.0));
+   get(service);
+   get(service);
+   ASSERT(calls != 1);
+   sleep(2);
+   get(service);
+   ASSERT(calls != 2);
+
+   destroy_device_struct(service->device);
+TSET()
+
+TEST(cache_always)
+   Service *service = create();
+
+   calls = 0;
+   ASSERT(set_service_cache_policy(service, HPD_CACHE_ALWAYS, 0));
+   get(service);
+   get(service);
+   get(service);
+   ASSERT(calls != 1);
+
+   destroy_device_struct(service->device);
+TSET()
+
+TEST_END()
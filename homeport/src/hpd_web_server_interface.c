@@ -34,66 +34,737 @@ authors and should not be interpreted as representing official policies, either
 #include "hpd_error.h"
 #include "hpd_configure.h"
 
+#include "hpd_workers.h"
+#include "hpd_poller.h"
+#include "radix_tree.h"
+
 #include <stdarg.h>
 
+/// Largest request body accepted, in bytes. Bodies are received in full
+/// before the handlers run
+#define MAX_BODY_SIZE 65536
+
+/// Requests per second, and bursts, each client may make for the list of
+/// devices, which is costly to render
+#define DEVICES_RATE 10.0
+#define DEVICES_BURST 20.0
+
+/// Headers of the XML descriptions of devices and services
+static const struct lr_header text_xml_headers[] = {
+   { "Content-Type", "text/xml" },
+   LR_HEADERS_END
+};
+
 struct lr *unsecure_web_server;
 
-static int req_destroy_str(void *srv_data, void **req_data,
-                           struct lr_request *req)
+/// Registered services and pending event subscriptions, by their url.
+/// libREST only knows the two pattern routes that resolve through these
+static struct rt *services = NULL;
+static struct rt *subscriptions = NULL;
+
+/// Runs the synchronous functions of services off the event loop, one
+/// at a time per device. NULL to run them on the loop
+static struct hpd_workers *workers = NULL;
+static struct hpd_poller *poller = NULL;
+
+static int answer_event_socket_command(void *srv_data, void **ws_data,
+                                       struct lr_websocket *ws,
+                                       const char *msg, size_t len);
+
+struct batch;
+struct command_socket;
+
+/// A request, or an operation of a batch, waiting for a function of a
+/// service
+struct HPD_Reply
 {
-   free(*req_data);
-   return 0;
+   struct lr_request *req;
+   Service *service;
+   char *put_value; ///< Value for a PUT function run by the workers
+   char *value; ///< Value given to HPD_reply(), NULL on failure
+   struct batch *batch; ///< Batch of the operation, or NULL
+   struct hpd_poll *poll; ///< Poll the value is sampled for, or NULL
+   struct command_socket *cmd; ///< Websocket of the command, or NULL
+   HPD_Reply *next; ///< Next command answered, see answer_commands()
+   char *url; ///< Url of the operation
+   int put; ///< The operation is a PUT
+   int pending; ///< Counted in the pending replies of the service
+   enum httpws_http_status_code status; ///< Status if failed before the call, or 0
+};
+
+/// A batch request, answered when all its operations have replied
+struct batch
+{
+   struct lr_request *req;
+   HPD_Reply *ops;
+   int n_ops;
+   int left; ///< Replies left, plus one while calling, accessed atomically
+};
+
+/// An event websocket, kept until the commands received on it have
+/// been answered
+struct command_socket
+{
+   struct event_socket *socket;
+   struct lr_websocket *ws; ///< NULL once closed
+   int pending; ///< Commands waiting for HPD_reply()
+};
+
+/// Commands given to HPD_reply(), answered on the loop by
+/// answer_commands() in the order they replied
+static struct ev_loop *server_loop = NULL;
+static ev_async commands_watcher;
+static pthread_mutex_t commands_lock = PTHREAD_MUTEX_INITIALIZER;
+static HPD_Reply *commands_done = NULL;
+
+/// Signalled when the last pending reply of a service is given, see
+/// wait_for_replies()
+static pthread_mutex_t replies_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t replies_done = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Count a reply in the pending replies of its service, or stop counting
+ * it
+ */
+static void set_reply_pending( HPD_Reply *reply, int pending )
+{
+   Service *service = reply->service;
+
+   pthread_mutex_lock(&replies_lock);
+   reply->pending = pending;
+   if (pending)
+      service->pending_replies++;
+   else if (--service->pending_replies == 0)
+      pthread_cond_broadcast(&replies_done);
+   pthread_mutex_unlock(&replies_lock);
+}
+
+/**
+ * Wait until the functions of a service called have given their reply
+ */
+static void wait_for_replies( Service *service )
+{
+   pthread_mutex_lock(&replies_lock);
+   while (service->pending_replies > 0)
+      pthread_cond_wait(&replies_done, &replies_lock);
+   pthread_mutex_unlock(&replies_lock);
 }
 
 void unregister_socket(struct event_socket *s)
 {
-   lr_unregister_service(unsecure_web_server, s->url);
+   rt_remove(subscriptions, s->url);
+}
+
+static void free_subscription(void *socket)
+{
+   destroy_socket(socket);
 }
 
 static int req_destroy_socket(void *srv_data, void **req_data,
                               struct lr_request *req)
 {
+   struct event_socket *socket = *req_data;
+
+   // Unknown subscription, the response has already been sent
+   if (!socket) return 0;
+
    lr_send_stop(req);
    // TODO For now we just close socket on connection lost
-   const char *url = lr_request_get_url(req); 
-   void *socket = lr_unregister_service(unsecure_web_server, url);
+   unregister_socket(socket);
    destroy_socket(socket);
    return 0;
 }
 
+static int req_destroy_reply(void *srv_data, void **req_data,
+                             struct lr_request *req)
+{
+   HPD_Reply *reply = *req_data;
+
+   if (reply) {
+      free(reply->put_value);
+      free(reply->value);
+      free(reply);
+   }
+   return 0;
+}
+
+/**
+ * Give the result of an asynchronous function of a service
+ *
+ * Must be called exactly once for each reply, and may be called from
+ * any thread. The request is answered from the event loop.
+ *
+ * @param reply The reply given to the function
+ *
+ * @param value The value of the service, not necessarily \0 terminated
+ *
+ * @param len The length of value, or 0 if the function failed
+ *
+ * The value is also kept as the last known value of the service. This is
+ * the last use of the service until the reply is answered on the loop,
+ * which looks the service up by its URL again, as it may have been
+ * unregistered meanwhile.
+ */
+void HPD_reply( HPD_Reply *reply, const char *value, size_t len )
+{
+   if (reply->pending) {
+      if (len)
+         store_service_value(reply->service, value, len,
+                             reply->put ? HPD_VALUE_PUT : HPD_VALUE_GET);
+      set_reply_pending(reply, 0);
+   }
+
+   // Samples of the poller are not requests
+   if (reply->poll) {
+      hpd_poller_sampled(reply->poll, value, len);
+      free(reply);
+      return;
+   }
+
+   if (len) {
+      reply->value = malloc((len+1) * sizeof(char));
+      if (reply->value) {
+         memcpy(reply->value, value, len);
+         reply->value[len] = '\0';
+      }
+   }
+
+   // Commands are sent on their websocket from the loop
+   if (reply->cmd) {
+      pthread_mutex_lock(&commands_lock);
+      reply->next = commands_done;
+      commands_done = reply;
+      pthread_mutex_unlock(&commands_lock);
+      ev_async_send(server_loop, &commands_watcher);
+      return;
+   }
+
+   // A batch is resumed once, by the last of its operations
+   if (!reply->batch)
+      lr_request_resume(reply->req);
+   else if (__atomic_sub_fetch(&reply->batch->left, 1, __ATOMIC_ACQ_REL) == 0)
+      lr_request_resume(reply->batch->req);
+}
+
+/**
+ * Name of the worker queue of the device of a service
+ *
+ * @return The name, which must be freed, or NULL if out of memory
+ */
+static char *device_queue( Service *service )
+{
+   Device *device = service->device;
+   char *name = malloc(strlen(device->type) + strlen(device->ID) + 3);
+
+   if (name)
+      sprintf(name, "/%s/%s", device->type, device->ID);
+   return name;
+}
+
+/**
+ * Run the synchronous GET or PUT function of a service on a worker
+ * thread, and give the result to HPD_reply()
+ */
+static void run_device_function( void *data )
+{
+   HPD_Reply *reply = data;
+   Service *service = reply->service;
+   char buffer[MHD_MAX_BUFFER_SIZE];
+   size_t len;
+
+   if (reply->put_value) {
+      len = service->put_function(service, buffer, MHD_MAX_BUFFER_SIZE,
+                                  reply->put_value);
+      free(reply->put_value);
+      reply->put_value = NULL;
+   } else {
+      len = service->get_function(service, buffer, MHD_MAX_BUFFER_SIZE);
+   }
+
+   HPD_reply(reply, buffer, len);
+}
+
+/**
+ * Call a function of the service of a reply, without waiting for it
+ *
+ * Asynchronous functions are called directly, synchronous ones run on
+ * the workers after the functions called earlier for the same device,
+ * or right away without workers. All of them give their result to
+ * HPD_reply().
+ *
+ * @param put_value The value to PUT, or NULL to GET
+ *
+ * @return 0 on success, 1 if the function could not be called
+ */
+static int dispatch(HPD_Reply *reply, char *put_value)
+{
+   Service *service = reply->service;
+   char *queue;
+   int rc = 1;
+
+   // Before the call, as the function may reply right away
+   set_reply_pending(reply, 1);
+
+   if (put_value && service->put_async_function) {
+      service->put_async_function(service, reply, put_value);
+      return 0;
+   }
+   if (!put_value && service->get_async_function) {
+      service->get_async_function(service, reply);
+      return 0;
+   }
+
+   if (put_value) {
+      reply->put_value = strdup(put_value);
+      if (!reply->put_value) {
+         set_reply_pending(reply, 0);
+         return 1;
+      }
+   }
+   if (!workers) {
+      run_device_function(reply);
+      return 0;
+   }
+
+   queue = device_queue(service);
+   if (queue)
+      rc = hpd_workers_submit(workers, queue, run_device_function, reply);
+   free(queue);
+   if (rc) {
+      free(reply->put_value);
+      reply->put_value = NULL;
+      set_reply_pending(reply, 0);
+   }
+   return rc;
+}
+
+/**
+ * Call a function of a service for a request, without waiting for it
+ *
+ * @param put_value The value to PUT, or NULL to GET
+ *
+ * @return LR_PENDING, or 0 if the request has been answered already
+ */
+static int call_async(Service *service, struct lr_request *req,
+                      void **req_data, char *put_value)
+{
+   HPD_Reply *reply = calloc(1, sizeof(HPD_Reply));
+
+   if (!reply) {
+      lr_sendf(req, WS_HTTP_500, NULL, "Internal Server Error");
+      return 0;
+   }
+   reply->req = req;
+   reply->service = service;
+   reply->put = put_value != NULL;
+
+   *req_data = reply;
+   if (dispatch(reply, put_value)) {
+      *req_data = NULL;
+      free(reply);
+      lr_sendf(req, WS_HTTP_500, NULL, "Internal Server Error");
+      return 0;
+   }
+
+   return LR_PENDING;
+}
+
+/**
+ * Take a sample of the value of a service for the poller, like a GET
+ *
+ * @return 0 on success, 1 if the function could not be called
+ */
+static int sample_service(Service *service, struct hpd_poll *poll)
+{
+   HPD_Reply *reply = calloc(1, sizeof(HPD_Reply));
+
+   if (!reply)
+      return 1;
+   reply->service = service;
+   reply->poll = poll;
+
+   if (!service->get_function && !service->get_async_function) {
+      free(reply);
+      return 1;
+   }
+   if (dispatch(reply, NULL)) {
+      free(reply);
+      return 1;
+   }
+   return 0;
+}
+
+/**
+ * Answer a request from the value given to HPD_reply()
+ *
+ * A PUT value is sent as a value change event first, like the values
+ * returned by synchronous PUT functions.
+ *
+ * @return 0
+ */
+static int answer_reply(struct lr_request *req, HPD_Reply *reply)
+{
+   Service *service;
+   char *xmlbuff = NULL;
+
+   if (reply->value) {
+      if (lr_request_get_method(req) == HTTP_PUT) {
+         service = rt_lookup(services, lr_request_get_url(req));
+         if (service)
+            send_event_of_value_change(service, reply->value,
+                                       lr_request_get_ip(req));
+      }
+      xmlbuff = get_xml_value(reply->value);
+   }
+
+   if (!xmlbuff) {
+      lr_sendf(req, WS_HTTP_500, NULL, "500 Internal Server Error");
+      return 0;
+   }
+
+   lr_sendf_headers(req, WS_HTTP_200, lr_headers_xml, "%s", xmlbuff);
+   free(xmlbuff);
+   return 0;
+}
+
+/**
+ * Wait until the functions of the device of a service submitted to the
+ * workers have run
+ */
+static void wait_for_device( Service *service )
+{
+   char *queue;
+
+   if (!workers)
+      return;
+
+   queue = device_queue(service);
+   if (queue) {
+      hpd_workers_wait(workers, queue);
+      free(queue);
+   }
+}
+
+static int req_destroy_batch(void *srv_data, void **req_data,
+                             struct lr_request *req)
+{
+   struct batch *batch = *req_data;
+   int i;
+
+   if (!batch)
+      return 0;
+
+   for (i = 0; i < batch->n_ops; i++) {
+      free(batch->ops[i].url);
+      free(batch->ops[i].put_value);
+      free(batch->ops[i].value);
+   }
+   free(batch->ops);
+   free(batch);
+   return 0;
+}
+
+/// Add an operation parsed from the body of a batch request
+static void add_batch_operation(void *data, const char *method,
+                                const char *url, const char *value)
+{
+   struct batch *batch = data;
+   HPD_Reply *op = &batch->ops[batch->n_ops++];
+
+   memset(op, 0, sizeof(HPD_Reply));
+   op->req = batch->req;
+   op->batch = batch;
+   op->put = method && strcmp(method, "PUT") == 0;
+   if (url) op->url = strdup(url);
+   // The value is kept in put_value until the function is called
+   if (value) op->put_value = strdup(value);
+
+   if (!method || (strcmp(method, "GET") != 0 && !op->put))
+      op->status = WS_HTTP_405;
+   else if (!url || (op->put && !value))
+      op->status = WS_HTTP_400;
+   else if (!op->url || (value && !op->put_value))
+      op->status = WS_HTTP_500;
+}
+
+/// Count an operation of a batch parsed from a request body
+static void count_batch_operation(void *data, const char *method,
+                                  const char *url, const char *value)
+{
+   (*(int *)data)++;
+}
+
+/**
+ * Answer a batch request once all its operations have replied
+ *
+ * The value change events of the PUT operations are sent together,
+ * and the results in one multi-status document.
+ */
+static int answer_batch(struct lr_request *req, struct batch *batch)
+{
+   Service **changed;
+   char **urls, **values, **changed_values, *xmlbuff;
+   int *statuses;
+   int i, n_changed = 0;
+   HPD_Reply *op;
+
+   urls = malloc(batch->n_ops * sizeof(char *) + 1);
+   values = malloc(batch->n_ops * sizeof(char *) + 1);
+   statuses = malloc(batch->n_ops * sizeof(int) + 1);
+   changed = malloc(batch->n_ops * sizeof(Service *) + 1);
+   changed_values = malloc(batch->n_ops * sizeof(char *) + 1);
+   if (!urls || !values || !statuses || !changed || !changed_values) {
+      lr_sendf(req, WS_HTTP_500, NULL, "500 Internal Server Error");
+      goto cleanup;
+   }
+
+   for (i = 0; i < batch->n_ops; i++) {
+      op = &batch->ops[i];
+      if (!op->status)
+         op->status = op->value ? WS_HTTP_200 : WS_HTTP_500;
+      urls[i] = op->url;
+      statuses[i] = op->status;
+      values[i] = op->status == WS_HTTP_200 ? op->value : NULL;
+
+      if (op->put && op->status == WS_HTTP_200) {
+         changed[n_changed] = rt_lookup(services, op->url);
+         changed_values[n_changed] = op->value;
+         if (changed[n_changed]) n_changed++;
+      }
+   }
+
+   send_events_of_value_changes(changed, changed_values, n_changed,
+                                lr_request_get_ip(req));
+
+   xmlbuff = get_xml_batch_result(batch->n_ops, urls, statuses, values);
+   if (!xmlbuff) {
+      lr_sendf(req, WS_HTTP_500, NULL, "500 Internal Server Error");
+      goto cleanup;
+   }
+   lr_sendf_headers(req, WS_HTTP_207, lr_headers_xml, "%s", xmlbuff);
+   free(xmlbuff);
+
+cleanup:
+   free(urls);
+   free(values);
+   free(statuses);
+   free(changed);
+   free(changed_values);
+   return 0;
+}
+
+/**
+ * Run a batch of GET and PUT operations on services
+ *
+ * The operations are read from the XML body (see parse_xml_batch()), and
+ * called like separate requests, so operations on different devices run
+ * in parallel on the workers, and the operations on one device in order.
+ * The request is answered when all of them have replied.
+ */
+static int answer_post_batch(void *srv_data, void **req_data,
+                             struct lr_request *req,
+                             const char *body, size_t len)
+{
+   struct batch *batch = *req_data;
+   Service *service;
+   HPD_Reply *op;
+   char *value;
+   int i, n = 0;
+
+   // Resumed by the last operation
+   if (batch)
+      return answer_batch(req, batch);
+
+   if (parse_xml_batch(body, count_batch_operation, &n) < 0) {
+      lr_sendf(req, WS_HTTP_400, NULL, "400 Bad Request");
+      return 1;
+   }
+   batch = calloc(1, sizeof(struct batch));
+   if (!batch) {
+      lr_sendf(req, WS_HTTP_500, NULL, "500 Internal Server Error");
+      return 1;
+   }
+   batch->req = req;
+   *req_data = batch;
+   batch->ops = malloc(n * sizeof(HPD_Reply) + 1);
+   if (!batch->ops) {
+      lr_sendf(req, WS_HTTP_500, NULL, "500 Internal Server Error");
+      return 1;
+   }
+   parse_xml_batch(body, add_batch_operation, batch);
+
+   // Held while calling, so the last reply is known
+   batch->left = batch->n_ops + 1;
+   for (i = 0; i < batch->n_ops; i++) {
+      op = &batch->ops[i];
+      if (!op->status) {
+         service = rt_lookup(services, op->url);
+         if (!service)
+            op->status = WS_HTTP_404;
+         else if (!op->put &&
+                  (op->value = get_cached_service_value(service, NULL)))
+            op->status = WS_HTTP_200;
+         else if (op->put ? !service->put_function && !service->put_async_function
+                          : !service->get_function && !service->get_async_function)
+            op->status = WS_HTTP_405;
+         else
+            op->service = service;
+      }
+
+      // dispatch() keeps its own copy of the value
+      value = op->put_value;
+      op->put_value = NULL;
+      if (!op->status && dispatch(op, value))
+         op->status = WS_HTTP_500;
+      free(value);
+
+      if (op->status)
+         HPD_reply(op, NULL, 0);
+   }
+
+   if (__atomic_sub_fetch(&batch->left, 1, __ATOMIC_ACQ_REL) == 0)
+      lr_request_resume(req);
+
+   return LR_PENDING;
+}
+
 static int answer_get_devices(void *srv_data, void **req_data,
                               struct lr_request *req,
                               const char *body, size_t len)
 {
    char *xmlbuff = get_xml_device_list();
-   struct lm *headers = lm_create();
 
-   lm_insert(headers, "Content-Type", "text/xml");
-   lr_sendf(req, WS_HTTP_200, headers, xmlbuff);
+   lr_sendf_headers(req, WS_HTTP_200, text_xml_headers, "%s", xmlbuff);
 
-   lm_destroy(headers);
    free(xmlbuff);
    return 0;
 }
 
+/// Write the timings of a libREST route, in microseconds
+static void send_route_stats(void *data, const char *url,
+                             struct lr_stats *stats)
+{
+   static const struct {
+      const char *name;
+      enum lr_timing timing;
+   } timings[] = {
+      { "handler", LR_TIMING_HANDLER },
+      { "firstByte", LR_TIMING_FIRST_BYTE },
+      { "total", LR_TIMING_TOTAL },
+   };
+   struct lr_request *req = data;
+   size_t i;
+
+   lr_send_chunkf(req, "<route url=\"%s\">", url);
+   for (i = 0; i < sizeof(timings) / sizeof(timings[0]); i++) {
+      enum lr_timing t = timings[i].timing;
+      lr_send_chunkf(req, "<%s count=\"%lu\" p50=\"%.0f\" p90=\"%.0f\" "
+                     "p99=\"%.0f\" max=\"%.0f\"/>",
+                     timings[i].name, lr_stats_count(stats, t),
+                     lr_stats_percentile(stats, t, 50) * 1e6,
+                     lr_stats_percentile(stats, t, 90) * 1e6,
+                     lr_stats_percentile(stats, t, 99) * 1e6,
+                     lr_stats_percentile(stats, t, 100) * 1e6);
+   }
+   lr_send_chunkf(req, "</route>");
+}
+
+static int answer_get_stats(void *srv_data, void **req_data,
+                            struct lr_request *req,
+                            const char *body, size_t len)
+{
+   if (body) return 0;
+
+   lr_send_start_headers(req, WS_HTTP_200, text_xml_headers);
+   lr_send_chunkf(req, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+                  "<stats>");
+   lr_stats_map(unsecure_web_server, send_route_stats, req);
+   lr_send_chunkf(req, "</stats>");
+   lr_send_stop(req);
+
+   return 0;
+}
+
 void send_event(struct event_socket *s, const char *fmt, ...)
 {
-   struct lr_request *req = s->req;
-   const char *ip = lr_request_get_ip(req);
-   printf("Send value change: %s\n", ip);
    va_list arg;
    va_start(arg, fmt);
-   lr_send_vchunkf(req, fmt, arg);
+   if (s->ws) {
+      printf("Send value change: %s\n", lr_websocket_get_ip(s->ws));
+      lr_websocket_vsendf(s->ws, fmt, arg);
+   } else {
+      printf("Send value change: %s\n", lr_request_get_ip(s->req));
+      lr_send_vchunkf(s->req, fmt, arg);
+   }
    va_end(arg);
 }
 
+static void close_event_websocket(void *srv_data, void **ws_data,
+                                  struct lr_websocket *ws)
+{
+   struct command_socket *cmd = *ws_data;
+
+   destroy_socket(cmd->socket);
+   cmd->socket = NULL;
+   cmd->ws = NULL;
+   if (!cmd->pending)
+      free(cmd);
+}
+
+static int answer_get_events(void *srv_data, void **req_data,
+                             struct lr_request *req,
+                             const char *body, size_t len)
+{
+   struct command_socket *cmd;
+   struct lr_websocket *ws;
+
+   // Wait for full request
+   if (body) return 0;
+
+   if (!lr_request_is_websocket(req)) {
+      lr_sendf(req, WS_HTTP_400, NULL, "400 Bad Request");
+      return 1;
+   }
+
+   cmd = calloc(1, sizeof(struct command_socket));
+   if (cmd)
+      cmd->socket = open_event_websocket(srv_data);
+   if (!cmd || !cmd->socket) {
+      free(cmd);
+      lr_sendf(req, WS_HTTP_500, NULL, "Internal Server Error");
+      return 1;
+   }
+
+   ws = lr_request_websocket(req, answer_event_socket_command,
+                             close_event_websocket, cmd);
+   if (!ws) {
+      destroy_socket(cmd->socket);
+      free(cmd);
+      lr_sendf(req, WS_HTTP_400, NULL, "400 Bad Request");
+      return 1;
+   }
+   cmd->socket->ws = ws;
+   cmd->ws = ws;
+
+   return 0;
+}
+
 static int answer_get_event_socket(void *srv_data, void **req_data,
                                    struct lr_request *req,
                                    const char *body, size_t len)
 {
+   struct event_socket *socket;
+
+   socket = rt_lookup(subscriptions, lr_request_get_url(req));
+   if (!socket) {
+      lr_sendf(req, WS_HTTP_404, NULL, "404 Not Found");
+      return 1;
+   }
+
+   *req_data = socket;
    lr_request_keep_open(req);
    lr_send_start(req, WS_HTTP_200, NULL);
-   open_event_socket(srv_data, req);
+   open_event_socket(socket, req);
    return 0;
 }
 
@@ -103,35 +774,16 @@ static int answer_post_events(void *srv_data, void **req_data,
 {
    int rc;
    struct event_socket *socket;
-   char *str;
-   char *req_str = *req_data;
    struct ev_loop *loop = srv_data;
 
-   // Recieve data
-   if (body) {
-      if (*req_data) len += strlen(req_str);
-      str = realloc(*req_data, (len+1)*sizeof(char));
-      if (!str) {
-         printf("Failed to allocate memory\n");
-         lr_sendf(req, WS_HTTP_500, NULL, "Internal server error");
-         return 0;
-      }
-      strncat(str, body, len);
-      str[len] = '\0';
-      *req_data = str;
-      return 0;
-   }
-   
    // Subscribe to events
-   socket = subscribe_to_events(*req_data, loop);
+   socket = subscribe_to_events(body, loop);
 
-   // Register new url in libREST
-   rc = lr_register_service(unsecure_web_server,
-                            socket->url,
-                            answer_get_event_socket, NULL, NULL, NULL,
-                            req_destroy_socket, socket);
+   // Served by the "/events/{id}" route
+   rc = rt_insert(subscriptions, socket->url, socket);
    if (rc) {
       printf("Failed to register new event url\n");
+      destroy_socket(socket);
       lr_sendf(req, WS_HTTP_500, NULL, "Internal server error");
       return 0;
    }
@@ -139,27 +791,154 @@ static int answer_post_events(void *srv_data, void **req_data,
    // Send respond
    // TODO Fix body to corrispond with RFC 2616 (holds for all other
    // bodies too.
-   struct lm *headers = lm_create();
-   lm_insert(headers, "Location", socket->url);
-   // TODO CORS HEADER - SHOULD BE PACKED INSIDE SETTINGS OR COMPILE FLAG
-   lm_insert(headers, "Access-Control-Expose-Headers", "Location");
-   lr_sendf(req, WS_HTTP_201, headers, "Created");
-   lm_destroy(headers);
+   struct lr_header headers[] = {
+      { "Location", socket->url },
+      // TODO CORS HEADER - SHOULD BE PACKED INSIDE SETTINGS OR COMPILE FLAG
+      { "Access-Control-Expose-Headers", "Location" },
+      LR_HEADERS_END
+   };
+   lr_sendf_headers(req, WS_HTTP_201, headers, "Created");
    
    return 0;
 }
 
+/**
+ * Get the value of a service as XML
+ *
+ * @param service The service to get the value of
+ *
+ * @param xmlbuff Set to the XML value on success, must be freed
+ *
+ * @return The HTTP status code of the result
+ */
+static enum httpws_http_status_code
+get_value( Service *service, char **xmlbuff )
+{
+   char *buffer;
+   int buf_len;
+
+   *xmlbuff = NULL;
+
+   // Check if allowed
+   if (!service->get_function)
+      return WS_HTTP_405;
+
+   // Call callback
+   buffer = malloc((MHD_MAX_BUFFER_SIZE+1) * sizeof(char));
+   if (!buffer)
+      return WS_HTTP_500;
+   buf_len = service->get_function(service, buffer, MHD_MAX_BUFFER_SIZE);
+   if (buf_len) {
+      store_service_value(service, buffer, buf_len, HPD_VALUE_GET);
+      buffer[buf_len] = '\0';
+      *xmlbuff = get_xml_value(buffer);
+   }
+   free(buffer);
+
+   return *xmlbuff ? WS_HTTP_200 : WS_HTTP_500;
+}
+
+/**
+ * Set the value of a service and notify subscribers of the change
+ *
+ * @param service The service to set the value of
+ *
+ * @param put_value The XML value received from the client
+ *
+ * @param IP The IP of the client
+ *
+ * @param xmlbuff Set to the new XML value on success, must be freed
+ *
+ * @return The HTTP status code of the result
+ */
+static enum httpws_http_status_code
+put_value( Service *service, const char *put_value, const char *IP, char **xmlbuff )
+{
+   char *value, *buffer;
+   int buf_len;
+
+   *xmlbuff = NULL;
+
+   // Check if allowed
+   if (!service->put_function)
+      return WS_HTTP_405;
+
+   value = get_value_from_xml_value(put_value);
+   if (!value)
+      return WS_HTTP_400;
+
+   // Call callback
+   buffer = malloc((MHD_MAX_BUFFER_SIZE+1) * sizeof(char));
+   if (!buffer) {
+      free(value);
+      return WS_HTTP_500;
+   }
+   buf_len = service->put_function(service,
+                                   buffer, MHD_MAX_BUFFER_SIZE,
+                                   value);
+   free(value);
+   if (buf_len == 0) {
+      free(buffer);
+      return WS_HTTP_500;
+   }
+
+   // Send value change event
+   store_service_value(service, buffer, buf_len, HPD_VALUE_PUT);
+   buffer[buf_len] = '\0';
+   send_event_of_value_change(service, buffer, IP);
+
+   *xmlbuff = get_xml_value(buffer);
+   free(buffer);
+
+   return *xmlbuff ? WS_HTTP_200 : WS_HTTP_500;
+}
+
+/**
+ * Answer a GET request from the last known value of a service
+ *
+ * @param value The value, which is freed
+ *
+ * @param age The age of the value in seconds, sent in the Age header
+ *
+ * @return 0
+ */
+static int answer_cached(struct lr_request *req, char *value, double age)
+{
+   char *xmlbuff = get_xml_value(value);
+   char age_str[32];
+   struct lr_header headers[] = {
+      { "Content-Type", "application/xml" },
+      { "Age", age_str },
+      LR_HEADERS_END
+   };
+
+   free(value);
+   if (!xmlbuff) {
+      lr_sendf(req, WS_HTTP_500, NULL, "Internal Server Error");
+      return 0;
+   }
+
+   snprintf(age_str, sizeof(age_str), "%ld", (long)age);
+   lr_sendf_headers(req, WS_HTTP_200, headers, "%s", xmlbuff);
+   free(xmlbuff);
+   return 0;
+}
+
 // TODO Do I need to add more to this (like logging, etc.)
 static int answer_get(void *srv_data, void **req_data,
                       struct lr_request *req,
                       const char *body, size_t len)
 {
-   Service *service = srv_data;
-   char *buffer, *xmlbuff;
+   Service *service = rt_lookup(services, lr_request_get_url(req));
+   char *xmlbuff, *value;
+   double age;
    const char *arg, *url, *ip;
    enum http_method method;
-   int buf_len;
-   struct lm *headers = lm_create();
+   enum httpws_http_status_code status;
+
+   // Resumed by HPD_reply()
+   if (*req_data)
+      return answer_reply(req, *req_data);
 
    // Check arguments
    arg = lr_request_get_argument(req, "x");
@@ -175,38 +954,43 @@ static int answer_get(void *srv_data, void **req_data,
    ip = lr_request_get_ip(req);
    Log (HPD_LOG_ONLY_REQUESTS, NULL, ip, http_method_str(method), url, arg);
 
+   if (!service) {
+      lr_sendf(req, WS_HTTP_404, NULL, "404 Not Found");
+      return 1;
+   }
+
    // Argument "x=1"
    if (arg && strcmp(arg, "x=1") == 0) {
-      struct lm *headers = lm_create();
-      lm_insert(headers, "Content-Type", "text/xml");
       xmlbuff = extract_service_xml(service);
-      lr_sendf(req, WS_HTTP_200, headers, xmlbuff);
-      lm_destroy(headers);
+      lr_sendf_headers(req, WS_HTTP_200, text_xml_headers, "%s", xmlbuff);
       free(xmlbuff);
       return 0;
    }
 
-   // Check if allowed
-   if (!service->get_function) {
-      lr_sendf(req, WS_HTTP_405, NULL, "405 Method Not Allowed");
-      return 1;
-   }
+   // Answered from the last known value, if the policy of the service
+   // allows it
+   value = get_cached_service_value(service, &age);
+   if (value)
+      return answer_cached(req, value, age);
+
+   // Answered when the device replies
+   if (service->get_async_function || (workers && service->get_function))
+      return call_async(service, req, req_data, NULL);
 
    // Call callback and send response
-   buffer = malloc((MHD_MAX_BUFFER_SIZE+1) * sizeof(char));
-   buf_len = service->get_function(service, buffer, MHD_MAX_BUFFER_SIZE);
-   if (buf_len) {
-      buffer[buf_len] = '\0';
-      xmlbuff = get_xml_value(buffer);
-      lm_insert(headers, "Content-Type", "application/xml");
-      lr_sendf(req, WS_HTTP_200, headers, xmlbuff);
-      free(xmlbuff);
-   } else {
-      lr_sendf(req, WS_HTTP_500, NULL, "Internal Server Error");
+   status = get_value(service, &xmlbuff);
+   switch (status) {
+      case WS_HTTP_200:
+         lr_sendf_headers(req, WS_HTTP_200, lr_headers_xml, "%s", xmlbuff);
+         free(xmlbuff);
+         return 0;
+      case WS_HTTP_405:
+         lr_sendf(req, WS_HTTP_405, NULL, "405 Method Not Allowed");
+         return 1;
+      default:
+         lr_sendf(req, WS_HTTP_500, NULL, "Internal Server Error");
+         return 0;
    }
-   free(buffer);
-
-   return 0;
 }
 
 // TODO Do I need to add more to this (like logging, etc.)
@@ -214,71 +998,208 @@ static int answer_put(void *srv_data, void **req_data,
                       struct lr_request *req,
                       const char *body, size_t len)
 {
-   Service *service = srv_data;
-   char *new_put;
-   size_t new_len;
+   Service *service = rt_lookup(services, lr_request_get_url(req));
+   enum httpws_http_status_code status;
+   char *xmlbuff, *value;
+   int rc;
+
+   // Resumed by HPD_reply()
+   if (*req_data)
+      return answer_reply(req, *req_data);
+
+   if (!service) {
+      lr_sendf(req, WS_HTTP_404, NULL, "404 Not Found");
+      return 1;
+   }
 
    // Check if allowed
-   if (!service->put_function) {
+   if (!service->put_function && !service->put_async_function) {
       lr_sendf(req, WS_HTTP_405, NULL, "405 Method Not Allowed");
       return 1;
    }
 
-   if (body) {
-      new_len = len+1;
-      if (service->put_value) new_len += strlen(service->put_value);
-      new_put = realloc(service->put_value, new_len*sizeof(char));
-      if (!new_put) {
-         free(service->put_value);
-         service->put_value = NULL;
-         lr_sendf(req, WS_HTTP_500, NULL, "500 Internal Server Error");
+   // Answered when the device replies
+   if (service->put_async_function || workers) {
+      value = get_value_from_xml_value(body);
+      if (!value) {
+         lr_sendf(req, WS_HTTP_400, NULL, "400 Bad Request");
          return 1;
       }
+      rc = call_async(service, req, req_data, value);
+      free(value);
+      return rc;
+   }
 
-      strncpy(new_put, body, len);
-      new_put[new_len-1] = '\0';
-      service->put_value = new_put;
-   } else {
-      if (service->put_value == NULL) {
+   status = put_value(service, body, lr_request_get_ip(req), &xmlbuff);
+
+   // Send response
+   switch (status) {
+      case WS_HTTP_200:
+         lr_sendf_headers(req, WS_HTTP_200, lr_headers_xml, "%s", xmlbuff);
+         free(xmlbuff);
+         break;
+      case WS_HTTP_400:
          lr_sendf(req, WS_HTTP_400, NULL, "400 Bad Request");
          return 1;
-      }
-      char *value = get_value_from_xml_value(service->put_value);
-      free(service->put_value);
-      service->put_value = NULL;
-      if (!value) {
-         lr_sendf(req, WS_HTTP_400, NULL, "400 Bad Request");
+      default:
+         lr_sendf(req, WS_HTTP_500, NULL, "500 Internal Server Error");
          return 1;
+   }
+
+   return 0;
+}
+
+/**
+ * Send the reply to a command on its websocket, if still open
+ *
+ * A PUT value is sent as a value change event first, like for requests.
+ */
+static void answer_command( HPD_Reply *reply )
+{
+   struct command_socket *cmd = reply->cmd;
+   char *xmlbuff = NULL;
+   Service *service;
+
+   if (cmd->ws) {
+      if (reply->value) {
+         if (reply->put) {
+            service = rt_lookup(services, reply->url);
+            if (service)
+               send_event_of_value_change(service, reply->value,
+                                          lr_websocket_get_ip(cmd->ws));
+         }
+         xmlbuff = get_xml_value(reply->value);
       }
+      lr_websocket_sendf(cmd->ws, "%d %s\n%s",
+                         xmlbuff ? WS_HTTP_200 : WS_HTTP_500, reply->url,
+                         xmlbuff ? xmlbuff : "");
+      free(xmlbuff);
+   }
 
-      // Call callback
-      char *buffer = malloc((MHD_MAX_BUFFER_SIZE+1) * sizeof(char));
-      int buf_len = service->put_function(service,
-                                          buffer, MHD_MAX_BUFFER_SIZE,
-                                          value);
-      free(value);
+   if (--cmd->pending == 0 && !cmd->ws)
+      free(cmd);
+   free(reply->put_value);
+   free(reply->value);
+   free(reply->url);
+   free(reply);
+}
 
-      // Send response
-      if (buf_len == 0) {
-         lr_sendf(req, WS_HTTP_500, NULL, "500 Internal Server Error");
-         free(buffer);
-         return 1;
-      } else {
-         // Send value change event
-         const char *IP = lr_request_get_ip(req);
-         buffer[buf_len] = '\0';
-         send_event_of_value_change(service, buffer, IP);
-         
-         // Reply to request
-         const char *xmlbuff = get_xml_value(buffer);
-         lr_sendf(req, WS_HTTP_200, NULL, xmlbuff);
+/// Answer the commands given to HPD_reply() since last time
+static void answer_commands( struct ev_loop *loop, ev_async *w, int revents )
+{
+   HPD_Reply *done, *reply, *ordered = NULL;
+
+   pthread_mutex_lock(&commands_lock);
+   done = commands_done;
+   commands_done = NULL;
+   pthread_mutex_unlock(&commands_lock);
+
+   // Replies were pushed in reverse order
+   while ((reply = done) != NULL) {
+      done = reply->next;
+      reply->next = ordered;
+      ordered = reply;
+   }
+   while ((reply = ordered) != NULL) {
+      ordered = reply->next;
+      answer_command(reply);
+   }
+}
+
+/**
+ * Handle a command received on an event websocket
+ *
+ * Commands are text messages on the form "GET <url>" or
+ * "PUT <url>\n<xml value>", where url is the value url of a service.
+ * The reply is sent on the same websocket as "<status> <url>\n<xml>",
+ * where status is the HTTP status code of the result. Value change
+ * events caused by a PUT are sent to all subscribers as usual.
+ *
+ * The functions of the service are called like for requests, through
+ * the workers of its device, so replies to later commands may be sent
+ * first.
+ *
+ * @return 0 to keep the websocket open
+ */
+static int answer_event_socket_command(void *srv_data, void **ws_data,
+                                       struct lr_websocket *ws,
+                                       const char *msg, size_t len)
+{
+   struct command_socket *cmd = *ws_data;
+   enum httpws_http_status_code status;
+   enum http_method method;
+   char *url, *value = NULL, *xmlbuff = NULL, *cached, *put_value = NULL;
+   const char *ip = lr_websocket_get_ip(ws);
+   size_t url_len;
+   Service *service;
+   HPD_Reply *reply;
+
+   if (strncmp(msg, "GET ", 4) == 0)
+      method = HTTP_GET;
+   else if (strncmp(msg, "PUT ", 4) == 0)
+      method = HTTP_PUT;
+   else {
+      lr_websocket_sendf(ws, "400 \n");
+      return 0;
+   }
+
+   // Split into url and value
+   url_len = strcspn(&msg[4], "\r\n");
+   url = malloc((url_len+1) * sizeof(char));
+   if (!url) {
+      lr_websocket_sendf(ws, "500 \n");
+      return 0;
+   }
+   strncpy(url, &msg[4], url_len);
+   url[url_len] = '\0';
+   if (msg[4+url_len] != '\0')
+      value = (char *)&msg[4+url_len+1];
+
+   Log (HPD_LOG_ONLY_REQUESTS, NULL, ip, http_method_str(method), url, NULL);
+
+   service = rt_lookup(services, url);
+   if (!service)
+      status = WS_HTTP_404;
+   else if (method == HTTP_GET
+            && (cached = get_cached_service_value(service, NULL))) {
+      xmlbuff = get_xml_value(cached);
+      status = xmlbuff ? WS_HTTP_200 : WS_HTTP_500;
+      free(cached);
+   } else if (method == HTTP_GET
+              && !service->get_function && !service->get_async_function)
+      status = WS_HTTP_405;
+   else if (method == HTTP_PUT
+            && !service->put_function && !service->put_async_function)
+      status = WS_HTTP_405;
+   else if (method == HTTP_PUT
+            && (!value || !(put_value = get_value_from_xml_value(value))))
+      status = WS_HTTP_400;
+   else {
+      // Answered by answer_command() when the device replies
+      reply = calloc(1, sizeof(HPD_Reply));
+      if (reply) {
+         reply->service = service;
+         reply->cmd = cmd;
+         reply->url = url;
+         reply->put = put_value != NULL;
+         cmd->pending++;
+         if (!dispatch(reply, put_value)) {
+            free(put_value);
+            return 0;
+         }
+         cmd->pending--;
+         free(reply);
       }
-      free(buffer);
+      status = WS_HTTP_500;
    }
 
+   lr_websocket_sendf(ws, "%d %s\n%s", status, url, xmlbuff ? xmlbuff : "");
+
+   free(put_value);
+   free(xmlbuff);
+   free(url);
    return 0;
 }
-
 /**
  * Start the MHD web server(s) and the AVAHI client or server
  *
@@ -303,6 +1224,23 @@ start_server(char* hostname, char *domain_name, struct ev_loop *loop)
    struct lr_settings settings = LR_SETTINGS_DEFAULT;
    settings.port = hpd_daemon->http_port;
 
+   // Without workers, functions run on the loop
+   if (hpd_daemon->workers > 0) {
+      workers = hpd_workers_create(hpd_daemon->workers);
+      if (!workers)
+         return HPD_E_MHD_ERROR;
+   }
+
+   server_loop = loop;
+   ev_async_init(&commands_watcher, answer_commands);
+   ev_async_start(loop, &commands_watcher);
+
+   services = rt_create();
+   subscriptions = rt_create();
+   poller = hpd_poller_create(loop, sample_service);
+   if (!services || !subscriptions || !poller)
+      return HPD_E_MHD_ERROR;
+
 	unsecure_web_server = lr_create(&settings, loop);
    if (!unsecure_web_server)
       return HPD_E_MHD_ERROR;
@@ -316,8 +1254,34 @@ start_server(char* hostname, char *domain_name, struct ev_loop *loop)
                             NULL, NULL);
    rc = lr_register_service(unsecure_web_server,
                             "/events",
-                            NULL, answer_post_events, NULL, NULL,
-                            req_destroy_str, loop);
+                            answer_get_events, answer_post_events,
+                            NULL, NULL, NULL, loop);
+   rc |= lr_register_service(unsecure_web_server,
+                             "/stats",
+                             answer_get_stats, NULL, NULL, NULL,
+                             NULL, NULL);
+   rc |= lr_register_service(unsecure_web_server,
+                             "/batch",
+                             NULL, answer_post_batch, NULL, NULL,
+                             req_destroy_batch, NULL);
+   rc |= lr_register_service(unsecure_web_server,
+                             "/events/{id}",
+                             answer_get_event_socket, NULL, NULL, NULL,
+                             req_destroy_socket, NULL);
+   rc |= lr_register_service(unsecure_web_server,
+                             "/{dtype}/{did}/{stype}/{sid}",
+                             answer_get, NULL, answer_put, NULL,
+                             req_destroy_reply, NULL);
+   rc |= lr_coalesce_service(unsecure_web_server,
+                             "/{dtype}/{did}/{stype}/{sid}",
+                             1, "x");
+   rc |= lr_buffer_service(unsecure_web_server, "/events", MAX_BODY_SIZE);
+   rc |= lr_buffer_service(unsecure_web_server, "/batch", MAX_BODY_SIZE);
+   rc |= lr_buffer_service(unsecure_web_server,
+                           "/{dtype}/{did}/{stype}/{sid}",
+                           MAX_BODY_SIZE);
+   rc |= lr_limit_service(unsecure_web_server, "/devices",
+                          DEVICES_RATE, DEVICES_BURST);
    if (rc) {
       printf("Failed to register non secure service\n");
 		return HPD_E_MHD_ERROR;
@@ -348,8 +1312,19 @@ stop_server()
 	int rc;
 
 #if HPD_HTTP
+   // Functions still running reply to the web server
+   hpd_workers_destroy(workers);
+   workers = NULL;
+   answer_commands(server_loop, &commands_watcher, 0);
+   ev_async_stop(server_loop, &commands_watcher);
+   hpd_poller_destroy(poller);
+   poller = NULL;
    lr_stop(unsecure_web_server);
    lr_destroy(unsecure_web_server);
+   rt_destroy(subscriptions, free_subscription);
+   rt_destroy(services, NULL);
+   subscriptions = NULL;
+   services = NULL;
 	rc = HPD_E_SUCCESS;
 #endif
 
@@ -363,9 +1338,28 @@ stop_server()
 
 }
 
+/**
+ * Remove a service from the router, the registry and the poller
+ *
+ * @param service The service to remove
+ */
+static void
+remove_service_from_server( Service *service )
+{
+   rt_remove(services, service->value_url);
+   registry_remove_service(service);
+   hpd_poller_remove(poller, service);
+   // The service may be destroyed once unregistered
+   wait_for_device(service);
+   wait_for_replies(service);
+}
+
 /**
  * Add a service to the XML file, the server(s), and the AVAHI client or server
 	 *
+ * If a step fails, the steps already done are undone, so that no
+ *  reference to the service is left behind
+ *
  * @param service_to_register The service to register
  *
  * @return A HPD error code
@@ -374,53 +1368,75 @@ int
 register_service( Service *service_to_register )
 {
 
-	int rc;
+	int rc, in_xml;
 
 	if( service_to_register->device->secure_device == HPD_NON_SECURE_DEVICE )
 	{
-      Service *s = lr_lookup_service(unsecure_web_server, service_to_register->value_url);
+      Service *s = rt_lookup(services, service_to_register->value_url);
 		if (s) {
 			printf("A similar service is already registered in the unsecure server\n");
 			return HPD_E_SERVICE_ALREADY_REGISTER;
 		}
 
 		printf("Registering non secure service\n");
-		rc = lr_register_service(unsecure_web_server,
-                               service_to_register->value_url,
-                               answer_get, NULL, answer_put, NULL,
-                               NULL, service_to_register);
+		rc = rt_insert(services, service_to_register->value_url,
+                     service_to_register);
 		if(rc) {
          printf("Failed to register non secure service\n");
 			return HPD_E_MHD_ERROR;
+      }
+      rc = registry_add_service(service_to_register);
+      if (rc < HPD_E_SUCCESS) {
+         rt_remove(services, service_to_register->value_url);
+         return rc;
+      }
+      if (service_to_register->poll_interval > 0
+          && hpd_poller_add(poller, service_to_register)) {
+         rc = HPD_E_MALLOC_ERROR;
+         goto server_error;
       }
 	} else
       return HPD_E_BAD_PARAMETER;
 
 	/* Add to XML */
 	rc = add_service_to_xml ( service_to_register );
-	if (rc == -1){
-		printf("Impossible to add the Service to the XML file.\n");
-		return HPD_E_XML_ERROR;
-	}
-	else if(rc == -2){
+	if (rc == HPD_E_SERVICE_ALREADY_IN_XML){
 		printf("The Service already exists\n");
 	}
+	else if (rc < HPD_E_SUCCESS){
+		printf("Impossible to add the Service to the XML file.\n");
+		rc = HPD_E_XML_ERROR;
+		goto server_error;
+	}
+	// Only removed again if added here
+	in_xml = rc != HPD_E_SERVICE_ALREADY_IN_XML;
 #if USE_AVAHI
 	rc = avahi_create_service ( service_to_register );
 	if(  rc < HPD_E_SUCCESS )
 	{
 		printf("avahi_create_service failed : %d\n", rc);
-		return rc;
+		goto xml_error;
 	}
 #endif
 	rc = notify_service_availability( service_to_register, HPD_YES);
 	if(  rc < HPD_E_SUCCESS )
 	{
 		printf("notify_service_availability failed : %d\n", rc);
-		return rc;
+		goto avahi_error;
 	}
 
 	return HPD_E_SUCCESS;
+
+avahi_error:
+#if USE_AVAHI
+	avahi_remove_service ( service_to_register );
+xml_error:
+#endif
+	if( in_xml )
+		remove_service_from_XML( service_to_register );
+server_error:
+	remove_service_from_server( service_to_register );
+	return rc;
 }
 
 /**
@@ -438,14 +1454,10 @@ unregister_service( Service *service_to_unregister )
 
 	if( service_to_unregister->device->secure_device == HPD_NON_SECURE_DEVICE )
 	{
-      Service *s = lr_lookup_service(unsecure_web_server, service_to_unregister->value_url);
+      Service *s = rt_lookup(services, service_to_unregister->value_url);
 	   if( !s )
 		   return HPD_E_SERVICE_NOT_REGISTER;
-
-		s = lr_unregister_service ( unsecure_web_server,
-            service_to_unregister->value_url );
-		if( !s )
-			return HPD_E_MHD_ERROR;
+      remove_service_from_server(service_to_unregister);
 	}
 	else 
 		return HPD_E_BAD_PARAMETER;
@@ -476,7 +1488,34 @@ unregister_service( Service *service_to_unregister )
 }
 
 /**
- * Register all of a device's services
+ * Begin a batch of registrations. Until the matching
+ *  register_commit, the XML file is only updated in memory
+ *
+ * @return A HPD error code
+ */
+int
+register_begin()
+{
+	begin_xml_batch();
+	return HPD_E_SUCCESS;
+}
+
+/**
+ * Commit a batch of registrations begun with register_begin,
+ *  writing the XML file once
+ *
+ * @return A HPD error code
+ */
+int
+register_commit()
+{
+	commit_xml_batch();
+	return HPD_E_SUCCESS;
+}
+
+/**
+ * Register all of a device's services, as a single batch. If one
+ *  of them fails, the ones already registered are unregistered
  *
  * @param device_to_register The device to register
  *
@@ -485,19 +1524,27 @@ unregister_service( Service *service_to_unregister )
 int 
 register_device_services( Device *device_to_register )
 {
-	ServiceElement *iterator;
-	int return_value;
+	ServiceElement *iterator, *registered;
+	int return_value = HPD_E_SUCCESS;
 
+	register_begin();
 	DL_FOREACH( device_to_register->service_head, iterator )
 	{
 		return_value = register_service( iterator->service );
 		if( return_value < HPD_E_SUCCESS )
 		{
-			return return_value;
+			DL_FOREACH( device_to_register->service_head, registered )
+			{
+				if( registered == iterator )
+					break;
+				unregister_service( registered->service );
+			}
+			break;
 		}
 	}
+	register_commit();
 
-	return HPD_E_SUCCESS;
+	return return_value < HPD_E_SUCCESS ? return_value : HPD_E_SUCCESS;
 
 }
 
@@ -514,19 +1561,40 @@ unregister_device_services( Device *device_to_unregister )
 	ServiceElement *iterator;
 	int return_value;
 
+	register_begin();
 	DL_FOREACH( device_to_unregister->service_head, iterator )
 	{
 		return_value = unregister_service( iterator->service );
 		if(return_value < HPD_E_SUCCESS)
 		{
+			register_commit();
 			return return_value;
 		}
 	}
-
+	register_commit();
 
 	return HPD_E_SUCCESS;
 }
 
+/**
+ * Apply the polling settings of a service, if registered
+ *
+ * @param service The service
+ *
+ * @return A HPD error code
+ */
+int
+update_service_polling( Service *service )
+{
+   if (!poller || !is_service_registered(service))
+      return HPD_E_SUCCESS;
+
+   hpd_poller_remove(poller, service);
+   if (service->poll_interval > 0 && hpd_poller_add(poller, service))
+      return HPD_E_MALLOC_ERROR;
+   return HPD_E_SUCCESS;
+}
+
 /**
  * Check if a service is registered in a server
  *
@@ -543,7 +1611,7 @@ is_service_registered( Service *service )
 
 	if( service->device->secure_device == HPD_NON_SECURE_DEVICE )
 	{
-      Service *s = lr_lookup_service(unsecure_web_server, service->value_url);
+      Service *s = rt_lookup(services, service->value_url);
       if (s) return 1;
       else return 0;
 	}	
@@ -551,65 +1619,3 @@ is_service_registered( Service *service )
 	return 0;
 }
 
-/**
- * Retrieve a Service object from a server
- *
- * @param device_type The type of the device that owns the service
- *
- * @param device_ID The ID of the device that owns the service
- *
- * @param service_type The type of the service
- *
- * @param service_ID The ID of the service 
- *
- * @return A pointer on the Service struct if found, NULL otherwise
- */
-Service* 
-get_service( char *device_type, char *device_ID, char *service_type, char *service_ID )
-{
-	Service *service = NULL;
-
-   // TODO This is not the best solution (duplicated code), nor the best
-   // place to do this
-	char *value_url = malloc(sizeof(char)*( strlen("/") + strlen(device_type) + strlen("/") 
-	                                           + strlen(device_ID) +
-                                              strlen("/") +
-                                              strlen(service_type)
-	                                           + strlen("/") +
-                                              strlen(service_ID) + 1 ) );
-	sprintf( value_url,"/%s/%s/%s/%s", device_type, device_ID, service_type,
-	         service_ID );
-	service = lr_lookup_service(unsecure_web_server, value_url);
-   free(value_url);
-	return service;
-}
-
-
-/**
- * Retrieve a Device object from a server
- *
- * @param device_type The type of the device
- *
- * @param device_ID The ID of the device
- *
- * @return A pointer on the Device struct if found, NULL otherwise
- */
-Device* 
-get_device( char *device_type, char *device_ID)
-{
-	Device *device = NULL;
-	Service *service = NULL;
-
-   // TODO This is not the best solution (duplicated code), nor the best
-   // place to do this
-   // TODO BUG DOES NOT HAVE A SERVER ID AND TYPE HERE !!!
-	char *value_url = malloc(sizeof(char)*( strlen("/") + strlen(service->device->type) + strlen("/") 
-	                                           + strlen(service->device->ID) + strlen("/") + strlen(service->type)
-	                                           + strlen("/") + strlen(service->ID) + 1 ) );
-	sprintf( value_url,"/%s/%s/%s/%s", service->device->type, service->device->ID, service->type,
-	         service->ID );
-	service = lr_lookup_service(unsecure_web_server, value_url);
-   free(value_url);
-	device = service->device;
-	return device;
-}
@@ -50,11 +50,11 @@ int register_service( Service *service_to_register );
 int unregister_service( Service *service_to_unregister );
 int register_device_services( Device *device_to_register );
 int unregister_device_services( Device *device_to_unregister );
+int register_begin();
+int register_commit();
 
 int is_service_registered( Service *service );
-
-Service* get_service( char *device_type, char *device_ID, char *service_type, char *service_ID );
-Device* get_device( char *device_type, char *device_ID);
+int update_service_polling( Service *service );
 
 void send_event(struct event_socket *s, const char *fmt, ...);
 void unregister_socket(struct event_socket *s);
@@ -0,0 +1,288 @@
+/*Copyright 2011 Aalborg University. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed*/
+
+/**
+ * @file hpd_workers.c
+ * @brief  Thread pool running blocking device functions
+ *
+ * Jobs are submitted to named queues, one per device. Jobs of the same
+ * queue run one at a time in submission order, so a driver never sees
+ * concurrent calls for one device, while the jobs of different queues
+ * run in parallel on the worker threads.
+ */
+
+#include "hpd_workers.h"
+#include "radix_tree.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct hpd_job
+{
+   hpd_job_cb cb;
+   void *data;
+   struct hpd_job *next;
+};
+
+/// A queue with jobs left, or with a job running
+struct hpd_queue
+{
+   char *name;
+   struct hpd_job *first;
+   struct hpd_job *last;
+   int running;              ///< A job of the queue is running
+   struct hpd_queue *next;   ///< Next queue ready to run a job
+};
+
+struct hpd_workers
+{
+   pthread_t *threads;
+   int n_threads;
+   pthread_mutex_t lock;
+   pthread_cond_t work;      ///< Signalled when a queue gets ready
+   pthread_cond_t idle;      ///< Signalled when a job has run
+   struct rt *queues;        ///< Queues with jobs left or running
+   struct hpd_queue *ready;  ///< Queues with jobs left, none running
+   struct hpd_queue *ready_last;
+   int stopping;
+};
+
+static void
+ready_push( struct hpd_workers *pool, struct hpd_queue *queue )
+{
+   queue->next = NULL;
+   if (pool->ready_last) pool->ready_last->next = queue;
+   else pool->ready = queue;
+   pool->ready_last = queue;
+   pthread_cond_signal(&pool->work);
+}
+
+/**
+ * Run jobs until the pool is stopped and no jobs are left
+ */
+static void *
+worker( void *arg )
+{
+   struct hpd_workers *pool = arg;
+   struct hpd_queue *queue;
+   struct hpd_job *job;
+
+   pthread_mutex_lock(&pool->lock);
+   for (;;) {
+      while (!pool->ready && !pool->stopping)
+         pthread_cond_wait(&pool->work, &pool->lock);
+      if (!pool->ready)
+         break;
+
+      queue = pool->ready;
+      pool->ready = queue->next;
+      if (!pool->ready) pool->ready_last = NULL;
+      job = queue->first;
+      queue->first = job->next;
+      if (!queue->first) queue->last = NULL;
+      queue->running = 1;
+
+      pthread_mutex_unlock(&pool->lock);
+      job->cb(job->data);
+      free(job);
+      pthread_mutex_lock(&pool->lock);
+
+      queue->running = 0;
+      if (queue->first) {
+         ready_push(pool, queue);
+      } else {
+         rt_remove(pool->queues, queue->name);
+         free(queue->name);
+         free(queue);
+      }
+      pthread_cond_broadcast(&pool->idle);
+   }
+   pthread_mutex_unlock(&pool->lock);
+
+   return NULL;
+}
+
+/**
+ * Create a pool and start its threads
+ *
+ * @param threads The number of worker threads
+ *
+ * @return The pool, or NULL on failure
+ */
+struct hpd_workers *
+hpd_workers_create( int threads )
+{
+   struct hpd_workers *pool;
+
+   if (threads <= 0)
+      return NULL;
+
+   pool = malloc(sizeof(struct hpd_workers));
+   if (!pool) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return NULL;
+   }
+
+   pool->threads = malloc(threads * sizeof(pthread_t));
+   pool->queues = rt_create();
+   if (!pool->threads || !pool->queues) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      free(pool->threads);
+      if (pool->queues) rt_destroy(pool->queues, NULL);
+      free(pool);
+      return NULL;
+   }
+   pthread_mutex_init(&pool->lock, NULL);
+   pthread_cond_init(&pool->work, NULL);
+   pthread_cond_init(&pool->idle, NULL);
+   pool->ready = NULL;
+   pool->ready_last = NULL;
+   pool->stopping = 0;
+
+   for (pool->n_threads = 0; pool->n_threads < threads; pool->n_threads++) {
+      if (pthread_create(&pool->threads[pool->n_threads], NULL,
+                         worker, pool)) {
+         fprintf(stderr, "ERROR: Cannot create worker thread\n");
+         break;
+      }
+   }
+   if (pool->n_threads == 0) {
+      hpd_workers_destroy(pool);
+      return NULL;
+   }
+
+   return pool;
+}
+
+/**
+ * Run the jobs left and stop the threads of a pool, then free it
+ *
+ * @param pool The pool to destroy
+ */
+void
+hpd_workers_destroy( struct hpd_workers *pool )
+{
+   int i;
+
+   if (!pool)
+      return;
+
+   pthread_mutex_lock(&pool->lock);
+   pool->stopping = 1;
+   pthread_cond_broadcast(&pool->work);
+   pthread_mutex_unlock(&pool->lock);
+
+   for (i = 0; i < pool->n_threads; i++)
+      pthread_join(pool->threads[i], NULL);
+
+   rt_destroy(pool->queues, NULL);
+   pthread_cond_destroy(&pool->idle);
+   pthread_cond_destroy(&pool->work);
+   pthread_mutex_destroy(&pool->lock);
+   free(pool->threads);
+   free(pool);
+}
+
+/**
+ * Submit a job to a queue of a pool
+ *
+ * The job runs on a worker thread, after the jobs submitted to the same
+ * queue before it have run.
+ *
+ * @param pool The pool to run the job
+ *
+ * @param queue The name of the queue, e.g. the device of the job
+ *
+ * @param job The function to run
+ *
+ * @param data Argument to job
+ *
+ * @return 0 on success, 1 on memory errors
+ */
+int
+hpd_workers_submit( struct hpd_workers *pool, const char *queue,
+                    hpd_job_cb job, void *data )
+{
+   struct hpd_job *j;
+   struct hpd_queue *q;
+
+   j = malloc(sizeof(struct hpd_job));
+   if (!j) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return 1;
+   }
+   j->cb = job;
+   j->data = data;
+   j->next = NULL;
+
+   pthread_mutex_lock(&pool->lock);
+   q = rt_lookup(pool->queues, queue);
+   if (!q) {
+      q = malloc(sizeof(struct hpd_queue));
+      if (q) q->name = strdup(queue);
+      if (!q || !q->name || rt_insert(pool->queues, queue, q)) {
+         pthread_mutex_unlock(&pool->lock);
+         fprintf(stderr, "ERROR: Cannot allocate memory\n");
+         if (q) free(q->name);
+         free(q);
+         free(j);
+         return 1;
+      }
+      q->first = NULL;
+      q->last = NULL;
+      q->running = 0;
+      q->next = NULL;
+   }
+
+   // A queue is ready when it has jobs and none of them is running
+   if (q->last) {
+      q->last->next = j;
+   } else {
+      q->first = j;
+      if (!q->running) ready_push(pool, q);
+   }
+   q->last = j;
+   pthread_mutex_unlock(&pool->lock);
+
+   return 0;
+}
+
+/**
+ * Wait until a queue of a pool has no jobs left or running
+ *
+ * @param pool The pool
+ *
+ * @param queue The name of the queue
+ */
+void
+hpd_workers_wait( struct hpd_workers *pool, const char *queue )
+{
+   pthread_mutex_lock(&pool->lock);
+   while (rt_lookup(pool->queues, queue))
+      pthread_cond_wait(&pool->idle, &pool->lock);
+   pthread_mutex_unlock(&pool->lock);
+}
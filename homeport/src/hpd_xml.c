@@ -46,6 +46,8 @@ create_service_xml_file()
   service_xml_file = (serviceXmlFile*)malloc(sizeof(serviceXmlFile));
   service_xml_file->mutex = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t));
   pthread_mutex_init(service_xml_file->mutex, NULL);
+  service_xml_file->batch = 0;
+  service_xml_file->dirty = 0;
 }
 
 /**
@@ -69,23 +71,74 @@ destroy_service_xml_file()
 }
 
 /**
- * Saves the XML internal to the actual File
+ * Writes the internal XML tree to the actual File, the mutex
+ * being held by the caller
  *
  * @return void
  */
-  void 
-save_xml_tree()
+  static void 
+write_xml_tree()
 {
-  pthread_mutex_lock(service_xml_file->mutex);
   service_xml_file->fp = fopen(XML_FILE_NAME, "w");
   if(service_xml_file->fp == NULL)
   {
-    pthread_mutex_unlock(service_xml_file->mutex);
     printf("Impossible to open the XML file\n");
-    return HPD_E_FAILED_TO_OPEN_FILE;
+    return;
   }
   mxmlSaveFile(service_xml_file->xml_tree, service_xml_file->fp, MXML_NO_CALLBACK);
   fclose(service_xml_file->fp);
+  service_xml_file->dirty = 0;
+}
+
+/**
+ * Saves the XML internal to the actual File. While a batch is
+ * open the tree is only marked as modified, and is written once
+ * when the last batch is committed
+ *
+ * @return void
+ */
+  void 
+save_xml_tree()
+{
+  pthread_mutex_lock(service_xml_file->mutex);
+  if(service_xml_file->batch > 0)
+    service_xml_file->dirty = 1;
+  else
+    write_xml_tree();
+  pthread_mutex_unlock(service_xml_file->mutex);
+}
+
+/**
+ * Begins a batch of changes to the XML file. Batches can be
+ * nested, the file is written when the outermost one is committed
+ *
+ * @return void
+ */
+  void 
+begin_xml_batch()
+{
+  if(service_xml_file == NULL)
+    return;
+  pthread_mutex_lock(service_xml_file->mutex);
+  service_xml_file->batch++;
+  pthread_mutex_unlock(service_xml_file->mutex);
+}
+
+/**
+ * Commits a batch of changes begun with begin_xml_batch, writing
+ * the XML file once if it was modified during the batch
+ *
+ * @return void
+ */
+  void 
+commit_xml_batch()
+{
+  if(service_xml_file == NULL)
+    return;
+  pthread_mutex_lock(service_xml_file->mutex);
+  if(service_xml_file->batch > 0 && --service_xml_file->batch == 0
+      && service_xml_file->dirty)
+    write_xml_tree();
   pthread_mutex_unlock(service_xml_file->mutex);
 }
 
@@ -127,30 +180,10 @@ init_xml_file(char *name, char *id)
   int 
 device_is_in_xml_file(Device *device)
 {
-  mxml_node_t *xml_device;
-
-  for (xml_device = mxmlFindElement(service_xml_file->xml_tree, 
-	service_xml_file->xml_tree,
-	"device", 
-	NULL, 
-	NULL, 
-	MXML_DESCEND);
-      xml_device != NULL;
-      xml_device = mxmlFindElement(	xml_device, 
-	service_xml_file->xml_tree,
-	"device", 
-	NULL, 
-	NULL, 
-	MXML_DESCEND))
-  {
-    if(strcmp(mxmlElementGetAttr(xml_device,"type") , device->type) == 0
-	&& strcmp(mxmlElementGetAttr(xml_device,"id") , device->ID) == 0)
-    {
-      return HPD_YES;
-    }
-  }
+  if(get_xml_node_of_device(device) == NULL)
+    return HPD_NO;
 
-      return HPD_NO;
+  return HPD_YES;
 }
 
 /**
@@ -163,75 +196,23 @@ device_is_in_xml_file(Device *device)
   int 
 service_is_in_xml_file(Service *service)
 {
-  if( device_is_in_xml_file(service->device) == HPD_NO )
+  if(get_xml_node_of_service(service) == NULL)
     return HPD_NO;
 
-  mxml_node_t *device = get_xml_node_of_device(service->device);
-  if(device == NULL)
-  {
-    printf("Error while retrieving device node\n");
-    return HPD_E_IMPOSSIBLE_TO_RETRIEVE_DEVICE_XML_NODE;
-  }
-
-  mxml_node_t *xml_service;
-
-  for (device = mxmlFindElement(service_xml_file->xml_tree, 
-	service_xml_file->xml_tree,
-	"device", 
-	NULL, 
-	NULL, 
-	MXML_DESCEND);
-      device != NULL;
-      device = mxmlFindElement(	device, 
-	service_xml_file->xml_tree, 
-	"device", 
-	NULL, 
-	NULL, 
-	MXML_DESCEND))
-  {
-    if(strcmp(mxmlElementGetAttr(device,"type") , service->device->type) == 0
-	&& strcmp(mxmlElementGetAttr(device,"id") , service->device->ID) == 0)
-    {
-      for (xml_service = mxmlFindElement(	device, 
-	    device,
-	    "service", 
-	    NULL, 
-	    NULL, 
-	    MXML_DESCEND);
-	  xml_service != NULL;
-	  xml_service = mxmlFindElement(	xml_service, 
-	    device, 
-	    "service", 
-	    NULL, 
-	    NULL, 
-	    MXML_DESCEND))
-      {
-	if(strcmp(mxmlElementGetAttr(xml_service,"type") , service->type) == 0
-	    && strcmp(mxmlElementGetAttr(xml_service,"id") , service->ID) == 0)
-	{
-	  return HPD_YES;
-	}
-      }
-    }
-  }
-
-  return HPD_NO;
+  return HPD_YES;
 }
 
 /**
- * Adds a specific device to the XML document
+ * Creates the node of a Device under the devicelist, without
+ * saving the XML file
  *
  * @param device_to_add The device to add
  *
- * @return returns HPD_E_SUCCESS if successful and HPD_E_DEVICE_ALREADY_IN_XML or HPD_E_XML_ERROR  if failed
+ * @return returns the new node or NULL if there is no devicelist
  */
-  int 
-add_device_to_xml(Device *device_to_add)
+  static mxml_node_t *
+new_device_node(Device *device_to_add)
 {
-
-  if(device_is_in_xml_file (device_to_add) == HPD_YES)
-    return HPD_E_DEVICE_ALREADY_IN_XML;
-
   mxml_node_t *devicelist;
   mxml_node_t *new_device;
 
@@ -239,7 +220,7 @@ add_device_to_xml(Device *device_to_add)
   if(devicelist == NULL)
   {
     printf("No \"devicelist\" in the XML file\n");
-    return HPD_E_XML_ERROR;
+    return NULL;
   }
 
   new_device = mxmlNewElement(devicelist, "device");
@@ -253,6 +234,26 @@ add_device_to_xml(Device *device_to_add)
   if(device_to_add->location != NULL) mxmlElementSetAttr(new_device, "location", device_to_add->location);
   if(device_to_add->type != NULL) mxmlElementSetAttr(new_device, "type", device_to_add->type);
 
+  return new_device;
+}
+
+/**
+ * Adds a specific device to the XML document
+ *
+ * @param device_to_add The device to add
+ *
+ * @return returns HPD_E_SUCCESS if successful and HPD_E_DEVICE_ALREADY_IN_XML or HPD_E_XML_ERROR  if failed
+ */
+  int 
+add_device_to_xml(Device *device_to_add)
+{
+
+  if(device_is_in_xml_file (device_to_add) == HPD_YES)
+    return HPD_E_DEVICE_ALREADY_IN_XML;
+
+  if(new_device_node (device_to_add) == NULL)
+    return HPD_E_XML_ERROR;
+
   save_xml_tree (); 
 
   return HPD_E_SUCCESS;
@@ -283,6 +284,33 @@ get_xml_node_of_device(Device *_device)
   return NULL;
 }
 
+/**
+ * Finds the node of a Service among the children of the node of its Device
+ *
+ * @param device The node of the Service's Device
+ * @param _service The service concerned
+ *
+ * @return returns the mxml_node_t corresponding to the Service of NULL if not found
+ */
+  static mxml_node_t *
+find_service_node(mxml_node_t *device, Service *_service)
+{
+  mxml_node_t *service;
+
+  for (service = mxmlFindElement(device, device,"service", NULL, NULL, MXML_DESCEND);
+      service != NULL;
+      service = mxmlFindElement(service, device, "service", NULL, NULL, MXML_DESCEND))
+  {
+    if(strcmp(mxmlElementGetAttr(service,"type") , _service->type) == 0
+	&& strcmp(mxmlElementGetAttr(service,"id") , _service->ID) == 0)
+    {
+      return service;
+    }
+  }
+
+  return NULL;
+}
+
 /**
  * Gets the internal node for a given Service
  *
@@ -293,39 +321,11 @@ get_xml_node_of_device(Device *_device)
   mxml_node_t *
 get_xml_node_of_service(Service *_service)
 {
-  if( device_is_in_xml_file(_service->device) == HPD_NO )
-    return NULL;
-
   mxml_node_t *device = get_xml_node_of_device(_service->device);
   if(device == NULL)
-  {
-    printf("Error while retrieving device node\n");
     return NULL;
-  }
-
-  mxml_node_t *service;
 
-  for (device = mxmlFindElement(service_xml_file->xml_tree, service_xml_file->xml_tree,"device", NULL, NULL, MXML_DESCEND);
-      device != NULL;
-      device = mxmlFindElement(device, service_xml_file->xml_tree, "device", NULL, NULL, MXML_DESCEND))
-  {
-    if(strcmp(mxmlElementGetAttr(device,"type") , _service->device->type) == 0
-	&& strcmp(mxmlElementGetAttr(device,"id") , _service->device->ID) == 0)
-    {
-      for (service = mxmlFindElement(device, device,"service", NULL, NULL, MXML_DESCEND);
-	  service != NULL;
-	  service = mxmlFindElement(service, device, "service", NULL, NULL, MXML_DESCEND))
-      {
-	if(strcmp(mxmlElementGetAttr(service,"type") , _service->type) == 0
-	    && strcmp(mxmlElementGetAttr(service,"id") , _service->ID) == 0)
-	{
-	  return service;
-	}
-      }
-    }
-  }
-
-  return NULL;
+  return find_service_node(device, _service);
 }
 
 /**
@@ -338,14 +338,12 @@ get_xml_node_of_service(Service *_service)
   int 
 add_service_to_xml(Service *service_to_add)
 {
-  if(service_is_in_xml_file (service_to_add) == HPD_YES)
+  mxml_node_t *device = get_xml_node_of_device(service_to_add->device);
+  if(device == NULL)
+    device = new_device_node(service_to_add->device);
+  else if(find_service_node(device, service_to_add) != NULL)
     return HPD_E_SERVICE_ALREADY_IN_XML;
-  else if(device_is_in_xml_file (service_to_add->device) == HPD_NO)
-  {
-    add_device_to_xml (service_to_add->device);
-  }
 
-  mxml_node_t *device = get_xml_node_of_device(service_to_add->device);
   if(device == NULL)
   {
     printf("Error while retrieving device node\n");
@@ -476,15 +474,10 @@ timestamp ( void )
   int 
 remove_service_from_XML(Service *_service)
 {
-  if(service_is_in_xml_file (_service) == HPD_NO)
-    return HPD_E_SERVICE_NOT_IN_LIST;
-
   mxml_node_t *service = get_xml_node_of_service (_service);
   if(service == NULL)
-  {
-    printf("Impossible to retrieve Service XML node\n");
-    return HPD_E_IMPOSSIBLE_TO_RETRIEVE_SERVICE_XML_NODE;
-  }
+    return HPD_E_SERVICE_NOT_IN_LIST;
+
   mxmlRemove(service);
   mxmlDelete(service);
   save_xml_tree ();
@@ -501,15 +494,10 @@ remove_service_from_XML(Service *_service)
   int 
 remove_device_from_XML(Device *_device)
 {
-  if(device_is_in_xml_file (_device) == HPD_NO)
-    return HPD_E_SERVICE_NOT_IN_LIST;
-
   mxml_node_t *device = get_xml_node_of_device(_device);
   if(device == NULL)
-  {
-    printf("Error while retrieving device node\n");
-    return HPD_E_IMPOSSIBLE_TO_RETRIEVE_DEVICE_XML_NODE;
-  }
+    return HPD_E_SERVICE_NOT_IN_LIST;
+
   mxmlRemove(device);
   mxmlDelete(device);
   save_xml_tree ();
@@ -539,7 +527,7 @@ delete_xml(char* xml_file_path)
  * @return The string of the value or NULL if failed
  */
   char* 
-get_value_from_xml_value(char* xml_value)
+get_value_from_xml_value(const char* xml_value)
 {
   mxml_node_t *xml;
   mxml_node_t *node;
@@ -567,6 +555,111 @@ get_value_from_xml_value(char* xml_value)
   return return_value;
 }
 
+/**
+ * Parses a batch of operations under the form of :
+ * "<batch><operation method="GET" url="/a/1/b/1"/>
+ *  <operation method="PUT" url="/a/1/b/2"><value>1</value></operation></batch>"
+ *
+ * @param xml_batch The XML formatted batch
+ *
+ * @param on_operation Called with the method, url and value (NULL for
+ * 		       GETs) of each operation, in order
+ *
+ * @param data Given to on_operation
+ *
+ * @return The number of operations, or -1 if the XML is malformed
+ */
+  int
+parse_xml_batch(const char *xml_batch, batch_operation_cb on_operation, void *data)
+{
+  mxml_node_t *xml;
+  mxml_node_t *batch;
+  mxml_node_t *node;
+  mxml_node_t *value;
+  const char *method, *url, *text;
+  int n = 0;
+
+  xml = mxmlLoadString(NULL, xml_batch, MXML_TEXT_CALLBACK);
+  if(xml == NULL)
+  {
+    printf("XML batch format uncompatible with HomePort\n");
+    return -1;
+  }
+
+  batch = mxmlFindElement(xml, xml, "batch", NULL, NULL, MXML_DESCEND);
+  if(batch == NULL)
+  {
+    mxmlDelete(xml);
+    printf("No \"batch\" in the XML file\n");
+    return -1;
+  }
+
+  for(node = mxmlFindElement(batch, batch, "operation", NULL, NULL, MXML_DESCEND_FIRST);
+      node != NULL;
+      node = mxmlFindElement(node, batch, "operation", NULL, NULL, MXML_NO_DESCEND))
+  {
+    method = mxmlElementGetAttr(node, "method");
+    url = mxmlElementGetAttr(node, "url");
+    text = NULL;
+    value = mxmlFindElement(node, node, "value", NULL, NULL, MXML_DESCEND_FIRST);
+    if(value != NULL && value->child != NULL)
+      text = value->child->value.text.string;
+    on_operation(data, method, url, text);
+    n++;
+  }
+
+  mxmlDelete(xml);
+
+  return n;
+}
+
+/**
+ * Returns the results of a batch of operations under the form of :
+ * "<?xml version="1.0" encoding="UTF-8"?><batch><result url="/a/1/b/1" status="200">
+ *  <value timestamp = xxxxxx >desired_value</value></result>...</batch>"
+ *
+ * @param n The number of operations
+ *
+ * @param urls The url of each operation
+ *
+ * @param statuses The HTTP status code of each operation
+ *
+ * @param values The value of each operation, or NULL when it has none
+ *
+ * @return Returns the char* corresponding
+ */
+  char *
+get_xml_batch_result(int n, char **urls, int *statuses, char **values)
+{
+  mxml_node_t *xml;
+  mxml_node_t *batch;
+  mxml_node_t *result;
+  mxml_node_t *xml_value;
+  char status[8];
+  int i;
+
+  xml = mxmlNewXML("1.0");
+  batch = mxmlNewElement(xml, "batch");
+  for(i = 0; i < n; i++)
+  {
+    result = mxmlNewElement(batch, "result");
+    if(urls[i] != NULL) mxmlElementSetAttr(result, "url", urls[i]);
+    sprintf(status, "%d", statuses[i]);
+    mxmlElementSetAttr(result, "status", status);
+    if(values[i] != NULL)
+    {
+      xml_value = mxmlNewElement(result, "value");
+      mxmlElementSetAttr(xml_value, "timestamp", timestamp());
+      mxmlNewText(xml_value, 0, values[i]);
+    }
+  }
+
+  char* return_value = mxmlSaveAllocString(xml, MXML_NO_CALLBACK);
+  mxmlDelete(xml);
+
+  return return_value;
+}
+
 /**
  * Extracts the service XML description given its internal structure
  *
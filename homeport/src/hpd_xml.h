@@ -48,12 +48,17 @@ authors and should not be interpreted as representing official policies, either
 #define	XML_FILE_NAME "services.xml"
 #define	DEVICE_LIST_ID "12345"
 
+typedef void (*batch_operation_cb)(void *data, const char *method,
+                                   const char *url, const char *value);
+
 typedef struct serviceXmlFile serviceXmlFile;
 struct serviceXmlFile
 {
     FILE *fp;/**<The actual File "services.xml"*/
     mxml_node_t *xml_tree;/**<The internal XML File*/
     pthread_mutex_t *mutex;/**<The mutex used to access the file*/
+    int batch;/**<Depth of the batches of changes begun and not yet committed*/
+    int dirty;/**<Whether the tree was modified since the file was last written*/
 };
 
 int init_xml_file(char *name, char *id);
@@ -67,12 +72,16 @@ char * timestamp();
 int remove_service_from_XML(Service *_service); 
 int remove_device_from_XML(Device *_device); 
 int delete_xml(char* xml_file_path); 
-char* get_value_from_xml_value(char* _xml_value); 
+char* get_value_from_xml_value(const char* _xml_value); 
+int parse_xml_batch(const char *xml_batch, batch_operation_cb on_operation, void *data);
+char *get_xml_batch_result(int n, char **urls, int *statuses, char **values);
 char *extract_service_xml(Service *_service_to_extract);
 const char * whitespace_cb(mxml_node_t *node, int where);
 void create_service_xml_file();
 void destroy_service_xml_file();
 void save_xml_tree();
+void begin_xml_batch();
+void commit_xml_batch();
 mxml_node_t *get_xml_node_of_device(Device *_device);
 mxml_node_t *get_xml_node_of_service(Service *_service);
 int update_device_xml( Device *device );
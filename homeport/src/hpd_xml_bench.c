@@ -0,0 +1,132 @@
+/*Copyright 2011 Aalborg University. All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification, are
+permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this list of
+      conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice, this list
+      of conditions and the following disclaimer in the documentation and/or other materials
+      provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+The views and conclusions contained in the software and documentation are those of the
+authors and should not be interpreted as representing official policies, either expressed*/
+
+/**
+ * @file hpd_xml_bench.c
+ * @brief  Benchmarks of the XML serialisation of values and batches
+ * @author Thibaut Le Guilly
+ */
+
+#include "hpd_xml.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BATCH 16        ///< Number of results in a batch
+
+static char *urls[BATCH];
+static char *values[BATCH];
+static int statuses[BATCH];
+
+/**
+ * Serialises a single value
+ *
+ * @param data Unused
+ * @param n Number of operations
+ */
+static void
+bench_value(void *data, size_t n)
+{
+  size_t i;
+  char *xml;
+
+  for (i = 0; i < n; i++)
+  {
+    xml = get_xml_value("21.5");
+    bench_use(xml);
+    free(xml);
+  }
+}
+
+/**
+ * Serialises a subscription answer
+ *
+ * @param data Unused
+ * @param n Number of operations
+ */
+static void
+bench_subscription(void *data, size_t n)
+{
+  size_t i;
+  char *xml;
+
+  for (i = 0; i < n; i++)
+  {
+    xml = get_xml_subscription("21.5", "/events/7f3c2a");
+    bench_use(xml);
+    free(xml);
+  }
+}
+
+/**
+ * Serialises the results of a batch of BATCH requests
+ *
+ * @param data Unused
+ * @param n Number of operations
+ */
+static void
+bench_batch(void *data, size_t n)
+{
+  size_t i;
+  char *xml;
+
+  for (i = 0; i < n; i++)
+  {
+    xml = get_xml_batch_result(BATCH, urls, statuses, values);
+    bench_use(xml);
+    free(xml);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, stat;
+  char buf[64];
+
+  for (i = 0; i < BATCH; i++)
+  {
+    snprintf(buf, sizeof(buf), "/device/Lamp/%d/Switch/0", i);
+    urls[i] = strdup(buf);
+    snprintf(buf, sizeof(buf), "%d", i % 2);
+    values[i] = strdup(buf);
+    statuses[i] = 200;
+  }
+
+  bench_init("hpd_xml", argc, argv);
+  bench_run("xml_value", bench_value, NULL);
+  bench_run("xml_subscription", bench_subscription, NULL);
+  bench_run("xml_batch_16", bench_batch, NULL);
+  stat = bench_finish();
+
+  for (i = 0; i < BATCH; i++)
+  {
+    free(urls[i]);
+    free(values[i]);
+  }
+  return stat;
+}
@@ -44,6 +44,7 @@ struct ev_loop;
 struct httpws;
 struct http_request;
 struct http_response;
+struct http_websocket;
 
 /**********************************************************************
  *  Callbacks                                                         *
@@ -56,6 +57,7 @@ typedef int (*httpws_data_cb)(
 typedef int (*httpws_nodata_cb)(
       struct httpws *ins, struct http_request *req,
       void* ws_ctx, void** req_data);
+typedef size_t (*httpws_produce_cb)(void *data, char *buf, size_t cap);
 
 /// Settings struct for webserver
 /**
@@ -93,10 +95,38 @@ typedef int (*httpws_nodata_cb)(
  *  on_req_body -> on_req_cmpl;
  *  }
  *  \enddot
+ *
+ *  Connections are guarded by a deadline per phase of a request. The
+ *  request line and headers must be received within header_timeout
+ *  seconds. The body must be received within body_timeout seconds,
+ *  extended by one second for every body_min_rate bytes received. At
+ *  any other time, e.g. before a request begins, timeout is the number
+ *  of seconds a connection may stay idle. A header_timeout or
+ *  body_timeout of 0 uses the idle timeout instead, and a body_min_rate
+ *  of 0 makes the body deadline fixed. Connections are closed without a
+ *  response when a deadline is missed.
+ *
+ *  Requests with a URL longer than max_url_size are answered with "414
+ *  URI Too Long". Requests with more than max_headers headers, or more
+ *  than max_header_size bytes of header fields and values, are answered
+ *  with "431 Request Header Fields Too Large". Both close the
+ *  connection.
+ *
+ *  If h2c is set, clients may use HTTP/2 over cleartext, either by
+ *  prior knowledge or by upgrading a HTTP/1.1 request. Each HTTP/2
+ *  stream is presented as a separate http request, calling the same
+ *  callbacks as above, and responses are sent on the stream.
  */
 struct httpws_settings {
    enum ws_port port;
    int timeout;
+   int header_timeout;
+   int body_timeout;
+   size_t body_min_rate;
+   size_t max_url_size;
+   size_t max_headers;
+   size_t max_header_size;
+   int h2c;
    void* ws_ctx;
    httpws_nodata_cb on_req_begin;
    httpws_data_cb   on_req_method;
@@ -120,6 +150,13 @@ struct httpws_settings {
 #define HTTPWS_SETTINGS_DEFAULT { \
    .port = WS_PORT_HTTP, \
    .timeout = 15, \
+   .header_timeout = 20, \
+   .body_timeout = 20, \
+   .body_min_rate = 500, \
+   .max_url_size = 8192, \
+   .max_headers = 100, \
+   .max_header_size = 16384, \
+   .h2c = 1, \
    .ws_ctx = NULL, \
    .on_req_begin = NULL, \
    .on_req_method = NULL, \
@@ -132,6 +169,45 @@ struct httpws_settings {
    .on_req_destroy = NULL, \
    .on_req_cmpl = NULL }
 
+typedef int (*httpws_ws_data_cb)(
+      struct http_websocket *ws, void* ws_ctx, void** ws_data,
+      int binary, const char *buf, size_t len);
+typedef void (*httpws_ws_nodata_cb)(
+      struct http_websocket *ws, void* ws_ctx, void** ws_data);
+
+/// Settings struct for websockets
+/**
+ *  Please initialise this struct as following, to ensure that all
+ *  settings have acceptable default values:
+ *  \code
+ *  struct http_websocket_settings settings =
+ *     HTTP_WEBSOCKET_SETTINGS_DEFAULT;
+ *  \endcode
+ *
+ *  on_message is called once for each full message received, that is
+ *  fragmented messages are reassembled before the call. The message is
+ *  null-terminated for convenience, but may contain null characters if
+ *  it is binary. Returning non-zero from on_message closes the
+ *  websocket. Messages longer than max_message_size closes the
+ *  websocket with status 1009.
+ *
+ *  on_close is called when the connection is destroyed, no matter which
+ *  side closed it.
+ */
+struct http_websocket_settings {
+   size_t max_message_size;
+   void* ws_ctx;
+   httpws_ws_data_cb   on_message;
+   httpws_ws_nodata_cb on_close;
+};
+
+/// Default settings for websockets
+#define HTTP_WEBSOCKET_SETTINGS_DEFAULT { \
+   .max_message_size = 65536, \
+   .ws_ctx = NULL, \
+   .on_message = NULL, \
+   .on_close = NULL }
+
 // Webserver functions
 struct httpws *  httpws_create  (struct httpws_settings *settings,
                                  struct ev_loop *loop);
@@ -153,6 +229,7 @@ const char *      http_request_get_cookie    (struct http_request *req,
                                               const char* key);
 const char *      http_request_get_ip        (struct http_request *req);
 void              http_request_keep_open     (struct http_request *req);
+int               http_request_is_websocket  (struct http_request *req);
 
 // Response functions
 void  http_response_destroy    (struct http_response *res);
@@ -165,6 +242,11 @@ void  http_response_sendf      (struct http_response *res,
                                 const char *fmt, ...);
 void  http_response_vsendf     (struct http_response *res,
                                 const char *fmt, va_list arg);
+int   http_response_produce    (struct http_response *res,
+                                size_t window,
+                                httpws_produce_cb produce, void *data);
+int   http_response_send_raw   (struct http_request *req,
+                                const char *buf, size_t len);
 int   http_response_add_cookie (struct http_response *res,
                                 const char *field, const char *value,
                                 const char *expires, const char *max_age,
@@ -172,5 +254,21 @@ int   http_response_add_cookie (struct http_response *res,
                                 int secure, int http_only,
                                 const char *extension);
 
+// Websocket functions
+struct http_websocket *
+      http_websocket_accept    (struct http_request *req,
+                                struct http_websocket_settings *settings,
+                                void *data);
+int   http_websocket_send      (struct http_websocket *ws, int binary,
+                                const char *buf, size_t len);
+int   http_websocket_sendf     (struct http_websocket *ws,
+                                const char *fmt, ...);
+int   http_websocket_vsendf    (struct http_websocket *ws,
+                                const char *fmt, va_list arg);
+int   http_websocket_ping      (struct http_websocket *ws);
+void  http_websocket_close     (struct http_websocket *ws,
+                                unsigned short code);
+const char *
+      http_websocket_get_ip    (struct http_websocket *ws);
 
 #endif
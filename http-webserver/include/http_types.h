@@ -41,10 +41,15 @@
 #define HTTPWS_HTTP_STATUS_CODE_MAP(XX) \
 	XX(200,200 OK) \
 	XX(201,201 Created) \
+	XX(207,207 Multi-Status) \
 	XX(303,303 See Other) \
    XX(400,400 Bad Request) \
 	XX(404,404 Not Found) \
    XX(405,405 Method Not Allowed) \
+   XX(413,413 Request Entity Too Large) \
+   XX(414,414 URI Too Long) \
+   XX(429,429 Too Many Requests) \
+   XX(431,431 Request Header Fields Too Large) \
    XX(500,500 Internal Server Error)
 
 /// HTTP status codes
@@ -0,0 +1,1210 @@
+// h2.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+*   
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*  
+*  1. Redistributions of source code must retain the above copyright
+*  notice, this list of conditions and the following disclaimer.
+*  
+*  2. Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*  
+*  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+*  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+*  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+*  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+*  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+*  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+*  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+*  SUCH DAMAGE.
+*  
+*  The views and conclusions contained in the software and
+*  documentation are those of the authors and should not be interpreted
+*  as representing official policies, either expressed.
+*/
+
+#include "h2.h"
+#include "hpack.h"
+#include "request.h"
+#include "webserver.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+/// Client connection preface, see RFC 7540 3.5
+#define PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define PREFACE_LEN 24
+
+#define FRAME_HEADER_LEN 9         ///< Length of frame header
+#define DEFAULT_FRAME_SIZE 16384   ///< Initial SETTINGS_MAX_FRAME_SIZE
+#define MAX_FRAME_SIZE 16777215    ///< Highest SETTINGS_MAX_FRAME_SIZE
+#define DEFAULT_WINDOW 65535       ///< Initial flow control window
+#define MAX_WINDOW 0x7FFFFFFF      ///< Highest flow control window
+#define HEADER_TABLE_SIZE 4096     ///< Our SETTINGS_HEADER_TABLE_SIZE
+#define MAX_STREAMS 100            ///< Our SETTINGS_MAX_CONCURRENT_STREAMS
+#define MAX_HEADER_BLOCK 65536     ///< Largest header block accepted
+
+/// Frame types, see RFC 7540 6
+enum frame_type {
+   F_DATA          = 0x0,
+   F_HEADERS       = 0x1,
+   F_PRIORITY      = 0x2,
+   F_RST_STREAM    = 0x3,
+   F_SETTINGS      = 0x4,
+   F_PUSH_PROMISE  = 0x5,
+   F_PING          = 0x6,
+   F_GOAWAY        = 0x7,
+   F_WINDOW_UPDATE = 0x8,
+   F_CONTINUATION  = 0x9
+};
+
+/// Frame flags
+enum frame_flag {
+   FL_END_STREAM  = 0x1,
+   FL_ACK         = 0x1,
+   FL_END_HEADERS = 0x4,
+   FL_PADDED      = 0x8,
+   FL_PRIORITY    = 0x20
+};
+
+/// Error codes, see RFC 7540 7
+enum error_code {
+   E_NO_ERROR      = 0x0,
+   E_PROTOCOL      = 0x1,
+   E_INTERNAL      = 0x2,
+   E_FLOW_CONTROL  = 0x3,
+   E_STREAM_CLOSED = 0x5,
+   E_FRAME_SIZE    = 0x6,
+   E_REFUSED       = 0x7,
+   E_COMPRESSION   = 0x9
+};
+
+/// Settings parameters, see RFC 7540 6.5.2
+enum settings_id {
+   SET_HEADER_TABLE_SIZE      = 0x1,
+   SET_ENABLE_PUSH            = 0x2,
+   SET_MAX_CONCURRENT_STREAMS = 0x3,
+   SET_INITIAL_WINDOW_SIZE    = 0x4,
+   SET_MAX_FRAME_SIZE         = 0x5,
+   SET_MAX_HEADER_LIST_SIZE   = 0x6
+};
+
+/// A HTTP/2 stream
+/**
+ *  Each stream carries a single http request. The request is fed with a
+ *  HTTP/1.1 message constructed from the HEADERS and DATA frames of the
+ *  stream, such that it calls the callbacks from httpws_settings just
+ *  as for a HTTP/1.x connection. Responses to the request are sent with
+ *  h2_stream_start(), h2_stream_add_header(), h2_stream_send() and
+ *  h2_stream_end().
+ *
+ *  Response data is queued in the stream until the flow control windows
+ *  of both the stream and the connection allows it to be sent.
+ *
+ *  Streams are destroyed together with their request, once both sides
+ *  have closed the stream. This is deferred until the current chunk of
+ *  data has been parsed, as the response is usually ended from within
+ *  the callbacks of the request. Responses ended later, outside of the
+ *  parser, are reaped once their last frame has been sent, see
+ *  h2_conn_sent().
+ */
+struct h2_stream {
+   struct h2_conn *h2;        ///< Connection
+   unsigned int id;           ///< Stream identifier
+   struct http_request *req;  ///< Request carried
+   int owned;                 ///< Request is destroyed with stream ?
+   int chunked;               ///< Body is passed on as chunked ?
+   int remote_closed;         ///< Client has ended stream ?
+   int local_closed;          ///< END_STREAM has been sent ?
+   int end_pending;           ///< END_STREAM to be sent after data ?
+   int headers_sent;          ///< Response headers sent ?
+   int reset;                 ///< Stream has been reset ?
+   int dead;                  ///< Stream is being destroyed ?
+   long window;               ///< Send window
+   char *hdrs;                ///< Encoded response headers
+   size_t hdrs_len;           ///< Length of encoded headers
+   char *out;                 ///< Data waiting for window
+   size_t out_len;            ///< Length of waiting data
+   struct h2_stream *next;    ///< Next stream on connection
+};
+
+/// A HTTP/2 connection
+/**
+ *  Created from the http request of a connection, when the connection
+ *  either begins with the HTTP/2 preface or upgrades to h2c. From then
+ *  on all data received on the connection is passed to h2_conn_parse().
+ */
+struct h2_conn {
+   struct httpws *webserver;         ///< HTTP Webserver
+   struct httpws_settings *settings; ///< Settings
+   struct ws_conn *conn;             ///< Connection to client
+   struct hpack *decoder;            ///< HPACK decoding context
+   size_t preface;                   ///< Bytes of preface received
+   int goaway;                       ///< GOAWAY sent, closing ?
+   int remote_goaway;                ///< Client sent a GOAWAY ?
+   char *in;                         ///< Partial frame received
+   size_t in_len;                    ///< Length of partial frame
+   char *block;                      ///< Header block being received
+   size_t block_len;                 ///< Length of header block
+   unsigned int block_stream;        ///< Stream of header block
+   int block_end_stream;             ///< Header block ends stream ?
+   unsigned int last_stream;         ///< Highest stream identifier
+   size_t streams_open;              ///< Number of streams
+   long window;                      ///< Connection send window
+   long initial_window;              ///< Initial stream send window
+   size_t max_frame;                 ///< Largest frame peer accepts
+   struct h2_stream *streams;        ///< Streams
+};
+
+/// Request constructed from a header block
+struct request_build {
+   char *method;       ///< :method
+   char *path;         ///< :path
+   char *authority;    ///< :authority
+   char *text;         ///< Regular headers as HTTP/1.1 text
+   size_t text_len;    ///< Length of text
+   int regular;        ///< Regular header seen ?
+   int content_length; ///< Content-Length seen ?
+   int end_stream;     ///< Stream ends with headers ?
+   int error;          ///< Malformed request ?
+};
+
+/// Append bytes to a buffer
+static int append(char **buf, size_t *len, const char *data, size_t n)
+{
+   char *new = realloc(*buf, *len + n + 1);
+   if (!new) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return 1;
+   }
+   memcpy(&new[*len], data, n);
+   *len += n;
+   new[*len] = '\0';
+   *buf = new;
+   return 0;
+}
+
+/// Read a 32 bit integer in network byte order
+static unsigned long get_u32(const char *buf)
+{
+   const unsigned char *b = (const unsigned char *)buf;
+   return (unsigned long)b[0] << 24 | b[1] << 16 | b[2] << 8 | b[3];
+}
+
+/// Write a 32 bit integer in network byte order
+static void put_u32(char *buf, unsigned long v)
+{
+   buf[0] = v >> 24;
+   buf[1] = v >> 16;
+   buf[2] = v >> 8;
+   buf[3] = v;
+}
+
+/// Send a frame
+/**
+ *  \param  h2       The connection
+ *  \param  type     Frame type
+ *  \param  flags    Frame flags
+ *  \param  id       Stream identifier
+ *  \param  payload  Payload
+ *  \param  len      Length of payload
+ */
+static void send_frame(struct h2_conn *h2, int type, int flags,
+                       unsigned int id, const char *payload, size_t len)
+{
+   char hdr[FRAME_HEADER_LEN];
+
+   hdr[0] = len >> 16;
+   hdr[1] = len >> 8;
+   hdr[2] = len;
+   hdr[3] = type;
+   hdr[4] = flags;
+   put_u32(&hdr[5], id & 0x7FFFFFFF);
+
+   // TODO Sends returns a status
+   ws_conn_send(h2->conn, hdr, FRAME_HEADER_LEN);
+   if (len) ws_conn_send(h2->conn, payload, len);
+}
+
+/// Close the connection with a GOAWAY frame
+/**
+ *  The connection is closed when the frame has been sent. Further data
+ *  received is ignored.
+ *
+ *  \param  h2    The connection
+ *  \param  code  Error code
+ */
+static void conn_error(struct h2_conn *h2, enum error_code code)
+{
+   char payload[8];
+
+   if (h2->goaway) return;
+
+   put_u32(&payload[0], h2->last_stream);
+   put_u32(&payload[4], code);
+   send_frame(h2, F_GOAWAY, 0, 0, payload, 8);
+   h2->goaway = 1;
+   ws_conn_close(h2->conn);
+}
+
+/// Reset a stream with a RST_STREAM frame
+/**
+ *  \param  h2    The connection
+ *  \param  id    Stream identifier
+ *  \param  code  Error code
+ */
+static void stream_error(struct h2_conn *h2, unsigned int id,
+                         enum error_code code)
+{
+   char payload[4];
+
+   put_u32(payload, code);
+   send_frame(h2, F_RST_STREAM, 0, id, payload, 4);
+}
+
+/// Find a stream on a connection
+static struct h2_stream *find_stream(struct h2_conn *h2, unsigned int id)
+{
+   struct h2_stream *stream;
+   for (stream = h2->streams; stream; stream = stream->next)
+      if (stream->id == id) return stream;
+   return NULL;
+}
+
+/// Create a new stream on a connection
+/**
+ *  \param  h2  The connection
+ *  \param  id  Stream identifier
+ *
+ *  \return The new stream or NULL on failure
+ */
+static struct h2_stream *stream_create(struct h2_conn *h2, unsigned int id)
+{
+   struct h2_stream *stream = calloc(1, sizeof(struct h2_stream));
+   if (!stream) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return NULL;
+   }
+
+   stream->h2 = h2;
+   stream->id = id;
+   stream->window = h2->initial_window;
+   stream->next = h2->streams;
+   h2->streams = stream;
+   h2->streams_open++;
+
+   return stream;
+}
+
+/// Destroy a stream, including its request if owned
+/**
+ *  \param  stream  The stream to destroy
+ */
+static void stream_destroy(struct h2_stream *stream)
+{
+   struct h2_conn *h2 = stream->h2;
+   struct h2_stream **s;
+
+   // The request may end the response while being destroyed
+   stream->dead = 1;
+   if (stream->req) {
+      if (stream->owned)
+         http_request_destroy(stream->req);
+      else
+         http_request_set_stream(stream->req, NULL);
+   }
+
+   for (s = &h2->streams; *s; s = &(*s)->next) {
+      if (*s == stream) {
+         *s = stream->next;
+         break;
+      }
+   }
+   h2->streams_open--;
+
+   free(stream->hdrs);
+   free(stream->out);
+   free(stream);
+}
+
+/// Destroy streams that have been closed by both sides
+static void reap_streams(struct h2_conn *h2)
+{
+   struct h2_stream *stream, *next;
+
+   for (stream = h2->streams; stream; stream = next) {
+      next = stream->next;
+      if (stream->reset || (stream->remote_closed && stream->local_closed))
+         stream_destroy(stream);
+   }
+}
+
+/// Send as much waiting data on a stream as the windows allow
+/**
+ *  Sends END_STREAM with the last data, if the response has ended.
+ *
+ *  \param  stream  The stream
+ */
+static void flush_stream(struct h2_stream *stream)
+{
+   struct h2_conn *h2 = stream->h2;
+   size_t n;
+   int end;
+
+   while (stream->out_len && stream->window > 0 && h2->window > 0) {
+      n = stream->out_len;
+      if (n > stream->window) n = stream->window;
+      if (n > h2->window) n = h2->window;
+      if (n > h2->max_frame) n = h2->max_frame;
+      end = stream->end_pending && n == stream->out_len;
+
+      send_frame(h2, F_DATA, end ? FL_END_STREAM : 0, stream->id,
+                 stream->out, n);
+      stream->out_len -= n;
+      memmove(stream->out, &stream->out[n], stream->out_len);
+      stream->window -= n;
+      h2->window -= n;
+      if (end) stream->local_closed = 1;
+   }
+
+   if (stream->end_pending && !stream->out_len && !stream->local_closed) {
+      send_frame(h2, F_DATA, FL_END_STREAM, stream->id, NULL, 0);
+      stream->local_closed = 1;
+   }
+}
+
+/// Flush all streams on a connection
+static void flush_streams(struct h2_conn *h2)
+{
+   struct h2_stream *stream;
+   for (stream = h2->streams; stream && h2->window > 0; stream = stream->next)
+      if (!stream->reset && !stream->dead)
+         flush_stream(stream);
+}
+
+/// Send the response headers of a stream
+/**
+ *  The header block is split into a HEADERS frame and CONTINUATION
+ *  frames, if it exceeds the maximum frame size of the peer.
+ *
+ *  \param  stream      The stream
+ *  \param  end_stream  Set END_STREAM on the HEADERS frame ?
+ */
+static void send_headers(struct h2_stream *stream, int end_stream)
+{
+   struct h2_conn *h2 = stream->h2;
+   size_t pos = 0, n;
+   int type = F_HEADERS, flags;
+
+   // Responses without a status gets a 200
+   if (!stream->hdrs_len)
+      hpack_encode_status(&stream->hdrs, &stream->hdrs_len, 200);
+
+   do {
+      n = stream->hdrs_len - pos;
+      if (n > h2->max_frame) n = h2->max_frame;
+      flags = pos + n == stream->hdrs_len ? FL_END_HEADERS : 0;
+      if (type == F_HEADERS && end_stream) flags |= FL_END_STREAM;
+      send_frame(h2, type, flags, stream->id, &stream->hdrs[pos], n);
+      type = F_CONTINUATION;
+      pos += n;
+   } while (pos < stream->hdrs_len);
+
+   stream->headers_sent = 1;
+   free(stream->hdrs);
+   stream->hdrs = NULL;
+   stream->hdrs_len = 0;
+}
+
+/// Apply settings received from the client
+/**
+ *  \param  h2   The connection
+ *  \param  buf  Settings as in the payload of a SETTINGS frame
+ *  \param  len  Length of settings
+ *
+ *  \return 0 on success, or the error code for a connection error
+ */
+static int apply_settings(struct h2_conn *h2, const char *buf, size_t len)
+{
+   struct h2_stream *stream;
+   unsigned long value;
+   size_t i;
+   long delta;
+
+   for (i = 0; i + 6 <= len; i += 6) {
+      value = get_u32(&buf[i+2]);
+      switch ((unsigned char)buf[i] << 8 | (unsigned char)buf[i+1]) {
+         case SET_INITIAL_WINDOW_SIZE:
+            if (value > MAX_WINDOW) return E_FLOW_CONTROL;
+            delta = (long)value - h2->initial_window;
+            for (stream = h2->streams; stream; stream = stream->next) {
+               if (stream->window + delta > MAX_WINDOW)
+                  return E_FLOW_CONTROL;
+               stream->window += delta;
+            }
+            h2->initial_window = value;
+            break;
+         case SET_MAX_FRAME_SIZE:
+            if (value < DEFAULT_FRAME_SIZE || value > MAX_FRAME_SIZE)
+               return E_PROTOCOL;
+            h2->max_frame = value;
+            break;
+         case SET_ENABLE_PUSH:
+            if (value > 1) return E_PROTOCOL;
+            break;
+         default:
+            // The encoder never indexes, so SET_HEADER_TABLE_SIZE does
+            // not matter, and others are only advisory
+            break;
+      }
+   }
+
+   return 0;
+}
+
+/// Decode base64url without padding, as used in HTTP2-Settings
+/**
+ *  \param  in   Encoded string
+ *  \param  out  Buffer of at least 3*strlen(in)/4 bytes
+ *
+ *  \return Length of decoded data
+ */
+static size_t base64url_decode(const char *in, char *out)
+{
+   unsigned long v = 0;
+   size_t n = 0;
+   int bits = 0, c;
+
+   for (; *in && *in != '='; in++) {
+      c = *in;
+      if (c >= 'A' && c <= 'Z') c -= 'A';
+      else if (c >= 'a' && c <= 'z') c = c - 'a' + 26;
+      else if (c >= '0' && c <= '9') c = c - '0' + 52;
+      else if (c == '-' || c == '+') c = 62;
+      else if (c == '_' || c == '/') c = 63;
+      else break;
+      v = (v << 6) | c;
+      bits += 6;
+      if (bits >= 8) {
+         bits -= 8;
+         out[n++] = v >> bits;
+      }
+   }
+
+   return n;
+}
+
+/// HPACK callback collecting the headers of a request
+/**
+ *  Pseudo-headers are stored for the request line. Regular headers are
+ *  written as HTTP/1.1 header lines, with the name capitalised as
+ *  commonly done in HTTP/1.1, such that lookups of e.g. "Content-Type"
+ *  works for both versions. Connection-specific headers are malformed
+ *  in HTTP/2 and are dropped.
+ */
+static void on_header(void *data,
+                      const char *name, size_t name_len,
+                      const char *value, size_t value_len)
+{
+   struct request_build *b = data;
+   char **pseudo = NULL;
+   size_t i;
+   int upper = 1;
+   char c;
+
+   if (name[0] == ':') {
+      if (b->regular) b->error = 1;
+      if (strcmp(name, ":method") == 0) pseudo = &b->method;
+      else if (strcmp(name, ":path") == 0) pseudo = &b->path;
+      else if (strcmp(name, ":authority") == 0) pseudo = &b->authority;
+      else if (strcmp(name, ":scheme") == 0) return;
+      else b->error = 1;
+      if (pseudo && !*pseudo) *pseudo = strdup(value);
+      else b->error = 1;
+      return;
+   }
+
+   b->regular = 1;
+   if (strcmp(name, "connection") == 0 ||
+       strcmp(name, "keep-alive") == 0 ||
+       strcmp(name, "proxy-connection") == 0 ||
+       strcmp(name, "transfer-encoding") == 0 ||
+       strcmp(name, "upgrade") == 0)
+      return;
+   if (strcmp(name, "content-length") == 0) {
+      if (b->end_stream) return;
+      b->content_length = 1;
+   }
+
+   for (i = 0; i < name_len; i++) {
+      c = name[i];
+      if (upper) c = toupper((unsigned char)c);
+      upper = c == '-';
+      if (append(&b->text, &b->text_len, &c, 1)) b->error = 1;
+   }
+   if (append(&b->text, &b->text_len, ": ", 2) ||
+       append(&b->text, &b->text_len, value, value_len) ||
+       append(&b->text, &b->text_len, "\r\n", 2))
+      b->error = 1;
+}
+
+/// Pass body data of a stream on to its request
+static void stream_body(struct h2_stream *stream, const char *buf, size_t len)
+{
+   char size[20];
+
+   if (stream->chunked) {
+      sprintf(size, "%zx\r\n", len);
+      http_request_parse(stream->req, size, strlen(size));
+      http_request_parse(stream->req, buf, len);
+      http_request_parse(stream->req, "\r\n", 2);
+   } else {
+      http_request_parse(stream->req, buf, len);
+   }
+}
+
+/// Mark the end of the request on a stream
+static void stream_remote_close(struct h2_stream *stream)
+{
+   if (stream->chunked)
+      http_request_parse(stream->req, "0\r\n\r\n", 5);
+   stream->remote_closed = 1;
+}
+
+/// Handle a complete header block
+/**
+ *  Opens a new stream with a request, or ends the request on an
+ *  existing stream, if the header block is trailers.
+ *
+ *  \param  h2  The connection
+ */
+static void headers_complete(struct h2_conn *h2)
+{
+   struct request_build b;
+   struct h2_stream *stream;
+   unsigned int id = h2->block_stream;
+   char *text = NULL;
+   size_t text_len = 0;
+
+   memset(&b, 0, sizeof(b));
+   b.end_stream = h2->block_end_stream;
+   h2->block_stream = 0;
+
+   // Always decode, to keep the dynamic table in sync
+   if (hpack_decode(h2->decoder, (unsigned char *)h2->block,
+                    h2->block_len, on_header, &b)) {
+      conn_error(h2, E_COMPRESSION);
+      goto cleanup;
+   }
+
+   // Trailers
+   if ((stream = find_stream(h2, id))) {
+      if (stream->remote_closed)
+         stream_error(h2, id, E_STREAM_CLOSED);
+      else if (!b.end_stream)
+         conn_error(h2, E_PROTOCOL);
+      else
+         stream_remote_close(stream);
+      goto cleanup;
+   }
+
+   if (id <= h2->last_stream) {
+      conn_error(h2, E_PROTOCOL);
+      goto cleanup;
+   }
+   h2->last_stream = id;
+
+   // Once the client is going away, only the streams it had already
+   // opened are served
+   if (h2->remote_goaway) {
+      stream_error(h2, id, E_REFUSED);
+      goto cleanup;
+   }
+
+   if (b.error || !b.method || !b.path) {
+      stream_error(h2, id, E_PROTOCOL);
+      goto cleanup;
+   }
+   if (h2->streams_open >= MAX_STREAMS) {
+      stream_error(h2, id, E_REFUSED);
+      goto cleanup;
+   }
+
+   // Construct HTTP/1.1 request
+   if (append(&text, &text_len, b.method, strlen(b.method)) ||
+       append(&text, &text_len, " ", 1) ||
+       append(&text, &text_len, b.path, strlen(b.path)) ||
+       append(&text, &text_len, " HTTP/1.1\r\n", 11) ||
+       (b.authority &&
+        (append(&text, &text_len, "Host: ", 6) ||
+         append(&text, &text_len, b.authority, strlen(b.authority)) ||
+         append(&text, &text_len, "\r\n", 2))) ||
+       (b.text && append(&text, &text_len, b.text, b.text_len)) ||
+       (!b.end_stream && !b.content_length &&
+        append(&text, &text_len, "Transfer-Encoding: chunked\r\n", 28)) ||
+       append(&text, &text_len, "\r\n", 2)) {
+      stream_error(h2, id, E_INTERNAL);
+      goto cleanup;
+   }
+
+   // Create stream and request
+   stream = stream_create(h2, id);
+   if (!stream) {
+      stream_error(h2, id, E_INTERNAL);
+      goto cleanup;
+   }
+   stream->req = http_request_create(h2->webserver, h2->settings,
+                                     h2->conn);
+   if (!stream->req) {
+      stream_error(h2, id, E_INTERNAL);
+      stream->reset = 1;
+      goto cleanup;
+   }
+   stream->owned = 1;
+   stream->chunked = !b.end_stream && !b.content_length;
+   http_request_set_stream(stream->req, stream);
+
+   http_request_parse(stream->req, text, text_len);
+   if (b.end_stream) stream->remote_closed = 1;
+
+cleanup:
+   free(b.method);
+   free(b.path);
+   free(b.authority);
+   free(b.text);
+   free(text);
+   h2->block_len = 0;
+}
+
+/// Handle a frame
+/**
+ *  \param  h2       The connection
+ *  \param  type     Frame type
+ *  \param  flags    Frame flags
+ *  \param  id       Stream identifier
+ *  \param  payload  Payload
+ *  \param  len      Length of payload
+ */
+static void handle_frame(struct h2_conn *h2, int type, int flags,
+                         unsigned int id, const char *payload, size_t len)
+{
+   struct h2_stream *stream;
+   unsigned long inc;
+   size_t pad = 0;
+   char buf[4];
+   int rc;
+
+   // Header blocks must be contiguous
+   if (h2->block_stream && type != F_CONTINUATION) {
+      conn_error(h2, E_PROTOCOL);
+      return;
+   }
+
+   // Strip padding
+   if ((type == F_DATA || type == F_HEADERS) && (flags & FL_PADDED)) {
+      if (len < 1 || (unsigned char)payload[0] >= len) {
+         conn_error(h2, E_PROTOCOL);
+         return;
+      }
+      pad = (unsigned char)payload[0];
+      payload++;
+      len -= 1 + pad;
+      pad++;
+   }
+
+   switch (type) {
+      case F_DATA:
+         if (id == 0) {
+            conn_error(h2, E_PROTOCOL);
+            return;
+         }
+
+         // Keep windows open, as data is passed on immediately
+         if (len + pad) {
+            put_u32(buf, len + pad);
+            send_frame(h2, F_WINDOW_UPDATE, 0, 0, buf, 4);
+         }
+
+         stream = find_stream(h2, id);
+         if (!stream || stream->remote_closed || stream->reset) {
+            if (id > h2->last_stream) conn_error(h2, E_PROTOCOL);
+            else stream_error(h2, id, E_STREAM_CLOSED);
+            return;
+         }
+         if (len + pad && !(flags & FL_END_STREAM))
+            send_frame(h2, F_WINDOW_UPDATE, 0, id, buf, 4);
+
+         if (len) stream_body(stream, payload, len);
+         if (flags & FL_END_STREAM) stream_remote_close(stream);
+         break;
+
+      case F_HEADERS:
+         if (id == 0 || !(id & 1)) {
+            conn_error(h2, E_PROTOCOL);
+            return;
+         }
+         if (flags & FL_PRIORITY) {
+            if (len < 5) {
+               conn_error(h2, E_PROTOCOL);
+               return;
+            }
+            payload += 5;
+            len -= 5;
+         }
+         h2->block_stream = id;
+         h2->block_end_stream = flags & FL_END_STREAM;
+         // Falls through to collect the header block
+
+      case F_CONTINUATION:
+         if (id == 0 || id != h2->block_stream) {
+            conn_error(h2, E_PROTOCOL);
+            return;
+         }
+         if (h2->block_len + len > MAX_HEADER_BLOCK ||
+             append(&h2->block, &h2->block_len, payload, len)) {
+            conn_error(h2, E_INTERNAL);
+            return;
+         }
+         if (flags & FL_END_HEADERS) headers_complete(h2);
+         break;
+
+      case F_PRIORITY:
+         if (len != 5) stream_error(h2, id, E_FRAME_SIZE);
+         break;
+
+      case F_RST_STREAM:
+         if (id == 0 || len != 4) {
+            conn_error(h2, id == 0 ? E_PROTOCOL : E_FRAME_SIZE);
+            return;
+         }
+         if ((stream = find_stream(h2, id))) stream->reset = 1;
+         break;
+
+      case F_SETTINGS:
+         if (id != 0) {
+            conn_error(h2, E_PROTOCOL);
+            return;
+         }
+         if (flags & FL_ACK) {
+            if (len != 0) conn_error(h2, E_FRAME_SIZE);
+            return;
+         }
+         if (len % 6) {
+            conn_error(h2, E_FRAME_SIZE);
+            return;
+         }
+         if ((rc = apply_settings(h2, payload, len))) {
+            conn_error(h2, rc);
+            return;
+         }
+         send_frame(h2, F_SETTINGS, FL_ACK, 0, NULL, 0);
+         flush_streams(h2);
+         break;
+
+      case F_PUSH_PROMISE:
+         // Clients cannot push
+         conn_error(h2, E_PROTOCOL);
+         break;
+
+      case F_PING:
+         if (id != 0 || len != 8) {
+            conn_error(h2, id != 0 ? E_PROTOCOL : E_FRAME_SIZE);
+            return;
+         }
+         if (!(flags & FL_ACK))
+            send_frame(h2, F_PING, FL_ACK, 0, payload, 8);
+         break;
+
+      case F_GOAWAY:
+         if (id != 0 || len < 8) {
+            conn_error(h2, id != 0 ? E_PROTOCOL : E_FRAME_SIZE);
+            return;
+         }
+         // Let streams in progress finish, the client closes after. Their
+         // frames, e.g. WINDOW_UPDATE, are still handled
+         h2->remote_goaway = 1;
+         break;
+
+      case F_WINDOW_UPDATE:
+         if (len != 4) {
+            conn_error(h2, E_FRAME_SIZE);
+            return;
+         }
+         inc = get_u32(payload) & 0x7FFFFFFF;
+         if (id == 0) {
+            if (inc == 0 || h2->window + inc > MAX_WINDOW) {
+               conn_error(h2, inc ? E_FLOW_CONTROL : E_PROTOCOL);
+               return;
+            }
+            h2->window += inc;
+            flush_streams(h2);
+         } else if ((stream = find_stream(h2, id)) && !stream->reset) {
+            if (inc == 0 || stream->window + inc > MAX_WINDOW) {
+               stream_error(h2, id, inc ? E_FLOW_CONTROL : E_PROTOCOL);
+               stream->reset = 1;
+               return;
+            }
+            stream->window += inc;
+            flush_stream(stream);
+         }
+         break;
+
+      default:
+         // Unknown frame types must be ignored
+         break;
+   }
+}
+
+/// Handle all complete frames in a buffer
+/**
+ *  \param  h2   The connection
+ *  \param  buf  Buffer
+ *  \param  len  Length of buffer
+ *
+ *  \return Number of bytes handled
+ */
+static size_t handle_frames(struct h2_conn *h2, const char *buf, size_t len)
+{
+   const unsigned char *hdr;
+   size_t pos = 0, flen;
+
+   while (!h2->goaway && len - pos >= FRAME_HEADER_LEN) {
+      hdr = (const unsigned char *)&buf[pos];
+      flen = hdr[0] << 16 | hdr[1] << 8 | hdr[2];
+      if (flen > DEFAULT_FRAME_SIZE) {
+         conn_error(h2, E_FRAME_SIZE);
+         return len;
+      }
+      if (len - pos < FRAME_HEADER_LEN + flen) break;
+
+      handle_frame(h2, hdr[3], hdr[4], get_u32((char *)&hdr[5]) & 0x7FFFFFFF,
+                   &buf[pos + FRAME_HEADER_LEN], flen);
+      pos += FRAME_HEADER_LEN + flen;
+   }
+
+   return h2->goaway ? len : pos;
+}
+
+/// Check if data received is the HTTP/2 connection preface
+/**
+ *  Used to detect HTTP/2 with prior knowledge on a new connection. The
+ *  first three bytes ("PRI") are enough to tell it apart from HTTP/1.x
+ *  methods, the rest of the preface is checked by h2_conn_parse().
+ *
+ *  \param  buf  Start of data received on connection
+ *  \param  len  Length of data
+ *
+ *  \return 1 if it is the preface, 0 otherwise
+ */
+int h2_is_preface(const char *buf, size_t len)
+{
+   if (len > PREFACE_LEN) len = PREFACE_LEN;
+   return len >= 3 && memcmp(buf, PREFACE, len) == 0;
+}
+
+/// Check if a request asks for a h2c upgrade
+/**
+ *  Requests with a body are not upgraded, as the body would have to be
+ *  received as HTTP/1.1 after the switch.
+ *
+ *  \param  req  http request
+ *
+ *  \return 1 if the request should be upgraded, 0 otherwise
+ */
+int h2_is_upgrade(struct http_request *req)
+{
+   const char *len = http_request_find_header(req, "Content-Length");
+
+   if (len && atol(len) > 0) return 0;
+   if (http_request_find_header(req, "Transfer-Encoding")) return 0;
+   if (!http_request_find_header(req, "HTTP2-Settings")) return 0;
+   if (!http_request_header_has_token(req, "Connection", "HTTP2-Settings"))
+      return 0;
+   return http_request_header_has_token(req, "Upgrade", "h2c");
+}
+
+/// Create a HTTP/2 connection
+/**
+ *  Sends our SETTINGS frame, which is the server connection preface.
+ *  Should be freed with h2_conn_destroy(), which happens when the
+ *  request it is created from is destroyed.
+ *
+ *  For an upgrade the "101 Switching Protocols" response is sent first,
+ *  and the upgrading request becomes stream 1. The request is not owned
+ *  by the stream, as it already belongs to the connection.
+ *
+ *  \param  webserver  The http-webserver
+ *  \param  settings   The settings of the http-webserver
+ *  \param  conn       The connection
+ *  \param  upgrade    The request upgrading to h2c, or NULL for prior
+ *                     knowledge
+ *
+ *  \return The new connection or NULL on failure
+ */
+struct h2_conn *h2_conn_create(
+      struct httpws *webserver,
+      struct httpws_settings *settings,
+      struct ws_conn *conn,
+      struct http_request *upgrade)
+{
+   struct h2_stream *stream;
+   const char *http2_settings;
+   char payload[6], *buf;
+   size_t len;
+
+   struct h2_conn *h2 = calloc(1, sizeof(struct h2_conn));
+   if (!h2) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return NULL;
+   }
+
+   h2->webserver = webserver;
+   h2->settings = settings;
+   h2->conn = conn;
+   h2->window = DEFAULT_WINDOW;
+   h2->initial_window = DEFAULT_WINDOW;
+   h2->max_frame = DEFAULT_FRAME_SIZE;
+   h2->decoder = hpack_create(HEADER_TABLE_SIZE);
+   if (!h2->decoder) {
+      free(h2);
+      return NULL;
+   }
+
+   if (upgrade) {
+      // Settings from upgrade are acknowledged by the 101 response
+      http2_settings = http_request_find_header(upgrade, "HTTP2-Settings");
+      buf = malloc(strlen(http2_settings) + 1);
+      if (!buf) {
+         fprintf(stderr, "ERROR: Cannot allocate memory\n");
+         h2_conn_destroy(h2);
+         return NULL;
+      }
+      len = base64url_decode(http2_settings, buf);
+      if (len % 6 || apply_settings(h2, buf, len)) {
+         free(buf);
+         h2_conn_destroy(h2);
+         return NULL;
+      }
+      free(buf);
+
+      stream = stream_create(h2, 1);
+      if (!stream) {
+         h2_conn_destroy(h2);
+         return NULL;
+      }
+      stream->req = upgrade;
+      stream->remote_closed = 1;
+      h2->last_stream = 1;
+      http_request_set_stream(upgrade, stream);
+
+      ws_conn_sendf(conn, "HTTP/1.1 101 Switching Protocols\r\n"
+                          "Connection: Upgrade\r\n"
+                          "Upgrade: h2c\r\n\r\n");
+   }
+
+   payload[0] = 0;
+   payload[1] = SET_MAX_CONCURRENT_STREAMS;
+   put_u32(&payload[2], MAX_STREAMS);
+   send_frame(h2, F_SETTINGS, 0, 0, payload, 6);
+
+   // Requests on streams have no deadlines of their own, so from now on
+   // only the idle timeout applies, restarted by every frame received
+   ws_conn_set_timeout(conn, settings->timeout, 1);
+
+   return h2;
+}
+
+/// Destroy a HTTP/2 connection
+/**
+ *  Destroys all streams and the requests they own.
+ *
+ *  \param  h2  The connection to destroy
+ */
+void h2_conn_destroy(struct h2_conn *h2)
+{
+   if (!h2) return;
+
+   while (h2->streams)
+      stream_destroy(h2->streams);
+
+   hpack_destroy(h2->decoder);
+   free(h2->in);
+   free(h2->block);
+   free(h2);
+}
+
+/// Parse a chunk of data received on a HTTP/2 connection
+/**
+ *  Data is expected to start with the client connection preface. Frames
+ *  split across chunks are buffered until complete.
+ *
+ *  \param  h2   The connection
+ *  \param  buf  The chunk, not null-terminated
+ *  \param  len  Length of the chunk
+ *
+ *  \return Number of bytes parsed
+ */
+size_t h2_conn_parse(struct h2_conn *h2, const char *buf, size_t len)
+{
+   size_t i = 0, pos;
+
+   if (h2->goaway) return len;
+
+   // Connection preface
+   for (; h2->preface < PREFACE_LEN && i < len; i++, h2->preface++) {
+      if (buf[i] != PREFACE[h2->preface]) {
+         conn_error(h2, E_PROTOCOL);
+         return len;
+      }
+   }
+
+   // Handle complete frames directly from the chunk, buffering the rest
+   if (h2->in_len) {
+      if (append(&h2->in, &h2->in_len, &buf[i], len - i)) {
+         conn_error(h2, E_INTERNAL);
+         return len;
+      }
+      pos = handle_frames(h2, h2->in, h2->in_len);
+      h2->in_len -= pos;
+      memmove(h2->in, &h2->in[pos], h2->in_len);
+   } else {
+      pos = i + handle_frames(h2, &buf[i], len - i);
+      if (pos < len && append(&h2->in, &h2->in_len, &buf[pos], len - pos))
+         conn_error(h2, E_INTERNAL);
+   }
+
+   reap_streams(h2);
+
+   return len;
+}
+
+/// Tell a HTTP/2 connection that the data queued has been sent
+/**
+ *  Destroys the streams that were closed on both sides since the last
+ *  chunk of data was parsed, like streams whose response ended after
+ *  the request was received in full. This is done from the event loop,
+ *  where no callbacks of their requests are running, so that closed
+ *  streams count neither against MAX_STREAMS nor stay allocated on an
+ *  idle connection.
+ *
+ *  \param  h2  The connection
+ */
+void h2_conn_sent(struct h2_conn *h2)
+{
+   reap_streams(h2);
+}
+
+/// Begin a response on a stream
+/**
+ *  \param  stream  The stream
+ *  \param  status  Status code
+ *
+ *  \return 0 on success, 1 on failure
+ */
+int h2_stream_start(struct h2_stream *stream, int status)
+{
+   if (stream->headers_sent) return 1;
+
+   free(stream->hdrs);
+   stream->hdrs = NULL;
+   stream->hdrs_len = 0;
+   return hpack_encode_status(&stream->hdrs, &stream->hdrs_len, status);
+}
+
+/// Add a header to the response on a stream
+/**
+ *  Connection-specific headers are silently dropped, as they are not
+ *  allowed in HTTP/2.
+ *
+ *  \param  stream  The stream
+ *  \param  name    Header name
+ *  \param  value   Header value
+ *
+ *  \return 0 on success, 1 on failure
+ */
+int h2_stream_add_header(struct h2_stream *stream,
+                         const char *name, const char *value)
+{
+   if (stream->headers_sent) return 1;
+
+   if (strcasecmp(name, "Connection") == 0 ||
+       strcasecmp(name, "Keep-Alive") == 0 ||
+       strcasecmp(name, "Transfer-Encoding") == 0 ||
+       strcasecmp(name, "Upgrade") == 0)
+      return 0;
+
+   return hpack_encode(&stream->hdrs, &stream->hdrs_len, name, value);
+}
+
+/// Send data in the response on a stream
+/**
+ *  Sends the headers first, if not done yet. Data is queued until the
+ *  flow control windows allows it to be sent.
+ *
+ *  \param  stream  The stream
+ *  \param  buf     Data
+ *  \param  len     Length of data
+ *
+ *  \return 0 on success, 1 on failure
+ */
+int h2_stream_send(struct h2_stream *stream, const char *buf, size_t len)
+{
+   if (stream->dead || stream->reset || stream->end_pending) return 1;
+
+   if (!stream->headers_sent) send_headers(stream, 0);
+   if (len) {
+      if (append(&stream->out, &stream->out_len, buf, len)) return 1;
+      flush_stream(stream);
+   }
+
+   return 0;
+}
+
+/// Abort the response on a stream with a RST_STREAM frame
+/**
+ *  Used when the response cannot be completed, so the client sees it
+ *  fail instead of receiving a short body. Data still waiting for the
+ *  flow control windows is dropped.
+ *
+ *  \param  stream  The stream
+ */
+void h2_stream_abort(struct h2_stream *stream)
+{
+   if (stream->dead || stream->reset) return;
+
+   stream_error(stream->h2, stream->id, E_INTERNAL);
+   stream->reset = 1;
+   stream->out_len = 0;
+}
+
+/// End the response on a stream
+/**
+ *  END_STREAM is sent after any data still waiting for the flow control
+ *  windows.
+ *
+ *  \param  stream  The stream
+ */
+void h2_stream_end(struct h2_stream *stream)
+{
+   if (stream->dead || stream->reset || stream->end_pending) return;
+
+   if (!stream->headers_sent && !stream->out_len) {
+      send_headers(stream, 1);
+      stream->local_closed = 1;
+      return;
+   }
+
+   stream->end_pending = 1;
+   flush_stream(stream);
+}
@@ -0,0 +1,68 @@
+// h2.h
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+*   
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*  
+*  1. Redistributions of source code must retain the above copyright
+*  notice, this list of conditions and the following disclaimer.
+*  
+*  2. Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*  
+*  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+*  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+*  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+*  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+*  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+*  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+*  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+*  SUCH DAMAGE.
+*  
+*  The views and conclusions contained in the software and
+*  documentation are those of the authors and should not be interpreted
+*  as representing official policies, either expressed.
+*/
+
+#ifndef H2_H
+#define H2_H
+
+#include "http-webserver.h"
+#include <stddef.h>
+
+struct ws_conn;
+struct h2_conn;
+struct h2_stream;
+
+int h2_is_preface(const char *buf, size_t len);
+int h2_is_upgrade(struct http_request *req);
+
+struct h2_conn *h2_conn_create(
+      struct httpws *webserver,
+      struct httpws_settings *settings,
+      struct ws_conn *conn,
+      struct http_request *upgrade);
+
+void h2_conn_destroy(struct h2_conn *h2);
+
+size_t h2_conn_parse(struct h2_conn *h2,
+                     const char *buf,
+                     size_t len);
+void h2_conn_sent(struct h2_conn *h2);
+
+int h2_stream_start(struct h2_stream *stream, int status);
+int h2_stream_add_header(struct h2_stream *stream,
+                         const char *name, const char *value);
+int h2_stream_send(struct h2_stream *stream,
+                   const char *buf, size_t len);
+void h2_stream_end(struct h2_stream *stream);
+void h2_stream_abort(struct h2_stream *stream);
+
+#endif
@@ -0,0 +1,116 @@
+// header_parser_bench.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+*   
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*  
+*  1. Redistributions of source code must retain the above copyright
+*  notice, this list of conditions and the following disclaimer.
+*  
+*  2. Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*  
+*  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+*  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+*  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+*  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+*  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+*  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+*  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+*  SUCH DAMAGE.
+*  
+*  The views and conclusions contained in the software and
+*  documentation are those of the authors and should not be interpreted
+*  as representing official policies, either expressed.
+*/
+
+#include "header_parser.c"
+#include "bench.h"
+
+/// Headers of a typical request
+static const char *headers[][2] = {
+   { "Host", "localhost:8080" },
+   { "User-Agent", "Mozilla/5.0 (X11; Linux x86_64)" },
+   { "Accept", "application/xml" },
+   { "Accept-Language", "en-US,en;q=0.5" },
+   { "Accept-Encoding", "gzip, deflate" },
+   { "Connection", "keep-alive" },
+   { "Cache-Control", "max-age=0" },
+   { "Content-Type", "application/xml" },
+   { "Content-Length", "42" },
+   { "Origin", "http://localhost" },
+   { "Referer", "http://localhost/devices" },
+   { "Cookie", "session=1234" },
+};
+#define HEADERS (sizeof(headers) / sizeof(headers[0]))
+
+static size_t lengths[HEADERS][2];
+
+static void on_pair(void *data, const char *field, size_t field_length,
+                    const char *value, size_t value_length)
+{
+   bench_use(value);
+}
+
+/// Parse the headers of a request, each field and value in one chunk
+static void parse_bench(void *data, size_t n)
+{
+   struct hp_settings settings = HP_SETTINGS_DEFAULT;
+   struct hp *hp;
+   size_t i, j;
+
+   settings.on_field_value_pair = on_pair;
+   for (i = 0; i < n; i++) {
+      hp = hp_create(&settings);
+      for (j = 0; j < HEADERS; j++) {
+         hp_on_header_field(hp, headers[j][0], lengths[j][0]);
+         hp_on_header_value(hp, headers[j][1], lengths[j][1]);
+      }
+      hp_on_header_complete(hp);
+      hp_destroy(hp);
+   }
+}
+
+/// Parse the headers of a request, with values split in two chunks
+static void parse_chunked_bench(void *data, size_t n)
+{
+   struct hp_settings settings = HP_SETTINGS_DEFAULT;
+   struct hp *hp;
+   size_t i, j, half;
+
+   settings.on_field_value_pair = on_pair;
+   for (i = 0; i < n; i++) {
+      hp = hp_create(&settings);
+      for (j = 0; j < HEADERS; j++) {
+         half = lengths[j][1] / 2;
+         hp_on_header_field(hp, headers[j][0], lengths[j][0]);
+         hp_on_header_value(hp, headers[j][1], half);
+         hp_on_header_value(hp, headers[j][1] + half, lengths[j][1] - half);
+      }
+      hp_on_header_complete(hp);
+      hp_destroy(hp);
+   }
+}
+
+int main(int argc, char **argv)
+{
+   size_t i;
+
+   for (i = 0; i < HEADERS; i++) {
+      lengths[i][0] = strlen(headers[i][0]);
+      lengths[i][1] = strlen(headers[i][1]);
+   }
+
+   // An operation is the 12 headers of a request
+   bench_init("header_parser", argc, argv);
+   bench_run("headers_parse", parse_bench, NULL);
+   bench_run("headers_parse_chunked", parse_chunked_bench, NULL);
+   return bench_finish();
+}
@@ -0,0 +1,680 @@
+// hpack.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+*   
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*  
+*  1. Redistributions of source code must retain the above copyright
+*  notice, this list of conditions and the following disclaimer.
+*  
+*  2. Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*  
+*  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+*  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+*  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+*  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+*  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+*  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+*  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+*  SUCH DAMAGE.
+*  
+*  The views and conclusions contained in the software and
+*  documentation are those of the authors and should not be interpreted
+*  as representing official policies, either expressed.
+*/
+
+#include "hpack.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+/// Overhead of each entry in the dynamic table, see RFC 7541 4.1
+#define ENTRY_OVERHEAD 32
+
+/// Number of entries in the static table
+#define STATIC_SIZE 61
+
+/// Maximum length of a Huffman code
+#define HUFFMAN_MAX_LEN 30
+
+/// An entry in the static or dynamic table
+struct entry {
+   const char *name; ///< Name
+   size_t name_len;  ///< Length of name
+   const char *value; ///< Value
+   size_t value_len; ///< Length of value
+};
+
+#define XX(N, V) { N, sizeof(N)-1, V, sizeof(V)-1 }
+/// The static table, see RFC 7541 appendix A
+static const struct entry static_table[STATIC_SIZE] = {
+   XX(":authority", ""),
+   XX(":method", "GET"),
+   XX(":method", "POST"),
+   XX(":path", "/"),
+   XX(":path", "/index.html"),
+   XX(":scheme", "http"),
+   XX(":scheme", "https"),
+   XX(":status", "200"),
+   XX(":status", "204"),
+   XX(":status", "206"),
+   XX(":status", "304"),
+   XX(":status", "400"),
+   XX(":status", "404"),
+   XX(":status", "500"),
+   XX("accept-charset", ""),
+   XX("accept-encoding", "gzip, deflate"),
+   XX("accept-language", ""),
+   XX("accept-ranges", ""),
+   XX("accept", ""),
+   XX("access-control-allow-origin", ""),
+   XX("age", ""),
+   XX("allow", ""),
+   XX("authorization", ""),
+   XX("cache-control", ""),
+   XX("content-disposition", ""),
+   XX("content-encoding", ""),
+   XX("content-language", ""),
+   XX("content-length", ""),
+   XX("content-location", ""),
+   XX("content-range", ""),
+   XX("content-type", ""),
+   XX("cookie", ""),
+   XX("date", ""),
+   XX("etag", ""),
+   XX("expect", ""),
+   XX("expires", ""),
+   XX("from", ""),
+   XX("host", ""),
+   XX("if-match", ""),
+   XX("if-modified-since", ""),
+   XX("if-none-match", ""),
+   XX("if-range", ""),
+   XX("if-unmodified-since", ""),
+   XX("last-modified", ""),
+   XX("link", ""),
+   XX("location", ""),
+   XX("max-forwards", ""),
+   XX("proxy-authenticate", ""),
+   XX("proxy-authorization", ""),
+   XX("range", ""),
+   XX("referer", ""),
+   XX("refresh", ""),
+   XX("retry-after", ""),
+   XX("server", ""),
+   XX("set-cookie", ""),
+   XX("strict-transport-security", ""),
+   XX("transfer-encoding", ""),
+   XX("user-agent", ""),
+   XX("vary", ""),
+   XX("via", ""),
+   XX("www-authenticate", "")
+};
+#undef XX
+
+/// Length of the Huffman code for each symbol, see RFC 7541 appendix B
+/**
+ *  The code is canonical, so the codes themselves can be derived from
+ *  the lengths, by assigning consecutive codes to the symbols ordered by
+ *  length and then by symbol.
+ */
+static const unsigned char huffman_len[257] = {
+   13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+   28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13,  6,  8, 11, 10, 10,  8, 11,  8,  6,  6,  6,
+    5,  5,  5,  6,  6,  6,  6,  6,  6,  6,  7,  8, 15,  6, 12, 10,
+   13,  6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,
+    7,  7,  7,  7,  7,  7,  7,  7,  8,  7,  8, 13, 19, 13, 14,  6,
+   15,  5,  6,  5,  6,  5,  6,  6,  6,  5,  7,  7,  6,  6,  6,  5,
+    6,  7,  6,  5,  5,  6,  7,  7,  7,  7,  7, 15, 11, 14, 13, 28,
+   20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+   24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+   22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+   21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+   26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+   19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+   20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+   26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+   30,
+};
+
+/// Decoding tables for the canonical Huffman code
+static struct {
+   int init;                             ///< Tables are initialised ?
+   unsigned int first[HUFFMAN_MAX_LEN+1]; ///< First code of each length
+   unsigned int count[HUFFMAN_MAX_LEN+1]; ///< Codes of each length
+   unsigned int index[HUFFMAN_MAX_LEN+1]; ///< Offset in symbols
+   unsigned short symbols[257];          ///< Symbols ordered by code
+} huffman;
+
+/// HPACK decoding context
+/**
+ *  Holds the dynamic table of a decoder. Entries are kept in a circular
+ *  array with the newest entry at head, which gets the lowest index.
+ *  Each entry is a single allocation holding both name and value.
+ */
+struct hpack {
+   struct entry *entries; ///< Circular array of entries
+   size_t capacity;       ///< Size of array
+   size_t count;          ///< Number of entries
+   size_t head;           ///< Position of newest entry
+   size_t size;           ///< Size according to RFC 7541 4.1
+   size_t max_size;       ///< Current maximum size
+   size_t limit;          ///< Maximum size allowed by settings
+};
+
+/// Initialise the Huffman decoding tables
+static void huffman_init()
+{
+   unsigned int code = 0, len, sym, i = 0;
+
+   if (huffman.init) return;
+
+   memset(&huffman, 0, sizeof(huffman));
+   for (sym = 0; sym < 257; sym++)
+      huffman.count[huffman_len[sym]]++;
+   for (len = 1; len <= HUFFMAN_MAX_LEN; len++) {
+      huffman.first[len] = code;
+      huffman.index[len] = i;
+      code = (code + huffman.count[len]) << 1;
+      i += huffman.count[len];
+   }
+   for (len = 1; len <= HUFFMAN_MAX_LEN; len++)
+      for (sym = 0; sym < 257; sym++)
+         if (huffman_len[sym] == len)
+            huffman.symbols[huffman.index[len]++] = sym;
+   for (len = HUFFMAN_MAX_LEN; len > 0; len--)
+      huffman.index[len] -= huffman.count[len];
+
+   huffman.init = 1;
+}
+
+/// Decode a Huffman encoded string
+/**
+ *  \param  in       Encoded string
+ *  \param  len      Length of encoded string
+ *  \param  out      Buffer for decoded string, at least 8*len/5 long
+ *  \param  out_len  Set to length of decoded string
+ *
+ *  \return 0 on success, 1 on malformed input
+ */
+static int huffman_decode(const unsigned char *in, size_t len,
+                          char *out, size_t *out_len)
+{
+   unsigned int code = 0, bits = 0, sym;
+   size_t i, o = 0;
+   int b;
+
+   huffman_init();
+
+   for (i = 0; i < len; i++) {
+      for (b = 7; b >= 0; b--) {
+         code = code << 1 | ((in[i] >> b) & 1);
+         bits++;
+         if (code - huffman.first[bits] < huffman.count[bits]) {
+            sym = huffman.symbols[huffman.index[bits] +
+                                  code - huffman.first[bits]];
+            // EOS must not appear in the string
+            if (sym == 256) return 1;
+            out[o++] = sym;
+            code = 0;
+            bits = 0;
+         } else if (bits == HUFFMAN_MAX_LEN) {
+            return 1;
+         }
+      }
+   }
+
+   // Padding must be the most significant bits of EOS, i.e. all ones
+   if (bits > 7 || code != (1u << bits) - 1) return 1;
+
+   *out_len = o;
+   return 0;
+}
+
+/// Get an entry from the static or dynamic table
+/**
+ *  \param  hpack  HPACK context
+ *  \param  index  Index, starting from 1
+ *
+ *  \return The entry or NULL if the index is invalid
+ */
+static const struct entry *get_entry(struct hpack *hpack, size_t index)
+{
+   if (index == 0) return NULL;
+   if (index <= STATIC_SIZE) return &static_table[index-1];
+   index -= STATIC_SIZE + 1;
+   if (index >= hpack->count) return NULL;
+   return &hpack->entries[(hpack->head + index) % hpack->capacity];
+}
+
+/// Evict entries from the dynamic table until it fits a size
+/**
+ *  \param  hpack  HPACK context
+ *  \param  size   Size to fit in
+ */
+static void evict(struct hpack *hpack, size_t size)
+{
+   struct entry *e;
+
+   while (hpack->count && hpack->size > size) {
+      e = &hpack->entries[(hpack->head + hpack->count - 1) %
+                          hpack->capacity];
+      hpack->size -= e->name_len + e->value_len + ENTRY_OVERHEAD;
+      free((char *)e->name);
+      hpack->count--;
+   }
+}
+
+/// Add an entry to the dynamic table
+/**
+ *  Entries larger than the table empties the table, as specified in RFC
+ *  7541 4.4.
+ *
+ *  \param  hpack      HPACK context
+ *  \param  name       Name
+ *  \param  name_len   Length of name
+ *  \param  value      Value
+ *  \param  value_len  Length of value
+ *
+ *  \return 0 on success, 1 if out of memory
+ */
+static int add_entry(struct hpack *hpack,
+                     const char *name, size_t name_len,
+                     const char *value, size_t value_len)
+{
+   size_t size = name_len + value_len + ENTRY_OVERHEAD, i;
+   struct entry *entries;
+   char *str;
+
+   if (size > hpack->max_size) {
+      evict(hpack, 0);
+      return 0;
+   }
+
+   // Copy before eviction, as name may point into an evicted entry
+   str = malloc(name_len + value_len + 2);
+   if (!str) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return 1;
+   }
+   memcpy(str, name, name_len);
+   str[name_len] = '\0';
+   memcpy(&str[name_len+1], value, value_len);
+   str[name_len+1+value_len] = '\0';
+
+   evict(hpack, hpack->max_size - size);
+
+   // Grow array, straightening it out
+   if (hpack->count == hpack->capacity) {
+      entries = malloc(2 * hpack->capacity * sizeof(struct entry));
+      if (!entries) {
+         fprintf(stderr, "ERROR: Cannot allocate memory\n");
+         free(str);
+         return 1;
+      }
+      for (i = 0; i < hpack->count; i++)
+         entries[i] = hpack->entries[(hpack->head + i) % hpack->capacity];
+      free(hpack->entries);
+      hpack->entries = entries;
+      hpack->head = 0;
+      hpack->capacity *= 2;
+   }
+
+   hpack->head = (hpack->head + hpack->capacity - 1) % hpack->capacity;
+   hpack->entries[hpack->head].name = str;
+   hpack->entries[hpack->head].name_len = name_len;
+   hpack->entries[hpack->head].value = &str[name_len+1];
+   hpack->entries[hpack->head].value_len = value_len;
+   hpack->count++;
+   hpack->size += size;
+
+   return 0;
+}
+
+/// Decode an integer with a prefix, see RFC 7541 5.1
+/**
+ *  \param  buf     Buffer
+ *  \param  len     Length of buffer
+ *  \param  pos     Position in buffer, updated to after the integer
+ *  \param  prefix  Number of bits in prefix
+ *  \param  value   Set to the decoded value
+ *
+ *  \return 0 on success, 1 on malformed input
+ */
+static int decode_int(const unsigned char *buf, size_t len, size_t *pos,
+                      int prefix, size_t *value)
+{
+   size_t max = (1 << prefix) - 1;
+   int shift = 0;
+
+   if (*pos >= len) return 1;
+   *value = buf[(*pos)++] & max;
+   if (*value < max) return 0;
+
+   do {
+      // Values above 2^28 are never needed
+      if (*pos >= len || shift > 21) return 1;
+      *value += (size_t)(buf[*pos] & 0x7F) << shift;
+      shift += 7;
+   } while (buf[(*pos)++] & 0x80);
+
+   return 0;
+}
+
+/// Decode a string literal, see RFC 7541 5.2
+/**
+ *  \param  buf      Buffer
+ *  \param  len      Length of buffer
+ *  \param  pos      Position in buffer, updated to after the string
+ *  \param  str      Set to the decoded string, must be freed
+ *  \param  str_len  Set to the length of the decoded string
+ *
+ *  \return 0 on success, 1 on malformed input or out of memory
+ */
+static int decode_str(const unsigned char *buf, size_t len, size_t *pos,
+                      char **str, size_t *str_len)
+{
+   size_t n;
+   int huff;
+
+   if (*pos >= len) return 1;
+   huff = buf[*pos] & 0x80;
+   if (decode_int(buf, len, pos, 7, &n)) return 1;
+   if (n > len - *pos) return 1;
+
+   *str = malloc(huff ? n*8/5 + 1 : n + 1);
+   if (!*str) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return 1;
+   }
+
+   if (huff) {
+      if (huffman_decode(&buf[*pos], n, *str, str_len)) {
+         free(*str);
+         *str = NULL;
+         return 1;
+      }
+   } else {
+      memcpy(*str, &buf[*pos], n);
+      *str_len = n;
+   }
+   (*str)[*str_len] = '\0';
+   *pos += n;
+
+   return 0;
+}
+
+/// Create a HPACK decoding context
+/**
+ *  Should be freed with hpack_destroy().
+ *
+ *  \param  max_size  Maximum size of the dynamic table, i.e. the value
+ *                    of SETTINGS_HEADER_TABLE_SIZE
+ *
+ *  \return The new context, or NULL on failure
+ */
+struct hpack *hpack_create(size_t max_size)
+{
+   struct hpack *hpack = malloc(sizeof(struct hpack));
+   if (!hpack) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return NULL;
+   }
+
+   hpack->capacity = 16;
+   hpack->entries = malloc(hpack->capacity * sizeof(struct entry));
+   if (!hpack->entries) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      free(hpack);
+      return NULL;
+   }
+   hpack->count = 0;
+   hpack->head = 0;
+   hpack->size = 0;
+   hpack->max_size = max_size;
+   hpack->limit = max_size;
+
+   return hpack;
+}
+
+/// Destroy a HPACK decoding context
+/**
+ *  \param  hpack  The context to destroy
+ */
+void hpack_destroy(struct hpack *hpack)
+{
+   if (!hpack) return;
+   evict(hpack, 0);
+   free(hpack->entries);
+   free(hpack);
+}
+
+/// Decode a header block
+/**
+ *  The header block must be complete, that is the payload of a HEADERS
+ *  frame and all of its CONTINUATION frames. The callback is called for
+ *  each header in order. Names and values passed to the callback are
+ *  null-terminated, but only valid during the call.
+ *
+ *  Any error is a compression error, after which the context cannot be
+ *  used any more.
+ *
+ *  \param  hpack  HPACK context
+ *  \param  buf    Header block
+ *  \param  len    Length of header block
+ *  \param  cb     Callback for each header
+ *  \param  data   User data for callback
+ *
+ *  \return 0 on success, 1 on error
+ */
+int hpack_decode(struct hpack *hpack,
+                 const unsigned char *buf, size_t len,
+                 hpack_header_cb cb, void *data)
+{
+   const struct entry *e;
+   size_t pos = 0, index, name_len, value_len;
+   char *name, *value;
+   int prefix, fields = 0;
+
+   while (pos < len) {
+      // Indexed header field
+      if (buf[pos] & 0x80) {
+         if (decode_int(buf, len, &pos, 7, &index)) return 1;
+         if (!(e = get_entry(hpack, index))) return 1;
+         cb(data, e->name, e->name_len, e->value, e->value_len);
+         fields++;
+         continue;
+      }
+
+      // Dynamic table size update, only allowed before any fields
+      if ((buf[pos] & 0xE0) == 0x20) {
+         if (fields) return 1;
+         if (decode_int(buf, len, &pos, 5, &index)) return 1;
+         if (index > hpack->limit) return 1;
+         hpack->max_size = index;
+         evict(hpack, index);
+         continue;
+      }
+
+      // Literal header field with or without indexing
+      prefix = (buf[pos] & 0x40) ? 6 : 4;
+      if (decode_int(buf, len, &pos, prefix, &index)) return 1;
+      name = NULL;
+      if (index) {
+         if (!(e = get_entry(hpack, index))) return 1;
+      } else {
+         e = NULL;
+         if (decode_str(buf, len, &pos, &name, &name_len)) return 1;
+      }
+      if (decode_str(buf, len, &pos, &value, &value_len)) {
+         free(name);
+         return 1;
+      }
+      if (e) {
+         name = (char *)e->name;
+         name_len = e->name_len;
+      }
+
+      cb(data, name, name_len, value, value_len);
+      fields++;
+      if (prefix == 6 &&
+          add_entry(hpack, name, name_len, value, value_len)) {
+         if (!e) free(name);
+         free(value);
+         return 1;
+      }
+
+      if (!e) free(name);
+      free(value);
+   }
+
+   return 0;
+}
+
+/// Get the size of the dynamic table
+/**
+ *  \param  hpack  HPACK context
+ *
+ *  \return Size as defined in RFC 7541 4.1
+ */
+size_t hpack_table_size(struct hpack *hpack)
+{
+   return hpack->size;
+}
+
+/// Append bytes to a header block
+static int append(char **block, size_t *len, const char *buf, size_t n)
+{
+   char *new = realloc(*block, *len + n);
+   if (!new) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return 1;
+   }
+   memcpy(&new[*len], buf, n);
+   *block = new;
+   *len += n;
+   return 0;
+}
+
+/// Encode an integer with a prefix, see RFC 7541 5.1
+/**
+ *  \param  buf     Buffer of at least 6 bytes
+ *  \param  first   Bits above the prefix of the first byte
+ *  \param  prefix  Number of bits in prefix
+ *  \param  value   Value to encode
+ *
+ *  \return Number of bytes written
+ */
+static size_t encode_int(unsigned char *buf, unsigned char first,
+                         int prefix, size_t value)
+{
+   size_t max = (1 << prefix) - 1, n = 0;
+
+   if (value < max) {
+      buf[n++] = first | value;
+      return n;
+   }
+   buf[n++] = first | max;
+   value -= max;
+   while (value >= 0x80) {
+      buf[n++] = (value & 0x7F) | 0x80;
+      value >>= 7;
+   }
+   buf[n++] = value;
+   return n;
+}
+
+/// Append a header to a header block
+/**
+ *  Headers are encoded as literals without indexing, referring to the
+ *  static table for the name when possible. As nothing is added to the
+ *  dynamic table, the peer needs not keep any state for the headers we
+ *  send. Names are lowercased as required by HTTP/2.
+ *
+ *  \param  block  Header block, reallocated as needed
+ *  \param  len    Length of header block, updated
+ *  \param  name   Header name
+ *  \param  value  Header value
+ *
+ *  \return 0 on success, 1 on failure
+ */
+int hpack_encode(char **block, size_t *len,
+                 const char *name, const char *value)
+{
+   size_t name_len = strlen(name), value_len = strlen(value), i, n;
+   unsigned char buf[6];
+   char *lower;
+   int index = 0;
+
+   lower = malloc(name_len + 1);
+   if (!lower) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return 1;
+   }
+   for (i = 0; i <= name_len; i++)
+      lower[i] = tolower((unsigned char)name[i]);
+
+   for (i = 0; i < STATIC_SIZE && !index; i++)
+      if (strcmp(static_table[i].name, lower) == 0)
+         index = i + 1;
+
+   // Name
+   n = encode_int(buf, 0x00, 4, index);
+   if (append(block, len, (char *)buf, n)) goto error;
+   if (!index) {
+      n = encode_int(buf, 0x00, 7, name_len);
+      if (append(block, len, (char *)buf, n)) goto error;
+      if (append(block, len, lower, name_len)) goto error;
+   }
+
+   // Value
+   n = encode_int(buf, 0x00, 7, value_len);
+   if (append(block, len, (char *)buf, n)) goto error;
+   if (append(block, len, value, value_len)) goto error;
+
+   free(lower);
+   return 0;
+
+error:
+   free(lower);
+   return 1;
+}
+
+/// Append the status pseudo-header to a header block
+/**
+ *  Uses the indexed representation for the status codes present in the
+ *  static table.
+ *
+ *  \param  block   Header block, reallocated as needed
+ *  \param  len     Length of header block, updated
+ *  \param  status  Status code
+ *
+ *  \return 0 on success, 1 on failure
+ */
+int hpack_encode_status(char **block, size_t *len, int status)
+{
+   char value[4];
+   unsigned char c;
+   int i;
+
+   snprintf(value, sizeof(value), "%03d", status);
+   for (i = 7; i < 14; i++) {
+      if (strcmp(static_table[i].value, value) == 0) {
+         c = 0x80 | (i + 1);
+         return append(block, len, (char *)&c, 1);
+      }
+   }
+
+   return hpack_encode(block, len, ":status", value);
+}
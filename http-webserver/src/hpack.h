@@ -0,0 +1,57 @@
+// hpack.h
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+*   
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*  
+*  1. Redistributions of source code must retain the above copyright
+*  notice, this list of conditions and the following disclaimer.
+*  
+*  2. Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*  
+*  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+*  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+*  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+*  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+*  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+*  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+*  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+*  SUCH DAMAGE.
+*  
+*  The views and conclusions contained in the software and
+*  documentation are those of the authors and should not be interpreted
+*  as representing official policies, either expressed.
+*/
+
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stddef.h>
+
+typedef void (*hpack_header_cb)(void *data,
+                                const char *name, size_t name_len,
+                                const char *value, size_t value_len);
+
+struct hpack;
+
+struct hpack *hpack_create(size_t max_size);
+void hpack_destroy(struct hpack *hpack);
+
+int hpack_decode(struct hpack *hpack,
+                 const unsigned char *buf, size_t len,
+                 hpack_header_cb cb, void *data);
+size_t hpack_table_size(struct hpack *hpack);
+
+int hpack_encode(char **block, size_t *len,
+                 const char *name, const char *value);
+int hpack_encode_status(char **block, size_t *len, int status);
+
+#endif
@@ -0,0 +1,203 @@
+// hpack_test.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+*   
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*  
+*  1. Redistributions of source code must retain the above copyright
+*  notice, this list of conditions and the following disclaimer.
+*  
+*  2. Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*  
+*  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+*  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+*  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+*  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+*  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+*  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+*  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+*  SUCH DAMAGE.
+*  
+*  The views and conclusions contained in the software and
+*  documentation are those of the authors and should not be interpreted
+*  as representing official policies, either expressed.
+*/
+
+#include "hpack.c"
+#include "unit_test.h"
+#include <string.h>
+
+struct data {
+   char headers[1024];
+};
+
+static void on_header(void *_data,
+                      const char *name, size_t name_len,
+                      const char *value, size_t value_len)
+{
+   struct data *data = _data;
+   strncat(data->headers, name, name_len);
+   strcat(data->headers, ": ");
+   strncat(data->headers, value, value_len);
+   strcat(data->headers, "\n");
+}
+
+static size_t unhex(const char *hex, unsigned char *buf)
+{
+   size_t n = 0;
+   unsigned int c;
+   while (sscanf(&hex[2*n], "%2x", &c) == 1)
+      buf[n++] = c;
+   return n;
+}
+
+static int decode_hex(struct hpack *hpack, const char *hex,
+                      struct data *data)
+{
+   unsigned char buf[256];
+   size_t len = unhex(hex, buf);
+   data->headers[0] = '\0';
+   return hpack_decode(hpack, buf, len, on_header, data);
+}
+
+TEST_START("hpack.c")
+
+   struct hpack *hpack;
+   struct data data;
+   int rc;
+
+TEST(Requests without Huffman coding (RFC 7541 C.3))
+
+   hpack = hpack_create(4096);
+
+   rc = decode_hex(hpack, "828684410f7777772e6578616d706c652e636f6d", &data);
+   ASSERT_EQUAL(rc, 0);
+   ASSERT_STR_EQUAL(data.headers, ":method: GET\n:scheme: http\n"
+         ":path: /\n:authority: www.example.com\n");
+   ASSERT_EQUAL(hpack_table_size(hpack), 57);
+
+   rc = decode_hex(hpack, "828684be58086e6f2d6361636865", &data);
+   ASSERT_EQUAL(rc, 0);
+   ASSERT_STR_EQUAL(data.headers, ":method: GET\n:scheme: http\n"
+         ":path: /\n:authority: www.example.com\n"
+         "cache-control: no-cache\n");
+   ASSERT_EQUAL(hpack_table_size(hpack), 110);
+
+   rc = decode_hex(hpack, "828785bf400a637573746f6d2d6b65790c637573746f"
+                          "6d2d76616c7565", &data);
+   ASSERT_EQUAL(rc, 0);
+   ASSERT_STR_EQUAL(data.headers, ":method: GET\n:scheme: https\n"
+         ":path: /index.html\n:authority: www.example.com\n"
+         "custom-key: custom-value\n");
+   ASSERT_EQUAL(hpack_table_size(hpack), 164);
+
+   hpack_destroy(hpack);
+
+TSET()
+
+TEST(Requests with Huffman coding (RFC 7541 C.4))
+
+   hpack = hpack_create(4096);
+
+   rc = decode_hex(hpack, "828684418cf1e3c2e5f23a6ba0ab90f4ff", &data);
+   ASSERT_EQUAL(rc, 0);
+   ASSERT_STR_EQUAL(data.headers, ":method: GET\n:scheme: http\n"
+         ":path: /\n:authority: www.example.com\n");
+
+   rc = decode_hex(hpack, "828684be5886a8eb10649cbf", &data);
+   ASSERT_EQUAL(rc, 0);
+   ASSERT_STR_EQUAL(data.headers, ":method: GET\n:scheme: http\n"
+         ":path: /\n:authority: www.example.com\n"
+         "cache-control: no-cache\n");
+
+   rc = decode_hex(hpack, "828785bf408825a849e95ba97d7f8925a849e95bb8e8"
+                          "b4bf", &data);
+   ASSERT_EQUAL(rc, 0);
+   ASSERT_STR_EQUAL(data.headers, ":method: GET\n:scheme: https\n"
+         ":path: /index.html\n:authority: www.example.com\n"
+         "custom-key: custom-value\n");
+   ASSERT_EQUAL(hpack_table_size(hpack), 164);
+
+   hpack_destroy(hpack);
+
+TSET()
+
+TEST(Eviction (RFC 7541 C.5))
+
+   hpack = hpack_create(256);
+
+   rc = decode_hex(hpack, "4803333032580770726976617465611d4d6f6e2c2032"
+                          "31204f637420323031332032303a31333a323120474d"
+                          "546e1768747470733a2f2f7777772e6578616d706c65"
+                          "2e636f6d", &data);
+   ASSERT_EQUAL(rc, 0);
+   ASSERT_EQUAL(hpack_table_size(hpack), 222);
+
+   rc = decode_hex(hpack, "4803333037c1c0bf", &data);
+   ASSERT_EQUAL(rc, 0);
+   ASSERT_STR_EQUAL(data.headers, ":status: 307\n"
+         "cache-control: private\n"
+         "date: Mon, 21 Oct 2013 20:13:21 GMT\n"
+         "location: https://www.example.com\n");
+   ASSERT_EQUAL(hpack_table_size(hpack), 222);
+
+   hpack_destroy(hpack);
+
+TSET()
+
+TEST(Malformed input)
+
+   hpack = hpack_create(4096);
+
+   // Index 0
+   rc = decode_hex(hpack, "80", &data);
+   ASSERT_EQUAL(rc, 1);
+   // Index beyond dynamic table
+   rc = decode_hex(hpack, "be", &data);
+   ASSERT_EQUAL(rc, 1);
+   // String longer than block
+   rc = decode_hex(hpack, "400a6375", &data);
+   ASSERT_EQUAL(rc, 1);
+   // Table size update above limit
+   rc = decode_hex(hpack, "3fe21f", &data);
+   ASSERT_EQUAL(rc, 1);
+
+   hpack_destroy(hpack);
+
+TSET()
+
+TEST(Encoding)
+
+   char *block = NULL;
+   size_t len = 0;
+
+   hpack = hpack_create(4096);
+
+   hpack_encode_status(&block, &len, 200);
+   hpack_encode_status(&block, &len, 201);
+   hpack_encode(&block, &len, "Content-Type", "text/xml");
+   hpack_encode(&block, &len, "X-Custom", "value");
+   ASSERT_EQUAL((unsigned char)block[0], 0x88);
+
+   data.headers[0] = '\0';
+   rc = hpack_decode(hpack, (unsigned char *)block, len,
+                     on_header, &data);
+   ASSERT_EQUAL(rc, 0);
+   ASSERT_STR_EQUAL(data.headers, ":status: 200\n:status: 201\n"
+         "content-type: text/xml\nx-custom: value\n");
+   ASSERT_EQUAL(hpack_table_size(hpack), 0);
+
+   free(block);
+   hpack_destroy(hpack);
+
+TSET()
+
+TEST_END()
@@ -111,6 +111,26 @@ static int on_disconnect(struct ws *instance, struct ws_conn *conn,
    return 0;
 }
 
+/// Callback for webserver library
+/**
+ *  Handles a connection having sent all data queued, by letting the
+ *  request produce more.
+ *
+ *  \param  instance  Webserver instance
+ *  \param  conn      Connection
+ *  \param  http_ins  The http webserver instance
+ *  \param  req       The http request
+ *
+ *  \return 0 on success, 1 on error
+ */
+static int on_sent(struct ws *instance, struct ws_conn *conn,
+                   void *http_ins, void **req)
+{
+   http_request_sent(*req);
+
+   return 0;
+}
+
 /// Create a new http-server instance
 /**
  *  Allocates a new http-webserver instance, that should be freed with
@@ -146,6 +166,7 @@ struct httpws *httpws_create(struct httpws_settings *settings,
    ws_settings.on_connect    = on_connect;
    ws_settings.on_receive    = on_receive;
    ws_settings.on_disconnect = on_disconnect;
+   ws_settings.on_sent       = on_sent;
    ws_settings.ws_ctx        = instance;
 
    // Create webserver
@@ -39,6 +39,9 @@
 #include <ev.h>
 #include <curl/curl.h>
 #include <pthread.h> 
+#include <unistd.h>
+
+#define HEADER_TIMEOUT 1
 
 struct data {
    int state;
@@ -96,7 +99,7 @@ static size_t data_to_curl(void *ptr, size_t size, size_t nmemb,
 }
 
 // TODO This should take method as parameter as basic_get_test does
-static char* simple_get_request(char* url)
+static char* simple_get_request(char* url, long version)
 {
 	CURL *handle = curl_easy_init();
 	CURLcode c;
@@ -113,6 +116,7 @@ static char* simple_get_request(char* url)
 		curl_easy_setopt(handle, CURLOPT_READFUNCTION, data_to_curl);
 		curl_easy_setopt(handle, CURLOPT_READDATA, &sent);
       curl_easy_setopt(handle, CURLOPT_INFILESIZE, strlen(req_data));
+      curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, version);
 #ifdef DEBUG
       //curl_easy_setopt(handle, CURLOPT_VERBOSE, 1L);
 #endif
@@ -139,7 +143,8 @@ static char* simple_get_request(char* url)
 	}
 }
 
-static int basic_get_test(enum http_method method, char *host, char* path)
+static int basic_get_test(enum http_method method, char *host, char* path,
+                          long version)
 {
    // Construct URL
    int len = strlen(host) + strlen(path) + 1;
@@ -148,7 +153,7 @@ static int basic_get_test(enum http_method method, char *host, char* path)
    strcat(url, path);
 
    // Perform request
-   char *res = simple_get_request(url);
+   char *res = simple_get_request(url, version);
 
    // Parse errors
    int _errors = atoi(res);
@@ -191,6 +196,40 @@ static int basic_get_test(enum http_method method, char *host, char* path)
    return _errors;
 }
 
+/// Upgraded h2c connections must outlive the header deadline
+static int h2c_idle_test(char *url)
+{
+   int _errors = 0;
+   long version, connects;
+   char *res = calloc(1, sizeof(char));
+   CURL *handle = curl_easy_init();
+   struct curl_slist *chunk = NULL;
+
+   chunk = curl_slist_append(chunk, "Cookie: cookie1=val1; cookie2=val2");
+   curl_easy_setopt(handle, CURLOPT_URL, url);
+   curl_easy_setopt(handle, CURLOPT_HTTPHEADER, chunk);
+   curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, data_from_curl);
+   curl_easy_setopt(handle, CURLOPT_WRITEDATA, &res);
+   curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2_0);
+
+   // Upgrade
+   ASSERT(curl_easy_perform(handle) != CURLE_OK);
+   curl_easy_getinfo(handle, CURLINFO_HTTP_VERSION, &version);
+   ASSERT_EQUAL(version, CURL_HTTP_VERSION_2_0);
+
+   // Same connection after the header deadline
+   sleep(HEADER_TIMEOUT + 1);
+   ASSERT(curl_easy_perform(handle) != CURLE_OK);
+   curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects);
+   ASSERT_EQUAL(connects, 0);
+   ASSERT(atoi(res));
+
+   curl_slist_free_all(chunk);
+   curl_easy_cleanup(handle);
+   free(res);
+   return _errors;
+}
+
 /// Test thread
 static int test_thread()
 {
@@ -202,7 +241,15 @@ static int test_thread()
 
    // Run test
 	printf("Running webserver tests\n");
-	testresult = basic_get_test(HTTP_PUT, "http://localhost:8080", "/");
+	testresult = basic_get_test(HTTP_PUT, "http://localhost:8080", "/",
+                               CURL_HTTP_VERSION_1_1);
+
+   // HTTP/2 with prior knowledge
+   testresult += basic_get_test(HTTP_PUT, "http://localhost:8080", "/",
+                                CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE);
+
+   // HTTP/2 by upgrade, kept open past the header deadline
+   testresult += h2c_idle_test("http://localhost:8080/");
 
    // Check result
    if (testresult) {
@@ -497,6 +544,7 @@ static void *webserver_thread(void *arg)
    // Settings for the webserver
    struct httpws_settings settings = HTTPWS_SETTINGS_DEFAULT;
    settings.port = WS_PORT_HTTP_ALT;
+   settings.header_timeout = HEADER_TIMEOUT;
    settings.on_req_begin = on_req_begin;
    settings.on_req_method = on_req_method;
    settings.on_req_url = on_req_url;
@@ -32,15 +32,21 @@
 */
 
 #include "request.h"
+#include "response.h"
+#include "websocket.h"
+#include "h2.h"
 #include "http_parser.h"
 #include "url_parser.h"
 #include "linkedmap.h"
 #include "header_parser.h"
 #include "webserver.h"
 
+#include <ev.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 
 /// The possible states of a request
 enum state {
@@ -140,6 +146,15 @@ struct http_request
    struct lm *arguments;             ///< URL Arguments
    struct lm *headers;               ///< Header Pairs
    struct lm *cookies;               ///< Cookie Pairs
+   struct http_websocket *websocket; ///< Websocket if upgraded
+   struct h2_conn *h2;               ///< HTTP/2 connection if upgraded
+   struct h2_stream *stream;         ///< HTTP/2 stream of request
+   struct http_response *producer;   ///< Response being produced
+   size_t url_len;                   ///< Bytes of URL received
+   size_t header_count;              ///< Number of headers received
+   size_t header_size;               ///< Bytes of headers received
+   double body_start;                ///< Time body deadline was set
+   size_t body_len;                  ///< Bytes of body received
    void* data;                       ///< User data
 };
 
@@ -206,7 +221,7 @@ static void url_parser_key_value(void *data,
    struct http_request *req = data;
                   
    // TODO Has a return value
-   lm_insert_n(req->arguments, key, value_len, value, value_len);
+   lm_insert_n(req->arguments, key, key_len, value, value_len);
 }
 
 /// Callback for the header parser
@@ -276,6 +291,46 @@ static void header_parser_field_value_pair_complete(void* data,
    }
 }
 
+/// Set the deadline for the current phase of a request
+/**
+ *  Requests on HTTP/2 streams share the connection with other streams,
+ *  so only the connection idle timeout applies to these.
+ *
+ *  \param  req      The HTTP Request
+ *  \param  timeout  Seconds from now, or 0 to use the idle timeout
+ */
+static void set_deadline(struct http_request *req, double timeout)
+{
+   if (req->stream) return;
+
+   if (timeout > 0)
+      ws_conn_set_timeout(req->conn, timeout, 0);
+   else
+      ws_conn_set_timeout(req->conn, req->settings->timeout, 1);
+}
+
+/// Reject a request that exceeds a limit
+/**
+ *  Sends a response with the status and stops parsing. The connection
+ *  is closed after the response has been sent.
+ *
+ *  \param  req     The HTTP Request
+ *  \param  status  Status code to respond with
+ *
+ *  \return 1 to signal the parser to stop
+ */
+static int reject(struct http_request *req,
+                  enum httpws_http_status_code status)
+{
+   struct http_response *res = http_response_create(req, status);
+   if (res) {
+      http_response_sendf(res, NULL);
+      http_response_destroy(res);
+   }
+   req->state = S_STOP;
+   return 1;
+}
+
 /// Message begin callback for http_parser
 /**
  *  Called when the http request message begins, by the http_parser.
@@ -298,6 +353,7 @@ static int parser_msg_begin(http_parser *parser)
          return 1;
       case S_START:
          req->state = S_BEGIN;
+         set_deadline(req, settings->header_timeout);
          // Send request begin
          if(begin_cb)
             stat = begin_cb(req->webserver, req, settings->ws_ctx, &req->data);
@@ -344,6 +400,9 @@ static int parser_url(http_parser *parser, const char *buf, size_t len)
 
          req->state = S_URL;
       case S_URL:
+         req->url_len += len;
+         if (req->url_len > settings->max_url_size)
+            return reject(req, WS_HTTP_414);
          up_add_chunk(req->url_parser, buf, len);
          if(url_cb)
             stat = url_cb(req->webserver, req, settings->ws_ctx, &req->data, buf, len);
@@ -386,7 +445,12 @@ static int parser_hdr_field(http_parser *parser, const char *buf, size_t len)
          if (stat) { req->state = S_STOP; return stat; }
       case S_HEADER_VALUE:
          req->state = S_HEADER_FIELD;
+         if (++req->header_count > settings->max_headers)
+            return reject(req, WS_HTTP_431);
       case S_HEADER_FIELD:
+         req->header_size += len;
+         if (req->header_size > settings->max_header_size)
+            return reject(req, WS_HTTP_431);
          hp_on_header_field(req->header_parser, buf, len);
          if(header_field_cb)
             stat = header_field_cb(req->webserver, req, settings->ws_ctx, &req->data, buf, len);
@@ -423,6 +487,9 @@ static int parser_hdr_value(http_parser *parser, const char *buf, size_t len)
       case S_HEADER_FIELD:
          req->state = S_HEADER_VALUE;
       case S_HEADER_VALUE:
+         req->header_size += len;
+         if (req->header_size > settings->max_header_size)
+            return reject(req, WS_HTTP_431);
          hp_on_header_value(req->header_parser, buf, len);
          if(header_value_cb)
             stat = header_value_cb(req->webserver, req, settings->ws_ctx, &req->data, buf, len);
@@ -465,6 +532,19 @@ static int parser_hdr_cmpl(http_parser *parser)
       case S_HEADER_VALUE:
          hp_on_header_complete(req->header_parser);
          req->state = S_HEADER_COMPLETE;
+         // Body deadline, before callbacks that may keep it open
+         if ((parser->flags & F_CHUNKED) ||
+             (parser->content_length != 0 &&
+              parser->content_length != ULLONG_MAX)) {
+            req->body_start = ev_time();
+            set_deadline(req, settings->body_timeout);
+         }
+         // Switch to HTTP/2 before the request is handled, so the
+         // response is sent on stream 1
+         if (parser->upgrade && settings->h2c && !req->stream &&
+             h2_is_upgrade(req))
+            req->h2 = h2_conn_create(req->webserver, settings,
+                                     req->conn, req);
          if(header_cmpl_cb)
             stat = header_cmpl_cb(req->webserver, req, settings->ws_ctx, &req->data);
          if (stat) { req->state = S_STOP; return stat; }
@@ -500,6 +580,14 @@ static int parser_body(http_parser *parser, const char *buf, size_t len)
       case S_HEADER_COMPLETE:
          req->state = S_BODY;
       case S_BODY:
+         req->body_len += len;
+         if (settings->body_timeout > 0 && settings->body_min_rate > 0) {
+            // Extend deadline by the time the minimum rate allows for
+            double left = req->body_start + settings->body_timeout
+                        + (double)req->body_len / settings->body_min_rate
+                        - ev_time();
+            if (left > 0) set_deadline(req, left);
+         }
          if (body_cb) {
             stat = body_cb(req->webserver, req, settings->ws_ctx, &req->data, buf, len);
             if (stat) { req->state = S_STOP; return stat; }
@@ -532,6 +620,8 @@ static int parser_msg_cmpl(http_parser *parser)
       case S_HEADER_COMPLETE:
       case S_BODY:
          req->state = S_COMPLETE;
+         // Idle while responding, unless the callback keeps it open
+         set_deadline(req, 0);
          if(complete_cb)
             stat = complete_cb(req->webserver, req, settings->ws_ctx, &req->data);
          if (stat) { req->state = S_STOP; return stat; }
@@ -597,6 +687,15 @@ struct http_request *http_request_create(
 
    // Other field to init
    req->url = NULL;
+   req->websocket = NULL;
+   req->h2 = NULL;
+   req->stream = NULL;
+   req->producer = NULL;
+   req->url_len = 0;
+   req->header_count = 0;
+   req->header_size = 0;
+   req->body_start = 0;
+   req->body_len = 0;
    req->data = NULL;
 
    return req;
@@ -613,6 +712,13 @@ void http_request_destroy(struct http_request *req)
 {
    if (!req) return;
 
+   // Close websocket or HTTP/2 streams before the request they belong to
+   websocket_destroy(req->websocket);
+   h2_conn_destroy(req->h2);
+
+   // The connection is gone, so the rest of the body is not produced
+   if (req->producer) http_response_free(req->producer);
+
    // Call callback
    struct httpws_settings *settings = req->settings;
    httpws_nodata_cb destroy_cb = settings->on_req_destroy;
@@ -637,6 +743,12 @@ void http_request_destroy(struct http_request *req)
  *  events. The callbacks will change state of the ws_request and make
  *  calls on the functions defined in ws_settings.
  *
+ *  If the request has been upgraded to a websocket or HTTP/2, the chunk
+ *  is passed on to the websocket or HTTP/2 connection instead. This
+ *  also applies to any remains of a chunk after the end of the upgrade
+ *  request. A connection starting with the HTTP/2 connection preface is
+ *  handled as HTTP/2 with prior knowledge.
+ *
  *  @param  req The request, to which the chunk should be added.
  *  @param  buf The chunk, which is not assumed to be \\0 terminated.
  *  @param  len Length of the chuck.
@@ -648,10 +760,33 @@ size_t http_request_parse(
       const char *buf,
       size_t len)
 {
+   size_t parsed;
+
+   if (req->websocket)
+      return websocket_parse(req->websocket, buf, len);
+   if (req->h2)
+      return h2_conn_parse(req->h2, buf, len);
+
+   // HTTP/2 with prior knowledge
+   if (req->state == S_START && !req->stream && req->settings->h2c &&
+       h2_is_preface(buf, len)) {
+      req->h2 = h2_conn_create(req->webserver, req->settings,
+                               req->conn, NULL);
+      if (!req->h2) return 0;
+      return h2_conn_parse(req->h2, buf, len);
+   }
+
    // TODO This needs to send some kind of error message if any of the
    // parsers fails (http, header, url, etc.), including their callbacks
    // in this file
-   return http_parser_execute(&req->parser, &parser_settings, buf, len);
+   parsed = http_parser_execute(&req->parser, &parser_settings, buf, len);
+
+   if (req->parser.upgrade && req->websocket && parsed < len)
+      parsed += websocket_parse(req->websocket, &buf[parsed], len-parsed);
+   else if (req->parser.upgrade && req->h2 && parsed < len)
+      parsed += h2_conn_parse(req->h2, &buf[parsed], len-parsed);
+
+   return parsed;
 }
 
 /// Get the method of the http request
@@ -700,6 +835,66 @@ const char *http_request_get_header(struct http_request *req, const char* key)
    return lm_find(req->headers, key);
 }
 
+/// Data for http_request_find_header()
+struct header_search {
+   const char *field; ///< Field to search for
+   const char *value; ///< Value found
+};
+
+/// Map callback for http_request_find_header()
+static void header_search_cb(void *data, const char *key,
+                             const char *value)
+{
+   struct header_search *search = data;
+   if (!search->value && strcasecmp(key, search->field) == 0)
+      search->value = value;
+}
+
+/// Find a header with case-insensitive comparison of the field
+/**
+ *  \param  req    http request
+ *  \param  field  Header field
+ *
+ *  \return The value of the header, or NULL if not found
+ */
+const char *http_request_find_header(struct http_request *req,
+                                     const char *field)
+{
+   struct header_search search = { field, NULL };
+   lm_map(req->headers, header_search_cb, &search);
+   return search.value;
+}
+
+/// Check if a comma-separated header contains a token
+/**
+ *  Comparison is case-insensitive for both field and token, as required
+ *  for e.g. the Upgrade and the Connection header.
+ *
+ *  \param  req    http request
+ *  \param  field  Header field
+ *  \param  token  Token to search for
+ *
+ *  \return 1 if found, 0 otherwise
+ */
+int http_request_header_has_token(struct http_request *req,
+                                  const char *field, const char *token)
+{
+   const char *value = http_request_find_header(req, field);
+   size_t len = strlen(token);
+   const char *end;
+
+   while (value && *value) {
+      while (*value == ' ' || *value == '\t' || *value == ',') value++;
+      for (end = value; *end && *end != ','; end++);
+      while (end > value && (end[-1] == ' ' || end[-1] == '\t')) end--;
+      if (end - value == len && strncasecmp(value, token, len) == 0)
+         return 1;
+      value = strchr(value, ',');
+   }
+
+   return 0;
+}
+
 /// Get a linked map of all URL arguements for a request
 /**
  *  \param  req  http request
@@ -758,6 +953,75 @@ struct ws_conn *http_request_get_connection(struct http_request *req)
    return req->conn;
 }
 
+/// Attach a websocket to a request
+/**
+ *  Once attached all further data received on the connection is parsed
+ *  by the websocket. The websocket is destroyed with the request.
+ *
+ *  \param  req  http request
+ *  \param  ws   The websocket
+ *
+ *  \return 0 on success, 1 if the request cannot be upgraded
+ */
+int http_request_set_websocket(struct http_request *req,
+                               struct http_websocket *ws)
+{
+   if (req->websocket || !req->parser.upgrade) return 1;
+   req->websocket = ws;
+   return 0;
+}
+
+/// Attach a HTTP/2 stream to a request
+/**
+ *  Responses to the request are sent on the stream, instead of directly
+ *  on the connection.
+ *
+ *  \param  req     http request
+ *  \param  stream  The stream, or NULL to detach
+ */
+void http_request_set_stream(struct http_request *req,
+                             struct h2_stream *stream)
+{
+   req->stream = stream;
+}
+
+/// Get the HTTP/2 stream of a request
+/**
+ *  \param  req  http request
+ *
+ *  \return The stream, or NULL if the request is HTTP/1.x
+ */
+struct h2_stream *http_request_get_stream(struct http_request *req)
+{
+   return req->stream;
+}
+
+/// Set the response being produced on the connection of a request
+/**
+ *  \param  req  http request
+ *  \param  res  The response, or NULL when it is finished
+ */
+void http_request_set_producer(struct http_request *req,
+                               struct http_response *res)
+{
+   req->producer = res;
+}
+
+/// Tell a request that the data queued on its connection has been sent
+/**
+ *  Lets the response being produced, if any, queue its next part. On a
+ *  HTTP/2 connection, the streams closed meanwhile are destroyed.
+ *
+ *  \param  req  http request
+ */
+void http_request_sent(struct http_request *req)
+{
+   if (req->h2)
+      h2_conn_sent(req->h2);
+   if (req->producer)
+      http_response_produce_next(req->producer);
+}
+
 /// Get the IP of a request
 /**
  *  \param  req  http request
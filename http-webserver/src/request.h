@@ -52,4 +52,22 @@ size_t http_request_parse(struct http_request *req,
 
 struct ws_conn *http_request_get_connection(struct http_request *req);
 
+int http_request_set_websocket(struct http_request *req,
+                               struct http_websocket *ws);
+
+struct h2_stream;
+void http_request_set_stream(struct http_request *req,
+                             struct h2_stream *stream);
+struct h2_stream *http_request_get_stream(struct http_request *req);
+
+struct http_response;
+void http_request_set_producer(struct http_request *req,
+                               struct http_response *res);
+void http_request_sent(struct http_request *req);
+
+const char *http_request_find_header(struct http_request *req,
+                                     const char *field);
+int http_request_header_has_token(struct http_request *req,
+                                  const char *field, const char *token);
+
 #endif
@@ -33,6 +33,7 @@
 
 #include "response.h"
 #include "request.h"
+#include "h2.h"
 #include "http-webserver.h"
 #include "webserver.h"
 
@@ -46,6 +47,7 @@
 
 #define HTTP_VERSION "HTTP/1.1 "
 #define CRLF "\r\n"
+#define MSG_SIZE 256 ///< Initial room for status and headers
 
 /// A http response
 /**
@@ -59,11 +61,25 @@
  *  The body is sent in chunks by repeating the calls to
  *  http_response_sendf() and http_response_vsentf(). The status and
  *  headers will be sent on the first call.
+ *
+ *  Alternatively the body is produced while it is sent, with
+ *  http_response_produce(), which also finishes the response.
+ *
+ *  Responses to requests on a HTTP/2 stream are passed on to the stream,
+ *  which encodes the status and headers. In this case msg only marks
+ *  that the headers have not been sent yet.
  */
 struct http_response
 {
-   struct ws_conn *conn; ///< The connection to send on
-   char *msg;            ///< Status/headers to send
+   struct ws_conn *conn;     ///< The connection to send on
+   struct h2_stream *stream; ///< The HTTP/2 stream to send on or NULL
+   struct http_request *req; ///< The request responded to
+   char *msg;                ///< Status/headers to send
+   size_t msg_len;           ///< Length of msg
+   size_t msg_size;          ///< Bytes allocated for msg
+   httpws_produce_cb produce; ///< Producer of the body, or NULL
+   void *data;               ///< Data for the producer
+   size_t window;            ///< Bytes produced at a time
 };
 
 #ifdef DEBUG
@@ -111,11 +127,28 @@ static char* http_status_codes_to_str(enum httpws_http_status_code status)
  *  Any data sent with http_response_sendf() and http_reponse_vsendf()
  *  will be sent before the connection is closed.
  *
+ *  On a HTTP/2 stream only the stream is ended, as the connection is
+ *  shared with other streams.
+ *
  *  \param  res  The HTTP Response to destroy
  */
 void http_response_destroy(struct http_response *res)
 {
-   ws_conn_close(res->conn);
+   if (res->stream)
+      h2_stream_end(res->stream);
+   else
+      ws_conn_close(res->conn);
+   http_response_free(res);
+}
+
+/// Free a response without finishing it
+/**
+ *  Used when the connection of the response is gone.
+ *
+ *  \param  res  The HTTP Response to free
+ */
+void http_response_free(struct http_response *res)
+{
    free(res->msg);
    free(res);
 }
@@ -142,7 +175,7 @@ struct http_response *http_response_create(
       enum httpws_http_status_code status)
 {
    struct http_response *res = NULL;
-   int len;
+   size_t len;
 
    // Get data
    char *status_str = http_status_codes_to_str(status);
@@ -153,26 +186,42 @@ struct http_response *http_response_create(
    len += strlen(status_str);
    len += strlen(CRLF);
    
-   // Allocate space
+   // Allocate space, with room for the common headers and the final
+   // line break
    res = malloc(sizeof(struct http_response));
    if (res == NULL) {
       fprintf(stderr, "ERROR: Cannot allocate memory\n");
       return NULL;
    }
-   res->msg = malloc(len*sizeof(char));
-   if (res == NULL) {
+   res->msg_size = len + strlen(CRLF);
+   if (res->msg_size < MSG_SIZE) res->msg_size = MSG_SIZE;
+   res->msg = malloc(res->msg_size*sizeof(char));
+   if (res->msg == NULL) {
       fprintf(stderr, "ERROR: Cannot allocate memory\n");
-      http_response_destroy(res);
+      free(res);
       return NULL;
    }
   
    // Init struct
    res->conn = http_request_get_connection(req);
+   res->stream = http_request_get_stream(req);
+   res->req = req;
+   res->produce = NULL;
+   res->data = NULL;
+   res->window = 0;
 
    // Construct msg
    strcpy(res->msg, HTTP_VERSION);
    strcat(res->msg, status_str);
    strcat(res->msg, CRLF);
+   res->msg_len = len-1;
+
+   // HTTP/2 streams are not closed after the response
+   if (res->stream) {
+      // TODO Check return value
+      h2_stream_start(res->stream, status);
+      return res;
+   }
 
    // TODO Real persistant connections is not supported, so tell client
    // that we close connection after response has been sent
@@ -205,25 +254,42 @@ int http_response_add_header(struct http_response *res,
       return 1;
    }
 
-	char *msg;
-	int msg_len = strlen(res->msg)+strlen(field)+2+strlen(value)+strlen(CRLF)+1;
+   if (res->stream)
+      return h2_stream_add_header(res->stream, field, value);
+
+   char *msg;
+   size_t field_len = strlen(field);
+   size_t value_len = strlen(value);
+   size_t msg_len = res->msg_len+field_len+2+value_len+strlen(CRLF);
+   size_t msg_size = res->msg_size;
 
 #ifdef DEBUG
    if (msg_len > 100000)
       print_trace();
 #endif
 
-	msg = realloc(res->msg, msg_len*sizeof(char));
-	if (msg == NULL) {
-      	fprintf(stderr, "ERROR: Cannot allocate memory\n");
-      	return 1;
+   // Grow by doubling, so adding headers is linear in their size. Keep
+   // room for the line ending the headers, see send_head()
+   if (msg_len + strlen(CRLF) + 1 > msg_size) {
+      while (msg_size < msg_len + strlen(CRLF) + 1) msg_size *= 2;
+      msg = realloc(res->msg, msg_size*sizeof(char));
+      if (msg == NULL) {
+         fprintf(stderr, "ERROR: Cannot allocate memory\n");
+         return 1;
+      }
+      res->msg = msg;
+      res->msg_size = msg_size;
    }
-   res->msg = msg;
 
-   strcat(res->msg, field);
-   strcat(res->msg, ": ");
-   strcat(res->msg, value);
-   strcat(res->msg, CRLF);
+   msg = &res->msg[res->msg_len];
+   memcpy(msg, field, field_len);
+   msg += field_len;
+   memcpy(msg, ": ", 2);
+   msg += 2;
+   memcpy(msg, value, value_len);
+   msg += value_len;
+   strcpy(msg, CRLF);
+   res->msg_len = msg_len;
    
    return 0;
 }
@@ -259,59 +325,109 @@ int http_response_add_cookie(struct http_response *res,
    // Headers already sent
    if (!res->msg) return 1;
 
-	char *msg;
-	int msg_len = strlen(res->msg) + 12 +
-                 strlen(field) + 1 +
-                 strlen(value) +
-                 strlen(CRLF) + 1;
+   int rc;
+   char *cookie;
+   int cookie_len = strlen(field) + 1 + strlen(value) + 1;
 
    // Calculate length
-   if (expires)   msg_len += 10 + strlen(expires);
-   if (max_age)   msg_len += 10 + strlen(max_age);
-   if (domain)    msg_len +=  9 + strlen(domain);
-   if (path)      msg_len +=  7 + strlen(path);
-   if (secure)    msg_len +=  8;
-   if (http_only) msg_len += 10;
-   if (extension) msg_len +=  2 + strlen(extension);
-
-   // Reallocate message
-	msg = realloc(res->msg, msg_len*sizeof(char));
-	 if (msg == NULL) {
-      	fprintf(stderr, "ERROR: Cannot allocate memory\n");
-      	return 1;
+   if (expires)   cookie_len += 10 + strlen(expires);
+   if (max_age)   cookie_len += 10 + strlen(max_age);
+   if (domain)    cookie_len +=  9 + strlen(domain);
+   if (path)      cookie_len +=  7 + strlen(path);
+   if (secure)    cookie_len +=  8;
+   if (http_only) cookie_len += 10;
+   if (extension) cookie_len +=  2 + strlen(extension);
+
+   // Allocate value
+   cookie = malloc(cookie_len*sizeof(char));
+   if (cookie == NULL) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return 1;
    }
-   res->msg = msg;
 
-   // Apply header
-   strcat(res->msg, "Set-Cookie: ");
-   strcat(res->msg, field);
-   strcat(res->msg, "=");
-   strcat(res->msg, value);
-   strcat(res->msg, CRLF);
+   // Construct value
+   strcpy(cookie, field);
+   strcat(cookie, "=");
+   strcat(cookie, value);
    if (expires) {
-      strcat(res->msg, "; Expires=");
-      strcat(res->msg, expires);
+      strcat(cookie, "; Expires=");
+      strcat(cookie, expires);
    }
    if (max_age) {
-      strcat(res->msg, "; Max-Age=");
-      strcat(res->msg, max_age);
+      strcat(cookie, "; Max-Age=");
+      strcat(cookie, max_age);
    }
    if (domain) {
-      strcat(res->msg, "; Domain=");
-      strcat(res->msg, domain);
+      strcat(cookie, "; Domain=");
+      strcat(cookie, domain);
    }
    if (path) {
-      strcat(res->msg, "; Domain=");
-      strcat(res->msg, domain);
+      strcat(cookie, "; Path=");
+      strcat(cookie, path);
    }
-   if (secure) strcat(res->msg, "; Secure");
-   if (http_only) strcat(res->msg, "; HttpOnly");
+   if (secure) strcat(cookie, "; Secure");
+   if (http_only) strcat(cookie, "; HttpOnly");
    if (extension) {
-      strcat(res->msg, "; ");
-      strcat(res->msg, extension);
+      strcat(cookie, "; ");
+      strcat(cookie, extension);
    }
+
+   rc = http_response_add_header(res, "Set-Cookie", cookie);
+   free(cookie);
    
-   return 0;
+   return rc;
+}
+
+/// Send response on a HTTP/2 stream
+/**
+ *  The body is formatted here, as the stream sends it in DATA frames.
+ *  The stream sends the headers before the first data.
+ *
+ *  \param  res  The http response to send.
+ *  \param  fmt  The format string for the body or NULL
+ */
+static void h2_response_vsendf(struct http_response *res,
+                               const char *fmt, va_list arg)
+{
+   char *body = NULL;
+   int len = 0;
+   va_list arg2;
+
+   free(res->msg);
+   res->msg = NULL;
+
+   if (fmt) {
+      // Copy arg to avoid errors on 64bit
+      va_copy(arg2, arg);
+      len = vsnprintf("", 0, fmt, arg);
+      body = malloc((len+1)*sizeof(char));
+      if (body == NULL) {
+         fprintf(stderr, "ERROR: Cannot allocate memory\n");
+         va_end(arg2);
+         return;
+      }
+      vsprintf(body, fmt, arg2);
+      va_end(arg2);
+   }
+
+   // TODO Send returns a status
+   h2_stream_send(res->stream, body, len);
+   free(body);
+}
+
+/// Send the status and header lines, if not sent yet
+/**
+ *  \param  res  The http response
+ */
+static void send_head(struct http_response *res)
+{
+   if (!res->msg) return;
+
+   // TODO Send returns a status
+   strcpy(&res->msg[res->msg_len], CRLF);
+   ws_conn_send(res->conn, res->msg, res->msg_len + strlen(CRLF));
+   free(res->msg);
+   res->msg = NULL;
 }
 
 /// Send response to client
@@ -348,13 +464,13 @@ void http_response_sendf(struct http_response *res, const char *fmt, ...)
 void http_response_vsendf(struct http_response *res,
                           const char *fmt, va_list arg)
 {
-   if (res->msg) {
-      // TODO Sendf returns a status
-      ws_conn_sendf(res->conn, "%s%s", res->msg, CRLF);
-      free(res->msg);
-      res->msg = NULL;
+   if (res->stream) {
+      h2_response_vsendf(res, fmt, arg);
+      return;
    }
 
+   send_head(res);
+
    if (fmt) {
       // TODO Sendf returns a status
       ws_conn_vsendf(res->conn, fmt, arg);
@@ -362,3 +478,124 @@ void http_response_vsendf(struct http_response *res,
 
 }
 
+/// Send a response rendered in advance
+/**
+ *  For responses that hardly change, e.g. rejections under overload,
+ *  so that sending one costs no more than queueing its bytes. The
+ *  response must be a complete HTTP/1.1 response, including the
+ *  "Connection: close" header, as the connection is closed after it.
+ *
+ *  Requests on HTTP/2 streams cannot be answered this way, the regular
+ *  response functions must be used for these.
+ *
+ *  \param  req  The http request to respond to
+ *  \param  buf  The response
+ *  \param  len  Length of the response
+ *
+ *  \return 0 on success, 1 if the request is on a HTTP/2 stream or on
+ *          failure
+ */
+int http_response_send_raw(struct http_request *req,
+                           const char *buf, size_t len)
+{
+   struct ws_conn *conn = http_request_get_connection(req);
+
+   if (http_request_get_stream(req)) return 1;
+   if (ws_conn_send(conn, buf, len)) return 1;
+   ws_conn_close(conn);
+   return 0;
+}
+
+/// Send the next part of a produced body
+/**
+ *  The producer writes directly into the send queue of the connection.
+ *  Once it has no more data, the response is finished and destroyed.
+ *  If there is no room for the next part, the connection is aborted,
+ *  so the client does not take the truncated body for a complete one.
+ *
+ *  \param  res  The response being produced
+ */
+void http_response_produce_next(struct http_response *res)
+{
+   char *buf;
+   size_t len;
+
+   buf = ws_conn_send_reserve(res->conn, res->window);
+   if (buf == NULL) {
+      fprintf(stderr, "ERROR: Response body truncated, aborting connection\n");
+      http_request_set_producer(res->req, NULL);
+      ws_conn_abort(res->conn);
+      http_response_free(res);
+      return;
+   }
+   len = res->produce(res->data, buf, res->window);
+   ws_conn_send_commit(res->conn, len);
+   if (len > 0) return;
+
+   http_request_set_producer(res->req, NULL);
+   http_response_destroy(res);
+}
+
+/// Send response with a body produced while it is sent
+/**
+ *  First it sends the status and header lines, if these haven't been
+ *  sent yet. Then the producer is called whenever the connection has
+ *  sent all queued data, to write the next part of the body directly
+ *  into the send queue. So the body is never held in memory in full,
+ *  and a slow client slows down the producer. The producer returns the
+ *  number of bytes written, at most cap, or 0 at the end of the body.
+ *
+ *  The response is destroyed when the body has been produced, or when
+ *  the connection closes before that. It must not be used after this
+ *  call.
+ *
+ *  HTTP/2 streams queue data until their flow control windows allow it
+ *  to be sent, so here the body is produced at once.
+ *
+ *  \param  res      The http response to send.
+ *  \param  window   The largest part of the body to produce at a time
+ *  \param  produce  The producer of the body
+ *  \param  data     Given to the producer
+ *
+ *  \return 0 on success and 1 on failure
+ */
+int http_response_produce(struct http_response *res, size_t window,
+                          httpws_produce_cb produce, void *data)
+{
+   char *buf;
+   size_t len;
+
+   if (res->stream) {
+      free(res->msg);
+      res->msg = NULL;
+      buf = malloc(window*sizeof(char));
+      if (buf == NULL) {
+         fprintf(stderr, "ERROR: Cannot allocate memory\n");
+         h2_stream_abort(res->stream);
+         http_response_free(res);
+         return 1;
+      }
+      while ((len = produce(data, buf, window)) > 0)
+         if (h2_stream_send(res->stream, buf, len)) break;
+      free(buf);
+      // A truncated body must not end with END_STREAM
+      if (len > 0) {
+         fprintf(stderr, "ERROR: Response body truncated, resetting stream\n");
+         h2_stream_abort(res->stream);
+         http_response_free(res);
+         return 1;
+      }
+      http_response_destroy(res);
+      return 0;
+   }
+
+   send_head(res);
+
+   res->produce = produce;
+   res->data = data;
+   res->window = window;
+   http_request_set_producer(res->req, res);
+   http_response_produce_next(res);
+
+   return 0;
+}
@@ -34,4 +34,9 @@
 #ifndef RESPONSE_H
 #define RESPONSE_H
 
+struct http_response;
+
+void http_response_produce_next(struct http_response *res);
+void http_response_free(struct http_response *res);
+
 #endif
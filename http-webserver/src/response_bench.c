@@ -0,0 +1,178 @@
+// response_bench.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+*   
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*  
+*  1. Redistributions of source code must retain the above copyright
+*  notice, this list of conditions and the following disclaimer.
+*  
+*  2. Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*  
+*  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+*  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+*  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+*  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+*  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+*  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+*  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+*  SUCH DAMAGE.
+*  
+*  The views and conclusions contained in the software and
+*  documentation are those of the authors and should not be interpreted
+*  as representing official policies, either expressed.
+*/
+
+#include "response.c"
+#include "bench.h"
+
+#include <stdarg.h>
+
+// The connection is replaced by stubs counting what would be sent, so
+// only building the response is measured
+
+static size_t sent = 0;
+static char scratch[4096];
+
+struct ws_conn *http_request_get_connection(struct http_request *req)
+{
+   return (struct ws_conn *)scratch;
+}
+
+struct h2_stream *http_request_get_stream(struct http_request *req)
+{
+   return NULL;
+}
+
+void http_request_set_producer(struct http_request *req,
+                               struct http_response *res)
+{
+}
+
+int ws_conn_send(struct ws_conn *conn, const char *buf, size_t len)
+{
+   sent += len;
+   return 0;
+}
+
+int ws_conn_vsendf(struct ws_conn *conn, const char *fmt, va_list arg)
+{
+   // Formatted like the webserver does, into its send buffer
+   sent += vsnprintf(scratch, sizeof(scratch), fmt, arg);
+   return 0;
+}
+
+char *ws_conn_send_reserve(struct ws_conn *conn, size_t len)
+{
+   return len <= sizeof(scratch) ? scratch : NULL;
+}
+
+void ws_conn_send_commit(struct ws_conn *conn, size_t len)
+{
+   sent += len;
+}
+
+void ws_conn_close(struct ws_conn *conn)
+{
+}
+
+void ws_conn_abort(struct ws_conn *conn)
+{
+}
+
+int h2_stream_start(struct h2_stream *stream, int status)
+{
+   return 0;
+}
+
+int h2_stream_add_header(struct h2_stream *stream,
+                         const char *name, const char *value)
+{
+   return 0;
+}
+
+int h2_stream_send(struct h2_stream *stream, const char *buf, size_t len)
+{
+   return 0;
+}
+
+void h2_stream_end(struct h2_stream *stream)
+{
+}
+
+void h2_stream_abort(struct h2_stream *stream)
+{
+}
+
+/// A 404 without headers
+static void status_bench(void *data, size_t n)
+{
+   struct http_response *res;
+   size_t i;
+
+   for (i = 0; i < n; i++) {
+      res = http_response_create(NULL, WS_HTTP_404);
+      http_response_sendf(res, "Resource not found");
+      http_response_destroy(res);
+   }
+}
+
+/// A value of a service, as sent by homeport
+static void value_bench(void *data, size_t n)
+{
+   struct http_response *res;
+   size_t i;
+
+   for (i = 0; i < n; i++) {
+      res = http_response_create(NULL, WS_HTTP_200);
+      http_response_add_header(res, "Access-Control-Allow-Origin", "*");
+      http_response_add_header(res, "Content-Type", "application/xml");
+      http_response_sendf(res, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+                          "<value timestamp=\"%lu\">%d</value>",
+                          1400000000ul + i, (int)(i % 100));
+      http_response_destroy(res);
+   }
+}
+
+/// A response with many headers and cookies, and a body in chunks
+static void headers_bench(void *data, size_t n)
+{
+   struct http_response *res;
+   char value[32];
+   size_t i;
+   int j;
+
+   for (i = 0; i < n; i++) {
+      res = http_response_create(NULL, WS_HTTP_200);
+      for (j = 0; j < 16; j++) {
+         sprintf(value, "value-%d", j);
+         http_response_add_header(res, "X-Header", value);
+      }
+      http_response_add_cookie(res, "session", "1234", NULL, "3600",
+                               NULL, "/", 0, 1, NULL);
+      for (j = 0; j < 8; j++)
+         http_response_sendf(res, "<chunk n=\"%d\"/>", j);
+      http_response_destroy(res);
+   }
+}
+
+int main(int argc, char **argv)
+{
+   int rc;
+
+   bench_init("response", argc, argv);
+   bench_run("response_status", status_bench, NULL);
+   bench_run("response_value", value_bench, NULL);
+   bench_run("response_headers", headers_bench, NULL);
+   rc = bench_finish();
+   bench_use(&sent);
+   return rc;
+}
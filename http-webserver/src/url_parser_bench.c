@@ -0,0 +1,109 @@
+// url_parser_bench.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+*   
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*  
+*  1. Redistributions of source code must retain the above copyright
+*  notice, this list of conditions and the following disclaimer.
+*  
+*  2. Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*  
+*  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+*  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+*  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+*  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+*  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+*  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+*  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+*  SUCH DAMAGE.
+*  
+*  The views and conclusions contained in the software and
+*  documentation are those of the authors and should not be interpreted
+*  as representing official policies, either expressed.
+*/
+
+#include "url_parser.c"
+#include "bench.h"
+
+/// URLs as requested from homeport, the last with arguments
+static const char *urls[] = {
+   "/devices",
+   "/Phidget/00a3f2c1/Lamp/3",
+   "/ZWave/0b12ee40/Temperature/12?x=1",
+   "/events/5f1b2c3d-8e4f-4a5b-9c6d-7e8f9a0b1c2d",
+   "/Zigbee/1c2d3e4f/Switch/0?timeout=10&format=xml&x=2",
+};
+#define URLS (sizeof(urls) / sizeof(urls[0]))
+
+static size_t lengths[URLS];
+
+static void on_path(void *data, const char *path, size_t len)
+{
+   bench_use(path);
+}
+
+static void on_pair(void *data, const char *key, size_t key_len,
+                    const char *value, size_t value_len)
+{
+   bench_use(value);
+}
+
+/// Parse a URL as received by a request: create, one chunk, complete
+static void parse_bench(void *data, size_t n)
+{
+   struct up_settings settings = UP_SETTINGS_DEFAULT;
+   struct up *up;
+   size_t i;
+
+   settings.on_path_complete = on_path;
+   settings.on_key_value = on_pair;
+   for (i = 0; i < n; i++) {
+      up = up_create(&settings, NULL);
+      up_add_chunk(up, urls[i % URLS], lengths[i % URLS]);
+      up_complete(up);
+      up_destroy(up);
+   }
+}
+
+/// Parse a URL received in three chunks
+static void parse_chunked_bench(void *data, size_t n)
+{
+   struct up_settings settings = UP_SETTINGS_DEFAULT;
+   struct up *up;
+   const char *url;
+   size_t i, len;
+
+   settings.on_path_complete = on_path;
+   settings.on_key_value = on_pair;
+   for (i = 0; i < n; i++) {
+      url = urls[i % URLS];
+      len = lengths[i % URLS];
+      up = up_create(&settings, NULL);
+      up_add_chunk(up, url, len / 3);
+      up_add_chunk(up, url + len / 3, len / 3);
+      up_add_chunk(up, url + 2 * (len / 3), len - 2 * (len / 3));
+      up_complete(up);
+      up_destroy(up);
+   }
+}
+
+int main(int argc, char **argv)
+{
+   size_t i;
+
+   for (i = 0; i < URLS; i++) lengths[i] = strlen(urls[i]);
+
+   bench_init("url_parser", argc, argv);
+   bench_run("url_parse", parse_bench, NULL);
+   bench_run("url_parse_chunked", parse_chunked_bench, NULL);
+   return bench_finish();
+}
@@ -0,0 +1,696 @@
+// websocket.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+*   
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*  
+*  1. Redistributions of source code must retain the above copyright
+*  notice, this list of conditions and the following disclaimer.
+*  
+*  2. Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*  
+*  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+*  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+*  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+*  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+*  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+*  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+*  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+*  SUCH DAMAGE.
+*  
+*  The views and conclusions contained in the software and
+*  documentation are those of the authors and should not be interpreted
+*  as representing official policies, either expressed.
+*/
+
+#include "websocket.h"
+#include "request.h"
+#include "webserver.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+/// GUID appended to the client key in the opening handshake (RFC 6455)
+#define WEBSOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+/// Frame opcodes, see RFC 6455 section 5.2
+enum opcode {
+   OP_CONTINUATION = 0x0, ///< Continuation of a fragmented message
+   OP_TEXT         = 0x1, ///< Text message
+   OP_BINARY       = 0x2, ///< Binary message
+   OP_CLOSE        = 0x8, ///< Connection close
+   OP_PING         = 0x9, ///< Ping
+   OP_PONG         = 0xA  ///< Pong
+};
+
+/// Close status codes, see RFC 6455 section 7.4.1
+enum close_code {
+   CLOSE_NORMAL         = 1000, ///< Normal closure
+   CLOSE_PROTOCOL_ERROR = 1002, ///< Protocol error
+   CLOSE_TOO_BIG        = 1009, ///< Message too big
+   CLOSE_INTERNAL_ERROR = 1011  ///< Unexpected condition on server
+};
+
+/// The possible states of a websocket
+enum state {
+   S_HEADER,  ///< Receiving frame header
+   S_PAYLOAD, ///< Receiving frame payload
+   S_CLOSED   ///< Close frame sent, further data is ignored
+};
+
+/// A websocket
+/**
+ *  A websocket is created from a http request with
+ *  http_websocket_accept(), once the opening handshake has been
+ *  received. From then on all data received on the connection is passed
+ *  to websocket_parse() instead of the http parser.
+ *
+ *  Frames are unmasked while they are received. Data frames are
+ *  collected until the final fragment of a message has arrived, after
+ *  which on_message() from http_websocket_settings is called with the
+ *  full message. Control frames are handled internally, that is pings
+ *  are answered with pongs and close frames are echoed before the
+ *  connection is closed.
+ */
+struct http_websocket {
+   struct http_websocket_settings settings; ///< Settings
+   struct http_request *req;                ///< Upgraded request
+   struct ws_conn *conn;                    ///< Connection to client
+   void *data;                              ///< User data
+   enum state state;                        ///< Current state
+   unsigned char hdr[14];                   ///< Frame header
+   size_t hdr_len;                          ///< Header bytes received
+   size_t hdr_need;                         ///< Header bytes expected
+   int fin;                                 ///< Final fragment ?
+   int opcode;                              ///< Opcode of frame
+   uint64_t payload_len;                    ///< Length of payload
+   uint64_t payload_read;                   ///< Payload received
+   int msg_opcode;                          ///< Opcode of message
+   char *msg;                               ///< Message buffer
+   size_t msg_len;                          ///< Length of message
+   size_t msg_size;                         ///< Size of message buffer
+   char ctrl[125];                          ///< Control frame payload
+};
+
+/// Rotate a 32 bit word left
+#define ROL(X, N) (((X) << (N)) | ((X) >> (32-(N))))
+
+/// Compute the SHA-1 digest of a message
+/**
+ *  Only used for the opening handshake, so the message is expected to
+ *  be short and is processed in a single call.
+ *
+ *  \param  data    Message
+ *  \param  len     Length of message
+ *  \param  digest  Buffer for the 20 byte digest
+ */
+static void sha1(const unsigned char *data, size_t len,
+                 unsigned char digest[20])
+{
+   uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE,
+                     0x10325476, 0xC3D2E1F0 };
+   uint64_t bits = (uint64_t)len * 8;
+   unsigned char block[64];
+   uint32_t w[80], a, b, c, d, e, f, k, t;
+   size_t off, i, n;
+   int done = 0, pad = 0;
+
+   for (off = 0; !done; off += 64) {
+      // Construct block, appending padding and length at the end
+      n = off < len ? len - off : 0;
+      if (n > 64) n = 64;
+      memcpy(block, &data[off], n);
+      memset(&block[n], 0, 64 - n);
+      if (n < 64 && !pad) {
+         block[n] = 0x80;
+         pad = 1;
+      }
+      if (n < 56) {
+         for (i = 0; i < 8; i++)
+            block[63-i] = bits >> (8*i);
+         done = 1;
+      }
+
+      // Process block
+      for (i = 0; i < 16; i++)
+         w[i] = block[4*i] << 24 | block[4*i+1] << 16 |
+                block[4*i+2] << 8 | block[4*i+3];
+      for (i = 16; i < 80; i++)
+         w[i] = ROL(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+      a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+      for (i = 0; i < 80; i++) {
+         if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+         } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+         } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+         } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+         }
+         t = ROL(a, 5) + f + e + k + w[i];
+         e = d; d = c; c = ROL(b, 30); b = a; a = t;
+      }
+      h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+   }
+
+   for (i = 0; i < 20; i++)
+      digest[i] = h[i/4] >> (24 - 8*(i%4));
+}
+
+/// Base64 encode data
+/**
+ *  \param  data  Data to encode
+ *  \param  len   Length of data
+ *  \param  out   Buffer of at least 4*((len+2)/3)+1 characters
+ */
+static void base64(const unsigned char *data, size_t len, char *out)
+{
+   static const char tbl[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+   size_t i;
+   uint32_t v;
+
+   for (i = 0; i < len; i += 3) {
+      v = data[i] << 16;
+      if (i+1 < len) v |= data[i+1] << 8;
+      if (i+2 < len) v |= data[i+2];
+      *out++ = tbl[(v >> 18) & 0x3F];
+      *out++ = tbl[(v >> 12) & 0x3F];
+      *out++ = i+1 < len ? tbl[(v >> 6) & 0x3F] : '=';
+      *out++ = i+2 < len ? tbl[v & 0x3F] : '=';
+   }
+   *out = '\0';
+}
+
+/// Send a frame on the websocket
+/**
+ *  Frames sent by a server are never masked.
+ *
+ *  \param  ws      The websocket
+ *  \param  opcode  Opcode of frame
+ *  \param  buf     Payload
+ *  \param  len     Length of payload
+ *
+ *  \return 0 on success, 1 on failure
+ */
+static int send_frame(struct http_websocket *ws, int opcode,
+                      const char *buf, size_t len)
+{
+   unsigned char hdr[10];
+   size_t hdr_len, i;
+
+   if (ws->state == S_CLOSED) return 1;
+
+   hdr[0] = 0x80 | opcode;
+   if (len < 126) {
+      hdr[1] = len;
+      hdr_len = 2;
+   } else if (len <= 0xFFFF) {
+      hdr[1] = 126;
+      hdr[2] = len >> 8;
+      hdr[3] = len;
+      hdr_len = 4;
+   } else {
+      hdr[1] = 127;
+      for (i = 0; i < 8; i++)
+         hdr[2+i] = (uint64_t)len >> (56 - 8*i);
+      hdr_len = 10;
+   }
+
+   if (ws_conn_send(ws->conn, (char *)hdr, hdr_len)) return 1;
+   if (ws_conn_send(ws->conn, buf, len)) return 1;
+
+   return 0;
+}
+
+/// Send a close frame and close the connection afterwards
+/**
+ *  \param  ws    The websocket
+ *  \param  code  Status code, or 0 to send a close frame without
+ */
+static void send_close(struct http_websocket *ws, unsigned short code)
+{
+   char payload[2];
+
+   if (ws->state == S_CLOSED) return;
+
+   payload[0] = code >> 8;
+   payload[1] = code & 0xFF;
+   send_frame(ws, OP_CLOSE, payload, code ? 2 : 0);
+   ws->state = S_CLOSED;
+   ws_conn_close(ws->conn);
+}
+
+/// Handle a fully received frame
+/**
+ *  \param  ws  The websocket
+ */
+static void frame_complete(struct http_websocket *ws)
+{
+   struct http_websocket_settings *settings = &ws->settings;
+   unsigned short code;
+
+   switch (ws->opcode) {
+      case OP_PING:
+         send_frame(ws, OP_PONG, ws->ctrl, ws->payload_len);
+         break;
+      case OP_PONG:
+         break;
+      case OP_CLOSE:
+         code = CLOSE_NORMAL;
+         if (ws->payload_len >= 2)
+            code = (unsigned char)ws->ctrl[0] << 8 |
+                   (unsigned char)ws->ctrl[1];
+         send_close(ws, code);
+         return;
+      default:
+         if (ws->opcode != OP_CONTINUATION)
+            ws->msg_opcode = ws->opcode;
+         ws->msg_len += ws->payload_len;
+         if (ws->fin) {
+            ws->msg[ws->msg_len] = '\0';
+            if (settings->on_message &&
+                settings->on_message(ws, settings->ws_ctx, &ws->data,
+                                     ws->msg_opcode == OP_BINARY,
+                                     ws->msg, ws->msg_len)) {
+               send_close(ws, CLOSE_INTERNAL_ERROR);
+               return;
+            }
+            ws->msg_opcode = 0;
+            ws->msg_len = 0;
+         }
+         break;
+   }
+
+   if (ws->state != S_CLOSED) {
+      ws->state = S_HEADER;
+      ws->hdr_len = 0;
+      ws->hdr_need = 2;
+   }
+}
+
+/// Decode a frame header
+/**
+ *  Called when the first two bytes have been received to determine the
+ *  full length of the header, and again when the full header has been
+ *  received.
+ *
+ *  \param  ws  The websocket
+ *
+ *  \return 0 on success, or a close status code on protocol errors
+ */
+static int decode_header(struct http_websocket *ws)
+{
+   unsigned char *hdr = ws->hdr;
+   uint64_t len;
+   size_t i;
+   char *msg;
+
+   if (ws->hdr_len == 2) {
+      ws->fin = hdr[0] & 0x80;
+      ws->opcode = hdr[0] & 0x0F;
+
+      // No extensions are negotiated, so reserved bits must be zero,
+      // and clients must always mask their frames
+      if (hdr[0] & 0x70) return CLOSE_PROTOCOL_ERROR;
+      if (!(hdr[1] & 0x80)) return CLOSE_PROTOCOL_ERROR;
+
+      switch (ws->opcode) {
+         case OP_CLOSE:
+         case OP_PING:
+         case OP_PONG:
+            if (!ws->fin || (hdr[1] & 0x7F) > 125)
+               return CLOSE_PROTOCOL_ERROR;
+            break;
+         case OP_CONTINUATION:
+            if (!ws->msg_opcode) return CLOSE_PROTOCOL_ERROR;
+            break;
+         case OP_TEXT:
+         case OP_BINARY:
+            if (ws->msg_opcode) return CLOSE_PROTOCOL_ERROR;
+            break;
+         default:
+            return CLOSE_PROTOCOL_ERROR;
+      }
+
+      switch (hdr[1] & 0x7F) {
+         case 126: ws->hdr_need = 2 + 2 + 4; break;
+         case 127: ws->hdr_need = 2 + 8 + 4; break;
+         default:  ws->hdr_need = 2 + 4; break;
+      }
+      return 0;
+   }
+
+   // Full header received
+   switch (hdr[1] & 0x7F) {
+      case 126:
+         len = hdr[2] << 8 | hdr[3];
+         break;
+      case 127:
+         for (len = 0, i = 2; i < 10; i++)
+            len = len << 8 | hdr[i];
+         break;
+      default:
+         len = hdr[1] & 0x7F;
+         break;
+   }
+   ws->payload_len = len;
+   ws->payload_read = 0;
+
+   // Make room for data frames in the message buffer
+   if (ws->opcode < OP_CLOSE) {
+      if (len > ws->settings.max_message_size - ws->msg_len)
+         return CLOSE_TOO_BIG;
+      if (ws->msg_len + len + 1 > ws->msg_size) {
+         msg = realloc(ws->msg, ws->msg_len + len + 1);
+         if (!msg) return CLOSE_INTERNAL_ERROR;
+         ws->msg = msg;
+         ws->msg_size = ws->msg_len + len + 1;
+      }
+   }
+
+   return 0;
+}
+
+/// Create a new websocket
+/**
+ *  Should be freed with websocket_destroy(). The settings are copied to
+ *  the websocket.
+ *
+ *  \param  req       The request that was upgraded
+ *  \param  conn      The connection of the request
+ *  \param  settings  Settings for the websocket
+ *  \param  data      User data, passed on to the callbacks
+ *
+ *  \return The new websocket or NULL on failure
+ */
+struct http_websocket *websocket_create(
+      struct http_request *req,
+      struct ws_conn *conn,
+      struct http_websocket_settings *settings,
+      void *data)
+{
+   struct http_websocket *ws = malloc(sizeof(struct http_websocket));
+   if (ws == NULL) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return NULL;
+   }
+
+   memcpy(&ws->settings, settings, sizeof(struct http_websocket_settings));
+   ws->req = req;
+   ws->conn = conn;
+   ws->data = data;
+   ws->state = S_HEADER;
+   ws->hdr_len = 0;
+   ws->hdr_need = 2;
+   ws->msg_opcode = 0;
+   ws->msg = NULL;
+   ws->msg_len = 0;
+   ws->msg_size = 0;
+
+   return ws;
+}
+
+/// Destroy a websocket
+/**
+ *  Calls on_close() from the websocket settings.
+ *
+ *  \param  ws  The websocket to destroy
+ */
+void websocket_destroy(struct http_websocket *ws)
+{
+   if (!ws) return;
+
+   if (ws->settings.on_close)
+      ws->settings.on_close(ws, ws->settings.ws_ctx, &ws->data);
+
+   free(ws->msg);
+   free(ws);
+}
+
+/// Parse a chunk of data received on a websocket
+/**
+ *  \param  ws   The websocket
+ *  \param  buf  The chunk, not null-terminated
+ *  \param  len  Length of the chunk
+ *
+ *  \return Number of bytes parsed
+ */
+size_t websocket_parse(struct http_websocket *ws,
+                       const char *buf, size_t len)
+{
+   size_t i = 0, n, k;
+   char *dst;
+   int err;
+
+   while (i < len && ws->state != S_CLOSED) {
+      switch (ws->state) {
+         case S_HEADER:
+            ws->hdr[ws->hdr_len++] = buf[i++];
+            if (ws->hdr_len == 2 || ws->hdr_len == ws->hdr_need) {
+               if ((err = decode_header(ws))) {
+                  send_close(ws, err);
+                  break;
+               }
+               if (ws->hdr_len < ws->hdr_need) break;
+               if (ws->payload_len == 0) frame_complete(ws);
+               else ws->state = S_PAYLOAD;
+            }
+            break;
+         case S_PAYLOAD:
+            n = len - i;
+            if (n > ws->payload_len - ws->payload_read)
+               n = ws->payload_len - ws->payload_read;
+            if (ws->opcode >= OP_CLOSE)
+               dst = &ws->ctrl[ws->payload_read];
+            else
+               dst = &ws->msg[ws->msg_len + ws->payload_read];
+            for (k = 0; k < n; k++)
+               dst[k] = buf[i+k] ^
+                        ws->hdr[ws->hdr_need - 4 + (ws->payload_read+k) % 4];
+            i += n;
+            ws->payload_read += n;
+            if (ws->payload_read == ws->payload_len)
+               frame_complete(ws);
+            break;
+         case S_CLOSED:
+            break;
+      }
+   }
+
+   return len;
+}
+
+/// Check if a request asks for a websocket upgrade
+/**
+ *  \param  req  http request
+ *
+ *  \return 1 if the request is a websocket opening handshake, 0
+ *          otherwise
+ */
+int http_request_is_websocket(struct http_request *req)
+{
+   if (http_request_get_method(req) != HTTP_GET) return 0;
+   if (!http_request_header_has_token(req, "Upgrade", "websocket")) return 0;
+   if (!http_request_header_has_token(req, "Connection", "Upgrade")) return 0;
+   return http_request_find_header(req, "Sec-WebSocket-Key") != NULL;
+}
+
+/// Accept a websocket upgrade on a request
+/**
+ *  Completes the opening handshake by sending the "101 Switching
+ *  Protocols" response. From then on the connection will be used for
+ *  websocket frames, so no http response should be created for the
+ *  request. The connection is kept open until either side closes it.
+ *
+ *  Should be called when the full request has been received, that is
+ *  from on_req_cmpl() in the http-webserver settings.
+ *
+ *  \param  req       The http request to upgrade
+ *  \param  settings  Settings for the websocket, are copied
+ *  \param  data      User data, passed on to the callbacks
+ *
+ *  \return The websocket, or NULL if the request is not a valid
+ *          websocket handshake
+ */
+struct http_websocket *http_websocket_accept(
+      struct http_request *req,
+      struct http_websocket_settings *settings,
+      void *data)
+{
+   struct http_websocket *ws;
+   const char *key, *version;
+   unsigned char digest[20];
+   char accept[29];
+   char *str;
+
+   if (!http_request_is_websocket(req)) return NULL;
+
+   version = http_request_find_header(req, "Sec-WebSocket-Version");
+   if (!version || strcmp(version, "13") != 0) return NULL;
+
+   // Compute accept key
+   key = http_request_find_header(req, "Sec-WebSocket-Key");
+   str = malloc(strlen(key) + strlen(WEBSOCKET_GUID) + 1);
+   if (!str) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return NULL;
+   }
+   strcpy(str, key);
+   strcat(str, WEBSOCKET_GUID);
+   sha1((unsigned char *)str, strlen(str), digest);
+   base64(digest, 20, accept);
+   free(str);
+
+   // Switch request to websocket
+   ws = websocket_create(req, http_request_get_connection(req),
+                         settings, data);
+   if (!ws) return NULL;
+   if (http_request_set_websocket(req, ws)) {
+      free(ws);
+      return NULL;
+   }
+
+   // Send handshake
+   ws_conn_sendf(ws->conn,
+         "HTTP/1.1 101 Switching Protocols\r\n"
+         "Upgrade: websocket\r\n"
+         "Connection: Upgrade\r\n"
+         "Sec-WebSocket-Accept: %s\r\n\r\n", accept);
+   http_request_keep_open(req);
+
+   return ws;
+}
+
+/// Send a message on a websocket
+/**
+ *  \param  ws      The websocket
+ *  \param  binary  0 for a text message, 1 for a binary message
+ *  \param  buf     Message
+ *  \param  len     Length of message
+ *
+ *  \return 0 on success, 1 on failure
+ */
+int http_websocket_send(struct http_websocket *ws, int binary,
+                        const char *buf, size_t len)
+{
+   return send_frame(ws, binary ? OP_BINARY : OP_TEXT, buf, len);
+}
+
+/// Send a text message on a websocket
+/**
+ *  Similar to the standard printf function. See http_websocket_vsendf()
+ *  for details.
+ *
+ *  \param  ws   The websocket
+ *  \param  fmt  Format string
+ *
+ *  \return 0 on success, 1 on failure
+ */
+int http_websocket_sendf(struct http_websocket *ws, const char *fmt, ...)
+{
+   int stat;
+   va_list arg;
+
+   va_start(arg, fmt);
+   stat = http_websocket_vsendf(ws, fmt, arg);
+   va_end(arg);
+
+   return stat;
+}
+
+/// Send a text message on a websocket
+/**
+ *  Similar to the standard vprintf function. The full formatted string
+ *  is sent as a single message.
+ *
+ *  \param  ws   The websocket
+ *  \param  fmt  Format string
+ *  \param  arg  List of arguments
+ *
+ *  \return 0 on success, 1 on failure
+ */
+int http_websocket_vsendf(struct http_websocket *ws,
+                          const char *fmt, va_list arg)
+{
+   int stat, len;
+   char *msg;
+   va_list arg2;
+
+   // Copy arg to avoid errors on 64bit
+   va_copy(arg2, arg);
+
+   len = vsnprintf("", 0, fmt, arg);
+   if (len < 0) {
+      va_end(arg2);
+      return 1;
+   }
+   msg = malloc((len+1)*sizeof(char));
+   if (!msg) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      va_end(arg2);
+      return 1;
+   }
+   vsprintf(msg, fmt, arg2);
+   va_end(arg2);
+
+   stat = send_frame(ws, OP_TEXT, msg, len);
+   free(msg);
+
+   return stat;
+}
+
+/// Send a ping on a websocket
+/**
+ *  The client answers with a pong, which is silently ignored. Can be
+ *  used to keep intermediaries from closing an idle connection.
+ *
+ *  \param  ws  The websocket
+ *
+ *  \return 0 on success, 1 on failure
+ */
+int http_websocket_ping(struct http_websocket *ws)
+{
+   return send_frame(ws, OP_PING, NULL, 0);
+}
+
+/// Close a websocket
+/**
+ *  Sends a close frame and closes the connection when it has been sent.
+ *  on_close() from the websocket settings will be called, when the
+ *  connection has been closed.
+ *
+ *  \param  ws    The websocket
+ *  \param  code  Status code according to RFC 6455 section 7.4, e.g.
+ *                1000 for a normal closure
+ */
+void http_websocket_close(struct http_websocket *ws, unsigned short code)
+{
+   send_close(ws, code);
+}
+
+/// Get the IP of the client on a websocket
+/**
+ *  \param  ws  The websocket
+ *
+ *  \return IP as a string
+ */
+const char *http_websocket_get_ip(struct http_websocket *ws)
+{
+   return ws_conn_get_ip(ws->conn);
+}
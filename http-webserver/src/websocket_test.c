@@ -0,0 +1,245 @@
+// websocket_test.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+*   
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*  
+*  1. Redistributions of source code must retain the above copyright
+*  notice, this list of conditions and the following disclaimer.
+*  
+*  2. Redistributions in binary form must reproduce the above copyright
+*  notice, this list of conditions and the following disclaimer in the
+*  documentation and/or other materials provided with the distribution.
+*  
+*  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+*  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+*  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+*  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+*  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+*  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+*  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+*  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+*  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+*  SUCH DAMAGE.
+*  
+*  The views and conclusions contained in the software and
+*  documentation are those of the authors and should not be interpreted
+*  as representing official policies, either expressed.
+*/
+
+#include "websocket.c"
+#include "unit_test.h"
+#include <string.h>
+#include <strings.h>
+
+// Stubs for the connection and request, recording what is sent
+static char sent[1024];
+static size_t sent_len = 0;
+static int closed = 0;
+static struct lm *headers;
+
+int ws_conn_send(struct ws_conn *conn, const char *buf, size_t len)
+{
+   memcpy(&sent[sent_len], buf, len);
+   sent_len += len;
+   return 0;
+}
+
+int ws_conn_sendf(struct ws_conn *conn, const char *fmt, ...)
+{
+   va_list arg;
+   va_start(arg, fmt);
+   sent_len += vsprintf(&sent[sent_len], fmt, arg);
+   va_end(arg);
+   return 0;
+}
+
+void ws_conn_close(struct ws_conn *conn) { closed = 1; }
+const char *ws_conn_get_ip(struct ws_conn *conn) { return "127.0.0.1"; }
+static const char *find_field;
+static const char *find_value;
+static void find_cb(void *data, const char *key, const char *value)
+{
+   if (strcasecmp(key, find_field) == 0) find_value = value;
+}
+const char *http_request_find_header(struct http_request *req,
+                                     const char *field)
+{
+   find_field = field;
+   find_value = NULL;
+   lm_map(headers, find_cb, NULL);
+   return find_value;
+}
+int http_request_header_has_token(struct http_request *req,
+                                  const char *field, const char *token)
+{
+   const char *value = http_request_find_header(req, field);
+   for (; value && *value; value++)
+      if (strncasecmp(value, token, strlen(token)) == 0) return 1;
+   return 0;
+}
+enum http_method http_request_get_method(struct http_request *req)
+{
+   return HTTP_GET;
+}
+struct ws_conn *http_request_get_connection(struct http_request *req)
+{
+   return NULL;
+}
+int http_request_set_websocket(struct http_request *req,
+                               struct http_websocket *ws)
+{
+   return 0;
+}
+void http_request_keep_open(struct http_request *req) {}
+
+struct data {
+   char msg[256];
+   int binary;
+   int count;
+   int closed;
+};
+
+static int on_message(struct http_websocket *ws, void *ws_ctx,
+                      void **ws_data, int binary,
+                      const char *buf, size_t len)
+{
+   struct data *data = *ws_data;
+   memcpy(data->msg, buf, len+1);
+   data->binary = binary;
+   data->count++;
+   return 0;
+}
+
+static void on_close(struct http_websocket *ws, void *ws_ctx,
+                     void **ws_data)
+{
+   struct data *data = *ws_data;
+   data->closed = 1;
+}
+
+// Masked frame with "Hello" from RFC 6455 section 5.7
+static const char hello[] =
+   "\x81\x85\x37\xfa\x21\x3d\x7f\x9f\x4d\x51\x58";
+// Fragmented masked "Hel" + "lo", with a ping in between
+static const char fragments[] =
+   "\x01\x83\x37\xfa\x21\x3d\x7f\x9f\x4d"
+   "\x89\x80\x00\x00\x00\x00"
+   "\x80\x82\x37\xfa\x21\x3d\x5b\x95";
+
+TEST_START("websocket.c")
+
+   struct http_websocket_settings settings =
+      HTTP_WEBSOCKET_SETTINGS_DEFAULT;
+   settings.on_message = on_message;
+   settings.on_close = on_close;
+   struct http_websocket *ws;
+   struct data data;
+   size_t i;
+
+TEST(Handshake from RFC 6455)
+
+   headers = lm_create();
+   lm_insert(headers, "Host", "server.example.com");
+   lm_insert(headers, "upgrade", "websocket");
+   lm_insert(headers, "Connection", "keep-alive, Upgrade");
+   lm_insert(headers, "Sec-WebSocket-Key", "dGhlIHNhbXBsZSBub25jZQ==");
+   lm_insert(headers, "Sec-WebSocket-Version", "13");
+
+   memset(&data, 0, sizeof(data));
+   sent_len = 0;
+   ws = http_websocket_accept(NULL, &settings, &data);
+   ASSERT_NOT_NULL(ws);
+   sent[sent_len] = '\0';
+   ASSERT_NOT_NULL(strstr(sent,
+            "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"));
+   websocket_destroy(ws);
+   ASSERT_EQUAL(data.closed, 1);
+
+   lm_remove(headers, "Sec-WebSocket-Version");
+   ws = http_websocket_accept(NULL, &settings, &data);
+   ASSERT_NULL(ws);
+   lm_destroy(headers);
+
+TSET()
+
+TEST(Single frame split in chunks)
+
+   memset(&data, 0, sizeof(data));
+   ws = websocket_create(NULL, NULL, &settings, &data);
+   for (i = 0; i < sizeof(hello)-1; i++)
+      websocket_parse(ws, &hello[i], 1);
+   ASSERT_EQUAL(data.count, 1);
+   ASSERT_EQUAL(data.binary, 0);
+   ASSERT_STR_EQUAL(data.msg, "Hello");
+   websocket_destroy(ws);
+
+TSET()
+
+TEST(Fragmented message with ping)
+
+   memset(&data, 0, sizeof(data));
+   sent_len = 0;
+   ws = websocket_create(NULL, NULL, &settings, &data);
+   websocket_parse(ws, fragments, sizeof(fragments)-1);
+   ASSERT_EQUAL(data.count, 1);
+   ASSERT_STR_EQUAL(data.msg, "Hello");
+   // Pong
+   ASSERT_EQUAL(sent_len, 2);
+   ASSERT_EQUAL((unsigned char)sent[0], 0x8A);
+   ASSERT_EQUAL(sent[1], 0);
+   websocket_destroy(ws);
+
+TSET()
+
+TEST(Unmasked frame closes with protocol error)
+
+   memset(&data, 0, sizeof(data));
+   sent_len = 0;
+   closed = 0;
+   ws = websocket_create(NULL, NULL, &settings, &data);
+   websocket_parse(ws, "\x81\x05Hello", 7);
+   ASSERT_EQUAL(data.count, 0);
+   ASSERT_EQUAL(closed, 1);
+   ASSERT_EQUAL(sent_len, 4);
+   ASSERT_EQUAL((unsigned char)sent[0], 0x88);
+   ASSERT_EQUAL(((unsigned char)sent[2] << 8 | (unsigned char)sent[3]),
+                1002);
+   websocket_destroy(ws);
+
+TSET()
+
+TEST(Too big message)
+
+   memset(&data, 0, sizeof(data));
+   sent_len = 0;
+   closed = 0;
+   settings.max_message_size = 4;
+   ws = websocket_create(NULL, NULL, &settings, &data);
+   websocket_parse(ws, hello, sizeof(hello)-1);
+   ASSERT_EQUAL(data.count, 0);
+   ASSERT_EQUAL(closed, 1);
+   ASSERT_EQUAL(((unsigned char)sent[2] << 8 | (unsigned char)sent[3]),
+                1009);
+   websocket_destroy(ws);
+   settings.max_message_size = 65536;
+
+TSET()
+
+TEST(Sending frames)
+
+   memset(&data, 0, sizeof(data));
+   sent_len = 0;
+   ws = websocket_create(NULL, NULL, &settings, &data);
+   http_websocket_sendf(ws, "%s", "Hello");
+   ASSERT_EQUAL(sent_len, 7);
+   ASSERT_EQUAL(memcmp(sent, "\x81\x05Hello", 7), 0);
+   websocket_destroy(ws);
+
+TSET()
+
+TEST_END()
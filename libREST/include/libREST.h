@@ -42,15 +42,46 @@
 // Structs
 struct lr;
 struct lr_request;
+struct lr_websocket;
+struct lr_stats;
 struct ev_loop;
 
 struct lr_settings {
 	int port;
 	int timeout;
+	size_t cache_size;
+	size_t send_window;
+	size_t limit_size;
 };
 #define LR_SETTINGS_DEFAULT { \
 	.port = WS_PORT_HTTP, \
-	.timeout = 15 }
+	.timeout = 15, \
+	.cache_size = 1048576, \
+	.send_window = 16384, \
+	.limit_size = 1024 }
+
+// A response header. Arrays of headers end with LR_HEADERS_END, and
+// are only read while a response is started, so they may be constant
+// or on the stack. This spares common responses any allocations for
+// their headers
+struct lr_header {
+	const char *name;
+	const char *value;
+};
+#define LR_HEADERS_END { NULL, NULL }
+
+// Common header sets: Content-Type: application/xml, and
+// Access-Control-Allow-Origin: *
+extern const struct lr_header lr_headers_xml[];
+extern const struct lr_header lr_headers_cors[];
+
+// Returned by a data callback, from its last call (body == NULL, or the
+// only call of a buffering service, see lr_buffer_service()), to
+// answer the request later with lr_request_complete() or
+// lr_request_resume(). Until then the request stays valid, even if its
+// connection closes meanwhile, and the on_destroy callback of the
+// service is delayed
+#define LR_PENDING 2
 
 // Callbacks
 typedef int (*lr_data_cb)(void *srv_data, void **req_data,
@@ -58,6 +89,14 @@ typedef int (*lr_data_cb)(void *srv_data, void **req_data,
                           const char* body, size_t len);
 typedef int (*lr_nodata_cb)(void *srv_data, void **req_data,
                             struct lr_request *req);
+typedef int (*lr_ws_data_cb)(void *srv_data, void **ws_data,
+                             struct lr_websocket *ws,
+                             const char *msg, size_t len);
+typedef void (*lr_ws_nodata_cb)(void *srv_data, void **ws_data,
+                                struct lr_websocket *ws);
+// Writes the next part of a response body to buf, at most cap bytes,
+// and returns how many, or 0 at the end of the body
+typedef size_t (*lr_produce_cb)(void *data, char *buf, size_t cap);
 
 // libREST instance functions
 struct lr *lr_create(struct lr_settings *settings, struct ev_loop *loop);
@@ -67,7 +106,12 @@ int lr_start(struct lr *ins);
 void lr_stop(struct lr *ins);
 
 // Registers a new service. Returns 1 if the url is already registered
-// or not enough memory
+// or not enough memory. A url containing "{name}" segments is a pattern
+// route: "{name}" matches one non-empty path segment, which is captured
+// as a parameter of the request (see lr_request_get_param). Plain urls
+// take precedence over patterns, and patterns are tried in the order
+// they were registered. Services may be (un)registered from any thread,
+// without blocking requests being routed meanwhile
 int lr_register_service(struct lr *ins,
                          char *url,
                          lr_data_cb on_get,
@@ -77,11 +121,84 @@ int lr_register_service(struct lr *ins,
                          lr_nodata_cb on_destroy,
                          void *srv_data);
 
-// Unregister service. Returns the data stored in the service
+// Unregister service. Returns the data stored in the service. For pattern
+// routes url must be the pattern itself
 void *lr_unregister_service(struct lr *ins, const char *url);
 
+// Returns the data of the service that would handle url
 void *lr_lookup_service(struct lr *ins, char *url);
 
+// Caches the successful GET responses of the service registered on url
+// (a pattern for pattern routes) for ttl seconds, or stops caching if
+// ttl is 0. Responses are cached per request url, and per value of the
+// arguments named in args, a comma separated list or NULL. Cached
+// responses are sent without calling the service, and dropped on PUT,
+// POST and DELETE requests to the same url. The cache holds at most
+// cache_size bytes of lr_settings. Returns 1 if url is not registered
+int lr_cache_service(struct lr *ins, const char *url,
+                     double ttl, const char *args);
+
+// Lets concurrent GET requests for the same response share it. While
+// a GET request to the service on url is being handled, requests with
+// the same url and values of the arguments in args wait for it, and get
+// a copy of its response. Only useful for services answering after
+// their callback returns, e.g. from another event. args replaces the
+// arguments given to lr_cache_service. Returns 1 if url is not
+// registered
+int lr_coalesce_service(struct lr *ins, const char *url,
+                        int enable, const char *args);
+
+// Makes the service on url get the bodies of PUT and POST requests in
+// full, instead of in chunks. Its callback is then called once per such
+// request, with body holding the whole body, \0 terminated, and len its
+// length. Bodies of more than max bytes are refused with 413 Request
+// Entity Too Large, before reaching the service. A max of 0 turns
+// buffering off. Returns 1 if url is not registered
+int lr_buffer_service(struct lr *ins, const char *url, size_t max);
+
+// Limits the requests each client makes to the service on url to rate
+// per second, with bursts of up to burst requests. Requests over the
+// limit get 429 Too Many Requests, before reaching the service. Limits
+// may be changed at any time, and a rate of 0 removes them. Clients are
+// told apart by address, and the limit_size of lr_settings clients on
+// limited routes are tracked, forgetting the least recently seen. Returns
+// 1 if url is not registered
+int lr_limit_service(struct lr *ins, const char *url,
+                     double rate, double burst);
+
+// Drops the cached responses for a request url, e.g. when the resource
+// changed by other means than a request
+void lr_cache_invalidate(struct lr *ins, const char *url);
+
+// Stats functions
+//
+// The requests to every url (or pattern) registered are timed, from
+// their arrival until the service returns, the response starts and the
+// response has been sent. Shared responses, e.g. from the cache, have
+// no time in the service. Timings are kept when the url is unregistered,
+// and can be read from any thread
+
+enum lr_timing {
+	LR_TIMING_HANDLER,      // Time spent in the service callbacks
+	LR_TIMING_FIRST_BYTE,   // Time until the response was started
+	LR_TIMING_TOTAL         // Time until the response was sent
+};
+
+typedef void (*lr_stats_cb)(void *data, const char *url,
+                            struct lr_stats *stats);
+
+// Calls cb with the timings of every url ever registered, newest first
+void lr_stats_map(struct lr *ins, lr_stats_cb cb, void *data);
+
+// Number of requests timed
+unsigned long lr_stats_count(const struct lr_stats *stats,
+                             enum lr_timing timing);
+
+// Seconds that percentile percent of the requests took at most. The
+// value is within 1/16 of the actual timing
+double lr_stats_percentile(const struct lr_stats *stats,
+                           enum lr_timing timing, double percentile);
+
 // Request functions
 enum http_method lr_request_get_method(struct lr_request *req);
 const char *lr_request_get_url(struct lr_request *req);
@@ -92,8 +209,27 @@ const char *lr_request_get_argument(struct lr_request *req, const char* key);
 struct lm *lr_request_get_cookies(struct lr_request *req);
 const char *lr_request_get_cookie(struct lr_request *req, const char* key);
 const char *lr_request_get_ip(struct lr_request *req);
+// Parameters captured by a pattern route, NULL for plain routes
+struct lm *lr_request_get_params(struct lr_request *req);
+const char *lr_request_get_param(struct lr_request *req, const char* key);
 void lr_request_keep_open(struct lr_request *req);
 
+// Completion of pending requests (see LR_PENDING). Each pending request
+// must be completed exactly once, before lr_destroy(), and these are the
+// only request functions that may be called from other threads than the
+// loop of the instance. lr_request_complete() sends a response like
+// lr_sendf(), formatting it before returning. lr_request_resume() calls
+// the callback of the service again on the loop, with body == NULL, to
+// answer the request itself, e.g. from data left in req_data
+void lr_request_complete(struct lr_request *req,
+                         enum httpws_http_status_code status,
+                         struct lm *headers, const char *fmt, ...);
+void lr_request_vcomplete(struct lr_request *req,
+                          enum httpws_http_status_code status,
+                          struct lm *headers, const char *fmt,
+                          va_list arg);
+void lr_request_resume(struct lr_request *req);
+
 // Send response functions
 void lr_sendf(struct lr_request *req,
               enum httpws_http_status_code status,
@@ -101,6 +237,14 @@ void lr_sendf(struct lr_request *req,
 void lr_send_start(struct lr_request *req,
                    enum httpws_http_status_code status,
                    struct lm *headers);
+// As lr_sendf() and lr_send_start(), with an array of headers, or NULL
+void lr_sendf_headers(struct lr_request *req,
+                      enum httpws_http_status_code status,
+                      const struct lr_header *headers,
+                      const char *fmt, ...);
+void lr_send_start_headers(struct lr_request *req,
+                           enum httpws_http_status_code status,
+                           const struct lr_header *headers);
 int lr_send_add_cookie_simple(struct lr_request *req,
                               const char *field, const char *value);
 int lr_send_add_cookie(struct lr_request *req,
@@ -112,5 +256,30 @@ int lr_send_add_cookie(struct lr_request *req,
 void lr_send_chunkf(struct lr_request *req, const char *fmt, ...);
 void lr_send_vchunkf(struct lr_request *req, const char *fmt, va_list arg);
 void lr_send_stop(struct lr_request *req);
+// Sends a response with a body produced while it is sent, instead of
+// lr_send_start() and lr_send_stop(). produce is called with data
+// whenever the connection has sent what was queued, and writes the next
+// part, up to send_window bytes of lr_settings, directly into the send
+// queue. So the body is never held in memory in full, and slow clients
+// slow the producer down. data must stay valid until produce returns 0
+// or the on_destroy callback of the service is called. Produced
+// responses are neither cached nor shared
+void lr_send_produce(struct lr_request *req,
+                     enum httpws_http_status_code status,
+                     struct lm *headers,
+                     lr_produce_cb produce, void *data);
+
+// Websocket functions. lr_request_websocket() should be called from the
+// GET callback when the full request has been received (body == NULL).
+// Returns NULL if the request is not a valid websocket handshake.
+int lr_request_is_websocket(struct lr_request *req);
+struct lr_websocket *lr_request_websocket(struct lr_request *req,
+                                          lr_ws_data_cb on_message,
+                                          lr_ws_nodata_cb on_close,
+                                          void *ws_data);
+int lr_websocket_sendf(struct lr_websocket *ws, const char *fmt, ...);
+int lr_websocket_vsendf(struct lr_websocket *ws, const char *fmt, va_list arg);
+void lr_websocket_close(struct lr_websocket *ws);
+const char *lr_websocket_get_ip(struct lr_websocket *ws);
 
 #endif
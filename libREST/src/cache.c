@@ -0,0 +1,423 @@
+// cache.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+ *   
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *  
+ *  The views and conclusions contained in the software and
+ *  documentation are those of the authors and should not be interpreted
+ *  as representing official policies, either expressed.
+ */
+
+#include "cache.h"
+#include "radix_tree.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+/// Bytes accounted for an entry besides its strings
+#define ENTRY_OVERHEAD sizeof(struct lrc_entry)
+
+/// A cached response
+/**
+ *  Entries are shared by the cache and the requests being served from
+ *  them, and freed when the last reference is released. An entry that
+ *  is still being filled is not in the cache, and only owned by the
+ *  request filling it.
+ */
+struct lrc_entry {
+   struct lrc_url *url;       ///< Variants of the url, NULL if not cached
+   char *url_str;             ///< Url of the response
+   char *key;                 ///< Key of the variant
+   enum httpws_http_status_code status;
+   struct lm *headers;        ///< Headers of the response
+   char *body;                ///< Body, null terminated
+   size_t len;                ///< Length of body
+   size_t cap;                ///< Allocated size of body
+   size_t size;               ///< Bytes accounted for in the cache
+   double expires;            ///< Time the entry expires at
+   unsigned long generation;  ///< Generation of the cache at creation
+   unsigned int refs;         ///< References, under the cache lock
+   struct lrc *cache;
+   struct lrc_entry *variant; ///< Next variant of the same url
+   struct lrc_entry *prev;    ///< More recently used
+   struct lrc_entry *next;    ///< Less recently used
+};
+
+/// The cached variants of a url
+struct lrc_url {
+   char *url;
+   struct lrc_entry *variants;
+};
+
+struct lrc {
+   pthread_mutex_t lock;
+   struct rt *urls;           ///< Url to struct lrc_url
+   struct lrc_entry *head;    ///< Most recently used
+   struct lrc_entry *tail;    ///< Least recently used
+   size_t size;               ///< Bytes used
+   size_t max_size;           ///< Bytes allowed
+   unsigned long generation;  ///< Incremented on every invalidation
+};
+
+static void entry_free(struct lrc_entry *entry)
+{
+   lm_destroy(entry->headers);
+   free(entry->url_str);
+   free(entry->key);
+   free(entry->body);
+   free(entry);
+}
+
+/// Drop a reference, under the cache lock
+static void entry_unref(struct lrc_entry *entry)
+{
+   if (--entry->refs == 0) entry_free(entry);
+}
+
+/// Take an entry out of the cache, under the cache lock
+static void entry_remove(struct lrc *cache, struct lrc_entry *entry)
+{
+   struct lrc_url *url = entry->url;
+   struct lrc_entry **e;
+
+   for (e = &url->variants; *e != entry; e = &(*e)->variant);
+   *e = entry->variant;
+   if (url->variants == NULL) {
+      rt_remove(cache->urls, url->url);
+      free(url->url);
+      free(url);
+   }
+
+   if (entry->prev) entry->prev->next = entry->next;
+   else cache->head = entry->next;
+   if (entry->next) entry->next->prev = entry->prev;
+   else cache->tail = entry->prev;
+
+   cache->size -= entry->size;
+   entry->url = NULL;
+   entry->variant = NULL;
+   entry->prev = NULL;
+   entry->next = NULL;
+   entry_unref(entry);
+}
+
+/// Find a variant of a url, under the cache lock
+static struct lrc_entry *variant_find(struct lrc *cache, const char *url,
+                                      const char *key)
+{
+   struct lrc_url *u = rt_lookup(cache->urls, url);
+   struct lrc_entry *entry;
+
+   if (u == NULL) return NULL;
+   for (entry = u->variants; entry != NULL; entry = entry->variant)
+      if (strcmp(entry->key, key) == 0)
+         return entry;
+
+   return NULL;
+}
+
+struct lrc *lrc_create(size_t max_size)
+{
+   struct lrc *cache = malloc(sizeof(struct lrc));
+   if (cache == NULL) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return NULL;
+   }
+
+   cache->urls = rt_create();
+   if (cache->urls == NULL) {
+      free(cache);
+      return NULL;
+   }
+   pthread_mutex_init(&cache->lock, NULL);
+   cache->head = NULL;
+   cache->tail = NULL;
+   cache->size = 0;
+   cache->max_size = max_size;
+   cache->generation = 0;
+
+   return cache;
+}
+
+void lrc_destroy(struct lrc *cache)
+{
+   if (cache == NULL) return;
+
+   while (cache->head) entry_remove(cache, cache->head);
+   rt_destroy(cache->urls, NULL);
+   pthread_mutex_destroy(&cache->lock);
+   free(cache);
+}
+
+/**
+ * Find a fresh response
+ *
+ * \param cache The cache
+ * \param url   The url of the request
+ * \param key   The key of the variant
+ * \param now   The current time, expired responses are removed
+ *
+ * \return The response with a reference taken, which must be released
+ *         with lrc_entry_release(), or NULL if not cached
+ */
+struct lrc_entry *lrc_lookup(struct lrc *cache, const char *url,
+                             const char *key, double now)
+{
+   struct lrc_entry *entry;
+
+   pthread_mutex_lock(&cache->lock);
+   entry = variant_find(cache, url, key);
+   if (entry && entry->expires <= now) {
+      entry_remove(cache, entry);
+      entry = NULL;
+   }
+   if (entry) {
+      // Move to front
+      if (entry->prev) {
+         entry->prev->next = entry->next;
+         if (entry->next) entry->next->prev = entry->prev;
+         else cache->tail = entry->prev;
+         entry->prev = NULL;
+         entry->next = cache->head;
+         cache->head->prev = entry;
+         cache->head = entry;
+      }
+      entry->refs++;
+   }
+   pthread_mutex_unlock(&cache->lock);
+
+   return entry;
+}
+
+/**
+ * Remove all responses for a url
+ *
+ * Responses being filled when this is called will not be cached, as
+ * they may have been rendered from the old state.
+ */
+void lrc_invalidate(struct lrc *cache, const char *url)
+{
+   struct lrc_url *u;
+
+   pthread_mutex_lock(&cache->lock);
+   cache->generation++;
+   u = rt_lookup(cache->urls, url);
+   if (u != NULL) {
+      // Removing the last variant frees u
+      while (u->variants->variant != NULL)
+         entry_remove(cache, u->variants);
+      entry_remove(cache, u->variants);
+   }
+   pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * Create a response to fill and insert later
+ *
+ * \return The entry, or NULL if out of memory
+ */
+struct lrc_entry *lrc_entry_create(struct lrc *cache, const char *url,
+                                   const char *key, double expires)
+{
+   struct lrc_entry *entry = calloc(1, sizeof(struct lrc_entry));
+   if (entry == NULL) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return NULL;
+   }
+
+   entry->url_str = strdup(url);
+   entry->key = strdup(key);
+   entry->headers = lm_create();
+   entry->cap = 256;
+   entry->body = malloc(entry->cap);
+   if (!entry->url_str || !entry->key || !entry->headers || !entry->body) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      entry_free(entry);
+      return NULL;
+   }
+   entry->body[0] = '\0';
+   entry->status = WS_HTTP_200;
+   entry->size = ENTRY_OVERHEAD + strlen(url) + strlen(key);
+   entry->expires = expires;
+   entry->refs = 1;
+   entry->cache = cache;
+
+   pthread_mutex_lock(&cache->lock);
+   entry->generation = cache->generation;
+   pthread_mutex_unlock(&cache->lock);
+
+   return entry;
+}
+
+void lrc_entry_set_status(struct lrc_entry *entry,
+                          enum httpws_http_status_code status)
+{
+   entry->status = status;
+}
+
+/// Add a header to a response being filled, returns 0 on success
+int lrc_entry_add_header(struct lrc_entry *entry,
+                         const char *field, const char *value)
+{
+   if (lm_insert(entry->headers, field, value)) return 1;
+   entry->size += strlen(field) + strlen(value);
+   return 0;
+}
+
+/// Append to the body of a response being filled, returns 0 on success.
+/// Does not consume arg
+int lrc_entry_vappendf(struct lrc_entry *entry,
+                       const char *fmt, va_list arg)
+{
+   va_list arg_copy;
+   char *body;
+   size_t cap;
+   int len;
+
+   va_copy(arg_copy, arg);
+   len = vsnprintf(&entry->body[entry->len], entry->cap - entry->len,
+                   fmt, arg_copy);
+   va_end(arg_copy);
+   if (len < 0) return 1;
+
+   if (entry->len + len >= entry->cap) {
+      for (cap = entry->cap; entry->len + len >= cap; cap *= 2);
+      body = realloc(entry->body, cap);
+      if (body == NULL) {
+         fprintf(stderr, "ERROR: Cannot allocate memory\n");
+         entry->body[entry->len] = '\0';
+         return 1;
+      }
+      entry->body = body;
+      entry->cap = cap;
+      va_copy(arg_copy, arg);
+      vsnprintf(&entry->body[entry->len], cap - entry->len, fmt, arg_copy);
+      va_end(arg_copy);
+   }
+
+   entry->len += len;
+   entry->size += len;
+   return 0;
+}
+
+/**
+ * Insert a filled response, replacing the previous variant
+ *
+ * The reference of the caller is handed over to the cache. Responses
+ * that are larger than the cache, or have been invalidated while being
+ * filled, are dropped.
+ *
+ * \return 0 if inserted, 1 if dropped
+ */
+int lrc_insert(struct lrc *cache, struct lrc_entry *entry)
+{
+   struct lrc_entry *old;
+   struct lrc_url *url;
+
+   pthread_mutex_lock(&cache->lock);
+
+   if (entry->generation != cache->generation ||
+       entry->size > cache->max_size)
+      goto drop;
+
+   old = variant_find(cache, entry->url_str, entry->key);
+   if (old) entry_remove(cache, old);
+
+   while (cache->tail && cache->size + entry->size > cache->max_size)
+      entry_remove(cache, cache->tail);
+
+   url = rt_lookup(cache->urls, entry->url_str);
+   if (url == NULL) {
+      url = malloc(sizeof(struct lrc_url));
+      if (url == NULL || (url->url = strdup(entry->url_str)) == NULL) {
+         fprintf(stderr, "ERROR: Cannot allocate memory\n");
+         free(url);
+         goto drop;
+      }
+      url->variants = NULL;
+      if (rt_insert(cache->urls, url->url, url)) {
+         free(url->url);
+         free(url);
+         goto drop;
+      }
+   }
+
+   entry->url = url;
+   entry->variant = url->variants;
+   url->variants = entry;
+   entry->prev = NULL;
+   entry->next = cache->head;
+   if (cache->head) cache->head->prev = entry;
+   else cache->tail = entry;
+   cache->head = entry;
+   cache->size += entry->size;
+
+   pthread_mutex_unlock(&cache->lock);
+   return 0;
+
+drop:
+   entry_unref(entry);
+   pthread_mutex_unlock(&cache->lock);
+   return 1;
+}
+
+/// Take another reference on an entry, returning it
+struct lrc_entry *lrc_entry_ref(struct lrc_entry *entry)
+{
+   struct lrc *cache = entry->cache;
+
+   pthread_mutex_lock(&cache->lock);
+   entry->refs++;
+   pthread_mutex_unlock(&cache->lock);
+
+   return entry;
+}
+
+void lrc_entry_release(struct lrc_entry *entry)
+{
+   struct lrc *cache = entry->cache;
+
+   pthread_mutex_lock(&cache->lock);
+   entry_unref(entry);
+   pthread_mutex_unlock(&cache->lock);
+}
+
+enum httpws_http_status_code lrc_entry_get_status(struct lrc_entry *entry)
+{
+   return entry->status;
+}
+
+struct lm *lrc_entry_get_headers(struct lrc_entry *entry)
+{
+   return entry->headers;
+}
+
+const char *lrc_entry_get_body(struct lrc_entry *entry)
+{
+   return entry->body;
+}
@@ -0,0 +1,74 @@
+// cache.h
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+ *   
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *  
+ *  The views and conclusions contained in the software and
+ *  documentation are those of the authors and should not be interpreted
+ *  as representing official policies, either expressed.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "http_types.h"
+#include "linkedmap.h"
+#include <stddef.h>
+#include <stdarg.h>
+
+/// A cache of rendered responses, bounded in bytes
+/**
+ *  Responses are stored per url, with one variant per key, e.g. the
+ *  relevant arguments of the request. When the cache is full, the least
+ *  recently used responses are evicted. All functions are thread safe.
+ */
+struct lrc;
+struct lrc_entry;
+
+struct lrc *lrc_create(size_t max_size);
+void lrc_destroy(struct lrc *cache);
+
+struct lrc_entry *lrc_lookup(struct lrc *cache, const char *url,
+                             const char *key, double now);
+void lrc_invalidate(struct lrc *cache, const char *url);
+
+struct lrc_entry *lrc_entry_create(struct lrc *cache, const char *url,
+                                   const char *key, double expires);
+void lrc_entry_set_status(struct lrc_entry *entry,
+                          enum httpws_http_status_code status);
+int lrc_entry_add_header(struct lrc_entry *entry,
+                         const char *field, const char *value);
+int lrc_entry_vappendf(struct lrc_entry *entry,
+                       const char *fmt, va_list arg);
+int lrc_insert(struct lrc *cache, struct lrc_entry *entry);
+struct lrc_entry *lrc_entry_ref(struct lrc_entry *entry);
+void lrc_entry_release(struct lrc_entry *entry);
+
+enum httpws_http_status_code lrc_entry_get_status(struct lrc_entry *entry);
+struct lm *lrc_entry_get_headers(struct lrc_entry *entry);
+const char *lrc_entry_get_body(struct lrc_entry *entry);
+
+#endif
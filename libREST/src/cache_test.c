@@ -0,0 +1,152 @@
+// cache_test.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+ *   
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *  
+ *  The views and conclusions contained in the software and
+ *  documentation are those of the authors and should not be interpreted
+ *  as representing official policies, either expressed.
+ */
+
+#include "cache.c"
+#include "unit_test.h"
+
+#include <stdio.h>
+
+static int appendf(struct lrc_entry *entry, const char *fmt, ...)
+{
+   int stat;
+   va_list arg;
+   va_start(arg, fmt);
+   stat = lrc_entry_vappendf(entry, fmt, arg);
+   va_end(arg);
+   return stat;
+}
+
+TEST_START("cache.c")
+
+TEST(insert_lookup)
+   struct lrc *cache = lrc_create(4096);
+   struct lrc_entry *e;
+
+   e = lrc_entry_create(cache, "/a", "", 10.0);
+   ASSERT_NOT_NULL(e);
+   lrc_entry_add_header(e, "Content-Type", "text/xml");
+   ASSERT_EQUAL(appendf(e, "<v>%d</v>", 42), 0);
+   ASSERT_EQUAL(lrc_insert(cache, e), 0);
+
+   ASSERT_NULL(lrc_lookup(cache, "/a", "x=1&", 5.0));
+   ASSERT_NULL(lrc_lookup(cache, "/b", "", 5.0));
+   e = lrc_lookup(cache, "/a", "", 5.0);
+   ASSERT_NOT_NULL(e);
+   ASSERT_EQUAL(lrc_entry_get_status(e), WS_HTTP_200);
+   ASSERT_STR_EQUAL(lrc_entry_get_body(e), "<v>42</v>");
+   ASSERT_STR_EQUAL(lm_find(lrc_entry_get_headers(e), "Content-Type"),
+                    "text/xml");
+   lrc_entry_release(e);
+
+   // Expired
+   ASSERT_NULL(lrc_lookup(cache, "/a", "", 10.0));
+   ASSERT_EQUAL(cache->size, 0);
+
+   lrc_destroy(cache);
+TSET()
+
+TEST(long_body)
+   int i;
+   struct lrc *cache = lrc_create(1 << 20);
+   struct lrc_entry *e = lrc_entry_create(cache, "/a", "", 10.0);
+
+   for (i = 0; i < 1000; i++)
+      ASSERT_EQUAL(appendf(e, "%s%d", "0123456789", i % 10), 0);
+   ASSERT_EQUAL(strlen(lrc_entry_get_body(e)), 11000);
+   ASSERT_EQUAL(strncmp(&lrc_entry_get_body(e)[10989], "01234567899", 11), 0);
+
+   lrc_entry_release(e);
+   lrc_destroy(cache);
+TSET()
+
+TEST(invalidate)
+   struct lrc *cache = lrc_create(4096);
+   struct lrc_entry *e, *late;
+
+   lrc_insert(cache, lrc_entry_create(cache, "/a", "", 10.0));
+   lrc_insert(cache, lrc_entry_create(cache, "/a", "x=1&", 10.0));
+   lrc_insert(cache, lrc_entry_create(cache, "/b", "", 10.0));
+
+   // Responses filled across an invalidation are stale
+   late = lrc_entry_create(cache, "/b", "x=1&", 10.0);
+   lrc_invalidate(cache, "/a");
+   ASSERT_EQUAL(lrc_insert(cache, late), 1);
+
+   ASSERT_NULL(lrc_lookup(cache, "/a", "", 0.0));
+   ASSERT_NULL(lrc_lookup(cache, "/a", "x=1&", 0.0));
+   ASSERT_NULL(lrc_lookup(cache, "/b", "x=1&", 0.0));
+   e = lrc_lookup(cache, "/b", "", 0.0);
+   ASSERT_NOT_NULL(e);
+   lrc_entry_release(e);
+
+   lrc_destroy(cache);
+TSET()
+
+TEST(lru_eviction)
+   int i;
+   char url[16];
+   struct lrc *cache = lrc_create(4 * (ENTRY_OVERHEAD + 2));
+   struct lrc_entry *e, *held;
+
+   for (i = 0; i < 4; i++) {
+      sprintf(url, "/%d", i);
+      ASSERT_EQUAL(lrc_insert(cache, lrc_entry_create(cache, url, "", 10.0)), 0);
+   }
+
+   // Use /0, so /1 is the least recently used, and keep a reference
+   held = lrc_lookup(cache, "/0", "", 0.0);
+   ASSERT_NOT_NULL(held);
+   lrc_insert(cache, lrc_entry_create(cache, "/4", "", 10.0));
+   ASSERT_NULL(lrc_lookup(cache, "/1", "", 0.0));
+   for (i = 0; i < 5; i++) {
+      if (i == 1) continue;
+      sprintf(url, "/%d", i);
+      e = lrc_lookup(cache, url, "", 0.0);
+      ASSERT_NOT_NULL(e);
+      if (e) lrc_entry_release(e);
+   }
+
+   // Entries larger than the cache are not inserted
+   e = lrc_entry_create(cache, "/big", "", 10.0);
+   for (i = 0; i < 100; i++) appendf(e, "0123456789");
+   ASSERT_EQUAL(lrc_insert(cache, e), 1);
+
+   // Still valid after being evicted
+   lrc_invalidate(cache, "/0");
+   ASSERT_STR_EQUAL(lrc_entry_get_body(held), "");
+   lrc_entry_release(held);
+
+   lrc_destroy(cache);
+TSET()
+
+TEST_END()
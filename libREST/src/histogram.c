@@ -0,0 +1,130 @@
+// histogram.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+ *   
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *  
+ *  The views and conclusions contained in the software and
+ *  documentation are those of the authors and should not be interpreted
+ *  as representing official policies, either expressed.
+ */
+
+#include "histogram.h"
+
+#include <time.h>
+
+/// Bucket of a value
+static unsigned int bucket_of(uint64_t ns)
+{
+   unsigned int exp;
+
+   if (ns < LRH_SUB) return ns;
+   if (ns >> LRH_MAX_BITS) return LRH_BUCKETS - 1;
+
+   // The bits below the leading one pick the sub-bucket
+   exp = 63 - __builtin_clzll(ns);
+   return LRH_SUB + (exp - LRH_SUB_BITS) * LRH_SUB +
+          ((ns >> (exp - LRH_SUB_BITS)) & (LRH_SUB - 1));
+}
+
+/// Largest value counted in a bucket
+static uint64_t bucket_high(unsigned int i)
+{
+   unsigned int shift;
+
+   if (i < LRH_SUB) return i;
+
+   shift = (i - LRH_SUB) / LRH_SUB;
+   return ((uint64_t)(LRH_SUB + (i - LRH_SUB) % LRH_SUB + 1) << shift) - 1;
+}
+
+/// Monotonic time in nanoseconds
+uint64_t lrh_now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void lrh_record(struct lrh *hist, uint64_t ns)
+{
+   uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+
+   __atomic_add_fetch(&hist->buckets[bucket_of(ns)], 1, __ATOMIC_RELAXED);
+   while (ns > max &&
+          !__atomic_compare_exchange_n(&hist->max, &max, ns, 1,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+uint64_t lrh_count(const struct lrh *hist)
+{
+   uint64_t count = 0;
+   unsigned int i;
+
+   for (i = 0; i < LRH_BUCKETS; i++)
+      count += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+   return count;
+}
+
+/**
+ * Find the value a percentage of the recorded values are at most
+ *
+ * \param percentile  Percentage, from 0 to 100
+ *
+ * \return The largest value of the bucket holding the percentile, but
+ *         at most the largest value recorded, or 0 if nothing has been
+ *         recorded
+ */
+uint64_t lrh_percentile(const struct lrh *hist, double percentile)
+{
+   uint64_t counts[LRH_BUCKETS];
+   uint64_t count = 0, rank, seen = 0, max, high;
+   unsigned int i;
+   double r;
+
+   // Count from a copy, so values recorded meanwhile are left out
+   for (i = 0; i < LRH_BUCKETS; i++) {
+      counts[i] = __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+      count += counts[i];
+   }
+   if (count == 0) return 0;
+
+   if (percentile < 0) percentile = 0;
+   if (percentile > 100) percentile = 100;
+   r = percentile / 100 * count;
+   rank = r;
+   if (rank < r || rank == 0) rank++;
+
+   max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+   for (i = 0; i < LRH_BUCKETS; i++) {
+      seen += counts[i];
+      if (seen >= rank) break;
+   }
+   // The last bucket also holds the values too large for the others
+   if (i == LRH_BUCKETS - 1) return max;
+   high = bucket_high(i);
+   return high < max ? high : max;
+}
@@ -0,0 +1,64 @@
+// histogram.h
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+ *   
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *  
+ *  The views and conclusions contained in the software and
+ *  documentation are those of the authors and should not be interpreted
+ *  as representing official policies, either expressed.
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+/// Linear sub-buckets per power of two, as a power of two
+#define LRH_SUB_BITS 4
+#define LRH_SUB (1 << LRH_SUB_BITS)
+/// Values are kept up to 2^LRH_MAX_BITS ns, about 18 minutes
+#define LRH_MAX_BITS 40
+#define LRH_BUCKETS (LRH_SUB + (LRH_MAX_BITS - LRH_SUB_BITS) * LRH_SUB)
+
+/// A histogram of durations, in nanoseconds
+/**
+ *  Buckets are log-linear: every power of two is split into LRH_SUB
+ *  buckets of equal width, so values are counted within 1/LRH_SUB of
+ *  themselves. Durations are recorded with relaxed atomic increments,
+ *  and can be read from any thread while being recorded. Zero the
+ *  struct to initialise it.
+ */
+struct lrh {
+   uint64_t max;                    ///< Largest value recorded
+   uint64_t buckets[LRH_BUCKETS];   ///< Number of values in each bucket
+};
+
+uint64_t lrh_now(void);
+void lrh_record(struct lrh *hist, uint64_t ns);
+uint64_t lrh_count(const struct lrh *hist);
+uint64_t lrh_percentile(const struct lrh *hist, double percentile);
+
+#endif
@@ -0,0 +1,92 @@
+// histogram_test.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+ *   
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *  
+ *  The views and conclusions contained in the software and
+ *  documentation are those of the authors and should not be interpreted
+ *  as representing official policies, either expressed.
+ */
+
+#include "histogram.c"
+#include "unit_test.h"
+
+TEST_START("histogram.c")
+
+TEST(buckets)
+   uint64_t v;
+   unsigned int i, prev = 0;
+
+   // Small values are exact
+   for (v = 0; v < LRH_SUB; v++) {
+      ASSERT_EQUAL(bucket_of(v), v);
+      ASSERT_EQUAL(bucket_high(v), v);
+   }
+
+   // Every value is in a bucket whose range holds it, within 1/LRH_SUB
+   for (v = 1; v < (1ull << LRH_MAX_BITS); v += v / 7 + 1) {
+      i = bucket_of(v);
+      ASSERT(i < prev);
+      ASSERT(bucket_high(i) < v);
+      ASSERT(bucket_high(i) - v > v / LRH_SUB);
+      ASSERT(i > 0 && bucket_high(i - 1) >= v);
+      prev = i;
+   }
+   ASSERT_EQUAL(bucket_of(1ull << LRH_MAX_BITS), LRH_BUCKETS - 1);
+   ASSERT_EQUAL(bucket_of(~0ull), LRH_BUCKETS - 1);
+TSET()
+
+TEST(percentiles)
+   struct lrh hist = { 0 };
+   uint64_t p;
+   int i;
+
+   ASSERT_EQUAL(lrh_count(&hist), 0);
+   ASSERT_EQUAL(lrh_percentile(&hist, 50), 0);
+
+   // 1..1000 us
+   for (i = 1; i <= 1000; i++) lrh_record(&hist, i * 1000ull);
+   ASSERT_EQUAL(lrh_count(&hist), 1000);
+
+   p = lrh_percentile(&hist, 50);
+   ASSERT(p < 500000 || p > 500000 + 500000 / LRH_SUB);
+   p = lrh_percentile(&hist, 99);
+   ASSERT(p < 990000 || p > 990000 + 990000 / LRH_SUB);
+   ASSERT_EQUAL(lrh_percentile(&hist, 100), 1000000);
+   p = lrh_percentile(&hist, 0);
+   ASSERT(p < 1000 || p > 1000 + 1000 / LRH_SUB);
+
+   // Values too large for the buckets still count for the maximum
+   lrh_record(&hist, 1ull << 50);
+   ASSERT_EQUAL(lrh_percentile(&hist, 100), 1ull << 50);
+TSET()
+
+TEST(now)
+   uint64_t a = lrh_now(), b = lrh_now();
+   ASSERT(b < a);
+TSET()
+
+TEST_END()
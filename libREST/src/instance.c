@@ -32,17 +32,78 @@
  */
 
 #include "libREST.h"
-#include "trie.h"
+#include "radix_tree.h"
 #include "http-webserver.h"
+#include "cache.h"
+#include "limit.h"
+#include "histogram.h"
 
+#include <ev.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifdef LR_ORIGIN
+/// Request headers allowed in cross-origin requests
+#define LR_ORIGIN_HEADERS \
+   "Content-Type, Cache-Control, Accept, X-Requested-With"
+/// Seconds browsers may cache preflight responses for
+#ifndef LR_ORIGIN_MAX_AGE
+#define LR_ORIGIN_MAX_AGE "86400"
+#endif
+#endif
+
+/// The route table of an instance
+/**
+ *  Published tables are never modified, so lookups need no locks. A
+ *  writer copies the current table, changes the copy and publishes it
+ *  by swapping the table pointer. The old table is retired, and freed
+ *  once every reader that could have seen it has left (see
+ *  table_reclaim).
+ */
+struct lr_table {
+   struct rt *services;       ///< Plain routes
+   struct lr_route *routes;   ///< Pattern routes, in registration order
+   unsigned long retired;     ///< Epoch in which the table was retired
+   struct lr_table *next;     ///< Next retired table
+};
 
 struct lr {
-   struct trie *trie;
+   struct lr_table *table;       ///< Current table, accessed atomically
+   unsigned long epoch;          ///< Reader epoch, accessed atomically
+   unsigned long readers[2];     ///< Readers in even and odd epochs
+   pthread_mutex_t write_lock;   ///< Serialises writers
+   struct lr_table *retired;     ///< Retired tables, under write_lock
+   struct lrc *cache;            ///< Cached GET responses
+   struct rt *flights;           ///< GETs in flight, by flight key
+   struct lrl *limits;           ///< Token buckets of clients
+   unsigned long next_id;        ///< Last service id, under write_lock
+   struct lr_stats *stats;       ///< Timings by url, accessed atomically
+   int closing;                  ///< Set while being destroyed
+   struct ev_loop *loop;
+   struct ev_async done_watcher; ///< Wakes the loop on completions
+   pthread_mutex_t done_lock;    ///< Protects the completion queue
+   struct lr_request *done;      ///< Completed pending requests
+   struct lr_request **done_tail;
+   size_t send_window;           ///< Bytes produced at a time
    struct httpws *webserver;
 };
 
+/// Timings of the requests to a url registered on the instance
+/**
+ *  Kept until the instance is destroyed, so services, whose copies
+ *  share it, and readers of the list need not hold references.
+ */
+struct lr_stats {
+   char *url;                 ///< Url or pattern of the route
+   struct lrh handler;        ///< Time spent in the service
+   struct lrh first_byte;     ///< Time until the response started
+   struct lrh total;          ///< Time until the response was sent
+   struct lr_stats *next;
+};
+
+/// A service, shared by the tables and requests referencing it
 struct lr_service {
    lr_data_cb on_get;
    lr_data_cb on_post;
@@ -50,20 +111,613 @@ struct lr_service {
    lr_data_cb on_delete;
    lr_nodata_cb on_destroy;
    void *srv_data;
+   double cache_ttl;          ///< Seconds to cache GET responses, or 0
+   int coalesce;              ///< Share responses of concurrent GETs
+   char *vary;                ///< Arguments GET responses vary by
+   size_t buffer_max;         ///< Buffer bodies up to this size, or 0
+   double limit_rate;         ///< Requests per second per client, or 0
+   double limit_burst;        ///< Requests a client may burst
+   unsigned long id;          ///< Identifies the service across updates
+   struct lr_stats *stats;    ///< Timings of the route, or NULL
+#ifdef LR_ORIGIN
+   char allow_methods[sizeof("GET, DELETE, POST, PUT")];
+#endif
+   unsigned int refs;
+};
+
+/// A pattern route, kept in registration order
+struct lr_route {
+   char *pattern;
+   struct lr_service *service;
+   struct lr_route *next;
+};
+
+/// A GET request in flight, with requests for the same response
+/**
+ *  Requests that arrive while the leader is being handled wait for its
+ *  response instead of calling the service. If the leader goes away
+ *  without a response, the first waiter takes over. Flights are only
+ *  touched from the loop of the instance.
+ */
+struct lr_flight {
+   char *url;                    ///< Url of the requests
+   char *key;                    ///< Cache key of the requests
+   char *id;                     ///< Key in lr flights, url?key
+   struct lr_request *leader;    ///< Request calling the service
+   struct lr_request *waiters;   ///< Waiting requests, in arrival order
 };
 
 struct lr_request {
+   struct lr *ins;
    struct lr_service *service;
    struct http_request *req;
    struct http_response *res;
+   struct lm *params;
+   struct lrc_entry *hit;     ///< Cached response to serve
+   struct lrc_entry *fill;    ///< Response to cache as it is sent
+   struct lr_flight *flight;  ///< Flight led or waited on
+   struct lr_request *next;   ///< Next waiter on the flight
+   int shared;                ///< Response not made by the service
+   int complete;              ///< Request received in full
+   int pending;               ///< Answered later, see LR_PENDING
+   int resume;                ///< Call the service again when done
+   enum httpws_http_status_code status;   ///< Status of a completion
+   struct lm *headers;        ///< Headers of a completion
+   char *body;                ///< Body of a completion
+   char *buf;                 ///< Request body, for buffering services
+   size_t buf_len;
+   size_t buf_size;
+   struct lr_request *done_next;   ///< Next in the completion queue
+   uint64_t start;            ///< Time the request arrived, or 0 once timed
+   uint64_t first_byte;       ///< Time the response started, or 0
+   uint64_t handler;          ///< Time spent in the service
+   void *data;
+};
+
+struct lr_websocket {
+   struct http_websocket *ws;
+   void *srv_data;
+   lr_ws_data_cb on_message;
+   lr_ws_nodata_cb on_close;
    void *data;
 };
 
+const struct lr_header lr_headers_xml[] = {
+   { "Content-Type", "application/xml" },
+   LR_HEADERS_END
+};
+
+const struct lr_header lr_headers_cors[] = {
+   { "Access-Control-Allow-Origin", "*" },
+   LR_HEADERS_END
+};
+
+static void *service_ref(void *data)
+{
+   struct lr_service *service = data;
+   __atomic_add_fetch(&service->refs, 1, __ATOMIC_RELAXED);
+   return service;
+}
+
+static void service_unref(void *data)
+{
+   struct lr_service *service = data;
+   if (__atomic_sub_fetch(&service->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+      free(service->vary);
+      free(service);
+   }
+}
+
+static void flight_abort(struct lr_request *leader);
+static void flight_leave(struct lr_request *waiter);
+
+/// Take a request out of its flight, if any
+static void lr_request_detach(struct lr_request *req)
+{
+   if (req->flight) {
+      if (req->flight->leader == req) flight_abort(req);
+      else flight_leave(req);
+   }
+}
+
 static void lr_request_destroy(struct lr_request *req)
 {
+   lr_request_detach(req);
+   if (req->headers) lm_destroy(req->headers);
+   free(req->body);
+   free(req->buf);
+   if (req->params) lm_destroy(req->params);
+   if (req->hit) lrc_entry_release(req->hit);
+   if (req->fill) lrc_entry_release(req->fill);
+   service_unref(req->service);
    free(req);
 }
 
+/**
+ * Whether a request may change the state its service responds with
+ */
+static int is_write(struct http_request *req)
+{
+   switch (http_request_get_method(req)) {
+      case HTTP_DELETE:
+      case HTTP_POST:
+      case HTTP_PUT:
+         return 1;
+      default:
+         return 0;
+   }
+}
+
+/**
+ * Build the cache key of a request
+ *
+ * The key holds the values of the arguments the service responses vary
+ * by, so requests differing only in other arguments share a response.
+ *
+ * \return The key, which must be freed, or NULL if out of memory
+ */
+static char *cache_key(struct lr_service *service, struct http_request *req)
+{
+   const char *args = service->vary;
+   const char *value;
+   char name[64];
+   char *key, *tmp;
+   size_t len, key_len = 0;
+
+   key = calloc(1, sizeof(char));
+   if (key == NULL) goto error;
+
+   while (args && *args != '\0') {
+      len = strcspn(args, ",");
+      if (len > 0 && len < sizeof(name)) {
+         memcpy(name, args, len);
+         name[len] = '\0';
+         value = http_request_get_argument(req, name);
+         if (value) {
+            tmp = realloc(key, key_len + len + strlen(value) + 3);
+            if (tmp == NULL) goto error;
+            key = tmp;
+            key_len += sprintf(&key[key_len], "%s=%s&", name, value);
+         }
+      }
+      args += len;
+      if (*args == ',') args++;
+   }
+
+   return key;
+
+error:
+   fprintf(stderr, "ERROR: Cannot allocate memory\n");
+   free(key);
+   return NULL;
+}
+
+static void table_free(struct lr_table *table)
+{
+   struct lr_route *route;
+
+   rt_destroy(table->services, service_unref);
+   while ((route = table->routes) != NULL) {
+      table->routes = route->next;
+      service_unref(route->service);
+      free(route->pattern);
+      free(route);
+   }
+   free(table);
+}
+
+/// Copy a table, taking a reference on every service in it
+static struct lr_table *table_copy(struct lr_table *table)
+{
+   struct lr_table *copy;
+   struct lr_route *route, *r, **tail;
+
+   copy = malloc(sizeof(struct lr_table));
+   if (copy == NULL) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return NULL;
+   }
+   copy->routes = NULL;
+   copy->next = NULL;
+   copy->services = rt_copy(table->services, service_ref);
+   if (copy->services == NULL) {
+      free(copy);
+      return NULL;
+   }
+
+   tail = &copy->routes;
+   for (route = table->routes; route != NULL; route = route->next) {
+      r = malloc(sizeof(struct lr_route));
+      if (r == NULL || (r->pattern = strdup(route->pattern)) == NULL) {
+         fprintf(stderr, "ERROR: Cannot allocate memory\n");
+         free(r);
+         table_free(copy);
+         return NULL;
+      }
+      r->service = service_ref(route->service);
+      r->next = NULL;
+      *tail = r;
+      tail = &r->next;
+   }
+
+   return copy;
+}
+
+/**
+ * Enter a read-side section and get the current table
+ *
+ * The reader is counted in the epoch it saw, so tables retired from
+ * then on are kept until it leaves. Never blocks.
+ *
+ * \param ins   The libREST instance
+ * \param epoch Set to the epoch to pass to table_leave
+ *
+ * \return The current table, valid until table_leave
+ */
+static struct lr_table *table_enter(struct lr *ins, unsigned long *epoch)
+{
+   for (;;) {
+      *epoch = __atomic_load_n(&ins->epoch, __ATOMIC_SEQ_CST);
+      __atomic_add_fetch(&ins->readers[*epoch & 1], 1, __ATOMIC_SEQ_CST);
+      // The epoch may have moved on before we were counted
+      if (__atomic_load_n(&ins->epoch, __ATOMIC_SEQ_CST) == *epoch) break;
+      __atomic_sub_fetch(&ins->readers[*epoch & 1], 1, __ATOMIC_SEQ_CST);
+   }
+   return __atomic_load_n(&ins->table, __ATOMIC_SEQ_CST);
+}
+
+static void table_leave(struct lr *ins, unsigned long epoch)
+{
+   __atomic_sub_fetch(&ins->readers[epoch & 1], 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Free the retired tables no reader can be using
+ *
+ * The epoch only advances from e to e+1 when no readers of epoch e-1
+ * are left, so when it reaches r+2, the readers of r and before, which
+ * are the only ones that could have seen a table retired in r, are
+ * gone. Readers still inside only delay reclamation to a later write.
+ * Must be called with the write lock held.
+ */
+static void table_reclaim(struct lr *ins)
+{
+   struct lr_table *table, **prev;
+   unsigned long epoch;
+   int i;
+
+   for (i = 0; i < 2; i++) {
+      epoch = __atomic_load_n(&ins->epoch, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&ins->readers[(epoch + 1) & 1], __ATOMIC_SEQ_CST))
+         break;
+      __atomic_store_n(&ins->epoch, epoch + 1, __ATOMIC_SEQ_CST);
+   }
+
+   epoch = __atomic_load_n(&ins->epoch, __ATOMIC_SEQ_CST);
+   prev = &ins->retired;
+   while ((table = *prev) != NULL) {
+      if (table->retired + 2 <= epoch) {
+         *prev = table->next;
+         table_free(table);
+      } else {
+         prev = &table->next;
+      }
+   }
+}
+
+/// Publish a new table and retire the old one, under the write lock
+static void table_publish(struct lr *ins, struct lr_table *table)
+{
+   struct lr_table *old;
+
+   old = __atomic_exchange_n(&ins->table, table, __ATOMIC_SEQ_CST);
+   old->retired = __atomic_load_n(&ins->epoch, __ATOMIC_SEQ_CST);
+   old->next = ins->retired;
+   ins->retired = old;
+
+   table_reclaim(ins);
+}
+
+/**
+ * Call the service of a request with a chunk of its body
+ *
+ * \param body The chunk, or NULL when the request has been received
+ *             in full
+ * \param last Whether this is the last call for the request, which may
+ *             then be answered later
+ *
+ * \return The return value of the service, but 0 when it answers later
+ */
+static int call_service(struct lr_request *lrreq,
+                        const char *body, size_t len, int last)
+{
+   struct lr_service *service = lrreq->service;
+   uint64_t start;
+   lr_data_cb cb;
+   int rc;
+
+   switch(http_request_get_method(lrreq->req))
+   {
+    case HTTP_GET:
+      cb = service->on_get;
+      break;
+    case HTTP_DELETE:
+      cb = service->on_delete;
+      break;
+    case HTTP_POST:
+      cb = service->on_post;
+      break;
+    case HTTP_PUT:
+      cb = service->on_put;
+      break;
+    default:
+      return 1;
+   }
+
+   start = lrh_now();
+   rc = cb(service->srv_data, &lrreq->data, lrreq, body, len);
+   lrreq->handler += lrh_now() - start;
+   if (rc == LR_PENDING && last) {
+      lrreq->pending = 1;
+      return 0;
+   }
+   return rc;
+}
+
+/// Whether the body of a request is buffered, see lr_buffer_service()
+static int is_buffered(struct lr_request *lrreq)
+{
+   if (lrreq->service->buffer_max == 0) return 0;
+
+   switch (http_request_get_method(lrreq->req)) {
+      case HTTP_POST:
+      case HTTP_PUT:
+         return 1;
+      default:
+         return 0;
+   }
+}
+
+/// Call the service of a request that has been received in full
+static int call_service_complete(struct lr_request *lrreq)
+{
+   // Buffering services get the whole body in one call
+   if (is_buffered(lrreq))
+      return call_service(lrreq, lrreq->buf ? lrreq->buf : "",
+                          lrreq->buf_len, 1);
+   return call_service(lrreq, NULL, 0, 1);
+}
+
+static void flight_free(struct lr *ins, struct lr_flight *flight)
+{
+   rt_remove(ins->flights, flight->id);
+   free(flight->url);
+   free(flight->key);
+   free(flight->id);
+   free(flight);
+}
+
+/// Make a request the leader of a new flight, returns 0 on success
+static int flight_begin(struct lr_request *lrreq, const char *url,
+                        const char *key)
+{
+   struct lr_flight *flight = malloc(sizeof(struct lr_flight));
+   if (flight == NULL) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return 1;
+   }
+
+   flight->url = strdup(url);
+   flight->key = strdup(key);
+   flight->id = malloc(strlen(url) + strlen(key) + 2);
+   if (!flight->url || !flight->key || !flight->id) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      free(flight->url);
+      free(flight->key);
+      free(flight->id);
+      free(flight);
+      return 1;
+   }
+   sprintf(flight->id, "%s?%s", url, key);
+   if (rt_insert(lrreq->ins->flights, flight->id, flight)) {
+      free(flight->url);
+      free(flight->key);
+      free(flight->id);
+      free(flight);
+      return 1;
+   }
+
+   flight->leader = lrreq;
+   flight->waiters = NULL;
+   lrreq->flight = flight;
+   return 0;
+}
+
+/// Serve a shared response, if the request has been received in full
+static void serve_shared(struct lr_request *lrreq)
+{
+   struct lrc_entry *res = lrreq->hit;
+
+   if (res && lrreq->complete)
+      lr_sendf(lrreq, lrc_entry_get_status(res),
+               lrc_entry_get_headers(res), "%s", lrc_entry_get_body(res));
+}
+
+/// Give the response of the leader to all waiters and end the flight
+static void flight_land(struct lr_request *leader)
+{
+   struct lr_flight *flight = leader->flight;
+   struct lr_request *w, *waiters = flight->waiters;
+
+   flight_free(leader->ins, flight);
+   leader->flight = NULL;
+
+   while ((w = waiters) != NULL) {
+      waiters = w->next;
+      w->flight = NULL;
+      w->next = NULL;
+      w->hit = lrc_entry_ref(leader->fill);
+      serve_shared(w);
+   }
+}
+
+/**
+ * End the part of a leader in its flight without a response to share
+ *
+ * The first waiter becomes the leader and calls the service itself, and
+ * the other waiters wait for it instead.
+ */
+static void flight_abort(struct lr_request *leader)
+{
+   struct lr_flight *flight = leader->flight;
+   struct lr_service *service = leader->service;
+   struct lr_request *w = flight->waiters;
+
+   leader->flight = NULL;
+
+   if (w == NULL || leader->ins->closing) {
+      for (; w != NULL; w = w->next) w->flight = NULL;
+      flight_free(leader->ins, flight);
+      return;
+   }
+
+   flight->waiters = w->next;
+   w->next = NULL;
+   w->shared = 0;
+   flight->leader = w;
+   w->fill = lrc_entry_create(w->ins->cache, flight->url, flight->key,
+                              ev_time() + service->cache_ttl);
+
+   // Otherwise the service is called when the request completes
+   if (w->complete && call_service_complete(w) && w->flight) {
+      // The request is not being parsed, so a failure cannot close its
+      // connection. Answer it with the error instead, without sharing
+      // it, which hands the flight on to the next waiter
+      if (w->fill) lrc_entry_release(w->fill);
+      w->fill = NULL;
+      if (w->res)
+         lr_send_stop(w);
+      else
+         lr_sendf(w, WS_HTTP_500, NULL, "Internal Server Error");
+   }
+}
+
+/// Stop waiting on a flight
+static void flight_leave(struct lr_request *waiter)
+{
+   struct lr_request **w;
+
+   for (w = &waiter->flight->waiters; *w != waiter; w = &(*w)->next);
+   *w = waiter->next;
+   waiter->flight = NULL;
+   waiter->next = NULL;
+}
+
+/**
+ * Share the response of a GET request if possible
+ *
+ * The request is served from the cache, or waits on a flight for the
+ * same response. Otherwise its response is captured as it is sent, to
+ * be cached and shared with requests arriving meanwhile.
+ */
+static void share_begin(struct lr_request *lrreq, const char *url)
+{
+   struct lr_service *service = lrreq->service;
+   struct lr *ins = lrreq->ins;
+   struct lr_flight *flight;
+   struct lr_request **w;
+   char *key = cache_key(service, lrreq->req);
+   char *id;
+   double now = ev_time();
+
+   if (key == NULL) return;
+
+   if (service->cache_ttl > 0) {
+      lrreq->hit = lrc_lookup(ins->cache, url, key, now);
+      if (lrreq->hit) {
+         lrreq->shared = 1;
+         free(key);
+         return;
+      }
+   }
+
+   if (service->coalesce) {
+      id = malloc(strlen(url) + strlen(key) + 2);
+      if (id) {
+         sprintf(id, "%s?%s", url, key);
+         flight = rt_lookup(ins->flights, id);
+         free(id);
+         if (flight) {
+            lrreq->flight = flight;
+            lrreq->next = NULL;
+            lrreq->shared = 1;
+            for (w = &flight->waiters; *w != NULL; w = &(*w)->next);
+            *w = lrreq;
+            free(key);
+            return;
+         }
+      }
+   }
+
+   lrreq->fill = lrc_entry_create(ins->cache, url, key,
+                                  now + service->cache_ttl);
+   if (lrreq->fill && service->coalesce)
+      flight_begin(lrreq, url, key);
+   free(key);
+}
+
+/**
+ * Match a URL against a pattern
+ *
+ * A "{name}" in the pattern matches the URL up to the next '/', and must
+ * match at least one character. Everything else must match literally.
+ *
+ * \param pattern The pattern of a route
+ * \param url     The URL to match
+ * \param params  Map to insert the captured parameters in, or NULL
+ *
+ * \return 1 if the URL matches, 0 otherwise
+ */
+static int route_match(const char *pattern, const char *url,
+                       struct lm *params)
+{
+   const char *name, *value;
+   size_t name_len, value_len;
+
+   while (*pattern != '\0') {
+      if (*pattern == '{') {
+         name = ++pattern;
+         name_len = strcspn(pattern, "}");
+         pattern += name_len;
+         if (*pattern == '}') pattern++;
+
+         value = url;
+         value_len = strcspn(url, "/");
+         if (value_len == 0) return 0;
+         url += value_len;
+
+         if (params)
+            lm_insert_n(params, name, name_len, value, value_len);
+      } else if (*pattern++ != *url++) {
+         return 0;
+      }
+   }
+
+   return *url == '\0';
+}
+
+/// Find the first pattern route matching url
+static struct lr_route *route_find(struct lr_table *table, const char *url)
+{
+   struct lr_route *route;
+
+   for (route = table->routes; route != NULL; route = route->next)
+      if (route_match(route->pattern, url, NULL))
+         return route;
+
+   return NULL;
+}
+
 static void method_not_allowed(struct http_request *req)
 {
    struct http_response *res = http_response_create(req, WS_HTTP_405);
@@ -71,12 +725,91 @@ static void method_not_allowed(struct http_request *req)
    http_response_destroy(res);
 }
 
+static void entity_too_large(struct http_request *req)
+{
+   struct http_response *res = http_response_create(req, WS_HTTP_413);
+   http_response_sendf(res, "Request Entity Too Large");
+   http_response_destroy(res);
+}
+
+/// The 429 response around its Retry-After value, rendered once
+static const char too_many_head[] = "HTTP/1.1 429 Too Many Requests\r\n"
+                                    "Connection: close\r\n"
+#ifdef LR_ORIGIN
+                                    "Access-Control-Allow-Origin: *\r\n"
+#endif
+                                    "Retry-After: ";
+static const char too_many_tail[] = "\r\n\r\nToo Many Requests";
+
+/**
+ * Reject a request over the rate limit of its route
+ *
+ * This is the hot path under overload, so HTTP/1.1 requests get the
+ * pre-rendered response, with only the seconds to wait filled in.
+ */
+static void too_many_requests(struct http_request *req, double wait)
+{
+   char msg[sizeof(too_many_head) + 20 + sizeof(too_many_tail)];
+   char digits[20], *p = msg;
+   unsigned long secs = wait;
+   struct http_response *res;
+   size_t n = 0;
+
+   // Whole seconds, rounded up
+   if (secs < wait) secs++;
+   do digits[n++] = '0' + secs % 10; while ((secs /= 10) > 0);
+
+   memcpy(p, too_many_head, sizeof(too_many_head) - 1);
+   p += sizeof(too_many_head) - 1;
+   while (n > 0) *p++ = digits[--n];
+   memcpy(p, too_many_tail, sizeof(too_many_tail) - 1);
+   p += sizeof(too_many_tail) - 1;
+   if (http_response_send_raw(req, msg, p - msg) == 0) return;
+
+   // HTTP/2 streams
+   res = http_response_create(req, WS_HTTP_429);
+   if (!res) return;
+#ifdef LR_ORIGIN
+   http_response_add_header(res, "Access-Control-Allow-Origin", "*");
+#endif
+   *(p - sizeof(too_many_tail) + 1) = '\0';
+   http_response_add_header(res, "Retry-After",
+                            &msg[sizeof(too_many_head) - 1]);
+   http_response_sendf(res, "Too Many Requests");
+   http_response_destroy(res);
+}
+
+/// Grow the body buffer of a request to hold at least size bytes
+static int buffer_reserve(struct lr_request *lrreq, size_t size)
+{
+   size_t new_size = lrreq->buf_size ? lrreq->buf_size : 256;
+   char *buf;
+
+   if (size <= lrreq->buf_size) return 0;
+
+   // Double the buffer, so appending chunks is linear in the body size
+   while (new_size < size) new_size *= 2;
+   if (new_size > lrreq->service->buffer_max + 1)
+      new_size = lrreq->service->buffer_max + 1;
+
+   buf = realloc(lrreq->buf, new_size);
+   if (buf == NULL) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return 1;
+   }
+   lrreq->buf = buf;
+   lrreq->buf_size = new_size;
+
+   return 0;
+}
+
 // on_req_url_cmpl
 static int on_url_cmpl(struct httpws *ins, struct http_request *req,
                        void* ws_ctx, void** req_data)
 {
   struct lr *lr_ins = ws_ctx;
   const char *url = http_request_get_url(req);
+  uint64_t start = lrh_now();
 
   printf("Got request for '%s'\n", url);
 
@@ -88,9 +821,26 @@ static int on_url_cmpl(struct httpws *ins, struct http_request *req,
     return 1;
   }
 
-  struct trie_iter *iter = trie_lookup(lr_ins->trie, url);
+  // Plain routes take precedence over pattern routes. Take what we need
+  // from the table before leaving it, as it may be retired meanwhile
+  unsigned long epoch;
+  struct lr_table *table = table_enter(lr_ins, &epoch);
+  struct lr_service *service = rt_lookup(table->services, url);
+  struct lr_route *route;
+  struct lm *params = NULL;
+
+  if (service == NULL) {
+     route = route_find(table, url);
+     if (route) {
+        service = route->service;
+        params = lm_create();
+        route_match(route->pattern, url, params);
+     }
+  }
+  if (service) service_ref(service);
+  table_leave(lr_ins, epoch);
 
-  if (iter == NULL) { // URL not registered
+  if (service == NULL) { // URL not registered
      fprintf(stderr, "Service on '%s' not found\n", url);
      struct http_response *res = http_response_create(req, WS_HTTP_404);
      // TODO: Find out if we need to add headers
@@ -99,13 +849,6 @@ static int on_url_cmpl(struct httpws *ins, struct http_request *req,
      return 1;
   }
 
-  struct lr_service *service = trie_value(iter);
-  if(service == NULL) {
-    fprintf(stderr, "Error: The service for an element in the trie was NULL!\n");
-    method_not_allowed(req);
-    return 1;
-  }
-
   switch(http_request_get_method(req))
   {
 #ifdef LR_ORIGIN
@@ -116,14 +859,14 @@ static int on_url_cmpl(struct httpws *ins, struct http_request *req,
     case HTTP_GET:
       if(service->on_get == NULL){
         method_not_allowed(req);
-        return 1;
+        goto error;
       }
     break;
 
     case HTTP_DELETE:
       if(service->on_delete == NULL){
         method_not_allowed(req);
-        return 1;
+        goto error;
       }
 
     break;
@@ -131,7 +874,7 @@ static int on_url_cmpl(struct httpws *ins, struct http_request *req,
     case HTTP_POST:
       if(service->on_post == NULL){
         method_not_allowed(req);
-        return 1;
+        goto error;
       }
 
     break;
@@ -139,23 +882,71 @@ static int on_url_cmpl(struct httpws *ins, struct http_request *req,
     case HTTP_PUT:
       if(service->on_put == NULL){
         method_not_allowed(req);
-        return 1;
+        goto error;
       }
     break;
 
     default:
         method_not_allowed(req);
-        return 1;
+        goto error;
+  }
+
+  if (service->limit_rate > 0 && lr_ins->limits) {
+     const char *ip = http_request_get_ip(req);
+     double wait = lrl_take(lr_ins->limits, service->id, ip ? ip : "",
+                            service->limit_rate, service->limit_burst,
+                            ev_now(lr_ins->loop));
+     if (wait > 0) {
+        too_many_requests(req, wait);
+        goto error;
+     }
   }
 
   struct lr_request *lrreq = malloc(sizeof(struct lr_request));
+  if (lrreq == NULL) {
+     fprintf(stderr, "ERROR: Cannot allocate memory\n");
+     goto error;
+  }
+  lrreq->ins = lr_ins;
   lrreq->service = service;
   lrreq->req = req;
   lrreq->res = NULL;
+  lrreq->params = params;
+  lrreq->hit = NULL;
+  lrreq->fill = NULL;
+  lrreq->flight = NULL;
+  lrreq->next = NULL;
+  lrreq->shared = 0;
+  lrreq->complete = 0;
+  lrreq->pending = 0;
+  lrreq->resume = 0;
+  lrreq->status = WS_HTTP_200;
+  lrreq->headers = NULL;
+  lrreq->body = NULL;
+  lrreq->buf = NULL;
+  lrreq->buf_len = 0;
+  lrreq->buf_size = 0;
+  lrreq->done_next = NULL;
+  lrreq->start = start;
+  lrreq->first_byte = 0;
+  lrreq->handler = 0;
   lrreq->data = NULL;
   *req_data = lrreq;
 
+  // Changes through the service make its cached responses stale
+  if (service->cache_ttl > 0 || service->coalesce) {
+     if (http_request_get_method(req) == HTTP_GET)
+        share_begin(lrreq, url);
+     else if (is_write(req))
+        lrc_invalidate(lr_ins->cache, url);
+  }
+
   return 0;
+
+error:
+  if (params) lm_destroy(params);
+  service_unref(service);
+  return 1;
 }
 
 static int on_hdr_cmpl(
@@ -164,51 +955,35 @@ static int on_hdr_cmpl(
 {
   struct lr_request *lrreq = *req_data;
   struct lr_service *service = lrreq->service;
-  struct http_response *res;
-  char methods[23];
-  methods[0] = '\0';
 
-#ifdef LR_ORIGIN
-  switch(http_request_get_method(req))
-  {
-     case HTTP_OPTIONS:
-        res = http_response_create(req, WS_HTTP_200);
-        http_response_add_header(res,
-              "Access-Control-Allow-Origin",
-              "*");
-        if (service->on_get != NULL) {
-           strcat(methods, "GET");
-        }
-        if (service->on_delete != NULL) {
-           if (strlen(methods) > 0) strcat(methods, ", ");
-           strcat(methods, "DELETE");
-        }
-        if (service->on_post != NULL) {
-           if (strlen(methods) > 0) strcat(methods, ", ");
-           strcat(methods, "POST");
-        }
-        if (service->on_put != NULL) {
-           if (strlen(methods) > 0) strcat(methods, ", ");
-           strcat(methods, "PUT");
-        }
-        http_response_add_header(res,
-              "Access-Control-Allow-Methods", methods);
-        // TODO Having so many specified headers here is not really
-        // thaaaat good
-        http_response_add_header(res,
-              "Access-Control-Allow-Headers", "Content-Type, "
-              "Cache-Control, Accept, X-Requested-With");
-        http_response_sendf(res, "OK");
-        http_response_destroy(res);
+  // Refuse bodies that will not fit before receiving them, and allocate
+  // room for the others at once
+  const char *length = http_request_get_header(req, "Content-Length");
+  if (is_buffered(lrreq) && length) {
+     unsigned long long n = strtoull(length, NULL, 10);
+     if (n > service->buffer_max) {
+        entity_too_large(req);
         return 1;
-        break;
-     default:
-        return 0;
-        break;
+     }
+     if (n > 0 && buffer_reserve(lrreq, n + 1)) return 1;
+  }
+
+#ifdef LR_ORIGIN
+  // Preflight requests are answered from the methods rendered when the
+  // service was registered
+  if (http_request_get_method(req) == HTTP_OPTIONS) {
+     const struct lr_header headers[] = {
+        { "Access-Control-Allow-Methods", service->allow_methods },
+        { "Access-Control-Allow-Headers", LR_ORIGIN_HEADERS },
+        { "Access-Control-Max-Age", LR_ORIGIN_MAX_AGE },
+        LR_HEADERS_END
+     };
+     lr_sendf_headers(lrreq, WS_HTTP_200, headers, "OK");
+     return 1;
   }
 #endif
 
-        return 0;
+  return 0;
 }
 
 static int on_body(struct httpws *ins, struct http_request *req,
@@ -216,40 +991,46 @@ static int on_body(struct httpws *ins, struct http_request *req,
                    const char* chunk, size_t len)
 {
   struct lr_request *lrreq = *req_data;
-  struct lr_service *service = lrreq->service;
-
-  switch(http_request_get_method(req))
-  {
-    case HTTP_GET:
-      return service->on_get(service->srv_data, &lrreq->data, lrreq, chunk, len);
-
-    case HTTP_DELETE:
-      return service->on_delete(service->srv_data, &lrreq->data, lrreq, chunk, len);
+  size_t max = lrreq->service->buffer_max;
 
-    case HTTP_POST:
-      return service->on_post(service->srv_data, &lrreq->data, lrreq, chunk, len);
+  // Shared responses are sent without the service
+  if (lrreq->shared) return 0;
 
-    case HTTP_PUT:
-      return service->on_put(service->srv_data, &lrreq->data, lrreq, chunk, len);
+  if (!is_buffered(lrreq)) return call_service(lrreq, chunk, len, 0);
 
-    default:
-      return 1;
+  if (len > max - lrreq->buf_len) {
+     entity_too_large(req);
+     return 1;
   }
+  if (buffer_reserve(lrreq, lrreq->buf_len + len + 1)) return 1;
+  memcpy(lrreq->buf + lrreq->buf_len, chunk, len);
+  lrreq->buf_len += len;
+  lrreq->buf[lrreq->buf_len] = '\0';
+
+  return 0;
 }
 
 static int on_cmpl(struct httpws *ins, struct http_request *req, void* ws_ctx, void** req_data)
 {
-  return on_body(ins, req, ws_ctx, req_data, NULL, 0);
+  struct lr_request *lrreq = *req_data;
+
+  // Waiters are answered when the leader sends its response
+  lrreq->complete = 1;
+  if (lrreq->shared) {
+     serve_shared(lrreq);
+     return 0;
+  }
+
+  return call_service_complete(lrreq);
 }
 
-static int on_destroy(struct httpws *ins, struct http_request *req, void* ws_ctx, void** req_data)
+/// Let the service clean up after a request, and destroy it
+static int request_release(struct lr_request *lrreq)
 {
-   int rc = 0;
-   if (*req_data == NULL) return 0;
-   struct lr_request *lrreq = *req_data;
    struct lr_service *service = lrreq->service;
+   int rc = 0;
 
-   if (service->on_destroy != NULL)
+   if (service->on_destroy != NULL && !lrreq->shared)
       rc = service->on_destroy(service->srv_data, &lrreq->data, lrreq);
 
    lr_request_destroy(lrreq);
@@ -257,6 +1038,84 @@ static int on_destroy(struct httpws *ins, struct http_request *req, void* ws_ctx
    return rc;
 }
 
+static int on_destroy(struct httpws *ins, struct http_request *req, void* ws_ctx, void** req_data)
+{
+   if (*req_data == NULL) return 0;
+   struct lr_request *lrreq = *req_data;
+
+   // Pending requests are released once they are completed. Until then
+   // they are only kept for the one completing them
+   if (lrreq->pending) {
+      lr_request_detach(lrreq);
+      lrreq->req = NULL;
+      return 0;
+   }
+
+   return request_release(lrreq);
+}
+
+/**
+ * Finish a pending request on the loop
+ *
+ * Sends the completion of the request, or calls the service again to
+ * answer it. Requests whose connection is gone are released instead.
+ */
+static void request_done(struct lr_request *lrreq)
+{
+   lrreq->pending = 0;
+
+   if (lrreq->req == NULL) {
+      request_release(lrreq);
+      return;
+   }
+
+   if (lrreq->resume) {
+      lrreq->resume = 0;
+      call_service(lrreq, NULL, 0, 1);
+      return;
+   }
+
+   lr_sendf(lrreq, lrreq->status, lrreq->headers, "%s",
+            lrreq->body ? lrreq->body : "");
+   if (lrreq->headers) lm_destroy(lrreq->headers);
+   free(lrreq->body);
+   lrreq->headers = NULL;
+   lrreq->body = NULL;
+}
+
+static void on_done(struct ev_loop *loop, struct ev_async *watcher,
+                    int revents)
+{
+   struct lr *ins = watcher->data;
+   struct lr_request *lrreq, *done;
+
+   pthread_mutex_lock(&ins->done_lock);
+   done = ins->done;
+   ins->done = NULL;
+   ins->done_tail = &ins->done;
+   pthread_mutex_unlock(&ins->done_lock);
+
+   while ((lrreq = done) != NULL) {
+      done = lrreq->done_next;
+      lrreq->done_next = NULL;
+      request_done(lrreq);
+   }
+}
+
+/// Queue a pending request to be finished on the loop, from any thread
+static void request_queue_done(struct lr_request *lrreq)
+{
+   struct lr *ins = lrreq->ins;
+
+   pthread_mutex_lock(&ins->done_lock);
+   lrreq->done_next = NULL;
+   *ins->done_tail = lrreq;
+   ins->done_tail = &lrreq->done_next;
+   pthread_mutex_unlock(&ins->done_lock);
+
+   ev_async_send(ins->loop, &ins->done_watcher);
+}
+
 struct lr *lr_create(struct lr_settings *settings, struct ev_loop *loop)
 {
    struct lr *ins = malloc(sizeof(struct lr));
@@ -265,7 +1124,34 @@ struct lr *lr_create(struct lr_settings *settings, struct ev_loop *loop)
       return NULL;
    }
 
-   ins->trie = trie_create();
+   ins->table = malloc(sizeof(struct lr_table));
+   if (ins->table == NULL) {
+      fprintf(stderr, "Cannot allocate lr instance\n");
+      free(ins);
+      return NULL;
+   }
+   ins->table->services = rt_create();
+   ins->table->routes = NULL;
+   ins->table->next = NULL;
+   ins->epoch = 0;
+   ins->readers[0] = 0;
+   ins->readers[1] = 0;
+   ins->retired = NULL;
+   pthread_mutex_init(&ins->write_lock, NULL);
+   ins->cache = lrc_create(settings->cache_size);
+   ins->flights = rt_create();
+   ins->limits = settings->limit_size ? lrl_create(settings->limit_size)
+                                      : NULL;
+   ins->next_id = 0;
+   ins->stats = NULL;
+   ins->closing = 0;
+   ins->loop = loop;
+   ins->send_window = settings->send_window;
+   ev_async_init(&ins->done_watcher, on_done);
+   ins->done_watcher.data = ins;
+   pthread_mutex_init(&ins->done_lock, NULL);
+   ins->done = NULL;
+   ins->done_tail = &ins->done;
 
    struct httpws_settings ws_set = HTTPWS_SETTINGS_DEFAULT;
    ws_set.port = settings->port;
@@ -282,16 +1168,34 @@ struct lr *lr_create(struct lr_settings *settings, struct ev_loop *loop)
    return ins;
 }
 
-void free_service(void *element)
-{
-	free(element);
-}
-
 void lr_destroy(struct lr *ins)
 {
+   struct lr_table *table;
+   struct lr_stats *stats;
+
    if(ins != NULL) {
+      ins->closing = 1;
+      ev_async_stop(ins->loop, &ins->done_watcher);
       httpws_destroy(ins->webserver);
-      trie_destroy(ins->trie, free_service);
+      // Requests completed after their connection closed
+      on_done(ins->loop, &ins->done_watcher, 0);
+      pthread_mutex_destroy(&ins->done_lock);
+      lrc_destroy(ins->cache);
+      rt_destroy(ins->flights, NULL);
+      lrl_destroy(ins->limits);
+      while ((stats = ins->stats) != NULL) {
+         ins->stats = stats->next;
+         free(stats->url);
+         free(stats);
+      }
+
+      // No readers are left
+      table_free(ins->table);
+      while ((table = ins->retired) != NULL) {
+         ins->retired = table->next;
+         table_free(table);
+      }
+      pthread_mutex_destroy(&ins->write_lock);
 
       free(ins);
    }
@@ -299,15 +1203,113 @@ void lr_destroy(struct lr *ins)
 
 int lr_start(struct lr *ins)
 {
-  if(ins)
+  if(ins) {
+    ev_async_start(ins->loop, &ins->done_watcher);
     return httpws_start(ins->webserver);
+  }
   return 1;
 }
 
 void lr_stop(struct lr *ins)
 {
-  if(ins)
+  if(ins) {
+    ev_async_stop(ins->loop, &ins->done_watcher);
     httpws_stop(ins->webserver);
+  }
+}
+
+/**
+ * Add a pattern route after the existing ones
+ *
+ * \return 0 on success, 1 if the pattern is malformed, already
+ *         registered, or on memory errors
+ */
+static int register_route(struct lr_table *table, const char *pattern,
+                          struct lr_service *service)
+{
+   struct lr_route *route, **tail;
+   const char *c;
+
+   // Every '{' must be closed, and name a parameter
+   for (c = strchr(pattern, '{'); c != NULL; c = strchr(c, '{')) {
+      c++;
+      if (*c == '}' || c[strcspn(c, "{}/")] != '}') {
+         fprintf(stderr, "Malformed route pattern '%s'\n", pattern);
+         return 1;
+      }
+   }
+
+   for (tail = &table->routes; *tail != NULL; tail = &(*tail)->next)
+      if (strcmp((*tail)->pattern, pattern) == 0)
+         return 1;
+
+   route = malloc(sizeof(struct lr_route));
+   if (route == NULL) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return 1;
+   }
+   route->pattern = malloc((strlen(pattern)+1)*sizeof(char));
+   if (route->pattern == NULL) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      free(route);
+      return 1;
+   }
+   strcpy(route->pattern, pattern);
+   route->service = service;
+   route->next = NULL;
+   *tail = route;
+
+   return 0;
+}
+
+#ifdef LR_ORIGIN
+/// Render the Access-Control-Allow-Methods value of a service
+static void render_allow_methods(struct lr_service *service)
+{
+   char *methods = service->allow_methods;
+
+   methods[0] = '\0';
+   if (service->on_get != NULL)
+      strcat(methods, "GET");
+   if (service->on_delete != NULL) {
+      if (methods[0]) strcat(methods, ", ");
+      strcat(methods, "DELETE");
+   }
+   if (service->on_post != NULL) {
+      if (methods[0]) strcat(methods, ", ");
+      strcat(methods, "POST");
+   }
+   if (service->on_put != NULL) {
+      if (methods[0]) strcat(methods, ", ");
+      strcat(methods, "PUT");
+   }
+}
+#endif
+
+/**
+ * Get the timings of a url, under the write lock
+ *
+ * A url registered again gets the timings it had before.
+ *
+ * \return The timings, or NULL if out of memory
+ */
+static struct lr_stats *stats_get(struct lr *ins, const char *url)
+{
+   struct lr_stats *stats;
+
+   for (stats = ins->stats; stats != NULL; stats = stats->next)
+      if (strcmp(stats->url, url) == 0) return stats;
+
+   stats = calloc(1, sizeof(struct lr_stats));
+   if (stats == NULL || (stats->url = strdup(url)) == NULL) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      free(stats);
+      return NULL;
+   }
+   stats->next = ins->stats;
+   __atomic_store_n(&ins->stats, stats, __ATOMIC_RELEASE);
+
+   return stats;
 }
 
 int lr_register_service(struct lr *ins,
@@ -320,6 +1322,8 @@ int lr_register_service(struct lr *ins,
                          void *srv_data)
 {
    struct lr_service *service = malloc(sizeof(struct lr_service));
+   struct lr_table *table;
+   int rc;
 
    if (service == NULL) {
       fprintf(stderr, "Not enough memory to allocate service\n");
@@ -332,31 +1336,272 @@ int lr_register_service(struct lr *ins,
    service->on_delete = on_delete;
    service->on_destroy = on_destroy;
    service->srv_data = srv_data;
+   service->cache_ttl = 0;
+   service->coalesce = 0;
+   service->vary = NULL;
+   service->buffer_max = 0;
+   service->limit_rate = 0;
+   service->limit_burst = 0;
+   service->stats = NULL;
+   service->refs = 1;
+#ifdef LR_ORIGIN
+   render_allow_methods(service);
+#endif
 
-   struct trie_iter* iter = trie_insert(ins->trie, url, service);
-
-   if(iter == NULL){
+   pthread_mutex_lock(&ins->write_lock);
+   table = table_copy(ins->table);
+   if (table == NULL) {
+      pthread_mutex_unlock(&ins->write_lock);
+      free(service);
       return 1;
    }
 
-   return 0;
+   if (strchr(url, '{') != NULL)
+      rc = register_route(table, url, service);
+   else
+      rc = rt_insert(table->services, url, service);
+
+   // Bucket ids are never reused, so a new service starts afresh
+   service->id = ++ins->next_id;
+   // Timing is left out if out of memory
+   if (!rc) service->stats = stats_get(ins, url);
+   if (rc) {
+      table_free(table);
+      free(service);
+   } else {
+      table_publish(ins, table);
+   }
+   pthread_mutex_unlock(&ins->write_lock);
+
+   return rc ? 1 : 0;
 }
 
 void *lr_unregister_service(struct lr *ins, const char *url)
 {
+   struct lr_service *service;
+   struct lr_route *route, **prev;
+   struct lr_table *table;
+   void *srv_data;
+
    printf("Unregistering service on '%s'\n", url);
-   struct lr_service *service = trie_remove(ins->trie, url);
-   void *srv_data = service->srv_data;
-   free(service);
+
+   pthread_mutex_lock(&ins->write_lock);
+   table = table_copy(ins->table);
+   if (table == NULL) {
+      pthread_mutex_unlock(&ins->write_lock);
+      return NULL;
+   }
+
+   if (strchr(url, '{') != NULL) {
+      service = NULL;
+      for (prev = &table->routes; *prev != NULL; prev = &(*prev)->next) {
+         route = *prev;
+         if (strcmp(route->pattern, url) == 0) {
+            *prev = route->next;
+            service = route->service;
+            free(route->pattern);
+            free(route);
+            break;
+         }
+      }
+   } else {
+      service = rt_remove(table->services, url);
+   }
+
+   if (!service) {
+      table_free(table);
+      pthread_mutex_unlock(&ins->write_lock);
+      return NULL;
+   }
+
+   // Older tables and requests may still hold the service
+   srv_data = service->srv_data;
+   service_unref(service);
+   table_publish(ins, table);
+   pthread_mutex_unlock(&ins->write_lock);
+
    return srv_data;
 }
 
 void *lr_lookup_service(struct lr *ins, char *url)
 {
-   struct trie_iter *iter = trie_lookup(ins->trie, url);
-   if (!iter) return NULL;
-   struct lr_service *srv = trie_value(iter);
-   return srv->srv_data;
+   unsigned long epoch;
+   struct lr_table *table = table_enter(ins, &epoch);
+   struct lr_service *srv = rt_lookup(table->services, url);
+   void *srv_data = NULL;
+
+   if (!srv) {
+      struct lr_route *route = route_find(table, url);
+      if (route) srv = route->service;
+   }
+   if (srv) srv_data = srv->srv_data;
+   table_leave(ins, epoch);
+
+   return srv_data;
+}
+
+#define UPDATE_CACHE    1  ///< Update cache_ttl and vary of the service
+#define UPDATE_COALESCE 2  ///< Update coalesce and vary of the service
+#define UPDATE_BUFFER   4  ///< Update buffer_max of the service
+#define UPDATE_LIMIT    8  ///< Update limit_rate and limit_burst
+
+/**
+ * Change the settings of a registered service
+ *
+ * Services are shared with older tables and requests, so the service
+ * is replaced by an updated copy.
+ *
+ * \param what     UPDATE_CACHE, UPDATE_COALESCE, UPDATE_BUFFER and/or
+ *                 UPDATE_LIMIT
+ * \param with     The new settings, only those in what are used
+ *
+ * \return 0 on success, 1 if url is not registered or out of memory
+ */
+static int service_update(struct lr *ins, const char *url, int what,
+                          const struct lr_service *with)
+{
+   struct lr_service *service, *old = NULL;
+   struct lr_route *route = NULL;
+   struct lr_table *table;
+   const char *args;
+   char *vary = NULL;
+
+   service = malloc(sizeof(struct lr_service));
+   if (service == NULL) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return 1;
+   }
+
+   pthread_mutex_lock(&ins->write_lock);
+   table = table_copy(ins->table);
+   if (table == NULL) goto error;
+
+   if (strchr(url, '{') != NULL) {
+      for (route = table->routes; route != NULL; route = route->next)
+         if (strcmp(route->pattern, url) == 0) break;
+      if (route) old = route->service;
+   } else {
+      old = rt_lookup(table->services, url);
+   }
+   if (old == NULL) {
+      table_free(table);
+      goto error;
+   }
+
+   // Settings not updated are kept
+   args = what & (UPDATE_CACHE | UPDATE_COALESCE) ? with->vary : old->vary;
+   if (args && (vary = strdup(args)) == NULL) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      table_free(table);
+      goto error;
+   }
+
+   *service = *old;
+   if (what & UPDATE_CACHE) service->cache_ttl = with->cache_ttl;
+   if (what & UPDATE_COALESCE) service->coalesce = with->coalesce;
+   if (what & UPDATE_BUFFER) service->buffer_max = with->buffer_max;
+   if (what & UPDATE_LIMIT) {
+      service->limit_rate = with->limit_rate;
+      service->limit_burst = with->limit_burst;
+   }
+   service->vary = vary;
+   service->refs = 1;
+
+   if (route) {
+      route->service = service;
+   } else {
+      rt_remove(table->services, url);
+      if (rt_insert(table->services, url, service)) {
+         rt_insert(table->services, url, old);
+         table_free(table);
+         goto error;
+      }
+   }
+
+   service_unref(old);
+   table_publish(ins, table);
+   pthread_mutex_unlock(&ins->write_lock);
+
+   return 0;
+
+error:
+   pthread_mutex_unlock(&ins->write_lock);
+   free(vary);
+   free(service);
+   return 1;
+}
+
+int lr_cache_service(struct lr *ins, const char *url,
+                     double ttl, const char *args)
+{
+   struct lr_service with = { .cache_ttl = ttl, .vary = (char *)args };
+
+   if (service_update(ins, url, UPDATE_CACHE, &with)) return 1;
+   lrc_invalidate(ins->cache, url);
+   return 0;
+}
+
+int lr_coalesce_service(struct lr *ins, const char *url,
+                        int enable, const char *args)
+{
+   struct lr_service with = { .coalesce = enable, .vary = (char *)args };
+
+   return service_update(ins, url, UPDATE_COALESCE, &with);
+}
+
+int lr_buffer_service(struct lr *ins, const char *url, size_t max)
+{
+   struct lr_service with = { .buffer_max = max };
+
+   return service_update(ins, url, UPDATE_BUFFER, &with);
+}
+
+int lr_limit_service(struct lr *ins, const char *url,
+                     double rate, double burst)
+{
+   struct lr_service with = { .limit_rate = rate, .limit_burst = burst };
+
+   return service_update(ins, url, UPDATE_LIMIT, &with);
+}
+
+void lr_cache_invalidate(struct lr *ins, const char *url)
+{
+   lrc_invalidate(ins->cache, url);
+}
+
+void lr_stats_map(struct lr *ins, lr_stats_cb cb, void *data)
+{
+   struct lr_stats *stats;
+
+   for (stats = __atomic_load_n(&ins->stats, __ATOMIC_ACQUIRE);
+        stats != NULL; stats = stats->next)
+      cb(data, stats->url, stats);
+}
+
+/// Histogram of a timing
+static const struct lrh *stats_timing(const struct lr_stats *stats,
+                                      enum lr_timing timing)
+{
+   switch (timing) {
+      case LR_TIMING_HANDLER:
+         return &stats->handler;
+      case LR_TIMING_FIRST_BYTE:
+         return &stats->first_byte;
+      default:
+         return &stats->total;
+   }
+}
+
+unsigned long lr_stats_count(const struct lr_stats *stats,
+                             enum lr_timing timing)
+{
+   return lrh_count(stats_timing(stats, timing));
+}
+
+double lr_stats_percentile(const struct lr_stats *stats,
+                           enum lr_timing timing, double percentile)
+{
+   return lrh_percentile(stats_timing(stats, timing), percentile) / 1e9;
 }
 
 void lr_sendf(struct lr_request *req,
@@ -374,6 +1619,14 @@ void lr_sendf(struct lr_request *req,
    va_end(arg);
 }
 
+static void cache_header(void *data,
+                         const char *key, const char *value)
+{
+   struct lrc_entry *entry = data;
+   // Failing to cache a header is not an error for the response
+   lrc_entry_add_header(entry, key, value);
+}
+
 static void add_header(void *data,
                        const char *key, const char *value)
 {
@@ -382,22 +1635,79 @@ static void add_header(void *data,
    http_response_add_header(res, key, value);
 }
 
-void lr_send_start(struct lr_request *req,
-                   enum httpws_http_status_code status,
-                   struct lm *headers)
+/// Record the timings of a request, once its response has been sent
+static void request_timed(struct lr_request *req)
 {
-   //NOTE THAT POINTER SIZES ARE DIFFERENT ON 64BIT
-   //printf("%d  %s\n", (int)(req), __func__);
+   struct lr_stats *stats = req->service->stats;
+   uint64_t now;
+
+   if (stats == NULL || req->start == 0) return;
+
+   now = lrh_now();
+   // Shared responses are not made by the service
+   if (!req->shared) lrh_record(&stats->handler, req->handler);
+   lrh_record(&stats->first_byte,
+              (req->first_byte ? req->first_byte : now) - req->start);
+   lrh_record(&stats->total, now - req->start);
+   req->start = 0;
+}
+
+/// Create the response of a request, before its own headers are added
+static void response_create(struct lr_request *req,
+                            enum httpws_http_status_code status)
+{
+   if (req->first_byte == 0) req->first_byte = lrh_now();
    req->res = http_response_create(req->req, status);
+   if (req->fill)
+      lrc_entry_set_status(req->fill, status);
    // TODO Consider headers to add
 #ifdef LR_ORIGIN
         http_response_add_header(req->res,
               "Access-Control-Allow-Origin",
               "*");
 #endif
+}
+
+void lr_send_start(struct lr_request *req,
+                   enum httpws_http_status_code status,
+                   struct lm *headers)
+{
+   //NOTE THAT POINTER SIZES ARE DIFFERENT ON 64BIT
+   //printf("%d  %s\n", (int)(req), __func__);
+   response_create(req, status);
+   if (req->fill)
+      lm_map(headers, cache_header, req->fill);
    lm_map(headers, add_header, req->res);
 }
 
+void lr_send_start_headers(struct lr_request *req,
+                           enum httpws_http_status_code status,
+                           const struct lr_header *headers)
+{
+   const struct lr_header *header;
+
+   response_create(req, status);
+   for (header = headers; header && header->name; header++) {
+      if (req->fill)
+         cache_header(req->fill, header->name, header->value);
+      add_header(req->res, header->name, header->value);
+   }
+}
+
+void lr_sendf_headers(struct lr_request *req,
+                      enum httpws_http_status_code status,
+                      const struct lr_header *headers,
+                      const char *fmt, ...)
+{
+   va_list arg;
+
+   va_start(arg, fmt);
+   lr_send_start_headers(req, status, headers);
+   lr_send_vchunkf(req, fmt, arg);
+   lr_send_stop(req);
+   va_end(arg);
+}
+
 int lr_send_add_cookie(struct lr_request *req,
                        const char *field, const char *value,
                        const char *expires, const char *max_age,
@@ -430,6 +1740,10 @@ void lr_send_vchunkf(struct lr_request *req, const char *fmt, va_list arg)
 {
    //NOTE THAT POINTER SIZES ARE DIFFERENT ON 64BIT
    //printf("%d  %s\n", (int)(req), __func__);
+   if (req->fill && lrc_entry_vappendf(req->fill, fmt, arg)) {
+      lrc_entry_release(req->fill);
+      req->fill = NULL;
+   }
    http_response_vsendf(req->res, fmt, arg);
 }
 
@@ -439,6 +1753,49 @@ void lr_send_stop(struct lr_request *req)
    //printf("%d  %s\n", (int)(req), __func__);
    if (req->res)
       http_response_destroy(req->res);
+   request_timed(req);
+
+   if (req->flight) {
+      if (req->fill) flight_land(req);
+      else flight_abort(req);
+   }
+
+   // Only complete and successful responses are cached
+   if (req->fill) {
+      if (req->service->cache_ttl > 0 &&
+          lrc_entry_get_status(req->fill) == WS_HTTP_200)
+         lrc_insert(req->ins->cache, req->fill);
+      else
+         lrc_entry_release(req->fill);
+      req->fill = NULL;
+   }
+
+   // A pending write may have changed the state after the invalidation
+   // when it arrived, so GETs since then may have cached the old one
+   if ((req->service->cache_ttl > 0 || req->service->coalesce) &&
+       is_write(req->req))
+      lrc_invalidate(req->ins->cache, lr_request_get_url(req));
+}
+
+void lr_send_produce(struct lr_request *req,
+                     enum httpws_http_status_code status,
+                     struct lm *headers,
+                     lr_produce_cb produce, void *data)
+{
+   // Keeping the body for others would hold it in memory in full
+   if (req->fill) {
+      lrc_entry_release(req->fill);
+      req->fill = NULL;
+   }
+
+   lr_send_start(req, status, headers);
+   if (req->res) {
+      http_response_produce(req->res, req->ins->send_window,
+                            produce, data);
+      // Finished by http-webserver, when the body has been produced
+      req->res = NULL;
+   }
+   lr_send_stop(req);
 }
 
 enum http_method lr_request_get_method(struct lr_request *req)
@@ -486,7 +1843,150 @@ const char *lr_request_get_ip(struct lr_request *req)
    return http_request_get_ip(req->req);
 }
 
+struct lm *lr_request_get_params(struct lr_request *req)
+{
+   return req->params;
+}
+
+const char *lr_request_get_param(struct lr_request *req, const char* key)
+{
+   return lm_find(req->params, key);
+}
+
 void lr_request_keep_open(struct lr_request *req)
 {
    http_request_keep_open(req->req);
 }
+
+static void copy_header(void *data,
+                        const char *key, const char *value)
+{
+   struct lm *headers = data;
+   // TODO Has a return value
+   lm_insert(headers, key, value);
+}
+
+void lr_request_complete(struct lr_request *req,
+                         enum httpws_http_status_code status,
+                         struct lm *headers, const char *fmt, ...)
+{
+   va_list arg;
+
+   va_start(arg, fmt);
+   lr_request_vcomplete(req, status, headers, fmt, arg);
+   va_end(arg);
+}
+
+void lr_request_vcomplete(struct lr_request *req,
+                          enum httpws_http_status_code status,
+                          struct lm *headers, const char *fmt,
+                          va_list arg)
+{
+   va_list arg_copy;
+   int len;
+
+   // Format now, as the arguments may not outlive the call
+   va_copy(arg_copy, arg);
+   len = vsnprintf(NULL, 0, fmt, arg_copy);
+   va_end(arg_copy);
+   if (len >= 0) req->body = malloc((len+1)*sizeof(char));
+   if (req->body) vsnprintf(req->body, len+1, fmt, arg);
+
+   if (headers) {
+      req->headers = lm_create();
+      if (req->headers) lm_map(headers, copy_header, req->headers);
+   }
+
+   if (req->body == NULL || (headers && req->headers == NULL)) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      status = WS_HTTP_500;
+   }
+   req->status = status;
+   request_queue_done(req);
+}
+
+void lr_request_resume(struct lr_request *req)
+{
+   req->resume = 1;
+   request_queue_done(req);
+}
+
+int lr_request_is_websocket(struct lr_request *req)
+{
+   return http_request_is_websocket(req->req);
+}
+
+static int on_ws_message(struct http_websocket *ws, void *ws_ctx,
+                         void **ws_data, int binary,
+                         const char *msg, size_t len)
+{
+   struct lr_websocket *lrws = ws_ctx;
+   if (!lrws->on_message) return 0;
+   return lrws->on_message(lrws->srv_data, &lrws->data, lrws, msg, len);
+}
+
+static void on_ws_close(struct http_websocket *ws, void *ws_ctx,
+                        void **ws_data)
+{
+   struct lr_websocket *lrws = ws_ctx;
+   if (lrws->on_close)
+      lrws->on_close(lrws->srv_data, &lrws->data, lrws);
+   free(lrws);
+}
+
+struct lr_websocket *lr_request_websocket(struct lr_request *req,
+                                          lr_ws_data_cb on_message,
+                                          lr_ws_nodata_cb on_close,
+                                          void *ws_data)
+{
+   struct http_websocket_settings settings =
+      HTTP_WEBSOCKET_SETTINGS_DEFAULT;
+   struct lr_websocket *lrws = malloc(sizeof(struct lr_websocket));
+
+   if (lrws == NULL) {
+      fprintf(stderr, "Not enough memory to allocate websocket\n");
+      return NULL;
+   }
+
+   lrws->srv_data = req->service->srv_data;
+   lrws->on_message = on_message;
+   lrws->on_close = on_close;
+   lrws->data = ws_data;
+
+   settings.ws_ctx = lrws;
+   settings.on_message = on_ws_message;
+   settings.on_close = on_ws_close;
+
+   lrws->ws = http_websocket_accept(req->req, &settings, NULL);
+   if (lrws->ws == NULL) {
+      free(lrws);
+      return NULL;
+   }
+
+   return lrws;
+}
+
+int lr_websocket_sendf(struct lr_websocket *ws, const char *fmt, ...)
+{
+   int stat;
+   va_list arg;
+   va_start(arg, fmt);
+   stat = lr_websocket_vsendf(ws, fmt, arg);
+   va_end(arg);
+   return stat;
+}
+
+int lr_websocket_vsendf(struct lr_websocket *ws, const char *fmt, va_list arg)
+{
+   return http_websocket_vsendf(ws->ws, fmt, arg);
+}
+
+void lr_websocket_close(struct lr_websocket *ws)
+{
+   http_websocket_close(ws->ws, 1000);
+}
+
+const char *lr_websocket_get_ip(struct lr_websocket *ws)
+{
+   return http_websocket_get_ip(ws->ws);
+}
@@ -39,6 +39,7 @@
 #include <ev.h>
 #include <curl/curl.h>
 #include <pthread.h> 
+#include <unistd.h>
 
 static char *req_data = "Hello world";
 
@@ -146,8 +147,16 @@ static int basic_get_test(char *host, char* path, long code, char *body)
 }
 
 /// Test thread
+static void count_stats(void *data, const char *url,
+                        struct lr_stats *stats)
+{
+   if (strcmp(url, "/limit") == 0)
+      *(unsigned long *)data = lr_stats_count(stats, LR_TIMING_TOTAL);
+}
+
 static int test_thread()
 {
+   unsigned long count = 0;
    int ret = 0;
 	
    // Init
@@ -161,6 +170,35 @@ static int test_thread()
          405, "Method Not Allowed");
 	ret += basic_get_test("http://localhost:8080", "/devices",
          200, "PUT!");
+	ret += basic_get_test("http://localhost:8080", "/devices/lamp/1",
+         200, "lamp 1");
+	ret += basic_get_test("http://localhost:8080", "/devices/lamp/",
+         404, "Resource not found");
+	ret += basic_get_test("http://localhost:8080", "/devices/lamp/1/on",
+         404, "Resource not found");
+	ret += basic_get_test("http://localhost:8080", "/async/complete",
+         200, "ASYNC!");
+	ret += basic_get_test("http://localhost:8080", "/async/resume",
+         200, "RESUMED!");
+	ret += basic_get_test("http://localhost:8080", "/buffer/large",
+         200, "Hello world");
+	ret += basic_get_test("http://localhost:8080", "/buffer/small",
+         413, "Request Entity Too Large");
+	ret += basic_get_test("http://localhost:8080", "/produce",
+         200, "PRODUCED!");
+	ret += basic_get_test("http://localhost:8080", "/headers",
+         200, "<headers/>");
+	ret += basic_get_test("http://localhost:8080", "/limit",
+         200, "PUT!");
+	ret += basic_get_test("http://localhost:8080", "/limit",
+         429, "Too Many Requests");
+
+   // Only the request let through the limit is timed
+   lr_stats_map(ws, count_stats, &count);
+   if (count != 1) {
+      printf("Expected 1 timed request on /limit, got %lu\n", count);
+      ret++;
+   }
 
    // Check result
    if (ret) {
@@ -222,6 +260,17 @@ static int put_cb(void *srv_data, void **req_data,
    return 0;
 }
 
+static int param_cb(void *srv_data, void **req_data,
+                    struct lr_request *req, const char *body, size_t len)
+{
+   if (body == NULL) {
+      lr_sendf(req, WS_HTTP_200, NULL, "%s %s",
+               lr_request_get_param(req, "type"),
+               lr_request_get_param(req, "id"));
+   }
+   return 0;
+}
+
 static int delete_cb(void *srv_data, void **req_data,
                      struct lr_request *req, const char *body, size_t len)
 {
@@ -231,6 +280,89 @@ static int delete_cb(void *srv_data, void **req_data,
    return 0;
 }
 
+/// Answers a pending request from another thread
+static void *async_thread(void *arg)
+{
+   struct lr_request *req = arg;
+
+   usleep(10000);
+   if (strcmp(lr_request_get_url(req), "/async/resume") == 0)
+      lr_request_resume(req);
+   else
+      lr_request_complete(req, WS_HTTP_200, NULL, "ASYNC!");
+   return NULL;
+}
+
+static int async_cb(void *srv_data, void **req_data,
+                    struct lr_request *req, const char *body, size_t len)
+{
+   pthread_t thread;
+
+   if (body != NULL) return 0;
+
+   // Resumed
+   if (*req_data != NULL) {
+      lr_sendf(req, WS_HTTP_200, NULL, "RESUMED!");
+      return 0;
+   }
+
+   *req_data = req;
+   pthread_create(&thread, NULL, async_thread, req);
+   pthread_detach(thread);
+   return LR_PENDING;
+}
+
+/// Echoes the body, which is buffered in full
+static int buffer_cb(void *srv_data, void **req_data,
+                     struct lr_request *req, const char *body, size_t len)
+{
+   if (body != NULL && strlen(body) == len) {
+      lr_sendf(req, WS_HTTP_200, NULL, "%s", body);
+   }
+   return 0;
+}
+
+/// Produces the body a byte at a time, to wait for the client each time
+static size_t produce(void *data, char *buf, size_t cap)
+{
+   const char **body = data;
+
+   if (**body == '\0') return 0;
+   *buf = **body;
+   (*body)++;
+   return 1;
+}
+
+static int produce_cb(void *srv_data, void **req_data,
+                      struct lr_request *req, const char *body, size_t len)
+{
+   const char **str;
+
+   if (body != NULL) return 0;
+
+   str = malloc(sizeof(const char *));
+   *str = "PRODUCED!";
+   *req_data = str;
+   lr_send_produce(req, WS_HTTP_200, NULL, produce, str);
+   return 0;
+}
+
+static int produce_destroy_cb(void *srv_data, void **req_data,
+                              struct lr_request *req)
+{
+   free(*req_data);
+   return 0;
+}
+
+static int headers_cb(void *srv_data, void **req_data,
+                      struct lr_request *req, const char *body, size_t len)
+{
+   if (body == NULL) {
+      lr_sendf_headers(req, WS_HTTP_200, lr_headers_xml, "<headers/>");
+   }
+   return 0;
+}
+
 /// Webserver thread
 static void *webserver_thread(void *arg)
 {
@@ -261,6 +393,24 @@ static void *webserver_thread(void *arg)
    lr_register_service(ws, "/devices",
                        get_cb, post_cb, put_cb, delete_cb,
                        NULL, NULL);
+   lr_register_service(ws, "/devices/{type}/{id}",
+                       NULL, NULL, param_cb, NULL, NULL, NULL);
+   lr_register_service(ws, "/async/{how}",
+                       NULL, NULL, async_cb, NULL, NULL, NULL);
+   lr_register_service(ws, "/buffer/large",
+                       NULL, NULL, buffer_cb, NULL, NULL, NULL);
+   lr_buffer_service(ws, "/buffer/large", 64);
+   lr_register_service(ws, "/buffer/small",
+                       NULL, NULL, buffer_cb, NULL, NULL, NULL);
+   lr_buffer_service(ws, "/buffer/small", 4);
+   lr_register_service(ws, "/produce",
+                       NULL, NULL, produce_cb, NULL,
+                       produce_destroy_cb, NULL);
+   lr_register_service(ws, "/headers",
+                       NULL, NULL, headers_cb, NULL, NULL, NULL);
+   lr_register_service(ws, "/limit",
+                       NULL, NULL, put_cb, NULL, NULL, NULL);
+   lr_limit_service(ws, "/limit", 0.01, 1);
    lr_start(ws);
 
    // Start the event loop and webserver
@@ -0,0 +1,192 @@
+// limit.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+ *   
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *  
+ *  The views and conclusions contained in the software and
+ *  documentation are those of the authors and should not be interpreted
+ *  as representing official policies, either expressed.
+ */
+
+#include "limit.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/// Longest client address kept, that of an IPv6 address
+#define CLIENT_SIZE 46
+
+/// The tokens of a client on a route
+struct lrl_bucket {
+   unsigned long route;       ///< Route of the bucket, 0 if unused
+   char client[CLIENT_SIZE];  ///< Address of the client
+   double tokens;             ///< Tokens left at stamp
+   double stamp;              ///< Time tokens were counted at
+   struct lrl_bucket *chain;  ///< Next bucket in the same slot
+   struct lrl_bucket **link;  ///< Pointer to this bucket in its slot
+   struct lrl_bucket *prev;   ///< More recently used
+   struct lrl_bucket *next;   ///< Less recently used
+};
+
+struct lrl {
+   struct lrl_bucket *buckets;   ///< All buckets, used or not
+   struct lrl_bucket **slots;    ///< Hash table of used buckets
+   size_t mask;                  ///< Number of slots minus one
+   struct lrl_bucket *head;      ///< Most recently used
+   struct lrl_bucket *tail;      ///< Least recently used, or unused
+};
+
+/// FNV-1a hash of a route and client
+static size_t hash(unsigned long route, const char *client)
+{
+   size_t h = 2166136261u;
+
+   for (; *client; client++) h = (h ^ (unsigned char)*client) * 16777619u;
+   return (h ^ route) * 16777619u;
+}
+
+static void lru_remove(struct lrl *limits, struct lrl_bucket *b)
+{
+   if (b->prev) b->prev->next = b->next;
+   else limits->head = b->next;
+   if (b->next) b->next->prev = b->prev;
+   else limits->tail = b->prev;
+}
+
+static void lru_push(struct lrl *limits, struct lrl_bucket *b)
+{
+   b->prev = NULL;
+   b->next = limits->head;
+   if (limits->head) limits->head->prev = b;
+   else limits->tail = b;
+   limits->head = b;
+}
+
+/**
+ * Create a table of buckets
+ *
+ * \param size  Number of buckets, i.e. clients on routes tracked
+ *
+ * \return The table, or NULL on memory errors
+ */
+struct lrl *lrl_create(size_t size)
+{
+   struct lrl *limits;
+   size_t slots = 1, i;
+
+   if (size == 0) size = 1;
+   // Twice as many slots as buckets keeps the chains short
+   while (slots < 2 * size) slots *= 2;
+
+   limits = malloc(sizeof(struct lrl));
+   if (limits == NULL) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return NULL;
+   }
+   limits->buckets = calloc(size, sizeof(struct lrl_bucket));
+   limits->slots = calloc(slots, sizeof(struct lrl_bucket *));
+   if (limits->buckets == NULL || limits->slots == NULL) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      lrl_destroy(limits);
+      return NULL;
+   }
+   limits->mask = slots - 1;
+   limits->head = NULL;
+   limits->tail = NULL;
+   for (i = 0; i < size; i++) lru_push(limits, &limits->buckets[i]);
+
+   return limits;
+}
+
+void lrl_destroy(struct lrl *limits)
+{
+   if (limits == NULL) return;
+   free(limits->buckets);
+   free(limits->slots);
+   free(limits);
+}
+
+/**
+ * Take a token from the bucket of a client on a route
+ *
+ * The bucket holds at most burst tokens, and gains rate tokens per
+ * second. New clients start with a full bucket. rate and burst may
+ * change between calls, and apply from the call on.
+ *
+ * \param route   Identifier of the route, not 0
+ * \param client  Address of the client
+ * \param rate    Tokens per second, more than 0
+ * \param burst   Tokens the bucket holds, at least 1 is used
+ * \param now     Current time in seconds
+ *
+ * \return 0 if a token was taken, or else the seconds until one is
+ *         available
+ */
+double lrl_take(struct lrl *limits, unsigned long route, const char *client,
+                double rate, double burst, double now)
+{
+   struct lrl_bucket **slot = &limits->slots[hash(route, client) &
+                                             limits->mask];
+   struct lrl_bucket *b;
+
+   if (burst < 1) burst = 1;
+
+   for (b = *slot; b != NULL; b = b->chain)
+      if (b->route == route && strcmp(b->client, client) == 0) break;
+
+   if (b == NULL) {
+      // Forget the least recently seen client
+      b = limits->tail;
+      if (b->route) {
+         *b->link = b->chain;
+         if (b->chain) b->chain->link = b->link;
+      }
+      b->route = route;
+      strncpy(b->client, client, CLIENT_SIZE - 1);
+      b->client[CLIENT_SIZE - 1] = '\0';
+      b->tokens = burst;
+      b->stamp = now;
+      b->chain = *slot;
+      if (b->chain) b->chain->link = &b->chain;
+      b->link = slot;
+      *slot = b;
+   }
+   lru_remove(limits, b);
+   lru_push(limits, b);
+
+   if (now > b->stamp) {
+      b->tokens += (now - b->stamp) * rate;
+      b->stamp = now;
+   }
+   if (b->tokens > burst) b->tokens = burst;
+
+   if (b->tokens >= 1) {
+      b->tokens -= 1;
+      return 0;
+   }
+   return (1 - b->tokens) / rate;
+}
@@ -0,0 +1,107 @@
+// limit_test.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+ *   
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *  
+ *  The views and conclusions contained in the software and
+ *  documentation are those of the authors and should not be interpreted
+ *  as representing official policies, either expressed.
+ */
+
+#include "limit.c"
+#include "unit_test.h"
+
+TEST_START("limit.c")
+
+TEST(burst_refill)
+   struct lrl *limits = lrl_create(8);
+
+   // A full bucket of 3, refilled at 2 per second
+   ASSERT_EQUAL(lrl_take(limits, 1, "10.0.0.1", 2, 3, 100.0), 0);
+   ASSERT_EQUAL(lrl_take(limits, 1, "10.0.0.1", 2, 3, 100.0), 0);
+   ASSERT_EQUAL(lrl_take(limits, 1, "10.0.0.1", 2, 3, 100.0), 0);
+   ASSERT_EQUAL(lrl_take(limits, 1, "10.0.0.1", 2, 3, 100.0), 0.5);
+
+   // Other clients and routes have their own buckets
+   ASSERT_EQUAL(lrl_take(limits, 1, "10.0.0.2", 2, 3, 100.0), 0);
+   ASSERT_EQUAL(lrl_take(limits, 2, "10.0.0.1", 2, 3, 100.0), 0);
+
+   ASSERT_EQUAL(lrl_take(limits, 1, "10.0.0.1", 2, 3, 100.5), 0);
+   ASSERT_EQUAL(lrl_take(limits, 1, "10.0.0.1", 2, 3, 100.5), 0.5);
+
+   // Never more than burst tokens
+   ASSERT_EQUAL(lrl_take(limits, 1, "10.0.0.1", 2, 3, 200.0), 0);
+   ASSERT_EQUAL(lrl_take(limits, 1, "10.0.0.1", 2, 3, 200.0), 0);
+   ASSERT_EQUAL(lrl_take(limits, 1, "10.0.0.1", 2, 3, 200.0), 0);
+   ASSERT(lrl_take(limits, 1, "10.0.0.1", 2, 3, 200.0) == 0);
+
+   lrl_destroy(limits);
+TSET()
+
+TEST(change_limits)
+   struct lrl *limits = lrl_create(8);
+
+   ASSERT_EQUAL(lrl_take(limits, 1, "::1", 1, 1, 10.0), 0);
+   ASSERT_EQUAL(lrl_take(limits, 1, "::1", 1, 1, 10.0), 1);
+
+   // A higher rate applies to the time since the last request
+   ASSERT_EQUAL(lrl_take(limits, 1, "::1", 4, 1, 10.25), 0);
+   ASSERT_EQUAL(lrl_take(limits, 1, "::1", 4, 1, 10.25), 0.25);
+
+   // A lower burst cuts the tokens left
+   ASSERT_EQUAL(lrl_take(limits, 1, "::1", 4, 10, 20.0), 0);
+   ASSERT_EQUAL(lrl_take(limits, 1, "::1", 4, 2, 20.0), 0);
+   ASSERT_EQUAL(lrl_take(limits, 1, "::1", 4, 2, 20.0), 0);
+   ASSERT(lrl_take(limits, 1, "::1", 4, 2, 20.0) == 0);
+
+   lrl_destroy(limits);
+TSET()
+
+TEST(lru_eviction)
+   struct lrl *limits = lrl_create(2);
+   char client[16];
+   int i;
+
+   ASSERT_EQUAL(lrl_take(limits, 1, "a", 1, 1, 0.0), 0);
+   ASSERT_EQUAL(lrl_take(limits, 1, "b", 1, 1, 0.0), 0);
+   ASSERT(lrl_take(limits, 1, "a", 1, 1, 0.0) == 0);
+
+   // c takes the bucket of b, used less recently than a
+   ASSERT_EQUAL(lrl_take(limits, 1, "c", 1, 1, 0.0), 0);
+   ASSERT(lrl_take(limits, 1, "a", 1, 1, 0.0) == 0);
+   ASSERT_EQUAL(lrl_take(limits, 1, "b", 1, 1, 0.0), 0);
+
+   // Many clients through a small table
+   for (i = 0; i < 1000; i++) {
+      sprintf(client, "10.0.%d.%d", i / 256, i % 256);
+      ASSERT_EQUAL(lrl_take(limits, i % 3 + 1, client, 1, 1, 0.0), 0);
+   }
+   ASSERT_EQUAL(lrl_take(limits, 1, "a", 1, 1, 0.0), 0);
+
+   lrl_destroy(limits);
+TSET()
+
+TEST_END()
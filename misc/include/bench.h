@@ -0,0 +1,65 @@
+// bench.h
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+ *   
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *  
+ *  The views and conclusions contained in the software and
+ *  documentation are those of the authors and should not be interpreted
+ *  as representing official policies, either expressed.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stddef.h>
+
+/// Runs n operations of a benchmark
+typedef void (*bench_fn)(void *data, size_t n);
+
+/// Micro-benchmarks
+/**
+ *  A benchmark is a function running a given number of operations. It
+ *  is first run with growing numbers of operations, until it takes the
+ *  minimum time, which warms caches and sizes the repetitions. It is
+ *  then repeated with that number, and the median repetition reported
+ *  in ns/op and ops/s, with the heap allocations made per operation.
+ *  Allocations are counted by replacing malloc, calloc and realloc for
+ *  the whole program, which only works with glibc.
+ *
+ *  The arguments of bench_init are those of the program:
+ *    -r N       Repetitions, 5 by default
+ *    -t SEC     Minimum time of a repetition, 0.1 by default
+ *    -j FILE    Also write the results as JSON to FILE, - for stdout
+ *    NAME       Only run benchmarks whose name contain NAME
+ */
+void bench_init(const char *suite, int argc, char **argv);
+void bench_run(const char *name, bench_fn fn, void *data);
+int bench_finish(void);
+
+/// Keeps a result from being optimised away
+void bench_use(const void *result);
+
+#endif
@@ -35,6 +35,71 @@
 #define LINKED_LIST_H
 
 #include <stdlib.h>
+#include <stddef.h>
+
+// Intrusive lists
+//
+// The links are embedded in the elements, so inserting and removing
+// never allocates. A list is a circular list with its own link as
+// sentinel, and an element is found from its link with ll_link_entry.
+// Remove an element before it is freed
+
+struct ll_link {
+   struct ll_link *next;
+   struct ll_link *prev;
+};
+
+#define ll_link_init(LIST) \
+   { \
+      (LIST)->next = (LIST); \
+      (LIST)->prev = (LIST); \
+   }
+
+#define ll_link_empty(LIST) ((LIST)->next == (LIST))
+
+// Insert LINK after POS, which may be the list itself. The arguments
+// are evaluated more than once
+#define ll_link_insert(POS, LINK) \
+   { \
+      (LINK)->prev = (POS); \
+      (LINK)->next = (POS)->next; \
+      (POS)->next->prev = (LINK); \
+      (POS)->next = (LINK); \
+   }
+
+#define ll_link_append(LIST, LINK) \
+   { \
+      (LINK)->next = (LIST); \
+      (LINK)->prev = (LIST)->prev; \
+      (LIST)->prev->next = (LINK); \
+      (LIST)->prev = (LINK); \
+   }
+
+#define ll_link_remove(LINK) \
+   { \
+      (LINK)->prev->next = (LINK)->next; \
+      (LINK)->next->prev = (LINK)->prev; \
+      (LINK)->next = (LINK); \
+      (LINK)->prev = (LINK); \
+   }
+
+// The element of type TYPE holding LINK in its field MEMBER
+#define ll_link_entry(LINK, TYPE, MEMBER) \
+   ((TYPE *)((char *)(LINK) - offsetof(TYPE, MEMBER)))
+
+// Iterate over the links of LIST. NEXT is kept ahead, so the current
+// link may be removed
+#define ll_link_foreach(IT, NEXT, LIST) \
+   for (IT = (LIST)->next, NEXT = IT->next; \
+        IT != (LIST); \
+        IT = NEXT, NEXT = IT->next)
+
+// Lists of pointers
+//
+// Each element is held by an iterator. Iterators of removed elements
+// are kept in a pool of the list and reused by later inserts, so a list
+// only allocates when it grows beyond its size so far, or beyond what
+// was reserved with ll_reserve
 
 struct ll;
 struct ll_iter {
@@ -48,6 +113,7 @@ struct ll {
    struct ll_iter *head;
    struct ll_iter *last; // Last inserted element
    struct ll_iter *tail;
+   struct ll_iter *pool; // Unused iterators, linked by next
 };
 
 #define ll_create(LIST) \
@@ -56,25 +122,49 @@ struct ll {
       if (LIST) { \
          LIST->head = NULL; \
          LIST->tail = NULL; \
+         LIST->pool = NULL; \
       } \
    }
 
 #define ll_destroy(LIST) \
    { \
-      if (LIST->head != NULL) { \
-         while (LIST->head->next != NULL) { \
-            LIST->head = LIST->head->next; \
-            free(LIST->head->prev); \
-         } \
-         free(LIST->head); \
+      struct ll_iter *_ll_it; \
+      while ((_ll_it = LIST->head) != NULL) { \
+         LIST->head = _ll_it->next; \
+         free(_ll_it); \
+      } \
+      while ((_ll_it = LIST->pool) != NULL) { \
+         LIST->pool = _ll_it->next; \
+         free(_ll_it); \
       } \
       free(LIST); \
    }
 
+// Fill the pool of LIST up to N iterators. Iterators that cannot be
+// allocated now are allocated by the inserts needing them
+#define ll_reserve(LIST, N) \
+   { \
+      struct ll_iter *_ll_it; \
+      size_t _ll_n = 0; \
+      for (_ll_it = LIST->pool; _ll_it; _ll_it = _ll_it->next) \
+         _ll_n++; \
+      for (; _ll_n < (N); _ll_n++) { \
+         _ll_it = malloc(sizeof(struct ll_iter)); \
+         if (!_ll_it) break; \
+         _ll_it->next = LIST->pool; \
+         LIST->pool = _ll_it; \
+      } \
+   }
+
 #define ll_insert(LIST, ITER, DATA) \
    do { \
-      LIST->last = malloc(sizeof(struct ll_iter)); \
-      if (!LIST->last) break; \
+      if (LIST->pool) { \
+         LIST->last = LIST->pool; \
+         LIST->pool = LIST->pool->next; \
+      } else { \
+         LIST->last = malloc(sizeof(struct ll_iter)); \
+         if (!LIST->last) break; \
+      } \
       LIST->last->list = LIST; \
       LIST->last->data = DATA; \
       LIST->last->prev = ITER; \
@@ -106,7 +196,8 @@ struct ll {
          ITER->list->head = ITER->next; \
       if (ITER->list->tail == ITER) \
          ITER->list->tail = ITER->prev; \
-      free(ITER); \
+      ITER->next = ITER->list->pool; \
+      ITER->list->pool = ITER; \
    }
 
 #define ll_head(LIST) LIST->head
@@ -123,12 +214,3 @@ struct ll {
    }
 
 #endif
-
-
-
-
-
-
-
-
-
@@ -0,0 +1,65 @@
+// strpool.h
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+ *   
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *  
+ *  The views and conclusions contained in the software and
+ *  documentation are those of the authors and should not be interpreted
+ *  as representing official policies, either expressed.
+ */
+
+#ifndef STRPOOL_H
+#define STRPOOL_H
+
+#include <stddef.h>
+
+/// A pool of interned strings
+/**
+ *  Each distinct string is stored once, and counts the references to
+ *  it. Interned strings are compared by pointer, and must not be
+ *  modified. The pool is not thread safe.
+ */
+struct sp;
+
+struct sp *sp_create();
+void sp_destroy(struct sp *pool);
+
+/// Returns the interned copy of str, taking a reference, or NULL
+const char *sp_get(struct sp *pool, const char *str);
+const char *sp_get_n(struct sp *pool, const char *str, size_t len);
+
+/// Takes one more reference to an interned string
+const char *sp_ref(struct sp *pool, const char *str);
+
+/// Drops a reference, freeing the string with the last one
+void sp_put(struct sp *pool, const char *str);
+
+/// Returns the interned copy of str without taking a reference, or NULL
+const char *sp_find(struct sp *pool, const char *str);
+
+size_t sp_count(struct sp *pool); // Number of distinct strings
+
+#endif
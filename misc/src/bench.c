@@ -0,0 +1,249 @@
+// bench.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+ *   
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *  
+ *  The views and conclusions contained in the software and
+ *  documentation are those of the authors and should not be interpreted
+ *  as representing official policies, either expressed.
+ */
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_RESULTS 64
+#define MAX_REPETITIONS 101
+
+struct result {
+   const char *name;
+   size_t ops;          ///< Operations per repetition
+   int repetitions;
+   double ns_per_op;    ///< Median of the repetitions
+   double min_ns_per_op;
+   double allocs_per_op;
+   double bytes_per_op;
+};
+
+static const char *suite;
+static const char *filter = NULL;
+static const char *json = NULL;
+static int repetitions = 5;
+static double min_time = 0.1;
+static struct result results[MAX_RESULTS];
+static int n_results = 0;
+static const void *volatile sink;
+
+// Allocation counting
+static int counting = 0;
+static unsigned long allocs = 0;
+static unsigned long alloc_bytes = 0;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static void count(size_t size)
+{
+   if (__atomic_load_n(&counting, __ATOMIC_RELAXED)) {
+      __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+      __atomic_add_fetch(&alloc_bytes, size, __ATOMIC_RELAXED);
+   }
+}
+
+void *malloc(size_t size)
+{
+   count(size);
+   return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+   count(nmemb * size);
+   return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+   count(size);
+   return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+   __libc_free(ptr);
+}
+#define COUNTS_ALLOCS 1
+#else
+#define COUNTS_ALLOCS 0
+#endif
+
+static double now()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+   double x = *(const double *)a, y = *(const double *)b;
+   return x < y ? -1 : x > y;
+}
+
+void bench_init(const char *name, int argc, char **argv)
+{
+   int i;
+
+   suite = name;
+   for (i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+         repetitions = atoi(argv[++i]);
+         if (repetitions < 1) repetitions = 1;
+         if (repetitions > MAX_REPETITIONS) repetitions = MAX_REPETITIONS;
+      } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+         min_time = atof(argv[++i]);
+      } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+         json = argv[++i];
+      } else {
+         filter = argv[i];
+      }
+   }
+
+   printf("bench: %s, %d repetitions of at least %g s\n",
+          suite, repetitions, min_time);
+   printf("%-32s %12s %14s %10s %10s\n",
+          "benchmark", "ns/op", "ops/s", "allocs/op", "bytes/op");
+}
+
+void bench_run(const char *name, bench_fn fn, void *data)
+{
+   double times[MAX_REPETITIONS], t;
+   struct result *r;
+   size_t ops = 1;
+   int i;
+
+   if (filter && strstr(name, filter) == NULL) return;
+   if (n_results == MAX_RESULTS) {
+      fprintf(stderr, "bench: Too many benchmarks, skipping %s\n", name);
+      return;
+   }
+
+   // Warm up, and find how many operations take the minimum time
+   for (;;) {
+      t = now();
+      fn(data, ops);
+      t = now() - t;
+      if (t >= min_time) break;
+      ops *= t > min_time / 100 ? min_time / t * 1.2 + 1 : 100;
+   }
+
+   allocs = 0;
+   alloc_bytes = 0;
+   for (i = 0; i < repetitions; i++) {
+      __atomic_store_n(&counting, 1, __ATOMIC_RELAXED);
+      t = now();
+      fn(data, ops);
+      t = now() - t;
+      __atomic_store_n(&counting, 0, __ATOMIC_RELAXED);
+      times[i] = t * 1e9 / ops;
+   }
+   qsort(times, repetitions, sizeof(double), cmp_double);
+
+   r = &results[n_results++];
+   r->name = name;
+   r->ops = ops;
+   r->repetitions = repetitions;
+   r->ns_per_op = times[repetitions / 2];
+   r->min_ns_per_op = times[0];
+   r->allocs_per_op = (double)allocs / ops / repetitions;
+   r->bytes_per_op = (double)alloc_bytes / ops / repetitions;
+
+   printf("%-32s %12.1f %14.0f", r->name, r->ns_per_op, 1e9 / r->ns_per_op);
+   if (COUNTS_ALLOCS)
+      printf(" %10.2f %10.1f\n", r->allocs_per_op, r->bytes_per_op);
+   else
+      printf(" %10s %10s\n", "-", "-");
+   fflush(stdout);
+}
+
+/// Write the results as JSON
+static int write_json(FILE *f)
+{
+   struct result *r;
+   int i;
+
+   fprintf(f, "{\"suite\":\"%s\",\"benchmarks\":[", suite);
+   for (i = 0; i < n_results; i++) {
+      r = &results[i];
+      fprintf(f, "%s{\"name\":\"%s\",\"ops\":%zu,\"repetitions\":%d,"
+              "\"ns_per_op\":%.3f,\"min_ns_per_op\":%.3f,"
+              "\"ops_per_sec\":%.1f",
+              i ? "," : "", r->name, r->ops, r->repetitions,
+              r->ns_per_op, r->min_ns_per_op, 1e9 / r->ns_per_op);
+      if (COUNTS_ALLOCS)
+         fprintf(f, ",\"allocs_per_op\":%.4f,\"bytes_per_op\":%.2f}",
+                 r->allocs_per_op, r->bytes_per_op);
+      else
+         fprintf(f, ",\"allocs_per_op\":null,\"bytes_per_op\":null}");
+   }
+   fprintf(f, "]}\n");
+
+   return ferror(f);
+}
+
+/**
+ * Finish the benchmarks, writing the JSON results if asked for
+ *
+ * \return 0 on success, 1 if the results could not be written
+ */
+int bench_finish(void)
+{
+   FILE *f;
+   int rc;
+
+   if (json == NULL) return 0;
+   if (strcmp(json, "-") == 0) return write_json(stdout);
+
+   f = fopen(json, "w");
+   if (f == NULL) {
+      perror("bench: fopen");
+      return 1;
+   }
+   rc = write_json(f);
+   if (fclose(f)) rc = 1;
+   return rc ? 1 : 0;
+}
+
+void bench_use(const void *result)
+{
+   sink = result;
+}
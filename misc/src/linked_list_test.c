@@ -34,6 +34,11 @@
 #include "linked_list.h"
 #include "unit_test.h"
 
+struct elem {
+   int value;
+   struct ll_link link;
+};
+
 TEST_START("linked_list.h")
 
 TEST(create_destroy)
@@ -180,4 +185,71 @@ TEST(search)
    ll_destroy(list);
 TSET()
 
+TEST(pool)
+   struct ll *list;
+   struct ll_iter *it, *first;
+   int a = 1;
+   int b = 2;
+
+   ll_create(list);
+   ll_reserve(list, 2);
+   ASSERT_NOT_NULL(list->pool);
+
+   // Removed iterators are reused
+   ll_insert(list, ll_tail(list), &a);
+   first = ll_head(list);
+   ll_remove(first);
+   ASSERT_NULL(ll_head(list));
+   ASSERT_NULL(ll_tail(list));
+   ll_insert(list, ll_tail(list), &b);
+   it = ll_head(list);
+   ASSERT_EQUAL(it, first);
+   ASSERT_EQUAL(*(int *)ll_data(it), b);
+   ASSERT_NULL(ll_next(it));
+
+   ll_destroy(list);
+TSET()
+
+TEST(intrusive)
+   struct ll_link list, *it, *next;
+   struct elem e[4];
+   int i, sum = 0;
+
+   ll_link_init(&list);
+   ASSERT(!ll_link_empty(&list));
+
+   for (i = 0; i < 4; i++) {
+      e[i].value = i;
+      ll_link_append(&list, &e[i].link);
+   }
+   ASSERT(ll_link_empty(&list));
+   ASSERT_EQUAL(ll_link_entry(list.next, struct elem, link), &e[0]);
+   ASSERT_EQUAL(ll_link_entry(list.prev, struct elem, link), &e[3]);
+
+   // Remove odd elements while iterating
+   ll_link_foreach(it, next, &list) {
+      struct elem *el = ll_link_entry(it, struct elem, link);
+      if (el->value % 2) {
+         ll_link_remove(it);
+      }
+   }
+   ll_link_foreach(it, next, &list) {
+      sum += ll_link_entry(it, struct elem, link)->value;
+   }
+   ASSERT_EQUAL(sum, 2);
+   ASSERT_EQUAL(list.next, &e[0].link);
+   ASSERT_EQUAL(list.next->next, &e[2].link);
+   ASSERT_EQUAL(e[1].link.next, &e[1].link);
+
+   // Insert after a given element
+   ll_link_insert(&e[0].link, &e[1].link);
+   ASSERT_EQUAL(list.next->next, &e[1].link);
+   ASSERT_EQUAL(e[2].link.prev, &e[1].link);
+
+   ll_link_remove(&e[0].link);
+   ll_link_remove(&e[1].link);
+   ll_link_remove(&e[2].link);
+   ASSERT(!ll_link_empty(&list));
+TSET()
+
 TEST_END()
@@ -32,95 +32,230 @@
  */
 
 #include "linkedmap.h"
-#include "linked_list.h"
+
+#include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 
-struct lm
-{
-	struct ll *pairs;
+#define SMALL 8   ///< Pairs of a map kept without an index
+
+/// A key and value, in one allocation
+struct lm_pair {
+   uint32_t hash;    ///< Hash of the key
+   uint32_t key_len; ///< Length of the key
+   char *value;      ///< Value, null terminated, after the key
+   char key[];       ///< Key, null terminated
 };
 
-struct pair
-{
-	char* key;
-	char* value;
+/// A slot of the index, 0 pair if empty
+struct lm_slot {
+   uint32_t hash;    ///< Hash of the key of the pair
+   uint32_t pair;    ///< Position of the pair in pairs, plus one
+};
+
+/// A map of strings, kept in insertion order
+/**
+ *  Pairs are kept in an array in the order they were inserted, where
+ *  removed pairs leave holes until the array is compacted. Small maps
+ *  keep this array inline and are searched linearly. Larger maps index
+ *  it by hash in a table of twice its size, using open addressing with
+ *  Robin Hood hashing: probing stops at the first slot whose pair is
+ *  nearer its home slot than the key would be, and removals shift the
+ *  following slots back, so no tombstones are needed.
+ */
+struct lm {
+   struct lm_pair **pairs;       ///< Pairs, NULL where removed
+   unsigned int len;             ///< Pairs used, including removed
+   unsigned int count;           ///< Pairs in the map
+   unsigned int cap;             ///< Size of pairs
+   struct lm_slot *slots;        ///< Index of large maps, or NULL
+   unsigned int mask;            ///< Number of slots minus one
+   struct lm_pair *small[SMALL]; ///< Pairs of small maps
 };
 
+/// FNV-1a hash of a key
+static uint32_t hash(const char *key, size_t key_len)
+{
+   uint32_t h = 2166136261u;
+   size_t i;
+
+   for (i = 0; i < key_len; i++) h = (h ^ (unsigned char)key[i]) * 16777619u;
+   return h;
+}
+
+static int pair_is(const struct lm_pair *p, uint32_t h,
+                   const char *key, size_t key_len)
+{
+   return p->hash == h && p->key_len == key_len &&
+          memcmp(p->key, key, key_len) == 0;
+}
+
+/// Distance of a slot from the home slot of its pair
+static unsigned int distance(const struct lm *map, unsigned int i)
+{
+   return (i - map->slots[i].hash) & map->mask;
+}
+
+/// Put a pair in the index
+static void index_insert(struct lm *map, uint32_t h, uint32_t pair)
+{
+   struct lm_slot s = { h, pair }, tmp;
+   unsigned int i = h & map->mask, dist = 0, d;
+
+   for (;; i = (i + 1) & map->mask, dist++) {
+      if (map->slots[i].pair == 0) {
+         map->slots[i] = s;
+         return;
+      }
+      // Take the slot of a pair nearer its home, and place that instead
+      d = distance(map, i);
+      if (d < dist) {
+         tmp = map->slots[i];
+         map->slots[i] = s;
+         s = tmp;
+         dist = d;
+      }
+   }
+}
+
+/**
+ * Move the pairs to an array of cap pairs without holes, and rebuild
+ * the index if the map is large
+ *
+ * \return 0 on success, 2 if out of memory
+ */
+static int resize(struct lm *map, unsigned int cap)
+{
+   struct lm_pair **pairs = map->small;
+   struct lm_slot *slots = NULL;
+   unsigned int i, len = 0, n = 1;
+
+   if (cap > SMALL) {
+      while (n < 2 * cap) n *= 2;
+      pairs = malloc(cap * sizeof(struct lm_pair *));
+      slots = calloc(n, sizeof(struct lm_slot));
+      if (pairs == NULL || slots == NULL) {
+         fprintf(stderr, "Malloc failed when growing linkedmap\n");
+         free(pairs);
+         free(slots);
+         return 2;
+      }
+   }
+
+   // pairs may be the old array, as pairs only move down
+   for (i = 0; i < map->len; i++)
+      if (map->pairs[i]) pairs[len++] = map->pairs[i];
+
+   if (map->pairs != map->small && map->pairs != pairs) free(map->pairs);
+   free(map->slots);
+   map->pairs = pairs;
+   map->len = len;
+   map->cap = cap;
+   map->slots = slots;
+   map->mask = n - 1;
+
+   if (slots)
+      for (i = 0; i < len; i++)
+         index_insert(map, pairs[i]->hash, i + 1);
+
+   return 0;
+}
+
+/**
+ * Find a pair
+ *
+ * \param slot  Set to the slot of the pair in the index, if any
+ *
+ * \return The position of the pair in pairs, or -1 if not found
+ */
+static long find(const struct lm *map, const char *key, size_t key_len,
+                 unsigned int *slot)
+{
+   uint32_t h = hash(key, key_len);
+   unsigned int i, dist;
+   struct lm_slot *s;
+
+   if (map->slots == NULL) {
+      for (i = 0; i < map->len; i++)
+         if (map->pairs[i] && pair_is(map->pairs[i], h, key, key_len))
+            return i;
+      return -1;
+   }
+
+   for (i = h & map->mask, dist = 0;; i = (i + 1) & map->mask, dist++) {
+      s = &map->slots[i];
+      if (s->pair == 0 || distance(map, i) < dist) return -1;
+      if (s->hash == h && pair_is(map->pairs[s->pair - 1], h, key, key_len)) {
+         *slot = i;
+         return s->pair - 1;
+      }
+   }
+}
+
 // create a new linked map
 struct lm *lm_create()
 {
-	struct lm *ret = malloc(sizeof(struct lm));
-	if(ret == NULL)	{
-		fprintf(stderr, "Malloc failed when creating new linkedmap\n");
-		return NULL;
-	}
-
-	ll_create(ret->pairs);
-	if(ret->pairs == NULL) {
-		fprintf(stderr, "Malloc failed when creating new linkedlist in linkedmap\n");
-		return NULL; 
-	}
-
-	return ret;
+   struct lm *ret = malloc(sizeof(struct lm));
+   if(ret == NULL)   {
+      fprintf(stderr, "Malloc failed when creating new linkedmap\n");
+      return NULL;
+   }
+
+   ret->pairs = ret->small;
+   ret->len = 0;
+   ret->count = 0;
+   ret->cap = SMALL;
+   ret->slots = NULL;
+   ret->mask = 0;
+
+   return ret;
 }
 
 // Destroy a linked map. Also deallocates contents
 void lm_destroy(struct lm *map)
 {
-	struct ll_iter *it;
+   unsigned int i;
 
-	if(map)	{
-		// Loop through and destroy all keys
-		for(it = ll_head(map->pairs); it != NULL; it = ll_next(it))	{
-			free(((struct pair*)ll_data(it))->key);
-			free(((struct pair*)ll_data(it))->value);
-			free(((struct pair*)ll_data(it)));
-		}
-
-		ll_destroy(map->pairs);
-	}
+   if (map == NULL) return;
 
+   for (i = 0; i < map->len; i++) free(map->pairs[i]);
+   if (map->pairs != map->small) free(map->pairs);
+   free(map->slots);
    free(map);
 }
 
 int lm_insert_n(struct lm *map, const char* key, size_t key_len,
                                 const char* value, size_t value_len)
 {
-	// Check if the item is already in the list
-	if(lm_find_n(map, key, key_len) != NULL)
-		return 1;
-
-	char *mKey = malloc((key_len+1)*sizeof(char));
-	if(mKey == NULL) {
-		fprintf(stderr, "Malloc failed when allocating key for linkedmap\n");
-		return 2;
-	}
-
-	char *mValue = malloc((value_len+2)*sizeof(char));
-	if(mValue == NULL) {
-		fprintf(stderr, "Malloc failed when allocating value for linkedmap\n");
-      free(mKey);
-		return 2;
-	}
-
-	struct pair *p = malloc(sizeof(struct pair));
-	if(p == NULL) {
-		fprintf(stderr, "Malloc failed when allocating pair struct for linkedmap\n");
-      free(mValue);
-      free(mKey);
-		return 2;
-	}
-
-	strncpy(mKey, key, key_len);
-   mKey[key_len] = '\0';
-	strncpy(mValue, value, value_len);
-   mValue[value_len] = '\0';
-
-	p->key = mKey;
-	p->value = mValue;
-
-	ll_insert(map->pairs, ll_tail(map->pairs), p);
+   struct lm_pair *p;
+   unsigned int slot;
+
+   // Check if the item is already in the map
+   if (find(map, key, key_len, &slot) >= 0)
+      return 1;
+
+   // Compact the pairs if at least half are removed, or else grow
+   if (map->len == map->cap &&
+       resize(map, map->count < map->cap / 2 ? map->cap : 2 * map->cap))
+      return 2;
+
+   p = malloc(sizeof(struct lm_pair) + key_len + 1 + value_len + 1);
+   if (p == NULL) {
+      fprintf(stderr, "Malloc failed when allocating pair for linkedmap\n");
+      return 2;
+   }
+   p->hash = hash(key, key_len);
+   p->key_len = key_len;
+   memcpy(p->key, key, key_len);
+   p->key[key_len] = '\0';
+   p->value = p->key + key_len + 1;
+   memcpy(p->value, value, value_len);
+   p->value[value_len] = '\0';
+
+   map->pairs[map->len++] = p;
+   map->count++;
+   if (map->slots) index_insert(map, p->hash, map->len);
 
    return 0;
 }
@@ -134,22 +269,29 @@ int lm_insert(struct lm *map, const char* key, const char* value)
 // Remove a key and value pair
 void lm_remove_n(struct lm *map, const char* key, size_t key_len)
 {
-	struct ll_iter *it, *next;
-
-	if(map){
-		for(it = ll_head(map->pairs); it != NULL;) {
-			if(strncmp(((struct pair*)ll_data(it))->key, key, key_len) == 0) {
-				free(((struct pair*)ll_data(it))->key);
-				free(((struct pair*)ll_data(it))->value);
-				free(((struct pair*)ll_data(it)));
-            next = ll_next(it);
-				ll_remove(it);
-            it = next;
-			} else {
-            it = ll_next(it);
-         }
-		}
-	}
+   unsigned int slot, next;
+   long i;
+
+   if (map == NULL || (i = find(map, key, key_len, &slot)) < 0) return;
+
+   free(map->pairs[i]);
+   map->count--;
+
+   // Small maps are kept without holes
+   if (map->slots == NULL) {
+      memmove(&map->pairs[i], &map->pairs[i + 1],
+              (map->len - i - 1) * sizeof(struct lm_pair *));
+      map->len--;
+      return;
+   }
+   map->pairs[i] = NULL;
+
+   // Shift back the slots after, up to one that is empty or at home
+   for (next = (slot + 1) & map->mask;
+        map->slots[next].pair != 0 && distance(map, next) != 0;
+        slot = next, next = (next + 1) & map->mask)
+      map->slots[slot] = map->slots[next];
+   map->slots[slot].pair = 0;
 }
 
 // Remove a key and value pair
@@ -161,16 +303,12 @@ void lm_remove(struct lm *map, const char* key)
 // Get the value of a key in the linked map
 char* lm_find_n(struct lm *map, const char* key, size_t key_len)
 {
-	struct ll_iter *it;
-
-	if(map){
-		for(it = ll_head(map->pairs); it != NULL; it = ll_next(it)) {
-			if(strncmp(((struct pair*)ll_data(it))->key, key, key_len) == 0) {
-				return ((struct pair*)ll_data(it))->value;
-			}
-		}
-	}
-	return NULL;
+   unsigned int slot;
+   long i;
+
+   if (map == NULL || (i = find(map, key, key_len, &slot)) < 0)
+      return NULL;
+   return map->pairs[i]->value;
 }
 
 // Get the value of a key in the linked map
@@ -179,19 +317,13 @@ char* lm_find(struct lm *map, const char* key)
    return lm_find_n(map, key, strlen(key));
 }
 
-// Map a read-only function over the internal linked list.
+// Map a read-only function over the pairs, in insertion order
 void lm_map(struct lm *map, lm_map_cb func, void *data)
 {
-	if(map && func) {
-		struct ll_iter *it;
-		for(it = ll_head(map->pairs); it != NULL; it = ll_next(it)) {
-			func(data, ((struct pair*)ll_data(it))->key, ((struct pair*)ll_data(it))->value);
-		}
-	}
-}
-
-
-
-
-
+   unsigned int i;
 
+   if (map && func)
+      for (i = 0; i < map->len; i++)
+         if (map->pairs[i])
+            func(data, map->pairs[i]->key, map->pairs[i]->value);
+}
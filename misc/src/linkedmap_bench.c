@@ -0,0 +1,195 @@
+// linkedmap_bench.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+ *   
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *  
+ *  The views and conclusions contained in the software and
+ *  documentation are those of the authors and should not be interpreted
+ *  as representing official policies, either expressed.
+ */
+
+#include "linkedmap.h"
+#include "linked_list.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KEYS 1000        ///< Keys of the large map
+
+/// The previous linkedmap: a list of separately allocated pairs
+/**
+ *  Kept as the baseline. Lookups scan the list with strncmp on the
+ *  length of the key looked up, and inserts look the key up first.
+ */
+struct old_pair {
+   char *key;
+   char *value;
+};
+
+static struct ll *old_create()
+{
+   struct ll *pairs;
+   ll_create(pairs);
+   return pairs;
+}
+
+static char *old_find(struct ll *pairs, const char *key)
+{
+   struct ll_iter *it;
+   size_t key_len = strlen(key);
+
+   for (it = ll_head(pairs); it != NULL; it = ll_next(it))
+      if (strncmp(((struct old_pair *)ll_data(it))->key, key, key_len) == 0)
+         return ((struct old_pair *)ll_data(it))->value;
+   return NULL;
+}
+
+static int old_insert(struct ll *pairs, const char *key, const char *value)
+{
+   struct old_pair *p;
+
+   if (old_find(pairs, key) != NULL) return 1;
+   p = malloc(sizeof(struct old_pair));
+   p->key = strdup(key);
+   p->value = strdup(value);
+   ll_insert(pairs, ll_tail(pairs), p);
+   return 0;
+}
+
+static void old_destroy(struct ll *pairs)
+{
+   struct ll_iter *it;
+
+   for (it = ll_head(pairs); it != NULL; it = ll_next(it)) {
+      free(((struct old_pair *)ll_data(it))->key);
+      free(((struct old_pair *)ll_data(it))->value);
+      free(ll_data(it));
+   }
+   ll_destroy(pairs);
+}
+
+/// Headers of a typical request, as parsed by http-webserver
+static const char *headers[][2] = {
+   { "Host", "localhost:8080" },
+   { "User-Agent", "Mozilla/5.0 (X11; Linux x86_64)" },
+   { "Accept", "application/xml" },
+   { "Accept-Language", "en-US,en;q=0.5" },
+   { "Accept-Encoding", "gzip, deflate" },
+   { "Connection", "keep-alive" },
+   { "Cache-Control", "max-age=0" },
+   { "Content-Type", "application/xml" },
+   { "Content-Length", "42" },
+   { "Origin", "http://localhost" },
+   { "Referer", "http://localhost/devices" },
+   { "Cookie", "session=1234" },
+};
+#define HEADERS (sizeof(headers) / sizeof(headers[0]))
+
+/// Headers looked up per request, the last ones missing
+static const char *wanted[] = {
+   "Content-Length", "Content-Type", "Connection", "Host",
+   "Transfer-Encoding", "Sec-WebSocket-Key", "HTTP2-Settings"
+};
+#define WANTED (sizeof(wanted) / sizeof(wanted[0]))
+
+static char *keys[KEYS];
+
+/// Build the headers of a request, look some up and destroy them
+static void old_headers_bench(void *data, size_t n)
+{
+   struct ll *old;
+   size_t i, j;
+
+   for (i = 0; i < n; i++) {
+      old = old_create();
+      for (j = 0; j < HEADERS; j++)
+         old_insert(old, headers[j][0], headers[j][1]);
+      for (j = 0; j < WANTED; j++)
+         bench_use(old_find(old, wanted[j]));
+      old_destroy(old);
+   }
+}
+
+static void lm_headers_bench(void *data, size_t n)
+{
+   struct lm *map;
+   size_t i, j;
+
+   for (i = 0; i < n; i++) {
+      map = lm_create();
+      for (j = 0; j < HEADERS; j++)
+         lm_insert(map, headers[j][0], headers[j][1]);
+      for (j = 0; j < WANTED; j++)
+         bench_use(lm_find(map, wanted[j]));
+      lm_destroy(map);
+   }
+}
+
+static void old_lookup_bench(void *data, size_t n)
+{
+   size_t i;
+
+   for (i = 0; i < n; i++)
+      bench_use(old_find(data, keys[i * 7919 % KEYS]));
+}
+
+static void lm_lookup_bench(void *data, size_t n)
+{
+   size_t i;
+
+   for (i = 0; i < n; i++)
+      bench_use(lm_find(data, keys[i * 7919 % KEYS]));
+}
+
+int main(int argc, char **argv)
+{
+   struct ll *old;
+   struct lm *map;
+   unsigned int i;
+
+   old = old_create();
+   map = lm_create();
+   for (i = 0; i < KEYS; i++) {
+      keys[i] = malloc(32);
+      sprintf(keys[i], "argument%u", i * 2654435761u);
+      old_insert(old, keys[i], keys[i]);
+      lm_insert(map, keys[i], keys[i]);
+   }
+
+   // A request has 12 headers and 7 lookups, the large maps KEYS keys
+   bench_init("linkedmap", argc, argv);
+   bench_run("list_headers", old_headers_bench, NULL);
+   bench_run("linkedmap_headers", lm_headers_bench, NULL);
+   bench_run("list_lookup_1000", old_lookup_bench, old);
+   bench_run("linkedmap_lookup_1000", lm_lookup_bench, map);
+
+   old_destroy(old);
+   lm_destroy(map);
+   for (i = 0; i < KEYS; i++) free(keys[i]);
+   return bench_finish();
+}
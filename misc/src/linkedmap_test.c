@@ -1,6 +1,15 @@
 #include "linkedmap.h"
 #include "unit_test.h"
 #include <stdio.h>
+#include <string.h>
+
+static void append_key(void *data, const char *key, const char *value)
+{
+	strcat(data, key);
+	strcat(data, "=");
+	strcat(data, value);
+	strcat(data, ";");
+}
 
 TEST_START("linkedmap.c")
 
@@ -75,4 +84,80 @@ TEST(remove)
 	lm_destroy(map);
 TSET()
 
-TEST_END()
\ No newline at end of file
+TEST(exactLength)
+	struct lm *map;
+	map = lm_create();
+
+	lm_insert(map, "Content-Length", "12");
+	lm_insert_n(map, "Host: x", 4, "localhost", 9);
+
+	// Keys starting with or being a prefix of the key do not match
+	ASSERT_NULL(lm_find(map, "Content"));
+	ASSERT_NULL(lm_find(map, "Content-Length2"));
+	ASSERT_NULL(lm_find(map, "Hos"));
+	ASSERT_STR_EQUAL(lm_find(map, "Host"), "localhost");
+	ASSERT_STR_EQUAL(lm_find_n(map, "Content-Length: 12", 14), "12");
+
+	lm_remove(map, "Content");
+	ASSERT_NOT_NULL(lm_find(map, "Content-Length"));
+
+	lm_destroy(map);
+TSET()
+
+TEST(order)
+	struct lm *map;
+	char out[256] = "";
+	map = lm_create();
+
+	lm_insert(map, "c", "1");
+	lm_insert(map, "a", "2");
+	lm_insert(map, "b", "3");
+	lm_remove(map, "a");
+	lm_insert(map, "a", "4");
+
+	lm_map(map, append_key, out);
+	ASSERT_STR_EQUAL(out, "c=1;b=3;a=4;");
+
+	lm_destroy(map);
+TSET()
+
+TEST(many)
+	struct lm *map;
+	char key[32], value[32], out[8192] = "";
+	char *found;
+	int i, round;
+	map = lm_create();
+
+	// Grow past the inline pairs, remove and insert again, twice
+	for (round = 0; round < 2; round++) {
+		for (i = 0; i < 500; i++) {
+			sprintf(key, "key%d", i);
+			sprintf(value, "value%d", i);
+			lm_insert(map, key, value);
+		}
+		for (i = 0; i < 500; i += 2) {
+			sprintf(key, "key%d", i);
+			lm_remove(map, key);
+		}
+	}
+
+	for (i = 0; i < 500; i++) {
+		sprintf(key, "key%d", i);
+		sprintf(value, "value%d", i);
+		found = lm_find(map, key);
+		if (i % 2) {
+			ASSERT_STR_EQUAL(found, value);
+		} else {
+			ASSERT_NULL(found);
+		}
+	}
+	ASSERT_NULL(lm_find(map, "key500"));
+
+	// Odd keys remain, in the order they were first inserted
+	lm_map(map, append_key, out);
+	ASSERT_EQUAL(strncmp(out, "key1=value1;key3=value3;", 24), 0);
+
+	lm_destroy(map);
+TSET()
+
+TEST_END()
@@ -0,0 +1,495 @@
+// radix_tree.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+ *   
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *  
+ *  The views and conclusions contained in the software and
+ *  documentation are those of the authors and should not be interpreted
+ *  as representing official policies, either expressed.
+ */
+
+#include "radix_tree.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#define FREE UINT_MAX  ///< key_len of nodes on the free list
+#define LINEAR 8       ///< Search edges linearly up to this many
+
+/// A node in the radix tree
+/**
+ *  The key segment of a node is stored in the pool of the tree, and the
+ *  edges to its children are kept sorted by the first byte of their
+ *  segments, in labels. The children are indices into the node array,
+ *  so nodes can be stored contiguously and moved by realloc.
+ */
+struct rt_node {
+   void *value;            ///< Value or NULL if not a key
+   unsigned int key;       ///< Offset of segment in pool
+   unsigned int key_len;   ///< Length of segment
+   unsigned int children;  ///< Number of children
+   unsigned int capacity;  ///< Allocated number of edges
+   unsigned int *child;    ///< Children, followed by labels in memory
+   unsigned char *labels;  ///< First byte of segment of each child
+};
+
+/// A radix tree mapping strings to values
+/**
+ *  Node 0 is the root, which has an empty segment. Removed nodes are
+ *  kept on a free list threaded through their key field, and the pool
+ *  is compacted when more than half of it is unused.
+ */
+struct rt {
+   struct rt_node *nodes;  ///< Contiguous node storage
+   unsigned int nodes_len; ///< Number of nodes used
+   unsigned int nodes_cap; ///< Number of nodes allocated
+   unsigned int free;      ///< First free node or 0
+   char *pool;             ///< Key segments
+   size_t pool_len;        ///< Bytes of pool used
+   size_t pool_cap;        ///< Bytes of pool allocated
+   size_t pool_unused;     ///< Bytes of pool no longer referenced
+};
+
+struct rt *rt_create()
+{
+   struct rt *rt = calloc(1, sizeof(struct rt));
+   if (rt == NULL) {
+      fprintf(stderr, "malloc failed for creating a radix tree\n");
+      return NULL;
+   }
+
+   rt->nodes = calloc(1, sizeof(struct rt_node));
+   if (rt->nodes == NULL) {
+      fprintf(stderr, "malloc failed for creating a radix tree\n");
+      free(rt);
+      return NULL;
+   }
+   rt->nodes_len = 1;
+   rt->nodes_cap = 1;
+
+   return rt;
+}
+
+void rt_destroy(struct rt *rt, rt_dealloc_cb destructor)
+{
+   unsigned int i;
+
+   if (rt == NULL) return;
+
+   for (i = 0; i < rt->nodes_len; i++) {
+      if (rt->nodes[i].key_len == FREE) continue;
+      if (destructor && rt->nodes[i].value) destructor(rt->nodes[i].value);
+      free(rt->nodes[i].child);
+   }
+
+   free(rt->nodes);
+   free(rt->pool);
+   free(rt);
+}
+
+struct rt *rt_copy(struct rt *rt, rt_copy_cb copy)
+{
+   struct rt *c;
+   struct rt_node *node;
+   size_t size;
+   unsigned int i;
+
+   if (rt == NULL) return NULL;
+
+   c = malloc(sizeof(struct rt));
+   if (c == NULL) {
+      fprintf(stderr, "malloc failed for copying a radix tree\n");
+      return NULL;
+   }
+   *c = *rt;
+   c->nodes = malloc(rt->nodes_cap * sizeof(struct rt_node));
+   c->pool = rt->pool_cap ? malloc(rt->pool_cap) : NULL;
+   if (c->nodes == NULL || (rt->pool_cap && c->pool == NULL)) {
+      fprintf(stderr, "malloc failed for copying a radix tree\n");
+      free(c->nodes);
+      free(c->pool);
+      free(c);
+      return NULL;
+   }
+   memcpy(c->nodes, rt->nodes, rt->nodes_len * sizeof(struct rt_node));
+   if (rt->pool_len) memcpy(c->pool, rt->pool, rt->pool_len);
+
+   // Edges are the only per-node allocations
+   for (i = 0; i < c->nodes_len; i++) {
+      node = &c->nodes[i];
+      if (node->key_len == FREE || node->child == NULL) continue;
+      size = node->capacity * (sizeof(unsigned int) + 1);
+      node->child = malloc(size);
+      if (node->child == NULL) {
+         fprintf(stderr, "malloc failed for copying a radix tree\n");
+         for (; i < c->nodes_len; i++)
+            if (c->nodes[i].key_len != FREE) c->nodes[i].child = NULL;
+         rt_destroy(c, NULL);
+         return NULL;
+      }
+      memcpy(node->child, rt->nodes[i].child, size);
+      node->labels = (unsigned char *)&node->child[node->capacity];
+   }
+
+   if (copy)
+      for (i = 0; i < c->nodes_len; i++)
+         if (c->nodes[i].key_len != FREE && c->nodes[i].value)
+            c->nodes[i].value = copy(c->nodes[i].value);
+
+   return c;
+}
+
+/// Find the edge for a byte, or the position to insert it at
+static int find_edge(const struct rt_node *node, unsigned char c,
+                     unsigned int *pos)
+{
+   unsigned int lo = 0, hi = node->children, mid;
+
+   if (hi <= LINEAR) {
+      for (; lo < hi && node->labels[lo] < c; lo++);
+   } else {
+      while (lo < hi) {
+         mid = (lo + hi) / 2;
+         if (node->labels[mid] < c) lo = mid + 1;
+         else hi = mid;
+      }
+   }
+
+   *pos = lo;
+   return lo < node->children && node->labels[lo] == c;
+}
+
+/// Allocate a node, returning its index or 0 on failure
+static unsigned int node_new(struct rt *rt)
+{
+   struct rt_node *nodes;
+   unsigned int i;
+
+   if (rt->free) {
+      i = rt->free;
+      rt->free = rt->nodes[i].key;
+   } else {
+      if (rt->nodes_len == rt->nodes_cap) {
+         nodes = realloc(rt->nodes,
+                         2 * rt->nodes_cap * sizeof(struct rt_node));
+         if (nodes == NULL) {
+            fprintf(stderr, "realloc failed for radix tree nodes\n");
+            return 0;
+         }
+         rt->nodes = nodes;
+         rt->nodes_cap *= 2;
+      }
+      i = rt->nodes_len++;
+   }
+
+   memset(&rt->nodes[i], 0, sizeof(struct rt_node));
+   return i;
+}
+
+/// Return a node to the free list
+static void node_free(struct rt *rt, unsigned int i)
+{
+   free(rt->nodes[i].child);
+   rt->pool_unused += rt->nodes[i].key_len;
+   rt->nodes[i].child = NULL;
+   rt->nodes[i].value = NULL;
+   rt->nodes[i].key_len = FREE;
+   rt->nodes[i].key = rt->free;
+   rt->free = i;
+}
+
+/// Make room for len more bytes in the pool, returning 0 on success
+static int pool_reserve(struct rt *rt, size_t len)
+{
+   char *pool;
+   size_t cap = rt->pool_cap ? rt->pool_cap : 256;
+
+   while (rt->pool_len + len > cap) cap *= 2;
+   if (cap > UINT_MAX) return 1;
+   if (cap != rt->pool_cap) {
+      pool = realloc(rt->pool, cap);
+      if (pool == NULL) {
+         fprintf(stderr, "realloc failed for radix tree keys\n");
+         return 1;
+      }
+      rt->pool = pool;
+      rt->pool_cap = cap;
+   }
+
+   return 0;
+}
+
+/// Copy all used segments to a new pool
+static void pool_compact(struct rt *rt)
+{
+   char *pool = malloc(rt->pool_len - rt->pool_unused);
+   struct rt_node *node;
+   size_t len = 0;
+   unsigned int i;
+
+   if (pool == NULL) return;
+
+   for (i = 1; i < rt->nodes_len; i++) {
+      node = &rt->nodes[i];
+      if (node->key_len == FREE) continue;
+      memcpy(&pool[len], &rt->pool[node->key], node->key_len);
+      node->key = len;
+      len += node->key_len;
+   }
+
+   free(rt->pool);
+   rt->pool = pool;
+   rt->pool_len = len;
+   rt->pool_cap = len;
+   rt->pool_unused = 0;
+}
+
+/// Insert an edge at a position, returning 0 on success
+static int edge_add(struct rt *rt, unsigned int i, unsigned int pos,
+                    unsigned int child)
+{
+   struct rt_node *node = &rt->nodes[i];
+   unsigned int cap;
+   unsigned int *edges;
+   unsigned char *labels;
+
+   if (node->children == node->capacity) {
+      cap = node->capacity ? 2 * node->capacity : 2;
+      edges = malloc(cap * (sizeof(unsigned int) + 1));
+      if (edges == NULL) {
+         fprintf(stderr, "malloc failed for radix tree edges\n");
+         return 1;
+      }
+      labels = (unsigned char *)&edges[cap];
+      if (node->children) {
+         memcpy(edges, node->child, node->children * sizeof(unsigned int));
+         memcpy(labels, node->labels, node->children);
+      }
+      free(node->child);
+      node->child = edges;
+      node->labels = labels;
+      node->capacity = cap;
+   }
+
+   memmove(&node->child[pos+1], &node->child[pos],
+           (node->children - pos) * sizeof(unsigned int));
+   memmove(&node->labels[pos+1], &node->labels[pos],
+           node->children - pos);
+   node->child[pos] = child;
+   node->labels[pos] = rt->pool[rt->nodes[child].key];
+   node->children++;
+   return 0;
+}
+
+/// Remove the edge at a position
+static void edge_remove(struct rt *rt, unsigned int i, unsigned int pos)
+{
+   struct rt_node *node = &rt->nodes[i];
+
+   node->children--;
+   memmove(&node->child[pos], &node->child[pos+1],
+           (node->children - pos) * sizeof(unsigned int));
+   memmove(&node->labels[pos], &node->labels[pos+1],
+           node->children - pos);
+}
+
+/// Merge a node without value into its only child
+/**
+ *  \param  rt      The radix tree
+ *  \param  parent  Parent of the node
+ *  \param  pos     Position of the edge from the parent to the node
+ */
+static void merge(struct rt *rt, unsigned int parent, unsigned int pos)
+{
+   unsigned int i = rt->nodes[parent].child[pos];
+   unsigned int c = rt->nodes[i].child[0];
+   struct rt_node *node, *child;
+   size_t len;
+
+   if (rt->nodes[i].key + rt->nodes[i].key_len != rt->nodes[c].key) {
+      // Concatenate segments at the end of the pool
+      len = rt->nodes[i].key_len + rt->nodes[c].key_len;
+      if (pool_reserve(rt, len)) return;
+      node = &rt->nodes[i];
+      child = &rt->nodes[c];
+      memcpy(&rt->pool[rt->pool_len], &rt->pool[node->key], node->key_len);
+      memcpy(&rt->pool[rt->pool_len + node->key_len],
+             &rt->pool[child->key], child->key_len);
+      rt->pool_unused += child->key_len;
+      child->key = rt->pool_len;
+      child->key_len = len;
+      rt->pool_len += len;
+   } else {
+      // Segments are adjacent, as after a split
+      node = &rt->nodes[i];
+      child = &rt->nodes[c];
+      child->key = node->key;
+      child->key_len += node->key_len;
+      node->key_len = 0;
+   }
+
+   rt->nodes[parent].child[pos] = c;
+   node_free(rt, i);
+}
+
+int rt_insert_n(struct rt *rt, const char *key, size_t key_len, void *value)
+{
+   unsigned int i = 0, pos, c, mid, m, len;
+   size_t k = 0;
+   const char *seg;
+
+   if (key == NULL || value == NULL) return 1;
+
+   for (;;) {
+      // Key ends at node
+      if (k == key_len) {
+         if (rt->nodes[i].value) return 1;
+         rt->nodes[i].value = value;
+         return 0;
+      }
+
+      // No edge, add leaf with rest of key
+      if (!find_edge(&rt->nodes[i], key[k], &pos)) {
+         if (pool_reserve(rt, key_len - k)) return 1;
+         if (!(c = node_new(rt))) return 1;
+         memcpy(&rt->pool[rt->pool_len], &key[k], key_len - k);
+         rt->nodes[c].key = rt->pool_len;
+         rt->nodes[c].key_len = key_len - k;
+         rt->pool_len += key_len - k;
+         if (edge_add(rt, i, pos, c)) {
+            node_free(rt, c);
+            return 1;
+         }
+         rt->nodes[c].value = value;
+         return 0;
+      }
+
+      // Follow edge if segment matches
+      c = rt->nodes[i].child[pos];
+      seg = &rt->pool[rt->nodes[c].key];
+      len = rt->nodes[c].key_len;
+      for (m = 0; m < len && k + m < key_len && seg[m] == key[k+m]; m++);
+      if (m < len) {
+         // Split segment at mismatch
+         if (!(mid = node_new(rt))) return 1;
+         rt->nodes[mid].key = rt->nodes[c].key;
+         rt->nodes[mid].key_len = m;
+         rt->nodes[c].key += m;
+         rt->nodes[c].key_len -= m;
+         if (edge_add(rt, mid, 0, c)) {
+            rt->nodes[c].key -= m;
+            rt->nodes[c].key_len += m;
+            rt->nodes[mid].key_len = 0;
+            node_free(rt, mid);
+            return 1;
+         }
+         rt->nodes[i].child[pos] = mid;
+         c = mid;
+      }
+      i = c;
+      k += m;
+   }
+}
+
+int rt_insert(struct rt *rt, const char *key, void *value)
+{
+   if (key == NULL) return 1;
+   return rt_insert_n(rt, key, strlen(key), value);
+}
+
+void *rt_lookup_n(struct rt *rt, const char *key, size_t key_len)
+{
+   const struct rt_node *nodes = rt->nodes, *node = nodes;
+   unsigned int pos;
+   size_t k = 0;
+
+   while (k < key_len) {
+      if (!find_edge(node, key[k], &pos)) return NULL;
+      node = &nodes[node->child[pos]];
+      if (node->key_len > key_len - k ||
+          memcmp(&rt->pool[node->key], &key[k], node->key_len) != 0)
+         return NULL;
+      k += node->key_len;
+   }
+
+   return node->value;
+}
+
+void *rt_lookup(struct rt *rt, const char *key)
+{
+   if (key == NULL) return NULL;
+   return rt_lookup_n(rt, key, strlen(key));
+}
+
+void *rt_remove_n(struct rt *rt, const char *key, size_t key_len)
+{
+   unsigned int i = 0, parent = 0, grand = 0, pos = 0, ppos = 0;
+   struct rt_node *node;
+   size_t k = 0;
+   void *value;
+
+   // Find node, its parent and grandparent
+   while (k < key_len) {
+      grand = parent;
+      ppos = pos;
+      parent = i;
+      if (!find_edge(&rt->nodes[i], key[k], &pos)) return NULL;
+      i = rt->nodes[i].child[pos];
+      node = &rt->nodes[i];
+      if (node->key_len > key_len - k ||
+          memcmp(&rt->pool[node->key], &key[k], node->key_len) != 0)
+         return NULL;
+      k += node->key_len;
+   }
+
+   value = rt->nodes[i].value;
+   rt->nodes[i].value = NULL;
+   if (value == NULL || i == 0) return value;
+
+   // Remove leaf, or merge node with single child
+   if (rt->nodes[i].children == 0) {
+      edge_remove(rt, parent, pos);
+      node_free(rt, i);
+      if (parent != 0 && rt->nodes[parent].value == NULL &&
+          rt->nodes[parent].children == 1)
+         merge(rt, grand, ppos);
+   } else if (rt->nodes[i].children == 1) {
+      merge(rt, parent, pos);
+   }
+
+   if (rt->pool_unused > 4096 && 2 * rt->pool_unused > rt->pool_len)
+      pool_compact(rt);
+
+   return value;
+}
+
+void *rt_remove(struct rt *rt, const char *key)
+{
+   if (key == NULL) return NULL;
+   return rt_remove_n(rt, key, strlen(key));
+}
@@ -0,0 +1,150 @@
+// radix_tree_bench.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+ *   
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *  
+ *  The views and conclusions contained in the software and
+ *  documentation are those of the authors and should not be interpreted
+ *  as representing official policies, either expressed.
+ */
+
+#include "trie.h"
+#include "radix_tree.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SERVICES 100000  ///< Number of registered URLs
+#define QUERIES 65536    ///< Number of distinct lookups, a power of two
+
+static char **urls;
+static char **queries;
+
+/// Construct URLs as registered by homeport: /type/id/type/id
+static void make_urls()
+{
+   int i;
+   static const char *dev[] = { "Phidget", "ZWave", "Zigbee", "Plugwise" };
+   static const char *srv[] = { "Lamp", "Temperature", "Switch", "Light" };
+
+   urls = malloc(SERVICES * sizeof(char *));
+   for (i = 0; i < SERVICES; i++) {
+      urls[i] = malloc(64);
+      sprintf(urls[i], "/%s/%08x/%s/%d", dev[i % 4], i / 16 * 2654435761u,
+              srv[(i / 4) % 4], i % 16);
+   }
+}
+
+/// Lookup order, with every eighth URL unknown
+static void make_queries()
+{
+   int i;
+   static char miss[] = "/Phidget/00000000/Lamp/99";
+
+   queries = malloc(QUERIES * sizeof(char *));
+   srand(42);
+   for (i = 0; i < QUERIES; i++)
+      queries[i] = i % 8 ? urls[rand() % SERVICES] : miss;
+}
+
+static void trie_insert_bench(void *data, size_t n)
+{
+   struct trie *trie = NULL;
+   size_t i;
+
+   for (i = 0; i < n; i++) {
+      if (i % SERVICES == 0) {
+         if (trie) trie_destroy(trie, NULL);
+         trie = trie_create();
+      }
+      trie_insert(trie, urls[i % SERVICES], urls[i % SERVICES]);
+   }
+   if (trie) trie_destroy(trie, NULL);
+}
+
+static void trie_lookup_bench(void *data, size_t n)
+{
+   size_t i;
+
+   for (i = 0; i < n; i++)
+      bench_use(trie_lookup(data, queries[i & (QUERIES - 1)]));
+}
+
+static void rt_insert_bench(void *data, size_t n)
+{
+   struct rt *rt = NULL;
+   size_t i;
+
+   for (i = 0; i < n; i++) {
+      if (i % SERVICES == 0) {
+         rt_destroy(rt, NULL);
+         rt = rt_create();
+      }
+      rt_insert(rt, urls[i % SERVICES], urls[i % SERVICES]);
+   }
+   rt_destroy(rt, NULL);
+}
+
+static void rt_lookup_bench(void *data, size_t n)
+{
+   size_t i;
+
+   for (i = 0; i < n; i++)
+      bench_use(rt_lookup(data, queries[i & (QUERIES - 1)]));
+}
+
+int main(int argc, char **argv)
+{
+   struct trie *trie;
+   struct rt *rt;
+   int i;
+
+   make_urls();
+   make_queries();
+
+   trie = trie_create();
+   rt = rt_create();
+   for (i = 0; i < SERVICES; i++) {
+      trie_insert(trie, urls[i], urls[i]);
+      rt_insert(rt, urls[i], urls[i]);
+   }
+
+   // Inserts include building and destroying the tree every SERVICES
+   bench_init("trie", argc, argv);
+   bench_run("trie_insert", trie_insert_bench, NULL);
+   bench_run("trie_lookup", trie_lookup_bench, trie);
+   bench_run("radix_tree_insert", rt_insert_bench, NULL);
+   bench_run("radix_tree_lookup", rt_lookup_bench, rt);
+
+   trie_destroy(trie, NULL);
+   rt_destroy(rt, NULL);
+   for (i = 0; i < SERVICES; i++) free(urls[i]);
+   free(urls);
+   free(queries);
+   return bench_finish();
+}
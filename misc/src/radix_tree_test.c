@@ -0,0 +1,194 @@
+// radix_tree_test.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+ *   
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *  
+ *  The views and conclusions contained in the software and
+ *  documentation are those of the authors and should not be interpreted
+ *  as representing official policies, either expressed.
+ */
+
+#include "radix_tree.c"
+#include "unit_test.h"
+
+#include <stdio.h>
+
+static void *copy_str(void *value)
+{
+   return strdup(value);
+}
+
+TEST_START("radix_tree.c")
+
+TEST(create_destroy)
+   struct rt *rt = rt_create();
+   ASSERT_NOT_NULL(rt);
+   rt_destroy(rt, NULL);
+TSET()
+
+TEST(simple_insert)
+   char *key = "cat";
+   struct rt *rt = rt_create();
+
+   ASSERT_EQUAL(rt_insert(rt, key, key), 0);
+   ASSERT_STR_EQUAL(rt_lookup(rt, key), key);
+   ASSERT_NULL(rt_lookup(rt, "ca"));
+   ASSERT_NULL(rt_lookup(rt, "cats"));
+   ASSERT_NULL(rt_lookup(rt, ""));
+
+   rt_destroy(rt, NULL);
+TSET()
+
+TEST(insert_null_and_duplicate)
+   struct rt *rt = rt_create();
+
+   ASSERT_EQUAL(rt_insert(rt, NULL, "x"), 1);
+   ASSERT_EQUAL(rt_insert(rt, "x", NULL), 1);
+   ASSERT_EQUAL(rt_insert(rt, "dog", "1"), 0);
+   ASSERT_EQUAL(rt_insert(rt, "dog", "2"), 1);
+   ASSERT_STR_EQUAL(rt_lookup(rt, "dog"), "1");
+
+   rt_destroy(rt, NULL);
+TSET()
+
+TEST(split_and_prefix)
+   int i;
+   char *keys[] = { "cat", "dog", "penguin", "mouse", "dogma",
+                    "dogwood", "pen", "donation", "d", "" };
+   struct rt *rt = rt_create();
+
+   for (i = 0; i < 10; i++)
+      ASSERT_EQUAL(rt_insert(rt, keys[i], keys[i]), 0);
+   for (i = 0; i < 10; i++)
+      ASSERT_STR_EQUAL(rt_lookup(rt, keys[i]), keys[i]);
+   ASSERT_NULL(rt_lookup(rt, "do"));
+   ASSERT_NULL(rt_lookup(rt, "dogm"));
+   ASSERT_NULL(rt_lookup(rt, "peng"));
+
+   // Length-delimited keys
+   ASSERT_STR_EQUAL(rt_lookup_n(rt, "dogmatic", 5), "dogma");
+   ASSERT_STR_EQUAL(rt_lookup_n(rt, "penguin", 3), "pen");
+
+   rt_destroy(rt, NULL);
+TSET()
+
+TEST(remove)
+   int i;
+   char *keys[] = { "/device/a/0", "/device/a/1", "/device/b/0",
+                    "/device", "/dev", "/other" };
+   struct rt *rt = rt_create();
+
+   for (i = 0; i < 6; i++)
+      ASSERT_EQUAL(rt_insert(rt, keys[i], keys[i]), 0);
+
+   ASSERT_NULL(rt_remove(rt, "/device/a"));
+   ASSERT_STR_EQUAL(rt_remove(rt, "/device/a/0"), "/device/a/0");
+   ASSERT_NULL(rt_lookup(rt, "/device/a/0"));
+   ASSERT_STR_EQUAL(rt_remove(rt, "/device"), "/device");
+   ASSERT_NULL(rt_remove(rt, "/device"));
+   ASSERT_STR_EQUAL(rt_remove(rt, "/dev"), "/dev");
+
+   // Remaining keys are still found after merges
+   ASSERT_STR_EQUAL(rt_lookup(rt, "/device/a/1"), "/device/a/1");
+   ASSERT_STR_EQUAL(rt_lookup(rt, "/device/b/0"), "/device/b/0");
+   ASSERT_STR_EQUAL(rt_lookup(rt, "/other"), "/other");
+
+   // And can be inserted again
+   ASSERT_EQUAL(rt_insert(rt, "/device/a/0", "again"), 0);
+   ASSERT_STR_EQUAL(rt_lookup(rt, "/device/a/0"), "again");
+
+   rt_destroy(rt, NULL);
+TSET()
+
+TEST(many_keys)
+   int i;
+   char key[32];
+   struct rt *rt = rt_create();
+
+   // Wide nodes, deep nodes and pool compaction
+   for (i = 0; i < 5000; i++) {
+      sprintf(key, "/%d/%x", i % 300, i);
+      ASSERT_EQUAL(rt_insert(rt, key, (void *)(long)(i+1)), 0);
+   }
+   for (i = 0; i < 5000; i += 2) {
+      sprintf(key, "/%d/%x", i % 300, i);
+      ASSERT_EQUAL(rt_remove(rt, key), (void *)(long)(i+1));
+   }
+   for (i = 0; i < 5000; i++) {
+      sprintf(key, "/%d/%x", i % 300, i);
+      if (i % 2) {
+         ASSERT_EQUAL(rt_lookup(rt, key), (void *)(long)(i+1));
+      } else {
+         ASSERT_NULL(rt_lookup(rt, key));
+      }
+   }
+
+   rt_destroy(rt, NULL);
+TSET()
+
+TEST(copy)
+   int i;
+   char key[32];
+   struct rt *copy, *rt = rt_create();
+
+   for (i = 0; i < 200; i++) {
+      sprintf(key, "/%d/%x", i % 30, i);
+      rt_insert(rt, key, strdup(key));
+   }
+   for (i = 0; i < 200; i += 3) {
+      sprintf(key, "/%d/%x", i % 30, i);
+      free(rt_remove(rt, key));
+   }
+
+   copy = rt_copy(rt, copy_str);
+   ASSERT_NOT_NULL(copy);
+
+   // The copy is independent of the original
+   ASSERT_EQUAL(rt_insert(copy, "/new", strdup("/new")), 0);
+   ASSERT_NULL(rt_lookup(rt, "/new"));
+   free(rt_remove(rt, "/1/1"));
+   ASSERT_STR_EQUAL(rt_lookup(copy, "/1/1"), "/1/1");
+   for (i = 2; i < 200; i++) {
+      sprintf(key, "/%d/%x", i % 30, i);
+      if (i % 3) {
+         ASSERT_STR_EQUAL(rt_lookup(copy, key), key);
+      } else {
+         ASSERT_NULL(rt_lookup(copy, key));
+      }
+   }
+
+   rt_destroy(rt, free);
+   rt_destroy(copy, free);
+TSET()
+
+TEST(destructor)
+   struct rt *rt = rt_create();
+   rt_insert(rt, "a", strdup("a"));
+   rt_insert(rt, "ab", strdup("ab"));
+   rt_destroy(rt, free);
+TSET()
+
+TEST_END()
@@ -0,0 +1,229 @@
+// strpool.c
+
+/*  Copyright 2013 Aalborg University. All rights reserved.
+ *   
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  
+ *  THIS SOFTWARE IS PROVIDED BY Aalborg University ''AS IS'' AND ANY
+ *  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL Aalborg University OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ *  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ *  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ *  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *  
+ *  The views and conclusions contained in the software and
+ *  documentation are those of the authors and should not be interpreted
+ *  as representing official policies, either expressed.
+ */
+
+#include "strpool.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+
+#define MIN_BUCKETS 16   ///< Buckets of an empty pool
+
+/// An interned string, in one allocation
+struct sp_str {
+   struct sp_str *next; ///< Next string of the bucket
+   uint32_t hash;       ///< Hash of the string
+   uint32_t len;        ///< Length of the string
+   size_t refs;         ///< References to the string
+   char str[];          ///< The string, null terminated
+};
+
+/// Interned strings, chained in buckets by hash
+/**
+ *  The table doubles when it holds as many strings as buckets, and
+ *  halves when it holds less than a quarter, so chains stay short.
+ *  Strings are found from their pointer without a lookup, as they are
+ *  the last member of their sp_str.
+ */
+struct sp {
+   struct sp_str **buckets;  ///< Chains of strings
+   size_t mask;              ///< Number of buckets minus one
+   size_t count;             ///< Number of strings
+};
+
+/// FNV-1a hash of a string
+static uint32_t hash(const char *str, size_t len)
+{
+   uint32_t h = 2166136261u;
+   size_t i;
+
+   for (i = 0; i < len; i++) h = (h ^ (unsigned char)str[i]) * 16777619u;
+   return h;
+}
+
+static struct sp_str *str_of(const char *str)
+{
+   return (struct sp_str *)(str - offsetof(struct sp_str, str));
+}
+
+struct sp *sp_create()
+{
+   struct sp *pool = malloc(sizeof(struct sp));
+   if (pool == NULL) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return NULL;
+   }
+   pool->buckets = calloc(MIN_BUCKETS, sizeof(struct sp_str *));
+   if (pool->buckets == NULL) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      free(pool);
+      return NULL;
+   }
+   pool->mask = MIN_BUCKETS - 1;
+   pool->count = 0;
+   return pool;
+}
+
+/// Frees the pool and all its strings, whatever their references
+void sp_destroy(struct sp *pool)
+{
+   struct sp_str *s, *next;
+   size_t i;
+
+   if (pool == NULL) return;
+   for (i = 0; i <= pool->mask; i++) {
+      for (s = pool->buckets[i]; s != NULL; s = next) {
+         next = s->next;
+         free(s);
+      }
+   }
+   free(pool->buckets);
+   free(pool);
+}
+
+/// Moves the strings to a table of n buckets, keeping the old on failure
+static void resize(struct sp *pool, size_t n)
+{
+   struct sp_str **buckets, *s, *next;
+   size_t i;
+
+   buckets = calloc(n, sizeof(struct sp_str *));
+   if (buckets == NULL) return;
+   for (i = 0; i <= pool->mask; i++) {
+      for (s = pool->buckets[i]; s != NULL; s = next) {
+         next = s->next;
+         s->next = buckets[s->hash & (n - 1)];
+         buckets[s->hash & (n - 1)] = s;
+      }
+   }
+   free(pool->buckets);
+   pool->buckets = buckets;
+   pool->mask = n - 1;
+}
+
+static struct sp_str *lookup(struct sp *pool, uint32_t h,
+                             const char *str, size_t len)
+{
+   struct sp_str *s;
+
+   for (s = pool->buckets[h & pool->mask]; s != NULL; s = s->next)
+      if (s->hash == h && s->len == len && memcmp(s->str, str, len) == 0)
+         return s;
+   return NULL;
+}
+
+/// Interns a string
+/**
+ *  \param  pool  The pool
+ *  \param  str   The string, which does not need to be null terminated
+ *  \param  len   Length of str
+ *
+ *  \return The interned string, with one reference taken, or NULL if
+ *          memory could not be allocated
+ */
+const char *sp_get_n(struct sp *pool, const char *str, size_t len)
+{
+   uint32_t h = hash(str, len);
+   struct sp_str *s = lookup(pool, h, str, len);
+
+   if (s != NULL) {
+      s->refs++;
+      return s->str;
+   }
+
+   s = malloc(sizeof(struct sp_str) + len + 1);
+   if (s == NULL) {
+      fprintf(stderr, "ERROR: Cannot allocate memory\n");
+      return NULL;
+   }
+   s->hash = h;
+   s->len = len;
+   s->refs = 1;
+   memcpy(s->str, str, len);
+   s->str[len] = '\0';
+
+   if (pool->count > pool->mask) resize(pool, (pool->mask + 1) * 2);
+   s->next = pool->buckets[h & pool->mask];
+   pool->buckets[h & pool->mask] = s;
+   pool->count++;
+   return s->str;
+}
+
+const char *sp_get(struct sp *pool, const char *str)
+{
+   return sp_get_n(pool, str, strlen(str));
+}
+
+/// Takes a reference to a string already interned in pool
+const char *sp_ref(struct sp *pool, const char *str)
+{
+   str_of(str)->refs++;
+   return str;
+}
+
+/// Drops a reference to a string interned in pool, NULL is ignored
+void sp_put(struct sp *pool, const char *str)
+{
+   struct sp_str *s, **it;
+
+   if (str == NULL) return;
+   s = str_of(str);
+   if (--s->refs > 0) return;
+
+   for (it = &pool->buckets[s->hash & pool->mask]; *it != s; it = &(*it)->next);
+   *it = s->next;
+   free(s);
+   pool->count--;
+   if (pool->mask >= MIN_BUCKETS && pool->count < (pool->mask + 1) / 4)
+      resize(pool, (pool->mask + 1) / 2);
+}
+
+/// Finds the interned copy of a string, to compare it by pointer
+/**
+ *  \return The interned string, or NULL if str is not in the pool, so
+ *          that no interned string is equal to it
+ */
+const char *sp_find(struct sp *pool, const char *str)
+{
+   size_t len = strlen(str);
+   struct sp_str *s = lookup(pool, hash(str, len), str, len);
+
+   return s == NULL ? NULL : s->str;
+}
+
+size_t sp_count(struct sp *pool)
+{
+   return pool->count;
+}
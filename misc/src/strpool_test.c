@@ -0,0 +1,86 @@
+#include "strpool.h"
+#include "unit_test.h"
+#include <stdio.h>
+#include <string.h>
+
+TEST_START("strpool.c")
+
+TEST(createAndDestroy)
+	struct sp *pool = sp_create();
+	ASSERT_NOT_NULL(pool);
+	ASSERT_EQUAL(sp_count(pool), 0);
+	sp_destroy(pool);
+TSET()
+
+TEST(intern)
+	struct sp *pool = sp_create();
+	char buf[16];
+
+	strcpy(buf, "Temperature");
+	const char *a = sp_get(pool, "Temperature");
+	const char *b = sp_get(pool, buf);
+	const char *c = sp_get(pool, "Celsius");
+
+	ASSERT_STR_EQUAL(a, "Temperature");
+	ASSERT_EQUAL(a, b);
+	ASSERT(a == c);
+	ASSERT(a == buf);
+	ASSERT_EQUAL(sp_count(pool), 2);
+
+	// Only length bytes are compared
+	ASSERT_EQUAL(sp_get_n(pool, "Celsius degrees", 7), c);
+	ASSERT_EQUAL(sp_count(pool), 2);
+
+	sp_destroy(pool);
+TSET()
+
+TEST(references)
+	struct sp *pool = sp_create();
+
+	const char *a = sp_get(pool, "LivingRoom");
+	sp_ref(pool, a);
+	ASSERT_EQUAL(sp_find(pool, "LivingRoom"), a);
+
+	sp_put(pool, a);
+	ASSERT_EQUAL(sp_find(pool, "LivingRoom"), a);
+	sp_put(pool, a);
+	ASSERT_NULL(sp_find(pool, "LivingRoom"));
+	ASSERT_EQUAL(sp_count(pool), 0);
+
+	sp_put(pool, NULL);
+	sp_destroy(pool);
+TSET()
+
+TEST(many)
+	struct sp *pool = sp_create();
+	const char *strs[1000];
+	char str[16];
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		sprintf(str, "str%d", i);
+		strs[i] = sp_get(pool, str);
+	}
+	ASSERT_EQUAL(sp_count(pool), 1000);
+
+	for (i = 0; i < 1000; i += 2)
+		sp_put(pool, strs[i]);
+	ASSERT_EQUAL(sp_count(pool), 500);
+
+	for (i = 0; i < 1000; i++) {
+		sprintf(str, "str%d", i);
+		if (i % 2) {
+			ASSERT_EQUAL(sp_find(pool, str), strs[i]);
+		} else {
+			ASSERT_NULL(sp_find(pool, str));
+		}
+	}
+
+	for (i = 1; i < 1000; i += 2)
+		sp_put(pool, strs[i]);
+	ASSERT_EQUAL(sp_count(pool), 0);
+
+	sp_destroy(pool);
+TSET()
+
+TEST_END()
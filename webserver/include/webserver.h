@@ -85,6 +85,7 @@ struct ws_settings {
    ws_nodata_cb on_connect;
    ws_data_cb   on_receive;
    ws_nodata_cb on_disconnect;
+   ws_nodata_cb on_sent;      ///< All data queued has been sent
    void *ws_ctx;
 };
 
@@ -102,6 +103,7 @@ struct ws_settings {
    .on_connect = NULL, \
    .on_receive = NULL, \
    .on_disconnect = NULL, \
+   .on_sent = NULL, \
    .ws_ctx = NULL }
 
 // Webserver functions
@@ -113,10 +115,15 @@ void ws_stop(struct ws *instance);
 // Client functions
 void ws_conn_kill(struct ws_conn *conn);
 void ws_conn_close(struct ws_conn *conn);
+void ws_conn_abort(struct ws_conn *conn);
 int ws_conn_sendf(struct ws_conn *conn, const char *fmt, ...);
 int ws_conn_vsendf(struct ws_conn *conn, const char *fmt, va_list arg);
+int ws_conn_send(struct ws_conn *conn, const char *buf, size_t len);
+char *ws_conn_send_reserve(struct ws_conn *conn, size_t len);
+void ws_conn_send_commit(struct ws_conn *conn, size_t len);
 const char *ws_conn_get_ip(struct ws_conn *conn);
 void ws_conn_keep_open(struct ws_conn *conn);
+void ws_conn_set_timeout(struct ws_conn *conn, double timeout, int restart);
 
 #endif
 
@@ -51,7 +51,7 @@ struct ws {
    struct ws_settings settings;    ///< Settings
    char port_str[6];               ///< Port number - as a string
    struct ev_loop *loop;           ///< Event loop
-   struct ll *conns;               ///< Linked List of connections
+   struct ll_link conns;           ///< List of connections
    int sockfd;                     ///< Socket file descriptor
    struct ev_io watcher;           ///< New connection watcher
 };
@@ -61,9 +61,10 @@ struct ws_conn {
    struct ws *instance;             ///< Webserver instance
    char ip[INET6_ADDRSTRLEN];       ///< IP address of client
    struct ev_timer timeout_watcher; ///< Timeout watcher
-   int timeout;                     ///< Restart timeout watcher ?
+   int timeout;                     ///< Restart timeout on receive ?
    struct ev_io recv_watcher;       ///< Recieve watcher
    struct ev_io send_watcher;       ///< Send watcher
+   struct ll_link link;             ///< Link in the list of connections
    char *send_msg;                  ///< Data to send
    size_t send_len;                 ///< Length of data to send
    int send_close;                  ///< Close socket after send ?
@@ -178,7 +179,8 @@ static void *get_in_addr(struct sockaddr *sa)
 /**
   * Recieves up to maxdatasize (from struct ws_settings) of data from a
   * connection and calls on_recieve with it. Also resets the timeout for
-  * the connection, if one.
+  * the connection, if it is an idle timeout. This is done before the
+  * call, so on_recieve may replace it with ws_conn_set_timeout().
   *
   * \param  loop     The event loop
   * \param  watcher  The io watcher causing the call
@@ -209,18 +211,16 @@ static void conn_recv_cb(struct ev_loop *loop, struct ev_io *watcher,
       return;
    }
 
+   // Reset timeout
+   if (conn->timeout)
+      ev_timer_again(loop, &conn->timeout_watcher);
+
    if (settings->on_receive(conn->instance, conn, 
                             settings->ws_ctx, &conn->ctx,
                             buffer, recieved)) {
       ws_conn_kill(conn);
       return;
    }
-
-   // Reset timeout
-   if (conn->timeout) {
-      conn->timeout_watcher.repeat = conn->instance->settings.timeout;
-      ev_timer_again(loop, &conn->timeout_watcher);
-   }
 }
 
 /// Send callback for io-watcher
@@ -229,6 +229,7 @@ static void conn_recv_cb(struct ev_loop *loop, struct ev_io *watcher,
  * data could be sent at once, the remainer is store in send_msg again
  * and the watcher is not stopped. If a connection is flaggted with
  * close, the connection is closed when all the data has been sent.
+ * Otherwise on_sent from ws_settings is called, and may queue more.
   *
   * \param  loop     The event loop
   * \param  watcher  The io watcher causing the call
@@ -238,6 +239,7 @@ static void conn_send_cb(struct ev_loop *loop, struct ev_io *watcher,
       int revents)
 {
    struct ws_conn *conn = watcher->data;
+   struct ws_settings *settings = &conn->instance->settings;
    size_t sent;
 
    sent = send(watcher->fd, conn->send_msg, conn->send_len, 0);
@@ -248,23 +250,18 @@ static void conn_send_cb(struct ev_loop *loop, struct ev_io *watcher,
       conn->send_msg = NULL;
       conn->send_len = 0;
    } else {
+      // Move the remainder to the front, the message may contain binary
+      // data so this cannot be done with string functions
       conn->send_len -= sent;
-      char *s = malloc(conn->send_len*sizeof(char));
-      if (!s) {
-         fprintf(stderr, "Cannot allocate enough memory\n");
-         free(conn->send_msg);
-         conn->send_msg = NULL;
-         conn->send_len = 0;
-      } else {
-         strcpy(s, &conn->send_msg[sent]);
-         free(conn->send_msg);
-         conn->send_msg = s;
-         return;
-      }
+      memmove(conn->send_msg, &conn->send_msg[sent], conn->send_len);
+      return;
    }
 
    ev_io_stop(conn->instance->loop, &conn->send_watcher);
-   if (conn->send_close) ws_conn_kill(conn);
+   if (conn->send_close)
+      ws_conn_kill(conn);
+   else if (conn->send_msg == NULL && settings->on_sent)
+      settings->on_sent(conn->instance, conn, settings->ws_ctx, &conn->ctx);
 }
 
 /// Timeout callback for timeout watcher
@@ -290,21 +287,11 @@ static void conn_timeout_cb(struct ev_loop *loop,
  *
  *  \param  instance  The webser instance
  *  \param  conn      The connection to add
- *
- *  \return 0 on success, 1 on error
  */
-static int ws_instance_add_conn(struct ws *instance,
-                                struct ws_conn *conn)
+static void ws_instance_add_conn(struct ws *instance,
+                                 struct ws_conn *conn)
 {
-   struct ll_iter *it = ll_tail(instance->conns);
-   ll_insert(instance->conns, it, conn);
-   if (it) it = ll_next(it);
-   else it = ll_tail(instance->conns);
-   if (it == NULL) {
-      fprintf(stderr, "Not enough memory to add connection\n");
-      return 1;
-   }
-   return 0;
+   ll_link_append(&instance->conns, &conn->link);
 }
 
 /// Initialise and accept connection
@@ -460,6 +447,99 @@ int ws_conn_vsendf(struct ws_conn *conn, const char *fmt, va_list arg)
    else return 0;
 }
 
+/// Send raw data on connection
+/**
+ * Unlike ws_conn_sendf() this does not interpret the data in any way,
+ * so it can be used to send binary data, which may contain null
+ * characters.
+ *
+ * As ws_conn_vsendf() this only schedules the data to be sent.
+ *
+ * \param  conn  Connection to send on
+ * \param  buf   Data to send
+ * \param  len   Length of data
+ *
+ * \return  zero on success, -1 on failure
+ */
+int ws_conn_send(struct ws_conn *conn, const char *buf, size_t len)
+{
+   char *new_msg;
+
+   if (len == 0) return 0;
+
+   // Expand message to send
+   new_msg = realloc(conn->send_msg,
+         (conn->send_len + len + 1)*sizeof(char));
+   if (new_msg == NULL) {
+      fprintf(stderr, "Cannot allocate enough memory\n");
+      return -1;
+   }
+   conn->send_msg = new_msg;
+
+   // Append data
+   memcpy(&conn->send_msg[conn->send_len], buf, len);
+
+   // Start send watcher
+   if (conn->send_len == 0 && conn->instance != NULL)
+      ev_io_start(conn->instance->loop, &conn->send_watcher);
+
+   // Update length
+   conn->send_len += len;
+
+   return 0;
+}
+
+/// Reserve room for data at the end of the send queue
+/**
+ * Lets the caller write data directly into the queue of a connection,
+ * instead of having it copied there by ws_conn_send(). Nothing is sent
+ * before ws_conn_send_commit() is called, which must happen before any
+ * other data is queued on the connection.
+ *
+ * \param  conn  Connection to send on
+ * \param  len   Number of bytes to reserve
+ *
+ * \return  Room for len bytes, or NULL on failure
+ */
+char *ws_conn_send_reserve(struct ws_conn *conn, size_t len)
+{
+   char *new_msg;
+
+   new_msg = realloc(conn->send_msg,
+         (conn->send_len + len + 1)*sizeof(char));
+   if (new_msg == NULL) {
+      fprintf(stderr, "Cannot allocate enough memory\n");
+      return NULL;
+   }
+   conn->send_msg = new_msg;
+
+   return &conn->send_msg[conn->send_len];
+}
+
+/// Send data written to room from ws_conn_send_reserve()
+/**
+ * \param  conn  Connection to send on
+ * \param  len   Number of bytes written, at most the number reserved
+ */
+void ws_conn_send_commit(struct ws_conn *conn, size_t len)
+{
+   if (len == 0) {
+      // An empty queue has no message, see ws_conn_close()
+      if (conn->send_len == 0) {
+         free(conn->send_msg);
+         conn->send_msg = NULL;
+      }
+      return;
+   }
+
+   // Start send watcher
+   if (conn->send_len == 0 && conn->instance != NULL)
+      ev_io_start(conn->instance->loop, &conn->send_watcher);
+
+   // Update length
+   conn->send_len += len;
+}
+
 /// Remove connection from instance
 /**
  * This will remove a connection from a webserver instance. Will NOT
@@ -471,10 +551,7 @@ int ws_conn_vsendf(struct ws_conn *conn, const char *fmt, va_list arg)
 static void ws_instance_rm_conn(struct ws *instance, struct ws_conn
       *conn)
 {
-   struct ll_iter *iter;
-
-   ll_find(iter, instance->conns, conn);
-   ll_remove(iter);
+   ll_link_remove(&conn->link);
 }
 
 /// Close a connection, after the remaining data has been sent
@@ -494,6 +571,24 @@ void ws_conn_close(struct ws_conn *conn) {
    }
 }
 
+/// Close a connection with a reset, after the remaining data has been sent
+/**
+ * Used when a response cannot be completed. Responses without a length
+ * end when the connection closes, so a normal close would look like a
+ * complete, shorter response. The reset makes the client see an error.
+ *
+ * \param  conn  The connection to abort
+ */
+void ws_conn_abort(struct ws_conn *conn)
+{
+   struct linger linger = { 1, 0 };
+
+   if (setsockopt(conn->recv_watcher.fd, SOL_SOCKET, SO_LINGER,
+                  &linger, sizeof(linger)) != 0)
+      perror("setsockopt");
+   ws_conn_close(conn);
+}
+
 /// Disable timeout on connection
 /**
  *  Every connection have per default a timeout value, which is set in
@@ -511,6 +606,31 @@ void ws_conn_keep_open(struct ws_conn *conn)
    ev_timer_stop(conn->instance->loop, &conn->timeout_watcher);
 }
 
+/// Set the timeout of a connection
+/**
+ *  Replaces the timeout from struct ws_settings, starting from now. If
+ *  restart is set, the timeout is restarted whenever data is received,
+ *  making it an idle timeout like the default one. Otherwise it is a
+ *  deadline that data received does not extend, which is useful to
+ *  bound the time a client can spend on e.g. sending headers. A timeout
+ *  of 0 or less disables it, as ws_conn_keep_open() does.
+ *
+ *  \param  conn     The connection
+ *  \param  timeout  Timeout in seconds
+ *  \param  restart  Restart timeout on received data ?
+ */
+void ws_conn_set_timeout(struct ws_conn *conn, double timeout, int restart)
+{
+   if (timeout <= 0) {
+      ws_conn_keep_open(conn);
+      return;
+   }
+
+   conn->timeout = restart;
+   conn->timeout_watcher.repeat = timeout;
+   ev_timer_again(conn->instance->loop, &conn->timeout_watcher);
+}
+
 /// Kill and clean up after a connection
 /**
  *  This function stops the LibEV watchers, closes the socket, and frees
@@ -564,7 +684,6 @@ void ws_conn_kill(struct ws_conn *conn)
  */
 void ws_destroy(struct ws *instance)
 {
-   ll_destroy(instance->conns);
    free(instance);
 }
 
@@ -594,13 +713,7 @@ struct ws *ws_create(
    sprintf(instance->port_str, "%i", settings->port);
 
    instance->loop = loop;
-   ll_create(instance->conns);
-   if (instance->conns == NULL) {
-      fprintf(stderr, "ERROR: Cannot allocate memory for a new " \
-                      "webserver struct\n");
-      ws_destroy(instance);
-      return NULL;
-   }
+   ll_link_init(&instance->conns);
 
    return instance;
 }
@@ -657,18 +770,14 @@ int ws_start(struct ws *instance)
  */
 void ws_stop(struct ws *instance)
 {
-   struct ll_iter *it, *next;
+   struct ll_link *it, *next;
 
    // Stop accept watcher
    ev_io_stop(instance->loop, &instance->watcher);
 
    // Kill all connections
-   it = ll_head(instance->conns);
-   while (it != NULL) {
-      next = ll_next(it);
-      ws_conn_kill(ll_data(it));
-      it = next;
-   }
+   ll_link_foreach(it, next, &instance->conns)
+      ws_conn_kill(ll_link_entry(it, struct ws_conn, link));
 
    // Close socket
    if (close(instance->sockfd) != 0) {